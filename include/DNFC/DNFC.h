@@ -5,57 +5,126 @@
 #include <stdbool.h>
 
 #include "../../src/hypercuts/hypercuts.h"
+#include "../../src/static_classifier/static_classifier.h"
 #include "../../src/flow_table/flow_table.h"
-#include "../../src/queue/queue.h"
+#include "../../src/queue/ring.h"
+#include "../../src/memory_pool/memory_pool.h"
+#include "../../src/packet_buffer/packet_buffer.h"
+#include "../../src/SMR/epoch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef unsigned char u_char; // Defining u_char type for convenient display
 
+#define DNFC_BURST_SIZE 32         // Packets taken through each stage together by DNFC_process_burst
+
 struct DNFC_action
 {
-   struct queue* pckt_queue;
+   ring_matrix* pckt_queue;        // packet_buffer of the rule, one ring per (rx, worker) pair
    flow_table* flow_table;
+   struct DNFC* classifier;
+   size_t nb_draining;             // Workers yet to call DNFC_rule_drained, updated atomically
+   struct DNFC_action** next_retired; // Per worker, next action of its DNFC.retired list
 };
 
-struct DNFC_pckt
-{
-   u_char* data;
-   size_t size;
-};
-
+// Flow of the packets, in the 'tag' of their packet_buffer. The entry of the flow in
+// the flow table of its rule and each queued packet of the flow hold a reference.
 struct DNFC_tag
 {
-   struct linked_list* flow_pckt_list;
-   struct hazard_pointer* flow_pckt_list_hps;
-};
-
-struct DNFC_tagged_pckt
-{
-   struct DNFC_tag* tag;
-   struct DNFC_pckt* pckt;
+   uint64_t nb_pckts;              // Updated atomically
+   uint64_t nb_bytes;
+   memory_pool* pool;              // Pool the tag goes back to
+   uint32_t refcnt;                // Updated atomically, see DNFC_free_pckt
 };
 
 struct DNFC
 {
-   struct hypercuts_classifier* static_classifier;
+   struct static_classifier* static_classifier;
    void (*callback)(u_char*, size_t);
-   size_t queue_limit;
-   size_t nb_thread;
+   size_t queue_limit;             // Capacity of each ring of a rule queue
+   size_t nb_rx;                   // Threads calling DNFC_process
+   size_t nb_workers;              // Threads draining the rule queues
+   memory_pool* tag_pool;          // DNFC_tag
+   enum flow_key_layer key_layer;  // Flows of tunneled packets, FLOW_KEY_INNER unless set after new_DNFC
+   void (*rule_retired)(struct DNFC_action* action); // See DNFC_remove_rule, NULL unless set after new_DNFC
+   struct DNFC_action** retired;   // Per worker, actions it has yet to drain (see DNFC_drain_retired)
 };
 
 
-struct DNFC* new_DNFC(size_t nb_threads,
+/* Each of the 'nb_rx' RX threads passes its index in [0, nb_rx) to DNFC_process, and
+   each of the 'nb_workers' workers pops the packets of a rule with its own index from
+   the ring_matrix returned by DNFC_get_rule_queue (ring_matrix_pop), and drains the
+   removed rules with DNFC_drain_retired. The packets of a flow always go to the same
+   worker. The rules are classified by 'engine' (see
+   static_classifier.h), NULL is returned when it cannot classify them. */
+struct DNFC* new_DNFC(size_t nb_rx,
+                      size_t nb_workers,
                       struct classifier_rule ***rules,
                       uint32_t nb_rules,
+                      enum static_engine engine,
                       size_t queue_limit,
                       void (*callback)(u_char*, size_t),
                       bool verbose);
 
-bool DNFC_process(struct DNFC* classifier, u_char* pckt, size_t pckt_length);
+/* Take the reference of the caller to 'pckt': it is queued to the worker of its flow
+   with its DNFC_tag in pckt->tag, or given back to its pool after the callback when
+   no rule matches, or dropped when the queue is full. Return true when it was queued;
+   the worker frees it with DNFC_free_pckt. The headers are parsed once (see
+   parse_packet), so a queued packet also carries its offsets and flow hash. */
+bool DNFC_process(struct DNFC* classifier, size_t rx, struct packet_buffer* pckt);
 
-struct queue* DNFC_get_rule_queue(struct classifier_rule* rule);
+/* DNFC_process for 'n' packets, return how many were queued. Each stage runs over
+   DNFC_BURST_SIZE packets at a time: parsing and classification of all of them
+   (prefetching the headers ahead), then for each rule matched the flow lookups of its packets in one
+   batch, then bulk pushes to each worker. */
+size_t DNFC_process_burst(struct DNFC* classifier,
+                          size_t rx,
+                          struct packet_buffer** pckts,
+                          size_t n);
 
-void DNFC_free_tag(void* tag);
+ring_matrix* DNFC_get_rule_queue(struct classifier_rule* rule);
+
+/* Free a packet popped from a rule queue, with its reference to its DNFC_tag: the tag
+   of an expired flow goes back to the tag pool once its last packet is freed. */
+void DNFC_free_pckt(struct packet_buffer* pckt);
+
+/* Evict the flows of 'rule' idle at 'now_ms' (see expire_flows), as DNFC_process does
+   for the rules of the packets it classifies, return how many were. */
+size_t DNFC_expire_rule_flows(struct classifier_rule* rule, uint64_t now_ms);
+
+/* Give 'rule' its queue and flow table, as new_DNFC does, and insert it in the static
+   classifier just before 'before', or after all the rules when 'before' is NULL (see
+   hypercuts_insert). The packets being classified meanwhile match the rules before or
+   after the insertion, the classification never waits for it. Return false when the
+   rule cannot be inserted, or the engine of the classifier takes no update. */
+bool DNFC_insert_rule(struct DNFC* classifier,
+                      struct classifier_rule* rule,
+                      struct classifier_rule* before);
+
+/* Remove 'rule' from the static classifier, return false when it is not in it. Its
+   action is retired through the epoch (see epoch.h): once no packet classified before
+   the removal can still be pushed to its queue, rule_retired is called with it, at a
+   later DNFC_remove_rule or epoch_collect. Each worker then pops the packets left for
+   it in action->pckt_queue and calls DNFC_rule_drained, the last one frees the queue
+   and the flow table. Without rule_retired the action is handed to every worker
+   instead, and DNFC_drain_retired does that with the packets left. */
+bool DNFC_remove_rule(struct DNFC* classifier, struct classifier_rule* rule);
+
+/* Called by each worker once it drained the queue of a retired rule (see DNFC_remove_rule). */
+void DNFC_rule_drained(struct DNFC_action* action);
+
+/* Called by 'worker' between its pops when rule_retired is not set: free the packets
+   left for it in the queues of the rules retired since its last call, with
+   DNFC_free_pckt, then call DNFC_rule_drained for each. Return how many packets were
+   freed. */
+size_t DNFC_drain_retired(struct DNFC* classifier, size_t worker);
 
 //void free_DNFC(struct DNFC* classifier);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
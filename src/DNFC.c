@@ -1,176 +1,478 @@
+#include <time.h>
+
 #include "../include/DNFC/DNFC.h"
 
 
 /*          Private Functions              */
 
-struct DNFC_pckt* get_DNFC_pckt(u_char* pckt,
-                                size_t pckt_length);
+struct DNFC_action* new_DNFC_action(struct DNFC* classifier);
+
+void free_DNFC_action(struct DNFC_action* action);
+
+void DNFC_retire_action(void* action);
 
-void init_queue(struct queue* queue,
-                size_t nb_threads,
-                size_t queue_limit);
+size_t DNFC_process_chunk(struct DNFC* classifier,
+                          size_t rx,
+                          struct packet_buffer** pckts,
+                          size_t n);
+
+size_t DNFC_enqueue_rule(struct DNFC* classifier,
+                         size_t rx,
+                         struct DNFC_action* action,
+                         struct packet_buffer** pckts,
+                         const struct flow_key** keys,
+                         size_t n,
+                         uint64_t now_ms,
+                         struct packet_buffer** dropped,
+                         size_t* nb_dropped);
 
 struct DNFC_tag* get_flow_tag(struct DNFC* classifier,
-                              u_char* pckt,
+                              const struct flow_key* key,
                               size_t pckt_len,
                               flow_table* protocol_action);
 
-key_type DNFC_get_key(u_char* pckt,
-                      size_t pckt_len);
+bool DNFC_tag_ref(struct DNFC_tag* flow_tag);
+
+void DNFC_tag_unref(void* flow_tag);
+
+void DNFC_tag_free(void* flow_tag);
+
+void DNFC_drop_tag(struct packet_buffer* pckt);
+
+void DNFC_count_pckt(struct DNFC_tag* flow_tag,
+                     size_t pckt_len);
+
+size_t DNFC_worker_of(struct DNFC* classifier,
+                      struct packet_buffer* pckt);
+
+uint64_t DNFC_now_ms(void);
 
 /*          Private Functions              */
 
 
 
-struct DNFC* new_DNFC(size_t nb_threads,
+struct DNFC* new_DNFC(size_t nb_rx,
+                      size_t nb_workers,
                       struct classifier_rule ***rules,
                       uint32_t nb_rules,
+                      enum static_engine engine,
                       size_t queue_limit,
                       void (*callback)(u_char*, size_t),
                       bool verbose)
 {
    // Allocate the structure
    struct DNFC* result = chkmalloc(sizeof(*result));
+   result->nb_rx = nb_rx ? nb_rx : 1;
+   result->nb_workers = nb_workers ? nb_workers : 1;
+   result->queue_limit = queue_limit;
+   result->callback = callback;
+   result->key_layer = FLOW_KEY_INNER;
+   result->rule_retired = NULL;
+   result->retired = chkmalloc(result->nb_workers * sizeof(*result->retired));
+   for (size_t worker = 0; worker < result->nb_workers; ++worker)
+      result->retired[worker] = NULL;
+   
+   // Every rule gets its queue and flow table up front, so that the RX threads never
+   // create them concurrently: a single-producer single-consumer ring per (rx, worker)
    for (uint32_t i = 0; i < nb_rules; ++i)
-      (*rules)[i]->action = NULL;
+      (*rules)[i]->action = new_DNFC_action(result);
    
-   // Create the hypercut tree structure for static classification
-   result->static_classifier = new_hypercuts_classifier(rules, &nb_rules, verbose);
-   result->nb_thread = nb_threads;
-   result->callback = callback;
+   // Create the static classifier with the engine picked by the caller
+   result->static_classifier = new_static_classifier(static_engine_ops(engine), rules, &nb_rules, verbose);
+   if(!result->static_classifier)
+   {
+      for (uint32_t i = 0; i < nb_rules; ++i)
+      {
+         free_DNFC_action((*rules)[i]->action);
+         (*rules)[i]->action = NULL;
+      }
+      free(result->retired);
+      free(result);
+      return NULL;
+   }
+   
+   // Pool of the tags allocated for every new flow
+   result->tag_pool = new_memory_pool(sizeof(struct DNFC_tag));
    return result;
 }
 
 
 
 bool DNFC_process(struct DNFC* classifier,
-                  u_char* pckt,
-                  size_t pckt_len)
+                  size_t rx,
+                  struct packet_buffer* pckt)
 {
-   // Search for a match in the static classifier
-   struct DNFC_action* action = NULL;
-   if(!hypercuts_search(classifier->static_classifier, pckt, pckt_len, (void**)&action))
-   {
-      if(classifier->callback)
-         classifier->callback(pckt, pckt_len);
-      return false;
-   }
-   
-   // If no action is found we instantiate a new queue and a new flow table
-   if(!action)
+   return DNFC_process_burst(classifier, rx, &pckt, 1) == 1;
+}
+
+
+
+size_t DNFC_process_burst(struct DNFC* classifier,
+                          size_t rx,
+                          struct packet_buffer** pckts,
+                          size_t n)
+{
+   size_t queued = 0;
+   for(size_t base = 0; base < n; base += DNFC_BURST_SIZE)
    {
-      action = chkmalloc(sizeof(struct DNFC_action*));
-      action->pckt_queue = new_queue(classifier->queue_limit, classifier->nb_thread);
-      action->flow_table = new_hash_table(FNV_1, classifier->nb_thread);
+      size_t count = n - base < DNFC_BURST_SIZE ? n - base : DNFC_BURST_SIZE;
+      queued += DNFC_process_chunk(classifier, rx, pckts + base, count);
    }
+   return queued;
+}
+
+ring_matrix* DNFC_get_rule_queue(struct classifier_rule* rule)
+{
+   return ((struct DNFC_action*)rule->action)->pckt_queue;
+}
+
+
+
+void DNFC_free_pckt(struct packet_buffer* pckt)
+{
+   DNFC_drop_tag(pckt);
+   packet_buffer_free(pckt);
+}
+
+
+
+size_t DNFC_expire_rule_flows(struct classifier_rule* rule, uint64_t now_ms)
+{
+   return expire_flows(((struct DNFC_action*)rule->action)->flow_table, now_ms, DNFC_tag_unref);
+}
+
+
+
+bool DNFC_insert_rule(struct DNFC* classifier,
+                      struct classifier_rule* rule,
+                      struct classifier_rule* before)
+{
+   struct DNFC_action* action = new_DNFC_action(classifier);
+   rule->action = action;
+   if(static_classifier_insert(classifier->static_classifier, rule, before))
+      return true;
    
-   // Search for a match in the dynamic classifier
-   struct DNFC_tag* flow_tag = get_flow_tag(classifier, pckt, pckt_len, action->flow_table);
-   
-   // We build a pair with the tag and the packet
-   struct DNFC_tagged_pckt* packet_result = chkmalloc(sizeof(*packet_result));
-   packet_result->tag = flow_tag;
-   
-   packet_result->pckt = chkmalloc(sizeof(struct DNFC_pckt*));
-   packet_result->pckt->data = pckt;
-   packet_result->pckt->size = pckt_len;
+   // Nothing was published, no packet reached the queue
+   free_DNFC_action(action);
+   rule->action = NULL;
+   return false;
+}
+
+
+
+bool DNFC_remove_rule(struct DNFC* classifier, struct classifier_rule* rule)
+{
+   if(!static_classifier_remove(classifier->static_classifier, rule))
+      return false;
    
-   // We push the result in the queue of the static rule
-   queue_push(action->pckt_queue, packet_result);
+   // The RX threads classify and queue each chunk inside an epoch region, so the action
+   // is out of their reach once the regions entered before the removal are over
+   epoch_retire(rule->action, DNFC_retire_action);
+   rule->action = NULL;
+   epoch_collect();
    return true;
 }
 
-void DNFC_free_tag(void* tag_item)
+
+
+void DNFC_rule_drained(struct DNFC_action* action)
 {
-   key_type key = (key_type)tag_item;
-   free_byte_stream(key);
+   if(__atomic_sub_fetch(&action->nb_draining, 1, __ATOMIC_ACQ_REL) == 0)
+      free_DNFC_action(action);
 }
 
 
 
-/*          Private Functions              */
-
-struct DNFC_tag* get_flow_tag(struct DNFC* classifier,
-                  u_char* pckt,
-                  size_t pckt_len,
-                  flow_table* flow_table)
+size_t DNFC_drain_retired(struct DNFC* classifier, size_t worker)
 {
-   // Prepare to insert the packet in the linked list of packets of the flow
-   key_type new_flow_key = DNFC_get_key(pckt, pckt_len);
-   struct linked_list* pckt_llist = new_linked_list(new_flow_key, FNV1a_hash(new_flow_key), pckt);
-   
-   // Retrieve the list of packets for that flow
-   struct DNFC_tag* flow_tag = get_flow(flow_table, pckt);
-   if(!flow_tag)
+   // The list is taken whole, so no other thread pops from it
+   struct DNFC_action* action = __atomic_exchange_n(&classifier->retired[worker], NULL, __ATOMIC_ACQUIRE);
+   size_t nb_freed = 0;
+   while(action)
    {
-      // The tag is a tuple that contain the linked list representing the packets
-      // received for the matched flow and the hazardous pointers for that list.
-      // Note: HPs are mandatory to manipulate the linked list in a concurrent environement
-      flow_tag = chkmalloc(sizeof(*flow_tag));
-      flow_tag->flow_pckt_list = pckt_llist;
-      flow_tag->flow_pckt_list_hps = linked_list_init();
-   
-      if(!put_flow(flow_table, pckt, flow_tag)) // Check if the tag was already inserted while building it
+      struct DNFC_action* next = action->next_retired[worker];
+      struct packet_buffer* pckt;
+      while((pckt = ring_matrix_pop(action->pckt_queue, worker)))
       {
-         // If it was already inserted we free the one we created
-         linked_list_free(&flow_tag->flow_pckt_list);
-         free_hp(flow_tag->flow_pckt_list_hps);
-         free(flow_tag);
-         
-         // We are sure here that the tag will be retrieved (as we don't delete it from the flow table yet)
-         flow_tag = get_flow(flow_table, pckt);
-         linked_list_insert(flow_tag->flow_pckt_list_hps, &flow_tag->flow_pckt_list, pckt_llist);
+         DNFC_free_pckt(pckt);
+         ++nb_freed;
       }
-   } else {
-      linked_list_insert(flow_tag->flow_pckt_list_hps, &flow_tag->flow_pckt_list, pckt_llist);
+      DNFC_rule_drained(action);
+      action = next;
    }
-   return flow_tag;
+   return nb_freed;
 }
 
+
+
 /*          Private Functions              */
 
-/*          Parse packet function          */
+struct DNFC_action* new_DNFC_action(struct DNFC* classifier)
+{
+   struct DNFC_action* action = chkmalloc(sizeof(*action));
+   action->pckt_queue = new_ring_matrix(classifier->nb_rx, classifier->nb_workers, classifier->queue_limit);
+   action->flow_table = new_flow_table();
+   action->classifier = classifier;
+   action->nb_draining = classifier->nb_workers;
+   action->next_retired = chkmalloc(classifier->nb_workers * sizeof(*action->next_retired));
+   return action;
+}
 
-key_type DNFC_get_key(u_char* pckt, size_t pckt_len)
+// No other thread uses the action anymore: the packets left in the queue and the
+// entries of the flow table drop their references to their tags
+void free_DNFC_action(struct DNFC_action* action)
 {
-   key_type key = new_byte_stream();
-   
-   // Layer 2 protocol
-   struct ether_header* ethh = (struct ether_header*)pckt;
+   for(size_t worker = 0; worker < action->classifier->nb_workers; ++worker)
+   {
+      struct packet_buffer* pckt;
+      while((pckt = ring_matrix_pop(action->pckt_queue, worker)))
+         DNFC_free_pckt(pckt);
+   }
+   clear_flows(action->flow_table, DNFC_tag_unref);
+   free_ring_matrix(action->pckt_queue);
+   free_flow_table(action->flow_table);
+   free(action->next_retired);
+   free(action);
+}
+
+// The action of a removed rule, out of reach of the RX threads. Only the workers pop its
+// queue, so without rule_retired it goes to the list of each for DNFC_drain_retired.
+void DNFC_retire_action(void* action)
+{
+   struct DNFC_action* retired = action;
+   struct DNFC* classifier = retired->classifier;
+   if(classifier->rule_retired)
+   {
+      classifier->rule_retired(retired);
+      return;
+   }
+   for(size_t worker = 0; worker < classifier->nb_workers; ++worker)
+   {
+      struct DNFC_action* head = __atomic_load_n(&classifier->retired[worker], __ATOMIC_RELAXED);
+      do
+         retired->next_retired[worker] = head;
+      while(!__atomic_compare_exchange_n(&classifier->retired[worker], &head, retired, true,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+   }
+}
+
+size_t DNFC_process_chunk(struct DNFC* classifier,
+                          size_t rx,
+                          struct packet_buffer** pckts,
+                          size_t n)
+{
+   struct DNFC_action* actions[DNFC_BURST_SIZE];
+   struct flow_key keys[DNFC_BURST_SIZE];
+   struct packet_buffer* dropped[DNFC_BURST_SIZE];
+   size_t nb_dropped = 0;
    
-   // Layer 3 protocols
-   struct ip* ip4h = NULL;
-   struct ip6_hdr* ip6h = NULL;
+   // The tags read from the flow tables stay allocated until the chunk is queued
+   epoch_enter();
    
-   // Layer 4 protocols
-   struct tcphdr* tcph = NULL;
-   struct udphdr* udph = NULL;
+   // Stage 1: parse the headers of the whole chunk at once (prefetching them ahead and
+   // caching the offsets and the hash in the descriptors), then search for a match in
+   // the static classifier for all the packets at once, their lookups interleaved
+   const unsigned char* headers[DNFC_BURST_SIZE];
+   size_t header_lens[DNFC_BURST_SIZE];
+   parse_packets(pckts, n, classifier->key_layer, keys);
+   for(size_t i = 0; i < n; ++i)
+   {
+      headers[i] = packet_buffer_data(pckts[i]);
+      header_lens[i] = pckts[i]->data_len;
+   }
+   static_classifier_search_burst(classifier->static_classifier, headers, header_lens, n, (void**)actions);
+   for(size_t i = 0; i < n; ++i)
+   {
+      if(!actions[i])
+      {
+         if(classifier->callback)
+            classifier->callback(packet_buffer_data(pckts[i]), pckts[i]->data_len);
+         dropped[nb_dropped++] = pckts[i];
+      }
+   }
    
-   // Parse layer 3
-   parse_ethh(ethh, &ip4h, &ip6h);
-   if(!ip4h && !ip6h)
+   // Stages 2 and 3 for the packets of each rule matched, in the order of the burst
+   uint64_t now_ms = DNFC_now_ms();
+   size_t queued = 0;
+   for(size_t i = 0; i < n; ++i)
    {
-      fprintf(stderr, "Cannot parse layer 3 protocol!\n");
-      return NULL;
+      struct DNFC_action* action = actions[i];
+      if(!action)
+         continue;
+      
+      struct packet_buffer* group[DNFC_BURST_SIZE];
+      const struct flow_key* group_keys[DNFC_BURST_SIZE];
+      size_t nb_group = 0;
+      for(size_t j = i; j < n; ++j)
+      {
+         if(actions[j] == action)
+         {
+            group_keys[nb_group] = &keys[j];
+            group[nb_group++] = pckts[j];
+            actions[j] = NULL;
+         }
+      }
+      queued += DNFC_enqueue_rule(classifier, rx, action, group, group_keys, nb_group, now_ms, dropped, &nb_dropped);
    }
    
-   // Parse layer 4
-   if(ip4h)
-      parse_ipv4h(&ip4h, &tcph, &udph);
+   epoch_exit();
+   packet_buffer_free_n(dropped, nb_dropped);
+   return queued;
+}
 
-   if(ip6h)
-      parse_ipv6h(&ip6h, &tcph, &udph);
+size_t DNFC_enqueue_rule(struct DNFC* classifier,
+                         size_t rx,
+                         struct DNFC_action* action,
+                         struct packet_buffer** pckts,
+                         const struct flow_key** keys,
+                         size_t n,
+                         uint64_t now_ms,
+                         struct packet_buffer** dropped,
+                         size_t* nb_dropped)
+{
+   // Stage 2: search for the flows of all the packets in the dynamic classifier at once
+   // from the keys parsed in stage 1, the first packet of a flow inserts it
+   void* tags[DNFC_BURST_SIZE];
+   get_flows_by_key(action->flow_table, keys, tags, n);
    
-   if(!tcph && !udph)
+   size_t workers[DNFC_BURST_SIZE];
+   for(size_t i = 0; i < n; ++i)
    {
-      fprintf(stderr, "Cannot parse layer 4 protocol!\n");
-      return NULL;
+      struct DNFC_tag* flow_tag = tags[i];
+      if(flow_tag && DNFC_tag_ref(flow_tag))
+         DNFC_count_pckt(flow_tag, pckts[i]->data_len);
+      else
+         flow_tag = get_flow_tag(classifier, keys[i], pckts[i]->data_len, action->flow_table);
+      pckts[i]->tag = flow_tag;
+      workers[i] = DNFC_worker_of(classifier, pckts[i]);
+   }
+   
+   // Age out the idle and closed flows (only does work when a tick of the wheel elapsed),
+   // dropping the references of their entries to their tags
+   expire_flows(action->flow_table, now_ms, DNFC_tag_unref);
+   
+   // Stage 3: push the packets of each worker with a single bulk push, the ones that
+   // do not fit in its ring are dropped
+   size_t queued = 0;
+   for(size_t i = 0; i < n; ++i)
+   {
+      if(!pckts[i])
+         continue;
+      
+      size_t worker = workers[i];
+      void* batch[DNFC_BURST_SIZE];
+      size_t nb_batch = 0;
+      for(size_t j = i; j < n; ++j)
+      {
+         if(pckts[j] && workers[j] == worker)
+         {
+            batch[nb_batch++] = pckts[j];
+            pckts[j] = NULL;
+         }
+      }
+      
+      size_t pushed = ring_matrix_push_n(action->pckt_queue, rx, worker, batch, nb_batch);
+      for(size_t j = pushed; j < nb_batch; ++j)
+      {
+         DNFC_drop_tag(batch[j]);
+         dropped[(*nb_dropped)++] = batch[j];
+      }
+      queued += pushed;
    }
+   return queued;
+}
+
+struct DNFC_tag* get_flow_tag(struct DNFC* classifier,
+                              const struct flow_key* key,
+                              size_t pckt_len,
+                              flow_table* flow_table)
+{
+   // Packets that are not TCP or UDP have no flow, and get no tag
+   if(!key->version)
+      return NULL;
    
-   // Get the information to construct a key for the flow
-   if(tcph)
-      append_bytes(key, &tcph->th_seq, 4);
-   else
-      append_bytes(key, udph, pckt_len);
-   return key;
+   // Retrieve the tag of the flow with a reference for the packet, inserting a new one
+   // for the first packet, referenced by the packet and the flow table. The flow may
+   // expire between a failed insertion and the next lookup in which case we try again.
+   struct DNFC_tag* flow_tag = get_flow_by_key(flow_table, key);
+   if(flow_tag && !DNFC_tag_ref(flow_tag))
+      flow_tag = NULL;
+   for(int attempt = 0; !flow_tag && attempt < 3; ++attempt)
+   {
+      flow_tag = memory_pool_alloc(classifier->tag_pool);
+      flow_tag->nb_pckts = 0;
+      flow_tag->nb_bytes = 0;
+      flow_tag->pool = classifier->tag_pool;
+      flow_tag->refcnt = 2;
+      if(put_flow_by_key(flow_table, key, flow_tag)) // Check if the tag was already inserted while building it
+         break;
+      
+      // If it was already inserted we free the one we created, nobody could see it
+      memory_pool_free(classifier->tag_pool, flow_tag);
+      flow_tag = get_flow_by_key(flow_table, key);
+      if(flow_tag && !DNFC_tag_ref(flow_tag))
+         flow_tag = NULL;
+   }
+   if(flow_tag)
+      DNFC_count_pckt(flow_tag, pckt_len);
+   return flow_tag;
 }
+
+// Take a reference to a tag read from a flow table, inside the epoch region of the
+// lookup: fail when the flow expired meanwhile and its last reference is gone
+bool DNFC_tag_ref(struct DNFC_tag* flow_tag)
+{
+   uint32_t refcnt = __atomic_load_n(&flow_tag->refcnt, __ATOMIC_RELAXED);
+   while(refcnt)
+   {
+      if(__atomic_compare_exchange_n(&flow_tag->refcnt, &refcnt, refcnt + 1, true,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+         return true;
+   }
+   return false;
+}
+
+// The last reference retires the tag: an RX thread may still have read it from the
+// flow table before the flow expired, and fail to take a reference
+void DNFC_tag_unref(void* flow_tag)
+{
+   if(__atomic_sub_fetch(&((struct DNFC_tag*)flow_tag)->refcnt, 1, __ATOMIC_ACQ_REL) == 0)
+      epoch_retire(flow_tag, DNFC_tag_free);
+}
+
+void DNFC_tag_free(void* flow_tag)
+{
+   memory_pool_free(((struct DNFC_tag*)flow_tag)->pool, flow_tag);
+}
+
+void DNFC_drop_tag(struct packet_buffer* pckt)
+{
+   if(pckt->tag)
+      DNFC_tag_unref(pckt->tag);
+   pckt->tag = NULL;
+}
+
+void DNFC_count_pckt(struct DNFC_tag* flow_tag,
+                     size_t pckt_len)
+{
+   __atomic_add_fetch(&flow_tag->nb_pckts, 1, __ATOMIC_RELAXED);
+   __atomic_add_fetch(&flow_tag->nb_bytes, pckt_len, __ATOMIC_RELAXED);
+}
+
+// The worker of a flow comes from the hash of its key, packets of no flow go to the first one
+size_t DNFC_worker_of(struct DNFC* classifier,
+                      struct packet_buffer* pckt)
+{
+   if(!(pckt->flags & PACKET_HASH_VALID))
+      return 0;
+   return pckt->hash % classifier->nb_workers;
+}
+
+uint64_t DNFC_now_ms(void)
+{
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*          Private Functions              */
@@ -0,0 +1,30 @@
+#include "epoch.h"
+#include "epoch.hpp"
+
+
+
+void epoch_enter(void)
+{
+   DNFC::Epoch::enter();
+}
+
+
+
+void epoch_exit(void)
+{
+   DNFC::Epoch::exit();
+}
+
+
+
+void epoch_retire(void* ptr, void (*destroy)(void* ptr))
+{
+   DNFC::Epoch::retire(ptr, destroy);
+}
+
+
+
+size_t epoch_collect(void)
+{
+   return DNFC::Epoch::collect();
+}
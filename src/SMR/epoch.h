@@ -0,0 +1,38 @@
+#ifndef _EPOCHH_
+#define _EPOCHH_
+
+/*H**********************************************************************
+ * FILENAME :        epoch.h
+ *
+ * DESCRIPTION :
+ *        C interface of the process-wide epoch based reclamation (see
+ *        epoch.hpp). Readers enclose their use of shared objects between
+ *        epoch_enter and epoch_exit, and an object unreachable from the
+ *        shared structures is handed to epoch_retire, which destroys it
+ *        once no reader can hold it anymore.
+ *
+ * AUTHOR :    Pieroux Alexandre
+ *H*/
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Enter a critical region, regions nest. A thread inside one must not block. */
+void epoch_enter(void);
+
+void epoch_exit(void);
+
+/* Call 'destroy(ptr)' once no thread can be inside a region entered before now. */
+void epoch_retire(void* ptr, void (*destroy)(void* ptr));
+
+/* Destroy what can be of the objects retired by this thread, return how many were. */
+size_t epoch_collect(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef _EPOCHHPP_
+#define _EPOCHHPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace DNFC
+{
+
+/**
+ * Epoch
+ *
+ * Process-wide epoch based reclamation. Threads read the shared structures inside
+ * critical regions ('enter' / 'exit', or a Region): entering announces the global
+ * epoch the thread observed, exiting announces that it holds no pointer anymore.
+ * Retired pointers are stamped with the global epoch and destroyed once the epoch
+ * advanced twice, which requires every thread inside a region to have observed the
+ * newer epoch: no thread can still hold them.
+ *
+ * Regions nest and only the outermost one costs a fence, so a reader can enter once
+ * per burst of lookups; a thread staying in a region blocks the reclamation of every
+ * structure using the epoch, it must not wait or block inside one.
+ */
+class Epoch
+{
+  public:
+    // Pointers retired by a thread before it tries to advance the epoch and reclaim
+    const static std::size_t RetireThreshold = 128;
+
+    /**
+     * Region
+     *
+     * Critical region for the lifetime of the object.
+     */
+    class Region
+    {
+      public:
+        Region() { Epoch::enter(); }
+        ~Region() { Epoch::exit(); }
+
+        Region(const Region &) = delete;
+        Region &operator=(const Region &) = delete;
+    };
+
+    static void enter()
+    {
+        Record &self = record();
+        if (self.nesting++ == 0)
+        {
+            self.state.store((domain().epoch.load(std::memory_order_relaxed) << 1) | 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    static void exit()
+    {
+        Record &self = record();
+        if (--self.nesting == 0)
+            self.state.store(0, std::memory_order_release);
+    }
+
+    static bool inRegion()
+    {
+        return record().nesting > 0;
+    }
+
+    /**
+     * retire
+     *
+     * Destroy 'ptr', already unreachable from the shared structures, with a default
+     * constructed 'Deleter' once no thread can hold it anymore.
+     */
+    template <typename T, typename Deleter = std::default_delete<T>>
+    static void retire(T *ptr)
+    {
+        if (!ptr)
+            return;
+        Record &self = record();
+        self.limbo.push_back({ptr, [](void *p) { Deleter()(static_cast<T *>(p)); },
+                              domain().epoch.load(std::memory_order_acquire)});
+        if (self.limbo.size() >= RetireThreshold)
+            collect();
+    }
+
+    // 'retire' for an untyped pointer, destroyed with 'destroy(ptr)', as the C modules do
+    static void retire(void *ptr, void (*destroy)(void *))
+    {
+        if (!ptr)
+            return;
+        Record &self = record();
+        self.limbo.push_back({ptr, destroy, domain().epoch.load(std::memory_order_acquire)});
+        if (self.limbo.size() >= RetireThreshold)
+            collect();
+    }
+
+    /**
+     * collect
+     *
+     * Try to advance the epoch, then destroy the pointers retired by this thread (and
+     * by exited threads) that no thread can hold anymore. Return how many were. The
+     * destructors may retire pointers themselves.
+     */
+    static std::size_t collect()
+    {
+        tryAdvance();
+        uint64_t safe = domain().epoch.load(std::memory_order_acquire);
+        std::vector<Retired> expired;
+        take(record().limbo, safe, expired);
+
+        Domain &shared = domain();
+        {
+            std::unique_lock<std::mutex> lock(shared.orphanLock, std::try_to_lock);
+            if (lock.owns_lock())
+                take(shared.orphans, safe, expired);
+        }
+        for (const Retired &retired : expired)
+            retired.destroy(retired.ptr);
+        return expired.size();
+    }
+
+    static uint64_t current()
+    {
+        return domain().epoch.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct Retired
+    {
+        void *ptr;
+        void (*destroy)(void *);
+        uint64_t epoch;
+    };
+
+    // State of a thread, reused by another thread once it exits
+    struct alignas(64) Record
+    {
+        std::atomic<uint64_t> state{0}; // Epoch observed << 1 | 1 inside a region, 0 outside
+        std::atomic<bool> used{true};
+        int nesting = 0;
+        std::vector<Retired> limbo;
+        Record *next = nullptr;
+    };
+
+    struct Domain
+    {
+        std::atomic<uint64_t> epoch{2};
+        std::atomic<Record *> head{nullptr};
+        std::mutex orphanLock;
+        std::vector<Retired> orphans; // Retired by exited threads
+    };
+
+    // Give the record of the thread back when it exits, with what it could not reclaim
+    struct Owner
+    {
+        Record *self;
+
+        Owner() : self(acquire()) {}
+
+        ~Owner()
+        {
+            Domain &shared = domain();
+            self->state.store(0, std::memory_order_release);
+            if (!self->limbo.empty())
+            {
+                std::lock_guard<std::mutex> lock(shared.orphanLock);
+                shared.orphans.insert(shared.orphans.end(), self->limbo.begin(), self->limbo.end());
+                self->limbo.clear();
+            }
+            self->nesting = 0;
+            self->used.store(false, std::memory_order_release);
+        }
+    };
+
+    // Never destroyed, so that threads exiting with the process can still give their records back
+    static Domain &domain()
+    {
+        static Domain *shared = new Domain();
+        return *shared;
+    }
+
+    static Record &record()
+    {
+        static thread_local Owner owner;
+        return *owner.self;
+    }
+
+    static Record *acquire()
+    {
+        Domain &shared = domain();
+        for (Record *r = shared.head.load(std::memory_order_acquire); r; r = r->next)
+        {
+            bool expected = false;
+            if (!r->used.load(std::memory_order_relaxed) &&
+                r->used.compare_exchange_strong(expected, true, std::memory_order_acquire, std::memory_order_relaxed))
+                return r;
+        }
+
+        Record *r = new Record();
+        r->next = shared.head.load(std::memory_order_relaxed);
+        while (!shared.head.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed))
+            ;
+        return r;
+    }
+
+    // Advance the global epoch if every thread inside a region observed it
+    static bool tryAdvance()
+    {
+        Domain &shared = domain();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t epoch = shared.epoch.load(std::memory_order_relaxed);
+        for (Record *r = shared.head.load(std::memory_order_acquire); r; r = r->next)
+        {
+            uint64_t state = r->state.load(std::memory_order_acquire);
+            if ((state & 1) && (state >> 1) != epoch)
+                return false;
+        }
+        return shared.epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_acq_rel,
+                                                    std::memory_order_relaxed);
+    }
+
+    // Move the pointers of 'limbo' retired two epochs before 'epoch' to 'expired'
+    static void take(std::vector<Retired> &limbo, uint64_t epoch, std::vector<Retired> &expired)
+    {
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < limbo.size(); ++i)
+        {
+            if (limbo[i].epoch + 2 <= epoch)
+                expired.push_back(limbo[i]);
+            else
+                limbo[kept++] = limbo[i];
+        }
+        limbo.resize(kept);
+    }
+};
+
+/**
+ * EpochPointer
+ *
+ * Drop-in replacement of HazardPointer backed by Epoch, for the structures taking
+ * their reclamation scheme from their policy: the object keeps the thread inside a
+ * critical region, so assigning a pointer is a plain store and nothing needs to be
+ * published. 'retire' hands the pointer to the epoch, destroyed with 'Deleter'.
+ */
+template <class T, class Deleter = std::default_delete<T>>
+class EpochPointer
+{
+  public:
+    EpochPointer() : ptr(nullptr)
+    {
+        Epoch::enter();
+    }
+
+    EpochPointer(T *p) : ptr(p)
+    {
+        Epoch::enter();
+    }
+
+    ~EpochPointer()
+    {
+        Epoch::exit();
+    }
+
+    EpochPointer(const EpochPointer &) = delete;
+    EpochPointer &operator=(const EpochPointer &) = delete;
+
+    EpochPointer &operator=(T *p)
+    {
+        ptr = p;
+        return *this;
+    }
+
+    T *get() const
+    {
+        return ptr;
+    }
+
+    T *release()
+    {
+        T *p = ptr;
+        ptr = nullptr;
+        return p;
+    }
+
+    void retire()
+    {
+        Epoch::retire<T, Deleter>(release());
+    }
+
+  private:
+    T *ptr;
+};
+} // namespace DNFC
+
+#endif
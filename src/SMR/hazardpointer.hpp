@@ -4,496 +4,450 @@
 #include <vector>
 #include <atomic>
 #include <algorithm>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
 
 namespace DNFC
 {
 /**
  * HazardPointer default policy
- * 
+ *
+ * Each thread owns blocks of BlockSize hazard slots, a new block is added when a
+ * thread guards more pointers at the same time. A thread scans the slots of all the
+ * threads once it retired ScanFactor * (number of slots) + ScanMinimum pointers, so
+ * that each scan reclaims most of them and costs O(R log P) for R retired pointers
+ * and P slots.
  */
 class DefaultHazardPointerPolicy
 {
 public:
   const static int BlockSize = 4;
+  const static int ScanFactor = 2;
+  const static int ScanMinimum = 64;
 };
 
-template <class T, class Policy = DefaultHazardPointerPolicy>
-class HazardPointer
+/**
+ * HazardDomain
+ *
+ * Hazard slots and retired pointers shared by all the structures whose HazardPointers
+ * use 'Policy', whatever the type of the pointers: each thread has a single record
+ * and one scan reclaims the pointers of every structure, each one with the deleter it
+ * was retired with. A thread is registered at its first HazardPointer, or explicitly
+ * with 'attach' when it starts, and gives its record back when it exits or calls
+ * 'detach'; finding the record of the thread is then a single thread-local read.
+ */
+template <class Policy = DefaultHazardPointerPolicy>
+class HazardDomain
 {
+  static_assert(Policy::BlockSize > 0 && Policy::BlockSize <= 64, "BlockSize must be in [1, 64]");
+
 public:
-  /**
-     * operator=(const HazardPointer& hp)
-     * 
-     * copy operator= with the reference to another Hazard Pointer.
-     */
-  HazardPointer<T, Policy> &operator=(const HazardPointer &hp)
-  {
-    return operator=(hp.get());
-  }
+  using Slot = std::atomic<void *>;
 
   /**
-     * operator=(HazardPointer&& hp)
-     * 
-     * move operator= with another Hazard Pointer.
-     */
-  HazardPointer<T, Policy> &operator=(HazardPointer &&hp)
+   * SlotBlock
+   *
+   * Hazard slots of a thread, padded to whole cache lines so that the slots of two
+   * threads never share one. Other threads only read the slots, the owner keeps track
+   * of the ones in use in 'used'.
+   */
+  struct alignas(64) SlotBlock
   {
-    return operator=(std::move(hp.release()));
-  }
+    Slot slots[Policy::BlockSize];
+    std::atomic<SlotBlock *> next;
+    uint64_t used;
 
-  /**
-     * operator=(T* p)
-     * 
-     * operator= with a pointer to guard.
-     */
-  HazardPointer<T, Policy> &operator=(T *p)
-  {
-    if (!ptr.get())
+    SlotBlock() : slots(), next(nullptr), used(0) {}
+
+    Slot *allocSlot()
     {
-      ptr.reset(HazardPointer<T, Policy>::getMyhp()->guard(p));
+      uint64_t full = Policy::BlockSize == 64 ? ~uint64_t(0) : (uint64_t(1) << Policy::BlockSize) - 1;
+      if (used == full)
+        return nullptr;
+      int index = __builtin_ctzll(~used);
+      used |= uint64_t(1) << index;
+      return &slots[index];
     }
-    else
+
+    void freeSlot(Slot *slot)
     {
-      if (p != ptr->ptr.load(std::memory_order_relaxed))
-        ptr->ptr.exchange(p, std::memory_order_release);
+      used &= ~(uint64_t(1) << (slot - slots));
     }
+  };
 
-    return *this;
-  }
-
-  /**
-     * get
-     *
-     * Retrieve the guarded pointer.
-     */
-  T *get() const
+  struct Retired
   {
-    if (!ptr.get())
-      return nullptr;
-    return ptr->ptr.load(std::memory_order_relaxed);
-  }
+    void *ptr;
+    void (*destroy)(void *);
+  };
 
   /**
-     * release
-     *
-     * Release the safety guard on the pointer.
-     */
-  T *release()
+   * Record
+   *
+   * Hazard slots and retired pointers of a thread. The record is given back when the
+   * thread exits and reused by another one, along with the pointers it still retired.
+   */
+  struct Record
   {
-    if (!ptr.get())
-      return nullptr;
-    return ptr->ptr.exchange(nullptr, std::memory_order_release);
-  }
+    SlotBlock first;
+    std::atomic<bool> active;
+    Record *next;
 
-  /**
-     * retire
-     *
-     * Safely retire the node for deletion.
-     */
-  void retire()
-  {
+    // Owner only, their capacity is kept so that scans do not allocate
+    std::vector<Retired> retired;
+    std::vector<void *> hazards;
 
-    std::unique_ptr<HazardPointerRecord> &myhp = HazardPointer<T, Policy>::getMyhp();
-    if (!myhp.get())
-      return;
+    Record(Record *head) : active(true), next(head) {}
 
-    myhp->retire(ptr.release());
-    if (myhp->nbRetiredPtrs >= HazardPointerManager::get().getBatchSize())
+    // Take a free slot, adding a block when all of them are in use
+    Slot *allocSlot(SlotBlock *&owner)
     {
-      HazardPointerManager::get().scan();
-      HazardPointerManager::get().helpScan();
+      SlotBlock *b = &first;
+      for (;;)
+      {
+        if (Slot *slot = b->allocSlot())
+        {
+          owner = b;
+          return slot;
+        }
+        SlotBlock *n = b->next.load(std::memory_order_relaxed);
+        if (!n)
+        {
+          n = new SlotBlock();
+          b->next.store(n, std::memory_order_release);
+          domain().nbSlots.fetch_add(Policy::BlockSize, std::memory_order_relaxed);
+        }
+        b = n;
+      }
     }
-  }
+
+    // Append the non-null slots to 'output'
+    void getHps(std::vector<void *> &output) const
+    {
+      for (const SlotBlock *b = &first; b; b = b->next.load(std::memory_order_acquire))
+        for (auto &slot : b->slots)
+          if (void *p = slot.load(std::memory_order_acquire))
+            output.push_back(p);
+    }
+  };
 
   /**
-   * Constructor
-   *
-   * Automatically subscribe to the manager but don't guard any pointer.
-   * The manager will prevent a thread to subscribe more than one time.
+   * Record of the calling thread, registering it at its first use.
    */
-  HazardPointer() : ptr(nullptr)
+  static Record &myRecord()
   {
-    HazardPointerManager::get().subscribe();
+    Record *record = current;
+    if (__builtin_expect(record != nullptr, 1))
+      return *record;
+    return attach();
   }
 
   /**
-   * Constructor
+   * attach
    *
-   * Automatically subscribe to the manager and guard the given pointer.
-   * The manager will prevent a thread to subscribe more than one time.
+   * Register the calling thread, so that its first HazardPointer does not. The record
+   * is given back when the thread exits.
    */
-  HazardPointer(T *p)
+  static Record &attach()
   {
-    HazardPointerManager::get().subscribe();
-    if (ptr.get())
+    if (!current)
     {
-      ptr->ptr.exchange(p, std::memory_order_release);
-      return;
+      static thread_local Owner owner;
+      current = acquire();
+      owner.attached = true;
     }
-    ptr.reset(HazardPointer<T, Policy>::getMyhp()->guard(p));
-  };
+    return *current;
+  }
 
   /**
-   * Release the guarded pointer if there is one. If no more pointers are 
-   * guarded in this thread, then it will unsubscribe from the manager.
+   * detach
+   *
+   * Give the record of the calling thread back before it exits; it must not hold any
+   * HazardPointer anymore. Its retired pointers are reclaimed by the other threads.
    */
-  ~HazardPointer()
+  static void detach()
   {
-    std::unique_ptr<HazardPointerRecord> &myhp = HazardPointer<T, Policy>::getMyhp();
-    if (myhp)
+    if (current)
     {
-      if (ptr.get())
-        myhp->release(ptr.release());
-
-      if (myhp->nbActivePtrs <= 0)
-        HazardPointerManager::get().unsubscribe();
+      current->active.store(false, std::memory_order_release);
+      current = nullptr;
     }
-  };
+  }
 
-private:
   /**
-   * GuardedPointer
+   * retire
    *
-   * A convenient linked list that hold a pointer on which deletion is prohibited.
-   * In practice each GuardedPointer are contiguous within each GuardedPointerBlock.
-   * See GuardedPointerBlock for more information.
+   * Destroy 'ptr' with 'destroy' once no slot of the domain holds it anymore.
    */
-  struct GuardedPointer
+  static void retire(void *ptr, void (*destroy)(void *))
   {
-    std::atomic<T *> ptr;
-    std::atomic<GuardedPointer *> next;
-
-    void setPtr(T *p) { ptr.store(p, std::memory_order_release); }
-    void setNext(GuardedPointer *n) { next.store(n, std::memory_order_release); }
-    GuardedPointer *getNext() { return getCleared(next.load(std::memory_order_relaxed)); }
-
-    bool isDeleted()
-    {
-      uintptr_t nextPtr = reinterpret_cast<uintptr_t>(next.load(std::memory_order_relaxed));
-      return reinterpret_cast<GuardedPointer *>(nextPtr & 0x1);
-    }
-
-    void markAsDeleted()
-    {
-      uintptr_t nextPtr = reinterpret_cast<uintptr_t>(next.load(std::memory_order_relaxed));
-      GuardedPointer *mrkd = reinterpret_cast<GuardedPointer *>(nextPtr | 0x1);
-      next.store(mrkd, std::memory_order_release);
-    }
-
-  private:
-    GuardedPointer *getCleared(GuardedPointer *p)
+    Record &myhp = myRecord();
+    myhp.retired.push_back({ptr, destroy});
+    if (myhp.retired.size() >= getBatchSize())
     {
-      uintptr_t nextPtr = reinterpret_cast<uintptr_t>(p);
-      return reinterpret_cast<GuardedPointer *>(nextPtr & ~0x1);
+      scan();
+      helpScan();
     }
-  };
+  }
 
   /**
-   * GuardedPointerBlock
-   *
-   * An helping structure for memory managment. This structure represent a 'chunk'
-   * of memory used for GuardedPointer contiguous arrays. This will allocate the
-   * 'Policy::BlockSize' number of GuardedPointer. 
+   * Retrieve the threshold of retired pointers before scanning is required
    */
-  struct GuardedPointerBlock
+  static std::size_t getBatchSize()
   {
-    std::unique_ptr<GuardedPointerBlock> next = nullptr;
-
-    GuardedPointer *begin() { return reinterpret_cast<GuardedPointer *>(this + 1); }
-    GuardedPointer *end() { return begin() + Policy::BlockSize; }
-
-    const GuardedPointer *begin() const { return reinterpret_cast<const GuardedPointer *>(this + 1); }
-    const GuardedPointer *end() const { return begin() + Policy::BlockSize; }
-
-    GuardedPointerBlock()
-    {
-      GuardedPointer *last = end() - 1;
-      for (auto &&g = begin(); g != last; g = g->next)
-        g->next = g + 1;
-      last->next = nullptr;
-    };
-  };
+    return domain().nbSlots.load(std::memory_order_relaxed) * Policy::ScanFactor + Policy::ScanMinimum;
+  }
 
   /**
-   * HazardPointerRecord
-   * 
-   * An object that hold informations about allocated hazard pointers for the current
-   * thread.
+   * Scan function that is called to garbage collect the memory: the slots of all the
+   * threads are gathered and sorted, the retired pointers found in none of them are
+   * destroyed and the others are kept in place.
    */
-  struct HazardPointerRecord
+  static void scan()
   {
-    GuardedPointer *rlistHead = nullptr;
-    int nbActivePtrs = 0;
-    int nbRetiredPtrs;
+    Record &myhp = myRecord();
 
-    std::atomic<bool> active;
-    std::unique_ptr<HazardPointerRecord> next;
-
-    // Guard a given pointer
-    GuardedPointer *guard(T *p)
-    {
-      GuardedPointer *newPtr = allocPtr();
-      newPtr->setPtr(p);
-      nbActivePtrs++;
+    // Stage 1: the retirements happened before the slots are read
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::vector<void *> &plist = myhp.hazards;
+    plist.clear();
+    for (Record *i = domain().head.load(std::memory_order_acquire); i; i = i->next)
+      i->getHps(plist);
 
-      HazardPointerManager::get().nbhp.fetch_add(1, std::memory_order_relaxed);
-      return newPtr;
-    }
-
-    // Put a pointer on the retire list for it to be removed
-    void retire(GuardedPointer *n)
-    {
-      n->setNext(rlistHead);
-      n->markAsDeleted();
-      rlistHead = n;
-
-      nbRetiredPtrs++;
-      nbActivePtrs--;
-      HazardPointerManager::get().nbhp.fetch_sub(1, std::memory_order_relaxed);
-    }
-
-    // Return the GuardedPointer to the memory pool
-    const T *release(GuardedPointer *p)
-    {
-      const T *data = p->ptr.load(std::memory_order_relaxed);
-      freePtr(p);
-      return data;
-    }
+    // Stage 2
+    std::sort(plist.begin(), plist.end());
 
-    // Destroy the guarded pointer
-    void free(GuardedPointer *n)
+    // Stage 3
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < myhp.retired.size(); ++i)
     {
-      delete n->ptr.load(std::memory_order_relaxed);
-      n->ptr.store(nullptr, std::memory_order_release);
-      freePtr(n);
-    }
-
-    // Return in the passed vector of pointers, all the Hazard Pointers in this HazardPointerRecord
-    void getHps(std::vector<T *> &output)
-    {
-      getHpsPriv(output, blockHead.load(std::memory_order_relaxed));
-    }
-
-    HazardPointerRecord(HazardPointerRecord *head = nullptr, bool active = true) : next(head), nbRetiredPtrs(0), blockHead(nullptr)
-    {
-      this->active.store(active, std::memory_order_relaxed);
+      Retired r = myhp.retired[i];
+      if (std::binary_search(plist.begin(), plist.end(), r.ptr))
+        myhp.retired[kept++] = r;
+      else
+        r.destroy(r.ptr);
     }
+    myhp.retired.resize(kept);
+  }
 
-    ~HazardPointerRecord()
+  /**
+   * Adopt the pointers retired by threads that exited.
+   */
+  static void helpScan()
+  {
+    Record &myhp = myRecord();
+    for (Record *i = domain().head.load(std::memory_order_acquire); i; i = i->next)
     {
-      if (blockHead.load(std::memory_order_relaxed))
-        delete blockHead.load(std::memory_order_relaxed);
-    }
-
-  private:
-    std::atomic<GuardedPointerBlock *> blockHead;
-    GuardedPointer *flistHead = nullptr;
+      // Trying to lock the next non-used hazard pointer record
+      bool expected = false;
+      if (i->active.load(std::memory_order_relaxed) ||
+          !i->active.compare_exchange_strong(expected, true,
+                                             std::memory_order_acquire, std::memory_order_relaxed))
+        continue;
 
-    // Manage pointers memory allocation
-    GuardedPointer *allocPtr()
-    {
-      GuardedPointer *newPtr;
-      if (!flistHead)
-      {
-        void *chunk = std::malloc(Policy::BlockSize * sizeof(GuardedPointer) + sizeof(GuardedPointerBlock));
-        GuardedPointerBlock *newBlock = ::new (chunk) GuardedPointerBlock();
+      myhp.retired.insert(myhp.retired.end(), i->retired.begin(), i->retired.end());
+      i->retired.clear();
 
-        GuardedPointerBlock *head = blockHead.exchange(newBlock, std::memory_order_relaxed);
-        newBlock->next.reset(head);
-        flistHead = newBlock->begin();
-      }
+      // Release the record
+      i->active.store(false, std::memory_order_release);
 
-      newPtr = flistHead;
-      flistHead = newPtr->getNext();
-      newPtr->setNext(nullptr);
-      return newPtr;
+      // scan if we reached the threshold
+      if (myhp.retired.size() >= getBatchSize())
+        scan();
     }
+  }
 
-    // Put HazardPointer on free list for reuse
-    void freePtr(GuardedPointer *p)
-    {
-      p->setPtr(nullptr);
-      p->setNext(flistHead);
-      p->markAsDeleted();
-      flistHead = p;
+  // Number of records, threads registered now or before
+  static std::size_t nbRecords()
+  {
+    std::size_t count = 0;
+    for (Record *i = domain().head.load(std::memory_order_acquire); i; i = i->next)
+      ++count;
+    return count;
+  }
 
-      nbActivePtrs--;
-      HazardPointerManager::get().nbhp.fetch_sub(1, std::memory_order_relaxed);
-    }
+private:
+  // Give the record back when a registered thread exits
+  struct Owner
+  {
+    bool attached = false;
 
-    // Return a vector of all the Hazard Pointer contained in the GuardedPointerBlock linked list
-    void getHpsPriv(std::vector<T *> &output, GuardedPointerBlock *block)
+    ~Owner()
     {
-      for (auto &&g : *block)
-      {
-        if (!g.isDeleted())
-          output.push_back(g.ptr.load());
-      }
-      if (block && block->next)
-        getHpsPriv(output, block->next.get());
+      if (attached)
+        detach();
     }
   };
 
-  /**
-   * HazardPointerManager
-   * 
-   * This singleton private class provide a central managment point for safe memory reclamation. 
-   * It provide memory managment for system wide hazard pointers.
-   */
-  friend class HazardPointerManager;
-  class HazardPointerManager
+  struct Shared
   {
-  public:
-    // Retrive the unique instance of the HazardPointerManager
-    static HazardPointerManager &get()
-    {
-      static HazardPointerManager m;
-      return m;
-    }
+    std::atomic<Record *> head{nullptr};
+    std::atomic<std::size_t> nbSlots{0};
+  };
 
-    HazardPointerManager(): head(nullptr)
-    {}
+  // Never destroyed, so that threads exiting with the process can still give their records back
+  static Shared &domain()
+  {
+    static Shared *shared = new Shared();
+    return *shared;
+  }
 
-    ~HazardPointerManager()
+  // First try to reuse a record given back, then allocate and push a new one
+  static Record *acquire()
+  {
+    Shared &shared = domain();
+    for (Record *i = shared.head.load(std::memory_order_acquire); i; i = i->next)
     {
-      delete head.load(std::memory_order_relaxed);
+      bool expected = false;
+      if (i->active.load(std::memory_order_relaxed) ||
+          !i->active.compare_exchange_strong(expected, true,
+                                             std::memory_order_acquire, std::memory_order_relaxed))
+        continue;
+      return i;
     }
 
-    std::atomic<HazardPointerRecord *> head;
-    std::atomic<int> nbhp;
+    Record *record = new Record(shared.head.load(std::memory_order_relaxed));
+    shared.nbSlots.fetch_add(Policy::BlockSize, std::memory_order_relaxed);
+    while (!shared.head.compare_exchange_weak(record->next, record,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed))
+      ;
+    return record;
+  }
 
-    /**
-     * Subscribe a thread to the manager. During the time the thread is subscribed, it is
-     * given a HazardPointerRecord object that allow it to protect 'Policy::BlockSize' pointers.
-     */
-    void subscribe()
-    {
-      int tid = pthread_self() % 1000;
+  static thread_local Record *current;
+};
 
-      // Prevent subbing more than once
-      std::unique_ptr<HazardPointerRecord> &myhp = HazardPointer<T, Policy>::getMyhp();
-      if (myhp.get())
-        return;
+template <class Policy>
+thread_local typename HazardDomain<Policy>::Record *HazardDomain<Policy>::current = nullptr;
 
-      // First try to reuse a retire HP record
-      bool expected = false;
-      for (HazardPointerRecord *i = head.load(std::memory_order_relaxed); i != nullptr; i = i->next.get())
-      {
-        if (i->active.load(std::memory_order_relaxed) ||
-            !i->active.compare_exchange_strong(expected, true,
-                                               std::memory_order_acquire, std::memory_order_relaxed))
-          continue;
-
-        // Sucessfully locked one record to use
-        myhp.reset(i);
-        return;
-      }
+/**
+ * HazardPointer
+ *
+ * Guard on a pointer of a lock-free structure, in the HazardDomain of 'Policy'. A
+ * retired pointer is destroyed with 'Deleter' once no HazardPointer guards it anymore,
+ * so that objects taken from an allocator go back to it (see AllocatorDeleter in
+ * allocators.hpp).
+ */
+template <class T, class Policy = DefaultHazardPointerPolicy, class Deleter = std::default_delete<T>>
+class HazardPointer
+{
+public:
+  using Domain = HazardDomain<Policy>;
 
-      // Allocate and push a new record
-      myhp.reset(new HazardPointerRecord(head.load(std::memory_order_relaxed), true));
+  /**
+     * operator=(const HazardPointer& hp)
+     *
+     * copy operator= with the reference to another Hazard Pointer.
+     */
+  HazardPointer &operator=(const HazardPointer &hp)
+  {
+    return operator=(hp.get());
+  }
 
-      // Add the new record to the list
-      HazardPointerRecord *nextPtrVal = myhp->next.get();
-      while (!head.compare_exchange_weak(nextPtrVal, myhp.get(),
-                                         std::memory_order_release,
-                                         std::memory_order_relaxed))
-        ;
-    }
+  /**
+     * operator=(HazardPointer&& hp)
+     *
+     * move operator= with another Hazard Pointer.
+     */
+  HazardPointer &operator=(HazardPointer &&hp)
+  {
+    return operator=(hp.release());
+  }
 
-    /**
-     * Unsubscribe the current thread from the manager.
+  /**
+     * operator=(T* p)
+     *
+     * operator= with a pointer to guard. The pointer is published with a full barrier:
+     * the caller validates it afterwards by reading again where it loaded it from.
      */
-    void unsubscribe()
-    {
-      std::unique_ptr<HazardPointerRecord> &myhp = HazardPointer<T, Policy>::getMyhp();
-
-      // Prevent unsubscribe more than once
-      int tid = pthread_self() % 1000;
-      if (!myhp.get())
-        return;
-      myhp->active.store(false, std::memory_order_relaxed);
-      myhp.release();
-    }
+  HazardPointer &operator=(T *p)
+  {
+    if (!slot)
+      slot = Domain::myRecord().allocSlot(block);
+    if (p != slot->load(std::memory_order_relaxed))
+      slot->exchange(p, std::memory_order_seq_cst);
+    return *this;
+  }
 
-    /**
-     * Retrieve the threshold of the manager before scanning is required
+  /**
+     * get
+     *
+     * Retrieve the guarded pointer.
      */
-    unsigned int getBatchSize()
-    {
-      return nbhp.load(std::memory_order_relaxed) * 2 + Policy::BlockSize;
-    }
+  T *get() const
+  {
+    if (!slot)
+      return nullptr;
+    return static_cast<T *>(slot->load(std::memory_order_relaxed));
+  }
 
-    /**
-     * Scan function that is called to garbage collect the memory.
+  /**
+     * release
+     *
+     * Release the safety guard on the pointer.
      */
-    void scan()
-    {
-      // Stage 1
-      std::unique_ptr<HazardPointerRecord> &myhp = HazardPointer<T, Policy>::getMyhp();
-      std::vector<T *> plist;
-      for (auto &&i = head.load(std::memory_order_relaxed); i; i = i->next.get())
-      {
-        if (!i->active.load(std::memory_order_relaxed))
-          continue;
-        i->getHps(plist);
-      }
-      if (plist.size() <= 0)
-        return;
+  T *release()
+  {
+    if (!slot)
+      return nullptr;
+    return static_cast<T *>(slot->exchange(nullptr, std::memory_order_release));
+  }
 
-      // Stage 2
-      std::sort(plist.begin(), plist.end());
-      GuardedPointer *localRList = myhp->rlistHead;
-      myhp->rlistHead = nullptr;
+  /**
+     * retire
+     *
+     * Safely retire the node for deletion.
+     */
+  void retire()
+  {
+    if (T *p = release())
+      Domain::retire(p, &destroy);
+  }
 
-      // Stage 3
-      GuardedPointer *next;
-      for (auto &&g = localRList; g;)
-      {
-        next = g->getNext();
-        if (std::binary_search(plist.begin(), plist.end(), g->ptr.load(std::memory_order_relaxed)))
-          myhp->retire(g);
-        else
-          myhp->free(g);
-        g = next;
-      }
-    }
+  /**
+   * Constructor
+   *
+   * Don't guard any pointer: a slot of the thread is only taken at the first assignment.
+   */
+  HazardPointer() : slot(nullptr), block(nullptr)
+  {
+  }
 
-    void helpScan()
-    {
-      std::unique_ptr<HazardPointerRecord> &myhp = HazardPointer<T, Policy>::getMyhp();
-      bool expected = false;
-      for (auto &&i = head.load(std::memory_order_relaxed); i; i = i->next.get())
-      {
-        // Trying to lock the next non-used hazard pointer record
-        if (i->active.load(std::memory_order_relaxed) ||
-            !i->active.compare_exchange_strong(expected, true,
-                                               std::memory_order_acquire, std::memory_order_relaxed))
-          continue;
-
-        // Inserting the rlist of the node in myhp
-        for (auto &&g = i->rlistHead; g; g = g->getNext())
-        {
-          myhp->retire(g);
+  /**
+   * Constructor
+   *
+   * Guard the given pointer.
+   */
+  HazardPointer(T *p) : slot(nullptr), block(nullptr)
+  {
+    operator=(p);
+  }
 
-          // scan if we reached the threshold
-          if (myhp->nbRetiredPtrs >= HazardPointerManager::get().getBatchSize())
-            scan();
-        }
-        // Release the record
-        i->active.store(false, std::memory_order_relaxed);
-      }
-    }
-  };
+  HazardPointer(const HazardPointer &) = delete;
 
-  // Pointer guarded by the hazard pointer
-  std::unique_ptr<GuardedPointer> ptr;
+  /**
+   * Release the guarded pointer if there is one and give the slot back to the thread.
+   */
+  ~HazardPointer()
+  {
+    if (slot)
+    {
+      slot->store(nullptr, std::memory_order_release);
+      block->freeSlot(slot);
+    }
+  }
 
-  // Thread local storage
-  static std::unique_ptr<HazardPointerRecord> &getMyhp()
+private:
+  static void destroy(void *p)
   {
-    static thread_local std::unique_ptr<HazardPointerRecord> myhp;
-    return myhp;
+    Deleter()(static_cast<T *>(p));
   }
+
+  // Slot of the calling thread holding the guarded pointer, and its block
+  typename Domain::Slot *slot;
+  typename Domain::SlotBlock *block;
 };
 } // namespace DNFC
 
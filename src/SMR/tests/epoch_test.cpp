@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../epoch.hpp"
+
+using namespace DNFC;
+
+struct Tracked
+{
+    Tracked(std::atomic<int> &destroyed) : destroyed(destroyed) {}
+    ~Tracked() { ++destroyed; }
+
+    std::atomic<int> &destroyed;
+};
+
+// Advance the epoch as far as the other threads allow
+static void drain()
+{
+    for (int i = 0; i < 4; ++i)
+        Epoch::collect();
+}
+
+TEST(Epoch, RegionsNest)
+{
+    EXPECT_FALSE(Epoch::inRegion());
+    {
+        Epoch::Region outer;
+        EXPECT_TRUE(Epoch::inRegion());
+        {
+            Epoch::Region inner;
+            EXPECT_TRUE(Epoch::inRegion());
+        }
+        EXPECT_TRUE(Epoch::inRegion());
+    }
+    EXPECT_FALSE(Epoch::inRegion());
+}
+
+TEST(Epoch, RetireIsDeferred)
+{
+    std::atomic<int> destroyed(0);
+    Epoch::retire(new Tracked(destroyed));
+    EXPECT_EQ(destroyed, 0);
+    drain();
+    EXPECT_EQ(destroyed, 1);
+}
+
+TEST(Epoch, ReaderBlocksReclamation)
+{
+    std::atomic<int> destroyed(0);
+    std::atomic<bool> entered(false);
+    std::atomic<bool> leave(false);
+
+    // A reader entered before the retirement may still hold the pointer
+    std::thread reader([&] {
+        Epoch::Region region;
+        entered = true;
+        while (!leave)
+            std::this_thread::yield();
+    });
+    while (!entered)
+        std::this_thread::yield();
+
+    Epoch::retire(new Tracked(destroyed));
+    drain();
+    EXPECT_EQ(destroyed, 0);
+
+    leave = true;
+    reader.join();
+    drain();
+    EXPECT_EQ(destroyed, 1);
+}
+
+TEST(Epoch, EpochPointer)
+{
+    std::atomic<int> destroyed(0);
+    {
+        EpochPointer<Tracked> pointer(new Tracked(destroyed));
+        EXPECT_TRUE(Epoch::inRegion());
+        EXPECT_NE(pointer.get(), nullptr);
+        pointer.retire();
+        EXPECT_EQ(pointer.get(), nullptr);
+
+        // The thread itself is still inside the region
+        drain();
+        EXPECT_EQ(destroyed, 0);
+    }
+    EXPECT_FALSE(Epoch::inRegion());
+    drain();
+    EXPECT_EQ(destroyed, 1);
+}
+
+TEST(Epoch, ExitedThreadsHandOverTheirPointers)
+{
+    std::atomic<int> destroyed(0);
+    std::thread retirer([&] {
+        Epoch::Region region;
+        Epoch::retire(new Tracked(destroyed));
+    });
+    retirer.join();
+    drain();
+    EXPECT_EQ(destroyed, 1);
+}
+
+TEST(Epoch, StressPublishRetire)
+{
+    // Readers dereference the published object while writers replace and retire it
+    struct Value
+    {
+        std::atomic<int> alive{1};
+        ~Value() { alive = 0; }
+    };
+    std::atomic<Value *> shared(new Value());
+    std::atomic<bool> stop(false);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&] {
+            while (!stop)
+            {
+                Epoch::Region region;
+                for (int i = 0; i < 32; ++i)
+                    if (shared.load(std::memory_order_acquire)->alive.load(std::memory_order_relaxed) != 1)
+                        failed = true;
+            }
+        });
+    }
+    for (int t = 0; t < 2; ++t)
+    {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 20000; ++i)
+                Epoch::retire(shared.exchange(new Value(), std::memory_order_acq_rel));
+            Epoch::collect();
+        });
+    }
+    for (std::size_t t = 4; t < threads.size(); ++t)
+        threads[t].join();
+    stop = true;
+    for (int t = 0; t < 4; ++t)
+        threads[t].join();
+
+    EXPECT_FALSE(failed);
+    delete shared.load();
+}
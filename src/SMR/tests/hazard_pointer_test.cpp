@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <thread>
+#include <vector>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <gtest/gtest.h>
@@ -11,10 +13,12 @@
 
 using namespace DNFC;
 
-class TestPolicy : DNFC::DefaultHazardPointerPolicy
+class TestPolicy : public DNFC::DefaultHazardPointerPolicy
 {
   public:
     const static int BlockSize = 2;
+    const static int ScanFactor = 0;
+    const static int ScanMinimum = 1; // Scan at every retirement
 };
 
 TEST(HazardPointer, Declaration)
@@ -108,37 +112,201 @@ TEST(HazardPointer, PreventDeletionOfGuardedPointerWhileScanning)
 
     std::mutex m;
     std::condition_variable cv;
+    bool guarded = false;
     bool notified = false;
-    std::thread worker([&valOne, &notified, &m, &cv]()
+    std::thread worker([&valOne, &guarded, &notified, &m, &cv]()
     {
         DNFC::HazardPointer<int, TestPolicy> threadHP(valOne);
-
-        std::unique_lock<std::mutex> lk(m);
-        lk.unlock();
+        {
+            std::lock_guard<std::mutex> lk(m);
+            guarded = true;
+        }
         cv.notify_one();
 
-        while(!notified)
-            cv.wait(lk);
+        std::unique_lock<std::mutex> lk(m);
+        cv.wait(lk, [&notified] { return notified; });
     });
 
     {
         std::unique_lock<std::mutex> lk(m);
-        cv.wait(lk);
+        cv.wait(lk, [&guarded] { return guarded; });
+    }
 
-        one.retire();
-        two.retire();
-        three.retire();
-        four.retire();
-        five.retire();
+    one.retire();
+    two.retire();
+    three.retire();
+    four.retire();
+    five.retire();
 
+    EXPECT_EQ(*valOne, 1);
+    {
+        std::lock_guard<std::mutex> lk(m);
         notified = true;
-        cv.notify_one();
     }
+    cv.notify_one();
     worker.join();
 
     EXPECT_EQ(*valOne, 1);
 }
 
+// Deleter counting the pointers reclaimed
+std::atomic<int> reclaimed(0);
+
+struct CountingDeleter
+{
+    void operator()(int *p) const
+    {
+        ++reclaimed;
+        delete p;
+    }
+};
+
+TEST(HazardPointer, ReclaimWithDeleter)
+{
+    using HP = DNFC::HazardPointer<int, TestPolicy, CountingDeleter>;
+    int before = reclaimed;
+    int *guarded = new int(7);
+    HP guard(guarded);
+
+    // Retiring scans: everything but the guarded pointer is reclaimed right away
+    for (int i = 0; i < 100; ++i)
+    {
+        HP pointer(new int(i));
+        pointer.retire();
+    }
+    EXPECT_EQ(reclaimed, before + 100);
+
+    {
+        HP other(guarded);
+        other.retire();
+    }
+    EXPECT_EQ(reclaimed, before + 100);
+    EXPECT_EQ(*guarded, 7);
+
+    // Once released, the next scan reclaims it
+    guard.release();
+    HP last(new int(0));
+    last.retire();
+    EXPECT_EQ(reclaimed, before + 102);
+}
+
+TEST(HazardPointer, ExitedThreadsAreHelped)
+{
+    using HP = DNFC::HazardPointer<int, TestPolicy, CountingDeleter>;
+    int *guarded = new int(1);
+    HP guard(guarded);
+
+    // The retiring thread exits while the pointer is still guarded
+    std::thread retirer([guarded] {
+        HP pointer(guarded);
+        pointer.retire();
+    });
+    retirer.join();
+
+    int before = reclaimed;
+    guard.release();
+    HP pointer(new int(2));
+    pointer.retire();
+    EXPECT_EQ(reclaimed, before + 2);
+}
+
+TEST(HazardPointer, SharedDomain)
+{
+    struct Other
+    {
+        int value;
+    };
+    using IntHP = DNFC::HazardPointer<int, TestPolicy, CountingDeleter>;
+    using OtherHP = DNFC::HazardPointer<Other, TestPolicy>;
+
+    // Pointers of different types share the record and the scans of the thread
+    std::atomic<std::size_t> records(0);
+    std::atomic<bool> sameRecord(false);
+    std::thread worker([&] {
+        DNFC::HazardDomain<TestPolicy>::attach();
+        records = DNFC::HazardDomain<TestPolicy>::nbRecords();
+        auto *record = &DNFC::HazardDomain<TestPolicy>::myRecord();
+
+        IntHP one(new int(1));
+        OtherHP other(new Other{2});
+        sameRecord = record == &DNFC::HazardDomain<TestPolicy>::myRecord() &&
+                     DNFC::HazardDomain<TestPolicy>::nbRecords() == records;
+
+        int before = reclaimed;
+        other.retire();
+        one.retire();
+        EXPECT_EQ(reclaimed, before + 1);
+        EXPECT_TRUE(DNFC::HazardDomain<TestPolicy>::myRecord().retired.empty());
+        DNFC::HazardDomain<TestPolicy>::detach();
+    });
+    worker.join();
+    EXPECT_TRUE(sameRecord);
+
+    // The record given back is reused by the next thread
+    std::thread next([&] {
+        DNFC::HazardPointer<double, TestPolicy> hp(new double(3));
+        EXPECT_EQ(DNFC::HazardDomain<TestPolicy>::nbRecords(), records);
+        hp.retire();
+    });
+    next.join();
+}
+
+// Deleter clearing the value, so that a reader seeing a reclaimed pointer notices it
+struct PoisonDeleter
+{
+    void operator()(std::atomic<int> *p) const
+    {
+        p->store(0, std::memory_order_relaxed);
+        delete p;
+    }
+};
+
+TEST(HazardPointer, StressGuardRetire)
+{
+    // Readers guard and validate the published pointer while writers replace and retire it
+    using HP = DNFC::HazardPointer<std::atomic<int>, DNFC::DefaultHazardPointerPolicy, PoisonDeleter>;
+    std::atomic<std::atomic<int> *> shared(new std::atomic<int>(1));
+    std::atomic<bool> stop(false);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> readers;
+
+    for (int t = 0; t < 4; ++t)
+    {
+        readers.emplace_back([&] {
+            HP hp;
+            while (!stop)
+            {
+                std::atomic<int> *p = shared.load(std::memory_order_acquire);
+                hp = p;
+                if (shared.load(std::memory_order_acquire) != p)
+                    continue;
+                if (p->load(std::memory_order_relaxed) != 1)
+                    failed = true;
+            }
+        });
+    }
+
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 2; ++t)
+    {
+        writers.emplace_back([&] {
+            for (int i = 0; i < 20000; ++i)
+            {
+                HP old(shared.exchange(new std::atomic<int>(1), std::memory_order_acq_rel));
+                old.retire();
+            }
+        });
+    }
+    for (auto &writer : writers)
+        writer.join();
+    stop = true;
+    for (auto &reader : readers)
+        reader.join();
+
+    EXPECT_FALSE(failed);
+    delete shared.load();
+}
+
 int main(int argc, char **argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
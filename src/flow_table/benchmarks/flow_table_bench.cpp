@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <random>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "../flowtable.hpp"
+
+/**
+ * Flow churn benchmark
+ *
+ * Drive a FlowTable with a simulated clock: every 10 ms step opens the flows of the
+ * churn rate, looks up random active flows, ends the flows that reached their lifetime
+ * (half of them with a TCP FIN, the other half just go silent until the idle timeout)
+ * and runs the in-line expiry. Every 10 simulated seconds, print the number of flows in
+ * the table, the resident memory and the throughput of the lookups and insertions.
+ * Usage: flow_table_bench [flows per minute] [simulated seconds] [lookups per step]
+ *                         [flow lifetime in seconds]
+ */
+using namespace DNFC;
+
+const std::size_t HeaderLength = 54;
+const uint64_t StepLength = 10;
+
+void makePacket(uint8_t *pckt, uint64_t flow, uint8_t tcpFlags)
+{
+    memset(pckt, 0, HeaderLength);
+    pckt[12] = 0x08;
+    pckt[14] = 0x45;
+    pckt[23] = IPPROTO_TCP;
+    uint32_t src = 0x0a000000 | (flow >> 16);
+    uint16_t sport = 1024 + (flow & 0xffff) % 64000;
+    memcpy(&pckt[26], &src, 4);
+    pckt[30] = 192;
+    pckt[31] = 168;
+    pckt[32] = 1;
+    pckt[33] = 1 + (flow & 0xf);
+    memcpy(&pckt[34], &sport, 2);
+    pckt[37] = 80;
+    pckt[47] = tcpFlags;
+}
+
+double residentMB()
+{
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm)
+    {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(statm);
+    }
+    return resident * sysconf(_SC_PAGESIZE) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    using Clock = std::chrono::steady_clock;
+    uint64_t flowsPerMinute = argc > 1 ? atoll(argv[1]) : 10000000;
+    uint64_t seconds = argc > 2 ? atoll(argv[2]) : 180;
+    std::size_t lookupsPerStep = argc > 3 ? atol(argv[3]) : 2000;
+    uint64_t lifetime = (argc > 4 ? atoll(argv[4]) : 5) * 1000;
+
+    FlowTable<uint64_t> table;
+    std::minstd_rand rng(42);
+    uint8_t pckt[HeaderLength];
+    const uint64_t start = table.now();
+    uint64_t nextFlow = 0, endedFlows = 0, evicted = 0, lookups = 0, found = 0;
+    double lookupSeconds = 0, putSeconds = 0;
+
+    printf("# %llu flows per minute, flows live %llu s, idle timeout %llu s, closed timeout %llu s\n",
+           (unsigned long long)flowsPerMinute, (unsigned long long)lifetime / 1000,
+           (unsigned long long)DefaultFlowTablePolicy::IdleTimeout / 1000,
+           (unsigned long long)DefaultFlowTablePolicy::ClosedTimeout / 1000);
+    printf("%8s %12s %12s %10s %12s %12s %12s\n", "time (s)", "flows", "active", "RSS (MB)", "get Mops",
+           "put Mops", "evicted");
+
+    for (uint64_t elapsed = StepLength; elapsed <= seconds * 1000; elapsed += StepLength)
+    {
+        uint64_t now = start + elapsed;
+
+        // Open the flows of this step, flow 'f' starts at f * 60000 / flowsPerMinute
+        auto begin = Clock::now();
+        for (; nextFlow * 60000 / flowsPerMinute < elapsed; ++nextFlow)
+        {
+            makePacket(pckt, nextFlow, TH_SYN);
+            table.put(pckt, HeaderLength, nextFlow + 1);
+        }
+        putSeconds += std::chrono::duration<double>(Clock::now() - begin).count();
+
+        // End the flows which reached their lifetime
+        for (; endedFlows < nextFlow && endedFlows * 60000 / flowsPerMinute + lifetime < elapsed; ++endedFlows)
+        {
+            if (endedFlows & 1)
+            {
+                makePacket(pckt, endedFlows, TH_FIN | TH_ACK);
+                table.get(pckt, HeaderLength);
+            }
+        }
+
+        // Traffic on the active flows
+        uint64_t active = nextFlow - endedFlows;
+        begin = Clock::now();
+        for (std::size_t i = 0; active && i < lookupsPerStep; ++i)
+        {
+            makePacket(pckt, endedFlows + rng() % active, TH_ACK);
+            found += table.get(pckt, HeaderLength) != 0;
+        }
+        lookupSeconds += std::chrono::duration<double>(Clock::now() - begin).count();
+        lookups += active ? lookupsPerStep : 0;
+
+        evicted += table.expire(now);
+
+        if (elapsed % 10000 == 0)
+        {
+            printf("%8llu %12zu %12llu %10.1f %12.3f %12.3f %12llu\n", (unsigned long long)elapsed / 1000,
+                   table.size(), (unsigned long long)active, residentMB(), lookups / lookupSeconds / 1e6,
+                   nextFlow / putSeconds / 1e6, (unsigned long long)evicted);
+            fflush(stdout);
+        }
+    }
+
+    if (found != lookups)
+        printf("# %llu lookups of active flows missed\n", (unsigned long long)(lookups - found));
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include "flow_table.h"
+#include "flowtable.hpp"
+
+struct flow_table
+{
+   DNFC::FlowTable<void*> flows;
+};
+
+
+
+flow_table* new_flow_table(void)
+{
+   return new flow_table;
+}
+
+
+
+void* get_flow(flow_table* table,
+               u_char* pckt,
+               size_t pckt_len)
+{
+   return table->flows.get(pckt, pckt_len);
+}
+
+
+
+void get_flows(flow_table* table,
+               u_char** pckts,
+               const size_t* pckt_lens,
+               void** tags,
+               size_t n)
+{
+   table->flows.getBatch(pckts, pckt_lens, tags, n);
+}
+
+
+
+bool put_flow(flow_table* table,
+              u_char* pckt,
+              size_t pckt_len,
+              void* tag)
+{
+   return table->flows.put(pckt, pckt_len, tag);
+}
+
+
+
+bool remove_flow(flow_table* table,
+                 u_char* pckt,
+                 size_t pckt_len)
+{
+   return table->flows.remove(pckt, pckt_len);
+}
+
+
+
+void* get_flow_by_key(flow_table* table,
+                      const struct flow_key* key)
+{
+   return table->flows.get(*key);
+}
+
+
+
+void get_flows_by_key(flow_table* table,
+                      const struct flow_key* const* keys,
+                      void** tags,
+                      size_t n)
+{
+   table->flows.getBatch(keys, tags, n);
+}
+
+
+
+bool put_flow_by_key(flow_table* table,
+                     const struct flow_key* key,
+                     void* tag)
+{
+   return table->flows.put(*key, tag);
+}
+
+
+
+bool remove_flow_by_key(flow_table* table,
+                        const struct flow_key* key)
+{
+   return table->flows.remove(*key);
+}
+
+
+
+size_t expire_flows(flow_table* table,
+                    uint64_t now_ms,
+                    void (*evicted)(void* tag))
+{
+   return table->flows.expire(now_ms, [evicted](void* tag) {
+      if (evicted)
+         evicted(tag);
+   });
+}
+
+
+
+size_t clear_flows(flow_table* table,
+                   void (*evicted)(void* tag))
+{
+   return table->flows.clear([evicted](void* tag) {
+      if (evicted)
+         evicted(tag);
+   });
+}
+
+
+
+void start_flow_expiry(flow_table* table,
+                       unsigned int period_ms)
+{
+   table->flows.startExpiry(std::chrono::milliseconds(period_ms));
+}
+
+
+
+void free_flow_table(flow_table* table)
+{
+   delete table;
+}
@@ -5,24 +5,75 @@
  * FILENAME :        flow_table.h
  *
  * DESCRIPTION :
+ *        C interface of the flow table. Flows are identified by the 5-tuple,
+ *        tunnel ID and VLAN ID of TCP and UDP packets over IPv4 or IPv6 and
+ *        are stored in the lock-free DNFC::HashTable (see flowtable.hpp).
  *
  * PUBLIC STRUCTURE :
- *
+ *       flow_table
  *
  * AUTHOR :    Pieroux Alexandre
  *H*/
 
-#include "../classifier_rule/classifier_field.h"
-#include "../packet_parsing/packet_parsing.h"
-#include "../hash_table/hash_table.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../packet_parsing/flow_key.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef unsigned char u_char;
-typedef struct hash_table flow_table;
+typedef struct flow_table flow_table;
+
+flow_table* new_flow_table(void);
+
+void* get_flow(flow_table* table, u_char* pckt, size_t pckt_len);
+
+/* Write the tags of the flows of 'n' packets in 'tags' (NULL when not in the table), the
+ * lookups of the burst overlap. */
+void get_flows(flow_table* table,
+               u_char** pckts,
+               const size_t* pckt_lens,
+               void** tags,
+               size_t n);
+
+bool put_flow(flow_table* table, u_char* pckt, size_t pckt_len, void* tag);
 
-void* get_flow(flow_table* table, u_char* pckt);
+bool remove_flow(flow_table* table, u_char* pckt, size_t pckt_len);
 
-key_type put_flow(flow_table* table, u_char* pckt, void* tag);
+/* The same operations for a packet already parsed by parse_flow_key or parse_packet,
+ * without parsing it again. */
+void* get_flow_by_key(flow_table* table, const struct flow_key* key);
 
-bool remove_flow(flow_table* table, u_char* pckt);
+void get_flows_by_key(flow_table* table,
+                      const struct flow_key* const* keys,
+                      void** tags,
+                      size_t n);
+
+bool put_flow_by_key(flow_table* table, const struct flow_key* key, void* tag);
+
+bool remove_flow_by_key(flow_table* table, const struct flow_key* key);
+
+/* Evict the flows idle (or closed by TCP FIN/RST) for longer than their timeout at
+ * 'now_ms' (milliseconds of CLOCK_MONOTONIC), calling 'evicted' (if not NULL) with
+ * their tag. Return the number of flows evicted. Cheap to call for every packet:
+ * it only works when a tick of the expiry timing wheel elapsed. */
+size_t expire_flows(flow_table* table, uint64_t now_ms, void (*evicted)(void* tag));
+
+/* Evict all the flows, calling 'evicted' (if not NULL) with their tag. Return the
+ * number of flows evicted. */
+size_t clear_flows(flow_table* table, void (*evicted)(void* tag));
+
+/* Expire the flows from a background thread every 'period_ms' instead. */
+void start_flow_expiry(flow_table* table, unsigned int period_ms);
+
+void free_flow_table(flow_table* table);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
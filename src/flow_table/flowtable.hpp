@@ -0,0 +1,509 @@
+#ifndef _FLOWTABLEH_
+#define _FLOWTABLEH_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <netinet/tcp.h>
+
+#include "../hash_table/hashtable.hpp"
+#include "../hash_table/fixedkey.hpp"
+#include "../packet_parsing/burstparser.hpp"
+#include "timingwheel.hpp"
+
+namespace DNFC
+{
+
+/**
+ * Flow keys, stored inline in the HashTable nodes:
+ *   protocol (1 byte), source address, destination address, source port (2 bytes),
+ *   destination port (2 bytes), tunnel ID (4 bytes), VLAN ID (2 bytes). Addresses and
+ *   ports are kept in network byte order, the IDs in host byte order. The same
+ *   5-tuple in two VXLAN networks, GRE keys or VLANs is two flows.
+ */
+using IPv4FlowKey = FixedKey<19>;
+using IPv6FlowKey = FixedKey<43>;
+
+/**
+ * DefaultFlowTablePolicy
+ *
+ * Timeouts of the flows, in milliseconds: a flow is evicted once it has not been seen
+ * for IdleTimeout, or for ClosedTimeout after a TCP FIN or RST. TickLength is the
+ * resolution of the expiry timing wheel. The HashTables are compacted at most every
+ * CompactInterval, when flows were evicted meanwhile. Flows are set up at line rate,
+ * so the nodes and the cache-line aligned ArrayNodes come from memory pools.
+ */
+class DefaultFlowTablePolicy : public DefaultHashTablePolicy
+{
+  public:
+    const static uint64_t IdleTimeout = 60000;
+    const static uint64_t ClosedTimeout = 2000;
+    const static uint64_t TickLength = 10;
+    const static uint64_t CompactInterval = 10000;
+
+    template <typename T>
+    using NodeAllocator = DNFC::PoolAllocator<T>;
+    template <typename T>
+    using ArrayAllocator = DNFC::PoolAllocator<T, DNFC::DefaultPoolPolicy, 64>;
+};
+
+/**
+ * FlowEntry
+ *
+ * Value stored in the HashTable for each flow. The timestamp and the closed flag are
+ * updated in place by the lookups, 'id' tells the timer of the flow apart from the
+ * timers of older flows with the same key.
+ */
+template <typename Data>
+struct FlowEntry
+{
+    Data tag;
+    uint64_t id;
+    std::atomic<uint64_t> lastSeen;
+    std::atomic<bool> closed;
+
+    FlowEntry() : tag(), id(0), lastSeen(0), closed(false) {}
+
+    FlowEntry(const Data &tag, uint64_t id, uint64_t now, bool closed)
+        : tag(tag), id(id), lastSeen(now), closed(closed) {}
+
+    FlowEntry(const FlowEntry &other)
+        : tag(other.tag), id(other.id), lastSeen(other.lastSeen.load(std::memory_order_relaxed)),
+          closed(other.closed.load(std::memory_order_relaxed)) {}
+};
+
+/**
+ * FlowTable
+ *
+ * Associate a tag to the TCP and UDP flows of Ethernet frames. The 5-tuple, tunnel
+ * ID and VLAN ID are taken from the flow_key of the packet, given by callers that already parsed it or parsed
+ * here with FlowParser, and looked up in the lock-free HashTable matching its IP
+ * version, so no operation allocates besides the inserted node and the expiry timer
+ * of a new flow.
+ *
+ * Flows age out: every lookup stamps the flow with the table clock, and a timer per
+ * flow in a TimingWheel checks it once its timeout may have elapsed. A timer finding
+ * its flow seen in the meantime is scheduled again at the new deadline, so a lookup
+ * only touches the wheel when it closes a flow. Expired flows are removed from the
+ * HashTable, which retires their node through its HazardPointers, and the ArrayNodes
+ * they leave empty are folded back periodically. The expiry runs either in-line,
+ * with a thread calling 'expire' regularly (cheap when no tick elapsed), or in a
+ * background thread started by 'startExpiry'.
+ */
+template <typename Data, typename Policy = DefaultFlowTablePolicy>
+class FlowTable
+{
+  public:
+    FlowTable() : clock(steadyNow()), nextId(1), expiredTick(clock.load() / Policy::TickLength),
+                  expiryRunning(false), evictedSinceCompaction(0), nextCompaction(0), wheel(expiredTick.load())
+    {
+        expiring.clear();
+    }
+
+    ~FlowTable()
+    {
+        stopExpiry();
+    }
+
+    /**
+     * get
+     *
+     * Return the tag of the flow of 'key' (see FlowParser), or Data{} when it is not in
+     * the table. The flow is marked as seen at the table clock, and as closed if the
+     * packet is a TCP FIN or RST: its idle timer is then too late, so a second timer is
+     * scheduled at the closed timeout.
+     */
+    Data get(const flow_key &key)
+    {
+        FlowRef ref;
+        Data tag{};
+        bool closing = false;
+        auto touch = [&](FlowEntry<Data> &entry) {
+            tag = entry.tag;
+            ref.id = entry.id;
+            uint64_t now = clock.load(std::memory_order_relaxed);
+            if (entry.lastSeen.load(std::memory_order_relaxed) < now)
+                entry.lastSeen.store(now, std::memory_order_relaxed);
+            if (isClosing(key.tcp_flags) && !entry.closed.load(std::memory_order_relaxed))
+                closing = !entry.closed.exchange(true, std::memory_order_relaxed);
+        };
+
+        ref.version = getKey(key, ref.ipv4(), ref.key);
+        if (ref.version == 4)
+            ipv4Flows.visit(ref.ipv4(), touch);
+        else if (ref.version == 6)
+            ipv6Flows.visit(ref.key, touch);
+
+        if (closing)
+            wheel.schedule(ref, toTick(clock.load(std::memory_order_relaxed) + timeout(true)));
+        return tag;
+    }
+
+    Data get(const uint8_t *pckt, std::size_t pcktLength)
+    {
+        flow_key key;
+        FlowParser<>::parse(pckt, pcktLength, key);
+        return get(key);
+    }
+
+    /**
+     * getBatch
+     *
+     * 'get' for a burst of 'n' keys, writing the tags in 'out': the IPv4 and the IPv6
+     * keys of a chunk of the burst are each looked up with a single
+     * HashTable::visitBatch so that their cache misses overlap.
+     */
+    void getBatch(const flow_key *const *keys, Data *out, std::size_t n)
+    {
+        const std::size_t Chunk = Policy::BatchSize;
+        IPv4FlowKey ipv4[Chunk];
+        IPv6FlowKey ipv6[Chunk];
+        std::size_t ipv4Index[Chunk], ipv6Index[Chunk];
+        FlowRef closing[Chunk];
+
+        for (std::size_t base = 0; base < n; base += Chunk)
+        {
+            std::size_t count = std::min(n - base, Chunk);
+            std::size_t nbIpv4 = 0, nbIpv6 = 0, nbClosing = 0;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                out[base + i] = Data{};
+                int version = getKey(*keys[base + i], ipv4[nbIpv4], ipv6[nbIpv6]);
+                if (version == 4)
+                    ipv4Index[nbIpv4++] = i;
+                else if (version == 6)
+                    ipv6Index[nbIpv6++] = i;
+            }
+
+            uint64_t now = clock.load(std::memory_order_relaxed);
+            auto touch = [&](const std::size_t *index, std::size_t k, FlowEntry<Data> *entry, int version) {
+                if (!entry)
+                    return;
+                std::size_t i = index[k];
+                out[base + i] = entry->tag;
+                if (entry->lastSeen.load(std::memory_order_relaxed) < now)
+                    entry->lastSeen.store(now, std::memory_order_relaxed);
+                if (isClosing(keys[base + i]->tcp_flags) && !entry->closed.load(std::memory_order_relaxed) &&
+                    !entry->closed.exchange(true, std::memory_order_relaxed))
+                {
+                    FlowRef &ref = closing[nbClosing++];
+                    ref.id = entry->id;
+                    ref.version = version;
+                    if (version == 4)
+                        ref.ipv4() = ipv4[k];
+                    else
+                        ref.key = ipv6[k];
+                }
+            };
+            ipv4Flows.visitBatch(ipv4, nbIpv4, [&](std::size_t k, FlowEntry<Data> *entry) { touch(ipv4Index, k, entry, 4); });
+            ipv6Flows.visitBatch(ipv6, nbIpv6, [&](std::size_t k, FlowEntry<Data> *entry) { touch(ipv6Index, k, entry, 6); });
+
+            for (std::size_t c = 0; c < nbClosing; ++c)
+                wheel.schedule(closing[c], toTick(now + timeout(true)));
+        }
+    }
+
+    // 'getBatch' for a burst of packets, the keys of a chunk are parsed first with a BurstParser
+    void getBatch(const uint8_t *const *pckts, const std::size_t *lengths, Data *out, std::size_t n)
+    {
+        const std::size_t Chunk = Policy::BatchSize;
+        flow_key keys[Chunk];
+        const flow_key *refs[Chunk];
+        for (std::size_t base = 0; base < n; base += Chunk)
+        {
+            std::size_t count = std::min(n - base, Chunk);
+            BurstParser<>::parse(pckts + base, lengths + base, keys, count);
+            for (std::size_t i = 0; i < count; ++i)
+                refs[i] = &keys[i];
+            getBatch(refs, out + base, count);
+        }
+    }
+
+    /**
+     * put
+     *
+     * Insert the flow of 'key' with 'tag' and schedule its expiry. Return false if the
+     * flow is already in the table or 'key' is not a flow.
+     */
+    bool put(const flow_key &key, const Data &tag)
+    {
+        FlowRef ref;
+        ref.version = getKey(key, ref.ipv4(), ref.key);
+        if (!ref.version)
+            return false;
+
+        ref.id = nextId.fetch_add(1, std::memory_order_relaxed);
+        uint64_t now = clock.load(std::memory_order_relaxed);
+        FlowEntry<Data> entry(tag, ref.id, now, isClosing(key.tcp_flags));
+        bool inserted = ref.version == 4 ? ipv4Flows.insert(ref.ipv4(), entry) : ipv6Flows.insert(ref.key, entry);
+        if (inserted)
+            wheel.schedule(ref, toTick(now + timeout(entry.closed)));
+        return inserted;
+    }
+
+    bool put(const uint8_t *pckt, std::size_t pcktLength, const Data &tag)
+    {
+        flow_key key;
+        FlowParser<>::parse(pckt, pcktLength, key);
+        return put(key, tag);
+    }
+
+    bool remove(const flow_key &key)
+    {
+        IPv4FlowKey ipv4;
+        IPv6FlowKey ipv6;
+        switch (getKey(key, ipv4, ipv6))
+        {
+        case 4:
+            return ipv4Flows.remove(ipv4);
+        case 6:
+            return ipv6Flows.remove(ipv6);
+        default:
+            return false;
+        }
+    }
+
+    bool remove(const uint8_t *pckt, std::size_t pcktLength)
+    {
+        flow_key key;
+        FlowParser<>::parse(pckt, pcktLength, key);
+        return remove(key);
+    }
+
+    /**
+     * expire
+     *
+     * Set the table clock to 'now' (in milliseconds, on the clock of 'steadyNow' unless
+     * the table is only driven by this function) and evict the flows whose timeout
+     * elapsed, calling 'evicted(tag)' for each of them. Readers may still hold the tag
+     * of an evicted flow: 'evicted' must not destroy what they could use. When no tick
+     * of the wheel elapsed since the last call, or another thread is already expiring
+     * the table, return 0 right away. Return the number of flows evicted.
+     */
+    template <typename F>
+    std::size_t expire(uint64_t now, F evicted)
+    {
+        if (now > clock.load(std::memory_order_relaxed))
+            clock.store(now, std::memory_order_relaxed);
+        if (now / Policy::TickLength <= expiredTick.load(std::memory_order_relaxed) || expiring.test_and_set(std::memory_order_acquire))
+            return 0;
+
+        std::size_t count = 0;
+        wheel.advance(now / Policy::TickLength, [&](typename Wheel::Timer *timer) {
+            const FlowRef &ref = timer->value;
+            uint64_t deadline = 0;
+            auto check = [&](const FlowEntry<Data> &entry) {
+                if (entry.id != ref.id)
+                    return false;
+                deadline = entry.lastSeen.load(std::memory_order_relaxed) + timeout(entry.closed.load(std::memory_order_relaxed));
+                return deadline <= now;
+            };
+
+            Data tag{};
+            auto take = [&](const FlowEntry<Data> &entry) {
+                if (!check(entry))
+                    return false;
+                tag = entry.tag;
+                return true;
+            };
+
+            bool removed = ref.version == 4 ? ipv4Flows.removeIf(ref.ipv4(), take) : ipv6Flows.removeIf(ref.key, take);
+            if (removed)
+            {
+                ++count;
+                evicted(tag);
+            }
+            else if (deadline > now)
+            {
+                // Seen since the timer was set: wait for the new deadline
+                timer->deadline = toTick(deadline);
+                wheel.schedule(timer);
+                return true;
+            }
+            return false;
+        });
+
+        // Give back the ArrayNodes emptied by the evictions
+        evictedSinceCompaction += count;
+        if (evictedSinceCompaction && now >= nextCompaction)
+        {
+            ipv4Flows.compact();
+            ipv6Flows.compact();
+            evictedSinceCompaction = 0;
+            nextCompaction = now + Policy::CompactInterval;
+        }
+
+        expiredTick.store(wheel.now(), std::memory_order_relaxed);
+        expiring.clear(std::memory_order_release);
+        return count;
+    }
+
+    std::size_t expire(uint64_t now)
+    {
+        return expire(now, [](const Data &) {});
+    }
+
+    /**
+     * clear
+     *
+     * Evict all the flows, calling 'evicted(tag)' for each of them as 'expire' does.
+     * Flows inserted meanwhile may stay. Return the number of flows evicted.
+     */
+    template <typename F>
+    std::size_t clear(F evicted)
+    {
+        return clearTable(ipv4Flows, evicted) + clearTable(ipv6Flows, evicted);
+    }
+
+    /**
+     * startExpiry
+     *
+     * Run 'expire' with the steady clock every 'period' in a background thread, until
+     * 'stopExpiry' or the destruction of the table.
+     */
+    void startExpiry(std::chrono::milliseconds period = std::chrono::milliseconds(Policy::TickLength))
+    {
+        if (expiryRunning.exchange(true))
+            return;
+        expiryThread = std::thread([this, period] {
+            HazardDomain<>::attach();
+            while (expiryRunning.load(std::memory_order_relaxed))
+            {
+                expire(steadyNow());
+                std::this_thread::sleep_for(period);
+            }
+        });
+    }
+
+    void stopExpiry()
+    {
+        if (expiryRunning.exchange(false))
+            expiryThread.join();
+    }
+
+    // Number of flows in the table
+    std::size_t size() const
+    {
+        return ipv4Flows.size() + ipv6Flows.size();
+    }
+
+    // Current time of the table clock, in milliseconds
+    uint64_t now() const
+    {
+        return clock.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t steadyNow()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * getKey
+     *
+     * Fill the HashTable key of the flow of 'key'. Return the IP version of the key
+     * that was filled (4 or 6), or 0 when 'key' is not a TCP or UDP flow.
+     */
+    static int getKey(const flow_key &key, IPv4FlowKey &ipv4, IPv6FlowKey &ipv6)
+    {
+        // The destination port follows the source port in both, the VLAN ID the tunnel ID
+        if (key.version == 4)
+        {
+            ipv4.bytes[0] = key.proto;
+            std::memcpy(ipv4.bytes + 1, key.src, 4);
+            std::memcpy(ipv4.bytes + 5, key.dst, 4);
+            std::memcpy(ipv4.bytes + 9, &key.src_port, 4);
+            std::memcpy(ipv4.bytes + 13, &key.tunnel_id, 6);
+        }
+        else if (key.version == 6)
+        {
+            ipv6.bytes[0] = key.proto;
+            std::memcpy(ipv6.bytes + 1, key.src, 16);
+            std::memcpy(ipv6.bytes + 17, key.dst, 16);
+            std::memcpy(ipv6.bytes + 33, &key.src_port, 4);
+            std::memcpy(ipv6.bytes + 37, &key.tunnel_id, 6);
+        }
+        return key.version;
+    }
+
+  private:
+    // Identify the flow of a timer: IPv4 keys are stored in the first bytes of 'key'
+    struct FlowRef
+    {
+        uint64_t id;
+        int version;
+        IPv6FlowKey key;
+
+        IPv4FlowKey &ipv4()
+        {
+            return *reinterpret_cast<IPv4FlowKey *>(key.bytes);
+        }
+
+        const IPv4FlowKey &ipv4() const
+        {
+            return *reinterpret_cast<const IPv4FlowKey *>(key.bytes);
+        }
+    };
+
+    // Timers taken from the allocator of the HashTable nodes, a pool by default
+    class WheelPolicy : public DefaultTimingWheelPolicy
+    {
+      public:
+        template <typename T>
+        using TimerAllocator = typename Policy::template NodeAllocator<T>;
+    };
+
+    using Wheel = TimingWheel<FlowRef, WheelPolicy>;
+
+    static bool isClosing(uint8_t tcpFlags)
+    {
+        return tcpFlags & (TH_FIN | TH_RST);
+    }
+
+    // Their timers find them gone when they fire
+    template <typename Table, typename F>
+    static std::size_t clearTable(Table &flows, F &evicted)
+    {
+        std::size_t count = 0;
+        for (const auto &flow : flows.snapshot())
+        {
+            uint64_t id = flow.second.id;
+            if (flows.removeIf(flow.first, [id](const FlowEntry<Data> &entry) { return entry.id == id; }))
+            {
+                ++count;
+                evicted(flow.second.tag);
+            }
+        }
+        return count;
+    }
+
+    static uint64_t timeout(bool closed)
+    {
+        return closed ? uint64_t(Policy::ClosedTimeout) : uint64_t(Policy::IdleTimeout);
+    }
+
+    // First tick at or after 'time': the wheel is at tick t once the clock reached t * TickLength
+    static uint64_t toTick(uint64_t time)
+    {
+        return (time + Policy::TickLength - 1) / Policy::TickLength;
+    }
+
+    HashTable<IPv4FlowKey, FlowEntry<Data>, Policy> ipv4Flows;
+    HashTable<IPv6FlowKey, FlowEntry<Data>, Policy> ipv6Flows;
+    std::atomic<uint64_t> clock;
+    std::atomic<uint64_t> nextId;
+    std::atomic<uint64_t> expiredTick;
+    std::atomic_flag expiring;
+    std::atomic<bool> expiryRunning;
+    std::thread expiryThread;
+    std::size_t evictedSinceCompaction; // Only used by the thread expiring the table
+    uint64_t nextCompaction;
+    Wheel wheel;
+};
+} // namespace DNFC
+
+#endif
@@ -1,28 +1,28 @@
 #define _BSD_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <netinet/in.h>
 
-extern "C"
-{
 #include "../flow_table.h"
-#include "../../memory_management/memory_management.h"
-}
+#include "../flowtable.hpp"
+#include "../timingwheel.hpp"
 
 #include <gtest/gtest.h>
-#include <boost/bind.hpp>
-#include <boost/asio.hpp>
 
 #define NB_NUMBERS      1000000
 #define NB_THREADS      64
-#define HEADER_LENGTH   16
-#define HEADER_BIT_L    320
+#define HEADER_LENGTH   54
 
 struct arguments_t
 {
    u_char** numbers;
    uint32_t* index;
    uint32_t size;
-   hash_table** table;
+   flow_table** table;
 };
 
 
@@ -32,55 +32,302 @@ void* job_insert(void* args);
 void* job_get(void* args);
 void* job_remove(void* args);
 void init(arguments_t*** args);
+void run_jobs(void* (*job)(void*), arguments_t** args);
+void make_packet(u_char* pckt, uint32_t flow, uint8_t tcp_flags);
 
 
 
 TEST (FlowTable, Insert)
 {
    arguments_t** args;
-   threadpool_t* pool = new_threadpool(NB_THREADS);
    init(&args);
    
-   for (uint32_t i = 0; i < NB_THREADS; ++i)
-      threadpool_add_work(pool, job_insert, args[i]);
-   threadpool_wait(pool);
-   free_threadpool(pool);
+   run_jobs(job_insert, args);
    
-   hash_table_free(args[0]->table);
+   free_flow_table(*args[0]->table);
 }
 
 TEST (FlowTable, Get)
 {
    arguments_t** args;
-   threadpool_t* pool = new_threadpool(NB_THREADS);
    init(&args);
    
    for (uint32_t i = 0; i < NB_NUMBERS; ++i)
-      put_flow(*(*args)->table, (*args)->numbers[i], &(*args)->numbers[i]);
+      put_flow(*(*args)->table, (*args)->numbers[i], HEADER_LENGTH, &(*args)->numbers[i]);
    
-   for (uint32_t i = 0; i < NB_THREADS; ++i)
-      threadpool_add_work(pool, job_get, args[i]);
-   threadpool_wait(pool);
-   free_threadpool(pool);
+   run_jobs(job_get, args);
    
-   hash_table_free(args[0]->table);
+   free_flow_table(*args[0]->table);
 }
 
 TEST (FlowTable, Remove)
 {
    arguments_t** args;
-   threadpool_t* pool = new_threadpool(NB_THREADS);
    init(&args);
    
    for (uint32_t i = 0; i < NB_NUMBERS; ++i)
-      put_flow(*(*args)->table, (*args)->numbers[i], &(*args)->numbers[i]);
+      put_flow(*(*args)->table, (*args)->numbers[i], HEADER_LENGTH, &(*args)->numbers[i]);
    
-   for (uint32_t i = 0; i < NB_THREADS; ++i)
-      threadpool_add_work(pool, job_remove, args[i]);
-   threadpool_wait(pool);
-   free_threadpool(pool);
+   run_jobs(job_remove, args);
+   
+   free_flow_table(*args[0]->table);
+}
+
+
+
+TEST (FlowTable, TimingWheel)
+{
+   DNFC::TimingWheel<uint64_t> wheel(1000);
+   uint64_t deadlines[] = {1001, 1063, 1064, 1065, 5095, 5096, 300000, 17000000};
+   for (uint64_t deadline : deadlines)
+      wheel.schedule(deadline, deadline);
+   wheel.schedule(0, 500); // In the past: fires at the next tick
+   
+   std::vector<uint64_t> fired;
+   auto record = [&](DNFC::TimingWheel<uint64_t>::Timer* timer) {
+      EXPECT_EQ(timer->deadline == 500 ? 1001 : timer->deadline, wheel.now());
+      fired.push_back(timer->value);
+      return false;
+   };
+   EXPECT_EQ(wheel.advance(1001, record), 2);
+   EXPECT_EQ(wheel.advance(5095, record), 4);
+   EXPECT_EQ(wheel.advance(17000000, record), 3);
+   EXPECT_EQ(wheel.size(), 0);
+   EXPECT_EQ(fired.size(), 9);
+}
+
+class PooledWheelPolicy : public DNFC::DefaultTimingWheelPolicy
+{
+public:
+   template <typename T>
+   using TimerAllocator = DNFC::PoolAllocator<T>;
+};
+
+TEST (FlowTable, PooledTimers)
+{
+   typedef DNFC::TimingWheel<uint64_t, PooledWheelPolicy> Wheel;
+   Wheel wheel(0);
+   DNFC::pool<Wheel::Timer>& timers = Wheel::TimerAllocator::objects();
+   for (uint64_t i = 0; i < 1000; ++i)
+      wheel.schedule(i, i % 100 + 1);
+   EXPECT_EQ(timers.stats().allocated, 1000u);
+   
+   // Timers taken back are reused, the others go back to the pool
+   size_t fired = 0;
+   EXPECT_EQ(wheel.advance(50, [](Wheel::Timer*) { return false; }), 500u);
+   EXPECT_EQ(timers.stats().allocated, 500u);
+   EXPECT_EQ(wheel.advance(100, [&](Wheel::Timer* timer) {
+      if (fired++ % 2)
+         return false;
+      timer->deadline = 200;
+      wheel.schedule(timer);
+      return true;
+   }), 500u);
+   EXPECT_EQ(timers.stats().allocated, 250u);
+   EXPECT_EQ(wheel.advance(200, [](Wheel::Timer*) { return false; }), 250u);
+   EXPECT_EQ(timers.stats().allocated, 0u);
+}
+
+TEST (FlowTable, IdleExpiry)
+{
+   typedef DNFC::DefaultFlowTablePolicy Policy;
+   DNFC::FlowTable<int> table;
+   u_char pckt[HEADER_LENGTH];
+   uint64_t start = table.now();
    
-   hash_table_free(args[0]->table);
+   for (uint32_t i = 0; i < 100; ++i)
+   {
+      make_packet(pckt, i, 0);
+      EXPECT_TRUE(table.put(pckt, HEADER_LENGTH, i + 1));
+   }
+   
+   // Half of the flows are seen again before their timeout. Expiry has the resolution of a tick.
+   EXPECT_EQ(table.expire(start + Policy::IdleTimeout / 2), 0);
+   for (uint32_t i = 0; i < 50; ++i)
+   {
+      make_packet(pckt, i, 0);
+      EXPECT_EQ(table.get(pckt, HEADER_LENGTH), (int)i + 1);
+   }
+   
+   std::vector<int> evicted;
+   EXPECT_EQ(table.expire(start + Policy::IdleTimeout + Policy::TickLength, [&evicted](int tag) { evicted.push_back(tag); }), 50);
+   std::sort(evicted.begin(), evicted.end());
+   for (int i = 0; i < 50; ++i)
+      EXPECT_EQ(evicted[i], i + 51);
+   EXPECT_EQ(table.size(), 50);
+   
+   make_packet(pckt, 99, 0);
+   EXPECT_EQ(table.get(pckt, HEADER_LENGTH), 0);
+   EXPECT_EQ(table.expire(start + Policy::IdleTimeout * 3 / 2 + Policy::TickLength), 50);
+   EXPECT_EQ(table.size(), 0);
+}
+
+TEST (FlowTable, ClosedExpiry)
+{
+   flow_table* table = new_flow_table();
+   u_char pckt[HEADER_LENGTH];
+   uint64_t start = DNFC::FlowTable<void*>::steadyNow();
+   int tags[2];
+   
+   make_packet(pckt, 1, 0);
+   EXPECT_TRUE(put_flow(table, pckt, HEADER_LENGTH, &tags[0]));
+   make_packet(pckt, 2, 0);
+   EXPECT_TRUE(put_flow(table, pckt, HEADER_LENGTH, &tags[1]));
+   
+   // A FIN closes the first flow, it expires after the closed timeout only
+   make_packet(pckt, 1, TH_FIN | TH_ACK);
+   EXPECT_EQ(get_flow(table, pckt, HEADER_LENGTH), &tags[0]);
+   
+   static std::vector<void*> evicted;
+   size_t nb_evicted = expire_flows(table, start + DNFC::DefaultFlowTablePolicy::ClosedTimeout + 1000,
+                                    [](void* tag) { evicted.push_back(tag); });
+   EXPECT_EQ(nb_evicted, 1);
+   ASSERT_EQ(evicted.size(), 1);
+   EXPECT_EQ(evicted[0], &tags[0]);
+   
+   make_packet(pckt, 1, 0);
+   EXPECT_EQ(get_flow(table, pckt, HEADER_LENGTH), nullptr);
+   make_packet(pckt, 2, 0);
+   EXPECT_EQ(get_flow(table, pckt, HEADER_LENGTH), &tags[1]);
+   
+   // The flow can be inserted again once expired, and is removed explicitly before its timer fires
+   make_packet(pckt, 1, 0);
+   EXPECT_TRUE(put_flow(table, pckt, HEADER_LENGTH, &tags[1]));
+   EXPECT_TRUE(remove_flow(table, pckt, HEADER_LENGTH));
+   EXPECT_EQ(expire_flows(table, start + DNFC::DefaultFlowTablePolicy::IdleTimeout * 2, NULL), 1);
+   free_flow_table(table);
+}
+
+TEST (FlowTable, GetBatch)
+{
+   flow_table* table = new_flow_table();
+   uint64_t start = DNFC::FlowTable<void*>::steadyNow();
+   const size_t nb_pckts = 70;
+   u_char pckts[nb_pckts][HEADER_LENGTH + 20];
+   u_char* burst[nb_pckts];
+   size_t lens[nb_pckts];
+   void* tags[nb_pckts];
+   int values[nb_pckts];
+
+   // Every third packet is an IPv6 flow of the table, the others are IPv4 flows of the
+   // table when even, unknown flows when odd, and not IP at all on multiples of 7
+   for (size_t i = 0; i < nb_pckts; ++i)
+   {
+      burst[i] = pckts[i];
+      lens[i] = HEADER_LENGTH;
+      make_packet(pckts[i], i, 0);
+      if (i % 3 == 0)
+      {
+         memset(pckts[i], 0, sizeof(pckts[i]));
+         pckts[i][12] = 0x86;
+         pckts[i][13] = 0xdd;
+         pckts[i][14] = 0x60;
+         pckts[i][20] = IPPROTO_UDP;
+         memcpy(&pckts[i][22], &i, sizeof(i));
+         lens[i] = HEADER_LENGTH + 20;
+      }
+      else if (i % 7 == 0)
+         pckts[i][12] = 0x42;
+      if (i % 2 == 0 || i % 3 == 0)
+         put_flow(table, pckts[i], lens[i], &values[i]);
+   }
+
+   // A FIN in the batch closes its flow
+   make_packet(pckts[4], 4, TH_FIN);
+   get_flows(table, burst, lens, tags, nb_pckts);
+   for (size_t i = 0; i < nb_pckts; ++i)
+   {
+      bool known = i % 3 == 0 || (i % 7 != 0 && i % 2 == 0);
+      EXPECT_EQ(tags[i], known ? &values[i] : nullptr) << i;
+   }
+
+   EXPECT_EQ(expire_flows(table, start + DNFC::DefaultFlowTablePolicy::ClosedTimeout + 1000, NULL), 1);
+   make_packet(pckts[4], 4, 0);
+   EXPECT_EQ(get_flow(table, pckts[4], HEADER_LENGTH), nullptr);
+   free_flow_table(table);
+}
+
+TEST (FlowTable, ByKey)
+{
+   flow_table* table = new_flow_table();
+   u_char pckts[3][HEADER_LENGTH];
+   struct flow_key keys[3];
+   const struct flow_key* refs[3];
+   void* tags[3];
+   int values[3];
+
+   // A key parsed once is the same flow as its packet
+   for (uint32_t i = 0; i < 3; ++i)
+   {
+      make_packet(pckts[i], i, 0);
+      refs[i] = &keys[i];
+   }
+   pckts[2][23] = IPPROTO_ICMP;
+   for (uint32_t i = 0; i < 3; ++i)
+      EXPECT_EQ(parse_flow_key(pckts[i], HEADER_LENGTH, FLOW_KEY_INNER, &keys[i]), i != 2);
+
+   EXPECT_TRUE(put_flow_by_key(table, &keys[0], &values[0]));
+   EXPECT_FALSE(put_flow(table, pckts[0], HEADER_LENGTH, &values[1]));
+   EXPECT_TRUE(put_flow(table, pckts[1], HEADER_LENGTH, &values[1]));
+   EXPECT_FALSE(put_flow_by_key(table, &keys[2], &values[2]));
+   EXPECT_EQ(get_flow(table, pckts[0], HEADER_LENGTH), &values[0]);
+   EXPECT_EQ(get_flow_by_key(table, &keys[1]), &values[1]);
+
+   get_flows_by_key(table, refs, tags, 3);
+   EXPECT_EQ(tags[0], &values[0]);
+   EXPECT_EQ(tags[1], &values[1]);
+   EXPECT_EQ(tags[2], nullptr);
+
+   EXPECT_TRUE(remove_flow_by_key(table, &keys[0]));
+   EXPECT_EQ(get_flow(table, pckts[0], HEADER_LENGTH), nullptr);
+   free_flow_table(table);
+}
+
+TEST (FlowTable, Tenants)
+{
+   flow_table* table = new_flow_table();
+   const size_t vxlan_length = 14 + 20 + 8 + 8 + HEADER_LENGTH;
+   u_char tunneled[2][vxlan_length];
+   u_char tagged[2][HEADER_LENGTH + 4];
+   int values[4];
+
+   // The same inner 5-tuple in VXLAN networks 1 and 2, then in VLANs 1 and 2
+   for (int i = 0; i < 2; ++i)
+   {
+      memset(tunneled[i], 0, vxlan_length);
+      tunneled[i][12] = 0x08;
+      tunneled[i][14] = 0x45;
+      tunneled[i][23] = IPPROTO_UDP;
+      tunneled[i][36] = 4789 >> 8;
+      tunneled[i][37] = 4789 & 0xff;
+      tunneled[i][42] = 0x08;
+      tunneled[i][48] = i + 1;
+      make_packet(tunneled[i] + 50, 7, 0);
+
+      make_packet(tagged[i] + 4, 7, 0);
+      memset(tagged[i], 0, 4);
+      tagged[i][12] = 0x81;
+      tagged[i][13] = 0x00;
+      tagged[i][14] = 0;
+      tagged[i][15] = i + 1;
+   }
+
+   for (int i = 0; i < 2; ++i)
+   {
+      EXPECT_TRUE(put_flow(table, tunneled[i], vxlan_length, &values[i]));
+      EXPECT_TRUE(put_flow(table, tagged[i], HEADER_LENGTH + 4, &values[2 + i]));
+   }
+   for (int i = 0; i < 2; ++i)
+   {
+      EXPECT_EQ(get_flow(table, tunneled[i], vxlan_length), &values[i]);
+      EXPECT_EQ(get_flow(table, tagged[i], HEADER_LENGTH + 4), &values[2 + i]);
+   }
+
+   struct flow_key keys[2];
+   for (int i = 0; i < 2; ++i)
+      EXPECT_TRUE(parse_flow_key(tunneled[i], vxlan_length, FLOW_KEY_INNER, &keys[i]));
+   EXPECT_NE(keys[0].hash, keys[1].hash);
+   free_flow_table(table);
 }
 
 
@@ -127,66 +374,33 @@ void init(arguments_t*** args)
    uint32_t* destination_port = get_random_numbers(0, 65535);
    
    u_char** keys = new u_char*[NB_NUMBERS];
-   uint32_t j = 0;
-   uint32_t* nb = new uint32_t;
-   uint8_t zero = 0;
-   uint8_t ihl = 5;
-   uint8_t version = 4;
-   uint8_t TCP_p = 6;
-   u_short eth_type = 2048;
    for(uint32_t i = 0; i < NB_NUMBERS; i++){
-      key_type tmp = new_byte_stream();
-      
-      // Ethernet type
-      for(uint32_t j = 0; j < 12; j++)
-         append_bytes(tmp, &zero, 1);
-      append_bytes(tmp, &eth_type, 2);
-      
-      // IHL IPv4 field
-      append_bytes(tmp, &ihl, 1);
+      u_char* tmp = new u_char[HEADER_LENGTH]();
       
-      // Version IPv4 field
-      append_bytes(tmp, &version, 1);
+      // Ethernet type (IPv4)
+      tmp[12] = 0x08;
       
-      // Put the offset of port (9 bytes)
-      for(uint32_t j = 0; j < 7; j++)
-         append_bytes(tmp, &zero, 1);
+      // Version and IHL IPv4 fields
+      tmp[14] = 0x45;
       
       // Put the TCP protocol number 
-      append_bytes(tmp, &TCP_p, 1);
+      tmp[23] = IPPROTO_TCP;
       
-      // Put the offset of the addresses (2 bytes)
-      for(uint32_t j = 0; j < 2; j++)
-         append_bytes(tmp, &zero, 1);
+      // Put the source and destination addresses
+      memcpy(&tmp[26], &source_address[i], 4);
+      memcpy(&tmp[30], &destination_address[i], 4);
       
-      // Put the source address
-      *nb = source_address[i];
-      append_bytes(tmp, nb, 4);
+      // Put the source and destination ports
+      memcpy(&tmp[34], &source_port[(i % 65535)], 2);
+      memcpy(&tmp[36], &destination_port[(i % 65535)], 2);
       
-      // Put the destination address
-      *nb = destination_address[i];
-      append_bytes(tmp, nb, 4);
-      
-      // Put the offset of the source ports (16 bytes)
-      for(uint32_t j = 0; j < 16; j++)
-         append_bytes(tmp, &zero, 1);
-      
-      // Put the source port
-      *nb = source_port[(i % 65536)];
-      append_bytes(tmp, nb, 2);
-      
-      // Put the destination port
-      *nb = destination_port[(i % 65536)];
-      append_bytes(tmp, nb, 2);
-      
-      // Get the uint8_t array that form the header
-      keys[j++] = tmp->stream;
+      keys[i] = tmp;
    }
    
    // Preparing the structure
    *args = new arguments_t*[NB_THREADS];
-   hash_table** table = new hash_table*;
-   *table = new_hash_table(FNV_1, NB_THREADS);
+   flow_table** table = new flow_table*;
+   *table = new_flow_table();
    
    // We distribute the work per threads
    uint32_t divider = NB_NUMBERS / NB_THREADS;
@@ -211,11 +425,36 @@ void init(arguments_t*** args)
 
 
 
+void run_jobs(void* (*job)(void*), arguments_t** args)
+{
+   std::vector<std::thread> workers;
+   for (uint32_t i = 0; i < NB_THREADS; ++i)
+      workers.push_back(std::thread(job, args[i]));
+   for (auto &worker : workers)
+      worker.join();
+}
+
+
+
+void make_packet(u_char* pckt, uint32_t flow, uint8_t tcp_flags)
+{
+   memset(pckt, 0, HEADER_LENGTH);
+   pckt[12] = 0x08;
+   pckt[14] = 0x45;
+   pckt[23] = IPPROTO_TCP;
+   memcpy(&pckt[26], &flow, 4);
+   pckt[30] = 10;
+   pckt[35] = 80;
+   pckt[47] = tcp_flags;
+}
+
+
+
 void* job_insert(void* args)
 {
    arguments_t* args_cast = (arguments_t*)args;
    for (uint32_t i = 0; i < args_cast->size; ++i){
-      bool result = put_flow(*args_cast->table, args_cast->numbers[i], &args_cast->numbers[i]);
+      bool result = put_flow(*args_cast->table, args_cast->numbers[i], HEADER_LENGTH, &args_cast->numbers[i]);
       EXPECT_TRUE(result);
    }
    return NULL;
@@ -228,7 +467,7 @@ void* job_get(void* args)
    arguments_t* args_cast = (arguments_t*)args;
    for (uint32_t i = 0; i < args_cast->size; ++i){
       if (args_cast->numbers[i])
-         EXPECT_EQ(get_flow(*args_cast->table, args_cast->numbers[i]), &args_cast->numbers[i]);
+         EXPECT_EQ(get_flow(*args_cast->table, args_cast->numbers[i], HEADER_LENGTH), &args_cast->numbers[i]);
    }
    return NULL;
 }
@@ -239,7 +478,7 @@ void* job_remove(void* args)
 {
    arguments_t* args_cast = (arguments_t*)args;
    for(uint32_t i = 0; i < args_cast->size; ++i){
-      bool result = remove_flow(*args_cast->table, args_cast->numbers[i]);
+      bool result = remove_flow(*args_cast->table, args_cast->numbers[i], HEADER_LENGTH);
       EXPECT_TRUE(result);
    }
    return NULL;
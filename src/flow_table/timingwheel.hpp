@@ -0,0 +1,223 @@
+#ifndef _TIMINGWHEELH_
+#define _TIMINGWHEELH_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "../memory_pool/allocators.hpp"
+
+namespace DNFC
+{
+
+/**
+ * DefaultTimingWheelPolicy
+ *
+ * Each level of the wheel has 2^SlotBits slots, a slot of level l covers 2^(l*SlotBits)
+ * ticks: with the defaults, 4 levels of 64 slots cover 2^24 ticks before timers have
+ * to be cascaded again from the last level. The timers come from TimerAllocator (see
+ * allocators.hpp).
+ */
+class DefaultTimingWheelPolicy
+{
+  public:
+    const static int SlotBits = 6;
+    const static int Levels = 4;
+
+    template <typename T>
+    using TimerAllocator = DNFC::NewAllocator<T>;
+};
+
+/**
+ * TimingWheel
+ *
+ * Hierarchical timing wheel of timers carrying a 'T'. Any thread can schedule a timer
+ * at any time: it is pushed lock-free on an incoming list. The wheel itself is only
+ * touched by 'advance', which must not be called by several threads at the same time
+ * (the caller serializes it), so expiring n timers costs O(n) plus one step per tick
+ * elapsed, whatever the number of timers still pending.
+ */
+template <typename T, typename Policy = DefaultTimingWheelPolicy>
+class TimingWheel
+{
+  public:
+    struct Timer
+    {
+        Timer *next;
+        uint64_t deadline;
+        T value;
+    };
+
+    using TimerAllocator = typename Policy::template TimerAllocator<Timer>;
+
+    explicit TimingWheel(uint64_t now = 0) : current(now), pending(0), incoming(nullptr), slots() {}
+
+    ~TimingWheel()
+    {
+        freeList(incoming.load(std::memory_order_acquire));
+        for (auto &level : slots)
+            for (Timer *slot : level)
+                freeList(slot);
+    }
+
+    TimingWheel(const TimingWheel &) = delete;
+    TimingWheel &operator=(const TimingWheel &) = delete;
+
+    /**
+     * schedule
+     *
+     * Fire 'value' at the first 'advance' reaching the tick 'deadline'. A deadline in the
+     * past fires at the next tick.
+     */
+    void schedule(const T &value, uint64_t deadline)
+    {
+        schedule(TimerAllocator::create(Timer{nullptr, deadline, value}));
+    }
+
+    /**
+     * schedule
+     *
+     * Schedule again a timer given to the callback of 'advance'.
+     */
+    void schedule(Timer *timer)
+    {
+        Timer *head = incoming.load(std::memory_order_relaxed);
+        do
+            timer->next = head;
+        while (!incoming.compare_exchange_weak(head, timer, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    /**
+     * advance
+     *
+     * Move the wheel to the tick 'now' and call 'f(timer)' for every timer whose deadline
+     * is reached. 'f' returns true when it took the timer back (to schedule it again),
+     * false to have it freed. Return the number of timers fired.
+     */
+    template <typename F>
+    std::size_t advance(uint64_t now, F f)
+    {
+        std::size_t fired = 0;
+        drainIncoming();
+        while (current < now)
+        {
+            if (pending == 0)
+            {
+                current = now;
+                break;
+            }
+            ++current;
+
+            // Cascade the slots of the upper levels whose range starts at this tick
+            for (int level = 1; level < Policy::Levels && (current & lowMask(level)) == 0; ++level)
+            {
+                Timer *list = takeSlot(level, slotIndex(current, level));
+                while (list)
+                {
+                    Timer *next = list->next;
+                    place(list, current);
+                    list = next;
+                }
+            }
+
+            Timer *list = takeSlot(0, slotIndex(current, 0));
+            while (list)
+            {
+                Timer *next = list->next;
+                if (list->deadline > current)
+                    place(list, current + 1);
+                else
+                {
+                    ++fired;
+                    --pending;
+                    if (!f(list))
+                        TimerAllocator::destroy(list);
+                }
+                list = next;
+            }
+        }
+        return fired;
+    }
+
+    uint64_t now() const
+    {
+        return current;
+    }
+
+    // Number of timers in the wheel, not counting the ones scheduled since the last 'advance'
+    std::size_t size() const
+    {
+        return pending;
+    }
+
+  private:
+    const static std::size_t SlotsPerLevel = std::size_t(1) << Policy::SlotBits;
+
+    static uint64_t lowMask(int level)
+    {
+        return (uint64_t(1) << (level * Policy::SlotBits)) - 1;
+    }
+
+    static std::size_t slotIndex(uint64_t tick, int level)
+    {
+        return (tick >> (level * Policy::SlotBits)) & (SlotsPerLevel - 1);
+    }
+
+    static void freeList(Timer *list)
+    {
+        while (list)
+        {
+            Timer *next = list->next;
+            TimerAllocator::destroy(list);
+            list = next;
+        }
+    }
+
+    void drainIncoming()
+    {
+        Timer *list = incoming.exchange(nullptr, std::memory_order_acquire);
+        while (list)
+        {
+            Timer *next = list->next;
+            place(list, current + 1);
+            ++pending;
+            list = next;
+        }
+    }
+
+    Timer *takeSlot(int level, std::size_t index)
+    {
+        Timer *list = slots[level][index];
+        slots[level][index] = nullptr;
+        return list;
+    }
+
+    /**
+     * place
+     *
+     * A timer goes in the level of the highest digit (of SlotBits bits) where its deadline
+     * differs from the current tick: it is cascaded one level down when the current tick
+     * reaches that digit, and it fires from level 0. Deadlines beyond the last level wait
+     * in it and are placed again at each of its rounds. Deadlines before 'earliest', the
+     * first tick whose slot was not processed yet, are moved to it.
+     */
+    void place(Timer *timer, uint64_t earliest)
+    {
+        uint64_t deadline = timer->deadline > earliest ? timer->deadline : earliest;
+        int level = 0;
+        while (level + 1 < Policy::Levels && (deadline >> ((level + 1) * Policy::SlotBits)) != (current >> ((level + 1) * Policy::SlotBits)))
+            ++level;
+
+        Timer *&slot = slots[level][slotIndex(deadline, level)];
+        timer->next = slot;
+        slot = timer;
+    }
+
+    uint64_t current;
+    std::size_t pending;
+    std::atomic<Timer *> incoming;
+    Timer *slots[Policy::Levels][SlotsPerLevel];
+};
+} // namespace DNFC
+
+#endif
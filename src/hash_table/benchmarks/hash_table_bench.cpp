@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../hashtable.hpp"
+
+/**
+ * Contention microbenchmark
+ *
+ * Every thread runs a 50% get / 25% insert / 25% remove mix over a small key range
+ * so that most operations race on the same slots and go through the contention
+ * path. Usage: hash_table_bench [max threads] [key range] [milliseconds per run]
+ */
+using namespace DNFC;
+
+double runContention(std::size_t nbThreads, int keyRange, int milliseconds)
+{
+    HashTable<int, int> hm;
+    std::atomic<bool> start(false);
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long long> totalOps(0);
+    std::vector<std::thread> workers;
+
+    for (int k = 0; k < keyRange; k += 2)
+        hm.insert(k, k);
+
+    for (std::size_t t = 0; t < nbThreads; ++t)
+    {
+        workers.push_back(std::thread([&, t] {
+            std::minstd_rand rng(t + 1);
+            unsigned long long ops = 0;
+            while (!start.load(std::memory_order_acquire))
+                std::this_thread::yield();
+
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                unsigned int r = rng();
+                int key = (r >> 2) % keyRange;
+                switch (r & 0x3)
+                {
+                case 0:
+                    hm.insert(key, key);
+                    break;
+                case 1:
+                    hm.remove(key);
+                    break;
+                default:
+                    hm.get(key);
+                }
+                ++ops;
+            }
+            totalOps.fetch_add(ops, std::memory_order_relaxed);
+        }));
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+    stop.store(true, std::memory_order_relaxed);
+    for (auto &worker : workers)
+        worker.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+    return totalOps.load() / elapsed.count() / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t maxThreads = argc > 1 ? atoi(argv[1]) : 64;
+    int keyRange = argc > 2 ? atoi(argv[2]) : 64;
+    int milliseconds = argc > 3 ? atoi(argv[3]) : 500;
+
+    printf("# key range %d, %d ms per run, %u hardware threads\n",
+           keyRange, milliseconds, std::thread::hardware_concurrency());
+    printf("%8s %12s\n", "threads", "Mops/s");
+    for (std::size_t t = 1; t <= maxThreads; t *= 2)
+        printf("%8zu %12.3f\n", t, runContention(t, keyRange, milliseconds));
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <netinet/in.h>
+
+#include "../hashtable.hpp"
+#include "../fixedkey.hpp"
+#include "../hashers.hpp"
+
+/**
+ * Hasher benchmark
+ *
+ * Compare the hashers of a HashTable policy on IPv4 5-tuples (FixedKey<13>, laid out
+ * like the flow keys of flowtable.hpp): depth distribution of the keys in the trie,
+ * hashing cost and lookup throughput. Usage: hasher_bench [number of flows]
+ */
+using namespace DNFC;
+using FlowKey = FixedKey<13>;
+
+template <template <typename> class H>
+class BenchPolicy : public DefaultHashTablePolicy
+{
+  public:
+    template <typename Key>
+    using Hash = H<Key>;
+};
+
+template <typename Key>
+using RSSHash = ToeplitzHash<Key, 1>;
+
+FlowKey makeKey(uint32_t src, uint32_t dst, uint16_t sport, uint16_t dport)
+{
+    FlowKey key;
+    key.bytes[0] = IPPROTO_TCP;
+    for (int i = 0; i < 4; ++i)
+    {
+        key.bytes[1 + i] = src >> (24 - 8 * i);
+        key.bytes[5 + i] = dst >> (24 - 8 * i);
+    }
+    key.bytes[9] = sport >> 8;
+    key.bytes[10] = sport;
+    key.bytes[11] = dport >> 8;
+    key.bytes[12] = dport;
+    return key;
+}
+
+// Clients of a /16 on ephemeral ports talking to 16 servers on ports 80 and 443
+std::vector<FlowKey> clientServerMix(std::size_t n)
+{
+    std::mt19937 rng(42);
+    std::vector<FlowKey> keys;
+    for (std::size_t i = 0; i < n; ++i)
+        keys.push_back(makeKey(0x0a000000 | (rng() & 0xffff), 0xc0a80101 + (rng() & 0xf),
+                               32768 + rng() % 28232, rng() & 1 ? 443 : 80));
+    return keys;
+}
+
+// Consecutive sources and ports, like a scan or a load generator
+std::vector<FlowKey> sequentialMix(std::size_t n)
+{
+    std::vector<FlowKey> keys;
+    for (std::size_t i = 0; i < n; ++i)
+        keys.push_back(makeKey(0x0a000000 + (i >> 6), 0xc0a80101, 1024 + (i & 0x3f), 80));
+    return keys;
+}
+
+uint64_t reverseBits(uint64_t v)
+{
+    uint64_t r = 0;
+    for (int i = 0; i < 64; ++i, v >>= 1)
+        r = (r << 1) | (v & 1);
+    return r;
+}
+
+/**
+ * A key lands at the first trie level where no other key shares its slot: one level
+ * deeper than the longest prefix (in BlockSize wide digits, from the low bits of the
+ * hash) it has in common with another key. Sorting the bit reversed hashes puts the
+ * keys sharing the longest prefix next to each other.
+ */
+std::vector<std::size_t> depthHistogram(std::vector<uint64_t> hashes, int digitBits, int maxDepth)
+{
+    for (auto &h : hashes)
+        h = reverseBits(h);
+    std::sort(hashes.begin(), hashes.end());
+
+    std::vector<std::size_t> histogram(maxDepth + 1, 0);
+    for (std::size_t i = 0; i < hashes.size(); ++i)
+    {
+        int common = 0;
+        if (i > 0)
+            common = std::max(common, hashes[i] == hashes[i - 1] ? 64 : __builtin_clzll(hashes[i] ^ hashes[i - 1]));
+        if (i + 1 < hashes.size())
+            common = std::max(common, hashes[i] == hashes[i + 1] ? 64 : __builtin_clzll(hashes[i] ^ hashes[i + 1]));
+        histogram[std::min(common / digitBits + 1, maxDepth)]++;
+    }
+    return histogram;
+}
+
+template <template <typename> class H>
+void run(const char *name, const std::vector<FlowKey> &keys)
+{
+    using Clock = std::chrono::steady_clock;
+    const int digitBits = 6; // log2(DefaultHashTablePolicy::BlockSize)
+    const int maxDepth = 64 / digitBits + 1;
+    H<FlowKey> hasher;
+
+    std::vector<uint64_t> hashes(keys.size());
+    auto begin = Clock::now();
+    for (std::size_t i = 0; i < keys.size(); ++i)
+        hashes[i] = hasher(keys[i]);
+    double hashNs = std::chrono::duration<double, std::nano>(Clock::now() - begin).count() / keys.size();
+
+    std::vector<std::size_t> histogram = depthHistogram(hashes, digitBits, maxDepth);
+    double meanDepth = 0;
+    for (int d = 1; d <= maxDepth; ++d)
+        meanDepth += d * histogram[d];
+    meanDepth /= keys.size();
+
+    HashTable<FlowKey, int, BenchPolicy<H>> table;
+    std::vector<int> values(keys.size(), 1);
+    std::vector<int> out(keys.size());
+    table.insertBatch(keys.data(), values.data(), keys.size());
+
+    begin = Clock::now();
+    std::size_t found = 0;
+    for (const auto &key : keys)
+        found += table.get(key);
+    double getMops = keys.size() / std::chrono::duration<double, std::micro>(Clock::now() - begin).count();
+
+    begin = Clock::now();
+    table.getBatch(keys.data(), out.data(), keys.size());
+    double batchMops = keys.size() / std::chrono::duration<double, std::micro>(Clock::now() - begin).count();
+
+    printf("%-10s %8.2f %8.3f %10.2f %10.2f %8zu  ", name, hashNs, meanDepth, getMops, batchMops, found);
+    for (int d = 1; d <= maxDepth; ++d)
+        printf("%zu%c", histogram[d], d == maxDepth ? '\n' : '/');
+}
+
+void runAll(const char *mix, const std::vector<FlowKey> &keys)
+{
+    printf("\n# %s, %zu flows\n", mix, keys.size());
+    printf("%-10s %8s %8s %10s %10s %8s  %s\n", "hasher", "ns/hash", "depth", "get Mops", "batch Mops",
+           "found", "keys per depth (1/2/...)");
+    run<std::hash>("fnv1a", keys);
+    run<CRC32CHash>("crc32c", keys);
+    run<WyHash>("wyhash", keys);
+    run<XXH3Hash>("xxh3", keys);
+    run<RSSHash>("toeplitz", keys);
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t n = argc > 1 ? atol(argv[1]) : 1000000;
+    runAll("client/server mix", clientServerMix(n));
+    runAll("sequential mix", sequentialMix(n));
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../hashtable.hpp"
+
+/**
+ * Reclamation microbenchmark
+ *
+ * HashTable::get throughput with HazardPointers and with EpochPointers, on a table
+ * preloaded with 'keys' entries while one writer thread keeps replacing 1% of them
+ * (so that reclamation actually runs). The epoch variant is measured with a region
+ * per lookup and with a region per burst of 32 lookups, as a packet path would.
+ * Usage: reclamation_bench [max threads] [keys] [milliseconds per run]
+ */
+using namespace DNFC;
+
+class EpochPolicy : public DefaultHashTablePolicy
+{
+  public:
+    template <typename T, typename Deleter>
+    using Reclaimer = EpochPointer<T, Deleter>;
+};
+
+const int BurstSize = 32;
+volatile int sink; // Keeps the lookups from being optimized out
+
+template <typename Policy, bool BurstRegion>
+double runGets(std::size_t nbThreads, int keys, int milliseconds)
+{
+    HashTable<int, int, Policy> hm;
+    std::atomic<bool> start(false);
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long long> totalOps(0);
+    std::vector<std::thread> workers;
+
+    for (int k = 0; k < keys; ++k)
+        hm.insert(k, k);
+
+    for (std::size_t t = 0; t < nbThreads; ++t)
+    {
+        workers.push_back(std::thread([&, t] {
+            std::minstd_rand rng(t + 1);
+            unsigned long long ops = 0;
+            int sum = 0;
+            while (!start.load(std::memory_order_acquire))
+                std::this_thread::yield();
+
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                if (BurstRegion)
+                    Epoch::enter();
+                for (int i = 0; i < BurstSize; ++i)
+                    sum += hm.get(rng() % keys);
+                if (BurstRegion)
+                    Epoch::exit();
+                ops += BurstSize;
+            }
+            sink = sum;
+            totalOps.fetch_add(ops, std::memory_order_relaxed);
+        }));
+    }
+
+    // Writer replacing entries so that nodes are retired during the run
+    std::thread writer([&] {
+        std::minstd_rand rng(0);
+        while (!start.load(std::memory_order_acquire))
+            std::this_thread::yield();
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            int key = rng() % (keys / 100 + 1);
+            hm.remove(key);
+            hm.insert(key, key);
+        }
+    });
+
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+    stop.store(true, std::memory_order_relaxed);
+    for (auto &worker : workers)
+        worker.join();
+    writer.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+    return totalOps.load() / elapsed.count() / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t maxThreads = argc > 1 ? atoi(argv[1]) : 64;
+    int keys = argc > 2 ? atoi(argv[2]) : 1 << 20;
+    int milliseconds = argc > 3 ? atoi(argv[3]) : 500;
+
+    printf("# %d keys, %d ms per run, %u hardware threads, get Mops/s\n",
+           keys, milliseconds, std::thread::hardware_concurrency());
+    printf("%8s %14s %14s %14s\n", "threads", "hazard", "epoch/get", "epoch/burst");
+    for (std::size_t t = 1; t <= maxThreads; t *= 2)
+    {
+        double hazard = runGets<DefaultHashTablePolicy, false>(t, keys, milliseconds);
+        double epoch = runGets<EpochPolicy, false>(t, keys, milliseconds);
+        double burst = runGets<EpochPolicy, true>(t, keys, milliseconds);
+        printf("%8zu %14.3f %14.3f %14.3f\n", t, hazard, epoch, burst);
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef _FIXED_KEYH_
+#define _FIXED_KEYH_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+namespace DNFC
+{
+
+/**
+ * FixedKey
+ *
+ * A key made of 'Size' raw bytes stored inline (no padding, no allocation), such as
+ * a packed flow 5-tuple. Two keys are equal when all their bytes are equal.
+ */
+template <std::size_t Size>
+struct FixedKey
+{
+    uint8_t bytes[Size];
+
+    bool operator==(const FixedKey &other) const
+    {
+        return std::memcmp(bytes, other.bytes, Size) == 0;
+    }
+
+    bool operator!=(const FixedKey &other) const
+    {
+        return !(*this == other);
+    }
+};
+} // namespace DNFC
+
+namespace std
+{
+/**
+ * 64 bits FNV-1a hash of the key bytes.
+ */
+template <std::size_t Size>
+struct hash<DNFC::FixedKey<Size>>
+{
+    std::size_t operator()(const DNFC::FixedKey<Size> &key) const
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (std::size_t i = 0; i < Size; ++i)
+        {
+            hash ^= key.bytes[i];
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+};
+} // namespace std
+
+#endif
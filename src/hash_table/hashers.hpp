@@ -0,0 +1,289 @@
+#ifndef _HASHERSH_
+#define _HASHERSH_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace DNFC
+{
+
+/**
+ * Hashers for fixed-size keys (flow keys, integers, packed structures). They all hash
+ * the raw bytes of the key and return 64 bits: the HashTable trie consumes the bits
+ * of the hash from the least significant ones, so each hasher spreads the entropy of
+ * the key over the low bits first. They can be selected with the 'Hash' member of a
+ * HashTable policy:
+ *
+ *   class Policy : public DefaultHashTablePolicy
+ *   {
+ *     public:
+ *       template <typename Key>
+ *       using Hash = DNFC::CRC32CHash<Key>;
+ *   };
+ */
+namespace HashDetail
+{
+inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Read 1 to 7 bytes into the low bytes of a word
+inline uint64_t readTail(const uint8_t *p, std::size_t length)
+{
+    uint64_t v = 0;
+    std::memcpy(&v, p, length);
+    return v;
+}
+
+// 64x64 -> 128 bits multiplication folded back to 64 bits
+inline uint64_t mulFold(uint64_t a, uint64_t b)
+{
+    __uint128_t product = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+/**
+ * CRC32C (Castagnoli) software implementation, used when SSE4.2 is not available.
+ */
+inline const uint32_t *crc32cTable()
+{
+    static uint32_t table[256];
+    static bool initialized = [] {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; ++j)
+                crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+            table[i] = crc;
+        }
+        return true;
+    }();
+    (void)initialized;
+    return table;
+}
+
+inline uint32_t crc32cSoftware(uint32_t crc, const uint8_t *p, std::size_t length)
+{
+    const uint32_t *table = crc32cTable();
+    for (std::size_t i = 0; i < length; ++i)
+        crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) inline uint32_t crc32cHardware(uint32_t crc, const uint8_t *p, std::size_t length)
+{
+    uint64_t crc64 = crc;
+    for (; length >= 8; length -= 8, p += 8)
+        crc64 = __builtin_ia32_crc32di(crc64, read64(p));
+    crc = static_cast<uint32_t>(crc64);
+    for (; length > 0; --length, ++p)
+        crc = __builtin_ia32_crc32qi(crc, *p);
+    return crc;
+}
+
+inline bool hasSSE42()
+{
+    static bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+}
+#endif
+
+inline uint32_t crc32c(uint32_t crc, const uint8_t *p, std::size_t length)
+{
+#if defined(__x86_64__)
+    if (hasSSE42())
+        return crc32cHardware(crc, p, length);
+#endif
+    return crc32cSoftware(crc, p, length);
+}
+
+// CRC32C of the 8 bytes words of the key multiplied by an odd constant
+inline uint32_t crc32cMultiplied(uint32_t crc, const uint8_t *p, std::size_t length)
+{
+    for (; length > 0; p += 8)
+    {
+        std::size_t take = length < 8 ? length : 8;
+        uint64_t word = readTail(p, take) * 0x9E3779B97F4A7C15ULL;
+        crc = crc32c(crc, reinterpret_cast<const uint8_t *>(&word), sizeof(word));
+        length -= take;
+    }
+    return crc;
+}
+} // namespace HashDetail
+
+/**
+ * CRC32CHash
+ *
+ * Two CRC32C lanes computed with the SSE4.2 'crc32' instruction when the CPU supports
+ * it (table driven otherwise). The low 32 bits are the usual CRC32C of the key seeded
+ * with ~0. CRC being linear, any other CRC of the same bytes collides whenever the low
+ * lane does, so the high lane is the CRC of the key words multiplied by a constant.
+ */
+template <typename Key>
+struct CRC32CHash
+{
+    std::size_t operator()(const Key &key) const
+    {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(&key);
+        uint32_t low = HashDetail::crc32c(0xffffffff, p, sizeof(Key));
+        uint64_t high = HashDetail::crc32cMultiplied(0xffffffff, p, sizeof(Key));
+        return low | (high << 32);
+    }
+};
+
+/**
+ * WyHash
+ *
+ * wyhash style hash: the key is consumed 16 bytes at a time by 128 bits multiplications
+ * folded to 64 bits, then mixed one last time with the length.
+ */
+template <typename Key>
+struct WyHash
+{
+    std::size_t operator()(const Key &key) const
+    {
+        const uint64_t secret[3] = {0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL};
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(&key);
+        std::size_t length = sizeof(Key);
+        uint64_t seed = secret[0];
+
+        for (; length > 16; length -= 16, p += 16)
+            seed = HashDetail::mulFold(HashDetail::read64(p) ^ secret[1], HashDetail::read64(p + 8) ^ seed);
+
+        uint64_t a, b;
+        if (length > 8)
+        {
+            a = HashDetail::read64(p);
+            b = HashDetail::readTail(p + 8, length - 8);
+        }
+        else
+        {
+            a = HashDetail::readTail(p, length);
+            b = 0;
+        }
+        seed = HashDetail::mulFold(a ^ secret[1], b ^ seed);
+        return HashDetail::mulFold(seed ^ secret[2], sizeof(Key) ^ secret[1]);
+    }
+};
+
+/**
+ * XXH3Hash
+ *
+ * xxh3 style hash: 16 bytes stripes are multiplied with a secret and folded, the
+ * accumulator is then avalanched like XXH3. It follows the structure of XXH3 for
+ * short inputs but is not bit compatible with the reference implementation.
+ */
+template <typename Key>
+struct XXH3Hash
+{
+    std::size_t operator()(const Key &key) const
+    {
+        const uint64_t secret[4] = {0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL,
+                                    0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL};
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(&key);
+        std::size_t length = sizeof(Key);
+        uint64_t acc = length * 0x9E3779B185EBCA87ULL;
+
+        for (int i = 0; length > 0; i ^= 2)
+        {
+            std::size_t take = length < 16 ? length : 16;
+            uint64_t lo = HashDetail::readTail(p, take < 8 ? take : 8);
+            uint64_t hi = take > 8 ? HashDetail::readTail(p + 8, take - 8) : 0;
+            acc += HashDetail::mulFold(lo ^ secret[i], hi ^ secret[i + 1]);
+            p += take;
+            length -= take;
+        }
+
+        acc ^= acc >> 37;
+        acc *= 0x165667919E3779F9ULL;
+        acc ^= acc >> 32;
+        return acc;
+    }
+};
+
+/**
+ * ToeplitzHash
+ *
+ * The Toeplitz hash used by NICs for Receive Side Scaling, computed on the bytes of
+ * the key starting at 'Offset'. The low 32 bits are exactly the RSS hash a NIC computes
+ * with the same secret key (the default one is the widely used Microsoft key), the
+ * high 32 bits continue the same sliding window over the secret key, repeated as
+ * needed. With the flow keys of flowtable.hpp, use Offset = 1 to skip the protocol byte
+ * and hash the addresses and ports in the order the NIC does.
+ */
+template <typename Key, std::size_t Offset = 0>
+struct ToeplitzHash
+{
+    static_assert(Offset < sizeof(Key), "Offset must be inside the key");
+
+    std::size_t operator()(const Key &key) const
+    {
+        static const uint64_t *table = buildTable();
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(&key) + Offset;
+
+        uint64_t result = 0;
+        for (std::size_t i = 0; i < Length; ++i)
+            result ^= table[(i << 8) | p[i]];
+
+        // Standard 32 bits RSS hash in the low half
+        return (result >> 32) | (result << 32);
+    }
+
+  private:
+    static const std::size_t Length = sizeof(Key) - Offset;
+
+    /**
+     * The hash is linear: precompute, for every byte position and value, the xor of the
+     * 64 bits windows of the secret key selected by the bits of that byte.
+     */
+    static const uint64_t *buildTable()
+    {
+        static const uint8_t rssKey[40] = {
+            0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67,
+            0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb,
+            0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30,
+            0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa};
+        static uint64_t table[Length * 256];
+
+        // 'window' holds the 64 bits of the secret key starting at the current input bit
+        uint64_t window = 0;
+        for (int i = 0; i < 8; ++i)
+            window = (window << 8) | rssKey[i];
+
+        for (std::size_t i = 0; i < Length; ++i)
+        {
+            uint64_t bitWindows[8];
+            uint8_t next = rssKey[(i + 8) % sizeof(rssKey)];
+            for (int bit = 7; bit >= 0; --bit)
+            {
+                bitWindows[bit] = window;
+                window = (window << 1) | ((next >> bit) & 1);
+            }
+
+            for (int value = 0; value < 256; ++value)
+            {
+                uint64_t h = 0;
+                for (int bit = 0; bit < 8; ++bit)
+                    if (value & (1 << bit))
+                        h ^= bitWindows[bit];
+                table[(i << 8) | value] = h;
+            }
+        }
+        return table;
+    }
+};
+} // namespace DNFC
+
+#endif
@@ -3,7 +3,14 @@
 
 #include <cstddef>
 #include <cmath>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
 #include "../SMR/hazardpointer.hpp"
+#include "../SMR/epoch.hpp"
+#include "../memory_pool/allocators.hpp"
 
 namespace DNFC
 {
@@ -16,8 +23,44 @@ class DefaultHashTablePolicy
   public:
     const static std::size_t BlockSize = 64; // Should be a power of two
     const static std::size_t MaxFailCount = 4;
+    const static std::size_t BatchSize = 32; // Keys resolved in lockstep by the batch operations
+    const static std::size_t CounterStripes = 16; // Should be a power of two
+
+    // Hash function of the keys, see hashers.hpp for fast hashers of fixed-size keys
+    template <typename Key>
+    using Hash = std::hash<Key>;
+
+    // Allocators of the nodes and of the ArrayNodes, see allocators.hpp
+    template <typename T>
+    using NodeAllocator = DNFC::NewAllocator<T>;
+    template <typename T>
+    using ArrayAllocator = DNFC::CacheAlignedAllocator<T>;
+
+    // Reclamation of the removed nodes and folded ArrayNodes: HazardPointer, or
+    // EpochPointer (epoch.hpp) for read-mostly tables whose readers enter an Epoch
+    // region per burst of lookups
+    template <typename T, typename Deleter>
+    using Reclaimer = DNFC::HazardPointer<T, DNFC::DefaultHazardPointerPolicy, Deleter>;
 };
 
+/**
+ * HashTable
+ *
+ * Lock-free hash trie indexed by the bits of the key hash. Nodes store the full key
+ * next to its hash: the hash is compared first, as a fingerprint, and the keys only
+ * when the hashes are equal. Keys must be copyable and equality comparable. Distinct
+ * keys of the same hash cannot be told apart by the trie, so they share a slot in a
+ * collision chain: the chain is copied on every update and swapped in with a CAS, and
+ * the old one is retired as a whole once no reader guards its first node.
+ *
+ * Slots hold either nothing, a Node (tagged 0x1 while it is being removed) or a child
+ * ArrayNode (tagged 0x2). 'compact' folds back the child ArrayNodes left with at most
+ * one entry: their slots are frozen (tagged 0x4) so that they cannot change anymore,
+ * then the ArrayNode is replaced in its parent slot by its only node. Any thread
+ * finding a frozen slot completes the fold before going on, and the ArrayNodes are
+ * walked under HazardPointers so that folded ones can be retired. The policy can swap
+ * the HazardPointers for EpochPointers: the same code then only marks an epoch region.
+ */
 template <typename Key, typename Data, typename Policy = DefaultHashTablePolicy>
 class HashTable
 {
@@ -25,196 +68,343 @@ class HashTable
     bool insert(const Key& key, const Data& data)
     {
         std::size_t hash = hashKey(key);
-        Node *insertThis = new Node(data, hash);
-        ArrayNode local = head;
+        Cursor cursor;
+        restart(cursor);
+        if (!insertNode(NodeAllocator::create(key, data, hash), cursor))
+            return false;
+        count(1);
+        return true;
+    }
 
-        DNFC::HazardPointer<Node> nodeHP;
-        Item current;
+    /**
+     * insertBatch
+     *
+     * Insert 'n' pairs and return how many keys were inserted. The whole burst is
+     * hashed first and walked down to its deepest ArrayNode level by level, prefetching
+     * the slot of every key, before the insertions themselves are done.
+     */
+    std::size_t insertBatch(const Key *keys, const Data *data, std::size_t n)
+    {
+        std::size_t inserted = 0;
+        BatchState state[Policy::BatchSize];
 
-        for (int R = 0; R < keySize; R += arrayNodePow)
+        for (std::size_t base = 0; base < n; base += Policy::BatchSize)
         {
-            std::size_t failCount = 0;
-            int pos = hash & (Policy::BlockSize - 1);
-            hash = hash >> arrayNodePow;
+            std::size_t count = std::min(n - base, std::size_t(Policy::BatchSize));
+            startBatch<1>(keys + base, state, count);
 
-            std::atomic<Item> &item = local[pos];
-            for (;;)
+            for (bool descending = true; descending;)
             {
-                try
+                descending = false;
+                for (std::size_t i = 0; i < count; ++i)
                 {
-                    current = item.load(std::memory_order_relaxed);
-                    if (!current)
-                    {
-                        if (item.compare_exchange_strong(current, insertThis,
-                                                         std::memory_order_acquire, std::memory_order_relaxed))
-                            return true;
-                        else
-                            throw ContentionException();
-                    }
-                    else if (isArrayNode(current))
-                    {
-                        local = toArrayNode(current);
-                        break;
-                    }
+                    if (state[i].done)
+                        continue;
+                    Item current = state[i].slot->load(std::memory_order_relaxed);
+                    if (isArrayNode(current) && !isFrozen(current) && descend<1>(state[i], current))
+                        descending = true;
                     else
-                    {
-                        guard(nodeHP, item, toNode(current));
-                        if (isMarked(current))
-                        {
-                            if (item.compare_exchange_strong(current, insertThis,
-                                                             std::memory_order_acquire, std::memory_order_relaxed))
-                            {
-                                nodeHP.retire();
-                                return true;
-                            }
-                            else
-                            {
-                                nodeHP.release();
-                                throw ContentionException();
-                            }
-                        }
-                        else if (toNode(current)->hash == insertThis->hash)
-                        {
-                            nodeHP.release();
-                            delete insertThis;
-                            return false;
-                        }
-                        else
-                        {
-                            local = expandTable(item, R);
-                            nodeHP.release();
-                        }
-                    }
-                }
-                catch (ContentionException &e)
-                {
-                    if (failCount++ > Policy::MaxFailCount)
-                    {
-                        local = expandTable(item, R);
-                        failCount = 0;
-                    }
-                    continue;
+                        state[i].done = true;
                 }
             }
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                BatchState &s = state[i];
+                Node *insertThis = NodeAllocator::create(keys[base + i], data[base + i], s.hashValue);
+                if (insertNode(insertThis, s.cursor))
+                    ++inserted;
+            }
         }
-        return false;
+        count(inserted);
+        return inserted;
     }
 
     Data get(const Key& key)
+    {
+        Data res{};
+        visit(key, [&res](const Data &data) { res = data; });
+        return res;
+    }
+
+    /**
+     * visit
+     *
+     * Call 'f(data)' on the entry of 'key' in place, while its node is protected by a
+     * HazardPointer, and return whether the key was found. 'f' may update fields of the
+     * data that are safe to write concurrently (atomics) but must not keep references
+     * to it once it returns.
+     */
+    template <typename F>
+    bool visit(const Key &key, F f)
     {
         std::size_t hashValue = hashKey(key);
-        std::size_t hash = hashValue;
-        ArrayNode local = head;
-        DNFC::HazardPointer<Node> nodeHP;
-        Item current;
+        NodeHP nodeHP;
+        std::size_t failCount = 0;
+        Cursor cursor;
+        restart(cursor);
+
+        while (cursor.R < keySize)
+        {
+            std::atomic<Item> &item = cursor.local[slotOf(hashValue, cursor.R)];
+            Item current = item.load(std::memory_order_relaxed);
+            if (isFrozen(current))
+                help(cursor);
+            else if (isArrayNode(current))
+                failCount = enter(cursor, item, current) ? 0 : failCount;
+            else if (!current || isMarked(current))
+                return false;
+            else if (!guard(nodeHP, item, current))
+                contention(nodeHP, item, cursor.R, failCount);
+            else
+            {
+                Node *node = find(toNode(current), key, hashValue);
+                if (node)
+                    f(node->data);
+                nodeHP.release();
+                return node != nullptr;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * getBatch
+     *
+     * Lookup 'n' keys and write their data (or Data{} when absent) in 'out'.
+     */
+    void getBatch(const Key *keys, Data *out, std::size_t n)
+    {
+        visitBatch(keys, n, [out](std::size_t i, Data *data) { out[i] = data ? *data : Data{}; });
+    }
+
+    /**
+     * visitBatch
+     *
+     * Lookup 'n' keys and call 'f(i, data)' for each one with a pointer to the data of
+     * 'keys[i]', or nullptr when it is absent; the data is only guarded during the call.
+     * The keys are hashed up front and resolved interleaved: each round advances every
+     * pending key by one level and prefetches the slot, or the node, it will read on the
+     * next round, so the cache misses of the burst overlap instead of adding up.
+     */
+    template <typename F>
+    void visitBatch(const Key *keys, std::size_t n, F f)
+    {
+        BatchState state[Policy::BatchSize];
+        NodeHP nodeHP;
 
-        for (int R = 0; R < keySize; R += arrayNodePow)
+        for (std::size_t base = 0; base < n; base += Policy::BatchSize)
         {
-            std::size_t failCount = 0;
-            int pos = hash & (Policy::BlockSize - 1);
-            hash = hash >> arrayNodePow;
+            std::size_t count = std::min(n - base, std::size_t(Policy::BatchSize));
+            startBatch<0>(keys + base, state, count);
 
-            std::atomic<Item> &item = local[pos];
-            for (;;)
+            for (std::size_t pending = count; pending > 0;)
             {
-                try
+                for (std::size_t i = 0; i < count; ++i)
                 {
-                    current = item.load(std::memory_order_relaxed);
-                    if (isArrayNode(current))
+                    BatchState &s = state[i];
+                    if (s.done)
+                        continue;
+
+                    Item current = s.slot->load(std::memory_order_relaxed);
+                    if (isFrozen(current))
+                    {
+                        // Retry this key from the root once the fold is done
+                        help(s.cursor);
+                        s.slot = &s.cursor.local[slotOf(s.hashValue, 0)];
+                        s.node = nullptr;
+                        continue;
+                    }
+                    else if (isArrayNode(current))
                     {
-                        local = toArrayNode(current);
-                        break;
+                        if (descend<0>(s, current))
+                            continue;
+                        f(base + i, nullptr);
+                    }
+                    else if (!current || isMarked(current))
+                        f(base + i, nullptr);
+                    else if (s.node != toNode(current))
+                    {
+                        // Compare the node on the next round, once it had time to arrive
+                        s.node = toNode(current);
+                        __builtin_prefetch(s.node, 0, 3);
+                        continue;
                     }
                     else
                     {
-                        if (isMarked(current))
-                            return Data{};
-
-                        Node *node = toNode(current);
-                        guard(nodeHP, item, node);
-                        if (node && node->hash == hashValue)
+                        if (!guard(nodeHP, *s.slot, current))
                         {
-
-                            Data res = node->data;
-                            nodeHP.release();
-                            return res;
+                            // Retry this key on the next round
+                            s.node = nullptr;
+                            continue;
                         }
-                        else
-                            return Data{};
+                        Node *node = find(s.node, keys[base + i], s.hashValue);
+                        f(base + i, node ? &node->data : nullptr);
+                        nodeHP.release();
                     }
-                }
-                catch (ContentionException &e)
-                {
-                    if (failCount++ > Policy::MaxFailCount)
-                    {
-                        local = expandTable(item, R);
-                        failCount = 0;
-                    }
-                    continue;
+                    s.done = true;
+                    --pending;
                 }
             }
         }
-        return Data{};
     }
 
     bool remove(const Key& key)
+    {
+        return removeIf(key, [](const Data &) { return true; });
+    }
+
+    /**
+     * removeIf
+     *
+     * Remove the entry of 'key' only if 'pred(data)' holds. The predicate is evaluated on
+     * the node protected by a HazardPointer right before it is marked, so an entry
+     * removed and inserted again in the meantime is checked again.
+     */
+    template <typename P>
+    bool removeIf(const Key& key, P pred)
     {
         std::size_t hashValue = hashKey(key);
-        std::size_t hash = hashValue;
-        ArrayNode local = head;
-        DNFC::HazardPointer<Node> nodeHP;
-        Item current;
+        NodeHP nodeHP;
+        std::size_t failCount = 0;
+        Cursor cursor;
+        restart(cursor);
+        Node *node;
 
-        for (int R = 0; R < keySize; R += arrayNodePow)
+        while (cursor.R < keySize)
         {
-            std::size_t failCount = 0;
-            int pos = hash & (Policy::BlockSize - 1);
-            hash = hash >> arrayNodePow;
-
-            std::atomic<Item> &item = local[pos];
-            for (;;)
+            std::atomic<Item> &item = cursor.local[slotOf(hashValue, cursor.R)];
+            Item current = item.load(std::memory_order_relaxed);
+            if (isFrozen(current))
+                help(cursor);
+            else if (isArrayNode(current))
+                failCount = enter(cursor, item, current) ? 0 : failCount;
+            else if (!current || isMarked(current))
+                return false;
+            else if (!guard(nodeHP, item, current))
+                contention(nodeHP, item, cursor.R, failCount);
+            else if (!(node = find(toNode(current), key, hashValue)) || !pred(node->data))
             {
-                try
-                {
-                    current = item.load(std::memory_order_relaxed);
-                    if (!current)
-                        return false;
-                    else if (isArrayNode(current))
-                    {
-                        local = toArrayNode(current);
-                        break;
-                    }
-                    else
-                    {
-                        guard(nodeHP, item, toNode(current));
-                        if (toNode(current)->hash == hashValue && markToDelete(item, current))
-                        {
-                            uintptr_t ptrCast = reinterpret_cast<uintptr_t>(current);
-                            Item ptrMarked = reinterpret_cast<Item>(ptrCast | 0x1);
-                            if (item.compare_exchange_strong(ptrMarked, nullptr,
-                                                             std::memory_order_acquire, std::memory_order_relaxed))
-                                nodeHP.retire();
-                            return true;
-                        }
-                    }
-                }
-                catch (ContentionException &e)
+                nodeHP.release();
+                return false;
+            }
+            else if (toNode(current)->next)
+            {
+                // Swap the collision chain for a copy without the node
+                Node *chain = copyChain(toNode(current), node);
+                if (item.compare_exchange_strong(current, chain,
+                                                 std::memory_order_acq_rel, std::memory_order_relaxed))
                 {
-                    if (failCount++ > Policy::MaxFailCount)
-                    {
-                        local = expandTable(item, R);
-                        failCount = 0;
-                    }
-                    continue;
+                    nodeHP.retire();
+                    count(-1);
+                    return true;
                 }
-                return false;
+                ChainDeleter()(chain);
+                nodeHP.release();
+                contention(nodeHP, item, cursor.R, failCount);
+            }
+            else if (!markToDelete(item, current))
+            {
+                nodeHP.release();
+                contention(nodeHP, item, cursor.R, failCount);
+            }
+            else
+            {
+                // When the slot was frozen meanwhile, the fold retires the marked node
+                uintptr_t ptrCast = reinterpret_cast<uintptr_t>(current);
+                Item ptrMarked = reinterpret_cast<Item>(ptrCast | 0x1);
+                if (item.compare_exchange_strong(ptrMarked, nullptr,
+                                                 std::memory_order_acquire, std::memory_order_relaxed))
+                    nodeHP.retire();
+                else
+                    nodeHP.release();
+                count(-1);
+                return true;
             }
         }
         return false;
     }
 
-    HashTable<Key, Data, Policy>() : keySize(sizeof(Key) * 8),
-                                   head(new std::atomic<Item>[Policy::BlockSize]())
+    /**
+     * compact
+     *
+     * Fold back every child ArrayNode left with at most one entry into its parent slot,
+     * bottom-up so that emptied subtrees collapse in a single pass, and retire the
+     * ArrayNodes folded. Safe to run concurrently with all the other operations, for
+     * instance from a maintenance thread after a burst of removals. Return the number
+     * of ArrayNodes folded.
+     */
+    std::size_t compact()
+    {
+        std::size_t folded = 0;
+        for (std::size_t pos = 0; pos < Policy::BlockSize; ++pos)
+            folded += compactSlot(head[pos]);
+        return folded;
+    }
+
+    /**
+     * size
+     *
+     * Approximate number of entries: the sum of striped counters updated by the threads
+     * on each successful insert and remove. Exact when no update is in progress.
+     */
+    std::size_t size() const
+    {
+        long total = 0;
+        for (std::size_t i = 0; i < Policy::CounterStripes; ++i)
+            total += counters[i].value.load(std::memory_order_relaxed);
+        return total > 0 ? total : 0;
+    }
+
+    /**
+     * forEach
+     *
+     * Call 'f(key, data)' on every entry while the table keeps being updated. The walk is
+     * weakly consistent: each entry present during the whole walk is visited exactly once,
+     * entries inserted or removed meanwhile may or may not be. The node of the visited
+     * entry is protected by a HazardPointer during the call.
+     */
+    template <typename F>
+    void forEach(F f)
+    {
+        forEachBucket(f, 0, 1);
+    }
+
+    /**
+     * forEach (parallel)
+     *
+     * Same as above with the top-level buckets split among 'nbThreads' threads (one per
+     * core for 0), 'f' must then be safe to call concurrently.
+     */
+    template <typename F>
+    void forEach(F f, std::size_t nbThreads)
+    {
+        if (!nbThreads)
+            nbThreads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> workers;
+        for (std::size_t t = 1; t < nbThreads; ++t)
+            workers.push_back(std::thread([this, &f, t, nbThreads] { forEachBucket(f, t, nbThreads); }));
+        forEachBucket(f, 0, nbThreads);
+
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    /**
+     * snapshot
+     *
+     * Copy of the entries, with the same consistency as forEach.
+     */
+    std::vector<std::pair<Key, Data>> snapshot()
+    {
+        std::vector<std::pair<Key, Data>> entries;
+        entries.reserve(size());
+        forEach([&entries](const Key &key, const Data &data) { entries.emplace_back(key, data); });
+        return entries;
+    }
+
+    HashTable<Key, Data, Policy>() : keySize(sizeof(std::size_t) * 8),
+                                   head(ArrayAllocator::create()->slots)
     {
         std::size_t policyBlockSize = Policy::BlockSize;
         int arrayNodePowTmp = 0;
@@ -223,6 +413,16 @@ class HashTable
         arrayNodePow = arrayNodePowTmp;
     }
 
+    // No thread may use the table anymore: the entries and the ArrayNodes still in the
+    // trie are destroyed, the ones already retired belong to the reclamation scheme
+    ~HashTable()
+    {
+        destroy(head);
+    }
+
+    HashTable(const HashTable &) = delete;
+    HashTable &operator=(const HashTable &) = delete;
+
   private:
     friend class DefaultHashTablePolicy;
 
@@ -230,16 +430,147 @@ class HashTable
     using ArrayNode = std::atomic<Item> *;
     struct Node
     {
+        std::size_t hash; // Compared first, as a fingerprint of the key
+        Key key;
         Data data;
-        std::size_t hash;
+        Node *next; // Collision chain: the other keys of the same hash, never changed once published
         std::atomic<int> accessCount;
 
-        Node(Data d, std::size_t h) : data(d), hash(h), accessCount(0) {}
+        Node(const Key &k, Data d, std::size_t h) : hash(h), key(k), data(d), next(nullptr), accessCount(0) {}
     };
 
+    // Allocation unit of an ArrayNode, so that it can be retired through a HazardPointer
+    struct ArrayBlock
+    {
+        std::atomic<Item> slots[Policy::BlockSize];
+
+        ArrayBlock() : slots() {}
+    };
+
+    // Nodes and ArrayNodes come from the allocators of the policy and go back to them
+    // when the reclamation scheme of the policy destroys them
+    using NodeAllocator = typename Policy::template NodeAllocator<Node>;
+    using ArrayAllocator = typename Policy::template ArrayAllocator<ArrayBlock>;
+
+    // Give a node back to its allocator with the collision chain behind it
+    struct ChainDeleter
+    {
+        void operator()(Node *node) const
+        {
+            while (node)
+            {
+                Node *next = node->next;
+                NodeAllocator::destroy(node);
+                node = next;
+            }
+        }
+    };
+
+    using NodeHP = typename Policy::template Reclaimer<Node, ChainDeleter>;
+    using ArrayHP = typename Policy::template Reclaimer<ArrayBlock, DNFC::AllocatorDeleter<ArrayAllocator>>;
+
+    /**
+     * Cursor
+     *
+     * Position of a thread walking down the trie: the ArrayNode it is in, the slot of
+     * the parent holding it (needed to complete a fold) and the depth. The ArrayNode is
+     * protected by one of two HazardPointers, the other one protecting the next level
+     * while it is validated.
+     */
+    struct Cursor
+    {
+        ArrayNode local;
+        std::atomic<Item> *parent;
+        std::size_t R;
+        int current;
+        ArrayHP arrayHP[2];
+    };
+
+    struct BatchState
+    {
+        std::size_t hashValue;
+        Cursor cursor;
+        std::atomic<Item> *slot;
+        Node *node;
+        bool done;
+    };
+
+    /**
+     * Insert operations
+     */
+    bool insertNode(Node *insertThis, Cursor &cursor)
+    {
+        NodeHP nodeHP;
+        std::size_t failCount = 0;
+
+        while (cursor.R < keySize)
+        {
+            std::atomic<Item> &item = cursor.local[slotOf(insertThis->hash, cursor.R)];
+            Item current = item.load(std::memory_order_relaxed);
+            if (isFrozen(current))
+                help(cursor);
+            else if (!current)
+            {
+                if (item.compare_exchange_strong(current, insertThis,
+                                                 std::memory_order_acq_rel, std::memory_order_relaxed))
+                    return true;
+                contention(nodeHP, item, cursor.R, failCount);
+            }
+            else if (isArrayNode(current))
+                failCount = enter(cursor, item, current) ? 0 : failCount;
+            else if (!guard(nodeHP, item, current))
+                contention(nodeHP, item, cursor.R, failCount);
+            else if (isMarked(current))
+            {
+                if (item.compare_exchange_strong(current, insertThis,
+                                                 std::memory_order_acq_rel, std::memory_order_relaxed))
+                {
+                    nodeHP.retire();
+                    return true;
+                }
+                nodeHP.release();
+                contention(nodeHP, item, cursor.R, failCount);
+            }
+            else if (find(toNode(current), insertThis->key, insertThis->hash))
+            {
+                nodeHP.release();
+                NodeAllocator::destroy(insertThis);
+                return false;
+            }
+            else if (toNode(current)->hash == insertThis->hash)
+            {
+                // No level of the trie tells the keys apart: chain the new node in front
+                // of a copy of the chain in the slot
+                insertThis->next = copyChain(toNode(current), nullptr);
+                if (item.compare_exchange_strong(current, insertThis,
+                                                 std::memory_order_acq_rel, std::memory_order_relaxed))
+                {
+                    nodeHP.retire();
+                    return true;
+                }
+                ChainDeleter()(insertThis->next);
+                insertThis->next = nullptr;
+                nodeHP.release();
+                contention(nodeHP, item, cursor.R, failCount);
+            }
+            else
+            {
+                expandTable(item, cursor.R, current);
+                nodeHP.release();
+            }
+        }
+        NodeAllocator::destroy(insertThis);
+        return false;
+    }
+
     /**
      * Traversal operations
      */
+    std::size_t slotOf(std::size_t hashValue, int depth)
+    {
+        return (hashValue >> depth) & (Policy::BlockSize - 1);
+    }
+
     bool isArrayNode(Item ptr)
     {
         uintptr_t ptrCast = reinterpret_cast<uintptr_t>(ptr);
@@ -249,27 +580,101 @@ class HashTable
     Node *toNode(Item ptr)
     {
         uintptr_t ptrCast = reinterpret_cast<uintptr_t>(ptr);
-        return reinterpret_cast<Node *>(ptrCast & ~0x3);
+        return reinterpret_cast<Node *>(ptrCast & ~0x7);
     }
 
     ArrayNode toArrayNode(Item ptr)
     {
         uintptr_t ptrCast = reinterpret_cast<uintptr_t>(ptr);
-        return reinterpret_cast<ArrayNode>(ptrCast & ~0x3);
+        return reinterpret_cast<ArrayNode>(ptrCast & ~0x7);
+    }
+
+    ArrayBlock *toBlock(ArrayNode local)
+    {
+        return reinterpret_cast<ArrayBlock *>(local);
+    }
+
+    // Node of 'key' in the collision chain starting at 'node', nullptr when absent
+    Node *find(Node *node, const Key &key, std::size_t hashValue)
+    {
+        if (node->hash != hashValue)
+            return nullptr;
+        for (; node; node = node->next)
+            if (node->key == key)
+                return node;
+        return nullptr;
+    }
+
+    // Copy of the collision chain starting at 'node', without the node 'skip'
+    Node *copyChain(Node *node, const Node *skip)
+    {
+        Node *head = nullptr;
+        Node **tail = &head;
+        for (; node; node = node->next)
+        {
+            if (node == skip)
+                continue;
+            *tail = NodeAllocator::create(node->key, node->data, node->hash);
+            tail = &(*tail)->next;
+        }
+        return head;
+    }
+
+    void restart(Cursor &cursor)
+    {
+        cursor.local = head;
+        cursor.parent = nullptr;
+        cursor.R = 0;
+        cursor.current = 0;
+    }
+
+    // Move the cursor into the child ArrayNode 'child' read from 'item', unless the slot
+    // changed before the child was protected
+    bool enter(Cursor &cursor, std::atomic<Item> &item, Item child)
+    {
+        int next = cursor.current ^ 1;
+        cursor.arrayHP[next] = toBlock(toArrayNode(child));
+        if (item.load(std::memory_order_acquire) != child)
+            return false;
+
+        cursor.current = next;
+        cursor.parent = &item;
+        cursor.local = toArrayNode(child);
+        cursor.R += arrayNodePow;
+        return true;
+    }
+
+    // The cursor found a frozen slot: complete the fold and restart from the root
+    void help(Cursor &cursor)
+    {
+        fold(*cursor.parent, cursor.local);
+        restart(cursor);
     }
 
     /**
      * Memory operations
      */
-    struct ContentionException : public std::exception
+    // Publish the node of 'expected' in the hazard pointer and check that the slot still
+    // holds it. A frozen slot fails: its ArrayNode may already be folded away.
+    bool guard(NodeHP &hp, std::atomic<Item> &item, Item expected)
     {
-    };
+        hp = toNode(expected);
+        Item current = item.load(std::memory_order_acquire);
+        return !isFrozen(current) && toNode(current) == toNode(expected);
+    }
 
-    void guard(DNFC::HazardPointer<Node> &hp, std::atomic<Item> &item, Node *expected)
+    // A CAS or a guard lost a race on 'item': once the slot failed more than
+    // 'Policy::MaxFailCount' times in a row, expand it to spread the contending threads
+    void contention(NodeHP &hp, std::atomic<Item> &item, int depth, std::size_t &failCount)
     {
-        hp = toNode(item.load(std::memory_order_relaxed));
-        if (hp.get() != expected)
-            throw ContentionException();
+        if (failCount++ <= Policy::MaxFailCount || depth + arrayNodePow >= keySize)
+            return;
+
+        failCount = 0;
+        Item current = item.load(std::memory_order_relaxed);
+        if (current && !isArrayNode(current) && !isMarked(current) && !isFrozen(current) && guard(hp, item, current))
+            expandTable(item, depth, current);
+        hp.release();
     }
 
     bool markToDelete(std::atomic<Item> &item, Item expected)
@@ -295,41 +700,294 @@ class HashTable
         return reinterpret_cast<Item>(ptrCast & ~0x1);
     }
 
+    bool isFrozen(Item ptr)
+    {
+        uintptr_t ptrCast = reinterpret_cast<uintptr_t>(ptr);
+        return (ptrCast & 0x4);
+    }
+
+    Item freeze(Item ptr)
+    {
+        uintptr_t ptrCast = reinterpret_cast<uintptr_t>(ptr);
+        return reinterpret_cast<Item>(ptrCast | 0x4);
+    }
+
+    Item unfreeze(Item ptr)
+    {
+        uintptr_t ptrCast = reinterpret_cast<uintptr_t>(ptr);
+        return reinterpret_cast<Item>(ptrCast & ~0x4);
+    }
+
     /**
      * Expand operations
      */
-    ArrayNode expandTable(std::atomic<Item> &ptr, int depth)
+    ArrayNode expandTable(std::atomic<Item> &ptr, int depth, Item ptrValue)
     {
-        // Checking that expansion need to be done
-        Item ptrValue = ptr.load(std::memory_order_relaxed);
+        // Checking that expansion need to be done ('ptrValue' is guarded by the caller)
         if (isArrayNode(ptrValue))
-            return toArrayNode(ptr.load(std::memory_order_relaxed));
+            return toArrayNode(ptrValue);
 
         // Create block and reinsert the node in it
-        ArrayNode newBlock = new std::atomic<Item>[Policy::BlockSize]();
-        std::size_t hash = toNode(ptrValue)->hash >> (depth + arrayNodePow);
-        int pos = hash & (Policy::BlockSize - 1);
+        ArrayNode newBlock = ArrayAllocator::create()->slots;
+        int pos = slotOf(toNode(ptrValue)->hash, depth + arrayNodePow);
         newBlock[pos] = ptrValue;
 
         // Mark the pointer as being an ArrayNode
         uintptr_t ptrCast = reinterpret_cast<uintptr_t>(newBlock);
         Item ptrMarked = reinterpret_cast<Item>(ptrCast | 0x2);
 
-        // Try to insert it in
-        Item expected = ptr.load(std::memory_order_relaxed);
-        if (ptr.compare_exchange_strong(expected, ptrMarked,
-                                        std::memory_order_acquire, std::memory_order_relaxed))
+        // Try to insert it in, the slot must still hold the node we moved
+        if (ptr.compare_exchange_strong(ptrValue, ptrMarked,
+                                        std::memory_order_acq_rel, std::memory_order_relaxed))
             return newBlock;
 
         // Attempt failed
-        delete[] newBlock;
-        return toArrayNode(ptr.load(std::memory_order_relaxed));
+        ArrayAllocator::destroy(toBlock(newBlock));
+        return isArrayNode(ptrValue) ? toArrayNode(ptrValue) : nullptr;
+    }
+
+    /**
+     * Compaction operations
+     */
+    std::size_t compactSlot(std::atomic<Item> &item)
+    {
+        Item current = item.load(std::memory_order_acquire);
+        if (!isArrayNode(current) || isFrozen(current))
+            return 0;
+
+        ArrayHP arrayHP;
+        arrayHP = toBlock(toArrayNode(current));
+        if (item.load(std::memory_order_acquire) != current)
+            return 0;
+
+        ArrayNode local = toArrayNode(current);
+        std::size_t folded = 0;
+        for (std::size_t pos = 0; pos < Policy::BlockSize; ++pos)
+            folded += compactSlot(local[pos]);
+
+        // Only fold the ArrayNodes holding at most one node and no ArrayNode
+        std::size_t live = 0;
+        for (std::size_t pos = 0; pos < Policy::BlockSize; ++pos)
+        {
+            Item child = local[pos].load(std::memory_order_relaxed);
+            if (isArrayNode(child) || (child && !isMarked(child) && ++live > 1))
+                return folded;
+        }
+        return folded + fold(item, local);
+    }
+
+    /**
+     * fold
+     *
+     * Freeze every slot of 'local', held by 'parent', then replace it in 'parent' by its
+     * only node, by nothing, or by an unfrozen copy when entries were added before the
+     * freeze completed. Every thread finding a frozen slot runs the same steps: the
+     * frozen content cannot change, so they all compute the same replacement and only
+     * the one that swaps it in retires the ArrayNode and the removed nodes left in it.
+     */
+    bool fold(std::atomic<Item> &parent, ArrayNode local)
+    {
+        std::size_t live = 0;
+        bool hasArrayNode = false;
+        Item last = nullptr;
+        for (std::size_t pos = 0; pos < Policy::BlockSize; ++pos)
+        {
+            Item current = local[pos].load(std::memory_order_relaxed);
+            while (!isFrozen(current) &&
+                   !local[pos].compare_exchange_weak(current, freeze(current),
+                                                     std::memory_order_acq_rel, std::memory_order_relaxed))
+                ;
+            current = unfreeze(current);
+            if (isArrayNode(current))
+                hasArrayNode = true;
+            else if (current && !isMarked(current))
+            {
+                ++live;
+                last = current;
+            }
+        }
+
+        ArrayBlock *copy = nullptr;
+        Item replacement = last;
+        if (hasArrayNode || live > 1)
+        {
+            copy = ArrayAllocator::create();
+            for (std::size_t pos = 0; pos < Policy::BlockSize; ++pos)
+            {
+                Item current = unfreeze(local[pos].load(std::memory_order_relaxed));
+                if (!isMarked(current))
+                    copy->slots[pos].store(current, std::memory_order_relaxed);
+            }
+            replacement = reinterpret_cast<Item>(reinterpret_cast<uintptr_t>(copy->slots) | 0x2);
+        }
+
+        Item expected = reinterpret_cast<Item>(reinterpret_cast<uintptr_t>(local) | 0x2);
+        if (!parent.compare_exchange_strong(expected, replacement,
+                                            std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+            ArrayAllocator::destroy(copy);
+            return false;
+        }
+
+        for (std::size_t pos = 0; pos < Policy::BlockSize; ++pos)
+        {
+            Item current = unfreeze(local[pos].load(std::memory_order_relaxed));
+            if (isMarked(current))
+            {
+                NodeHP removed(toNode(current));
+                removed.retire();
+            }
+        }
+        ArrayHP folded(toBlock(local));
+        folded.retire();
+        return true;
+    }
+
+    void destroy(ArrayNode array)
+    {
+        for (std::size_t pos = 0; pos < Policy::BlockSize; ++pos)
+        {
+            Item item = array[pos].load(std::memory_order_relaxed);
+            if (isArrayNode(item))
+                destroy(toArrayNode(item));
+            else
+                ChainDeleter()(toNode(item));
+        }
+        ArrayAllocator::destroy(toBlock(array));
+    }
+
+    /**
+     * Iteration operations
+     */
+    template <typename F>
+    void forEachBucket(F &f, std::size_t first, std::size_t step)
+    {
+        NodeHP nodeHP;
+        for (std::size_t pos = first; pos < Policy::BlockSize; pos += step)
+        {
+            // A walk stopped by a fold starts again from the bucket, after the last entry
+            bool started = false;
+            std::size_t last = 0;
+            while (!walk(head[pos], nullptr, head, 0, f, nodeHP, started, last))
+                ;
+        }
+    }
+
+    // Whether the entry of hash 'a' comes after the entry of hash 'b' in the order of
+    // the walk: by slot at the first level, then at the second level, and so on
+    bool walksAfter(std::size_t a, std::size_t b)
+    {
+        if (a == b)
+            return false;
+        int depth = __builtin_ctzll(a ^ b) / arrayNodePow * arrayNodePow;
+        return slotOf(a, depth) > slotOf(b, depth);
+    }
+
+    /**
+     * walk
+     *
+     * Visit the entries under 'item', a slot of the ArrayNode 'array' held by 'parent'
+     * at depth 'depth', calling 'f' on the ones after 'last'. Return false when the walk
+     * ran into a fold: the fold is completed and the walk has to start again from the
+     * bucket.
+     */
+    template <typename F>
+    bool walk(std::atomic<Item> &item, std::atomic<Item> *parent, ArrayNode array, int depth, F &f,
+              NodeHP &nodeHP, bool &started, std::size_t &last)
+    {
+        for (;;)
+        {
+            Item current = item.load(std::memory_order_relaxed);
+            if (isFrozen(current))
+            {
+                fold(*parent, array);
+                return false;
+            }
+            else if (!current || isMarked(current))
+                return true;
+            else if (isArrayNode(current))
+            {
+                ArrayHP arrayHP;
+                arrayHP = toBlock(toArrayNode(current));
+                if (item.load(std::memory_order_acquire) != current)
+                    continue;
+
+                ArrayNode local = toArrayNode(current);
+                for (std::size_t pos = 0; pos < Policy::BlockSize; ++pos)
+                    if (!walk(local[pos], &item, local, depth + arrayNodePow, f, nodeHP, started, last))
+                        return false;
+                return true;
+            }
+            else if (!guard(nodeHP, item, current))
+                continue;
+
+            Node *node = toNode(current);
+            if (!started || walksAfter(node->hash, last))
+            {
+                for (Node *entry = node; entry; entry = entry->next)
+                    f(static_cast<const Key &>(entry->key), static_cast<const Data &>(entry->data));
+                started = true;
+                last = node->hash;
+            }
+            nodeHP.release();
+            return true;
+        }
+    }
+
+    /**
+     * Counting operations
+     */
+    struct alignas(64) Counter
+    {
+        std::atomic<long> value;
+    };
+
+    void count(long delta)
+    {
+        static std::atomic<std::size_t> nextStripe(0);
+        static thread_local std::size_t stripe = nextStripe.fetch_add(1, std::memory_order_relaxed);
+        if (delta)
+            counters[stripe & (Policy::CounterStripes - 1)].value.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    /**
+     * Batch operations
+     */
+    template <int RW>
+    void startBatch(const Key *keys, BatchState *state, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            BatchState &s = state[i];
+            s.hashValue = hashKey(keys[i]);
+            restart(s.cursor);
+            s.slot = &head[slotOf(s.hashValue, 0)];
+            s.node = nullptr;
+            s.done = false;
+            __builtin_prefetch(s.slot, RW, 3);
+        }
+    }
+
+    // Move a batched key one level down into the ArrayNode 'child' read from its slot and
+    // prefetch its slot there. The key stays on the same slot if it changed meanwhile.
+    template <int RW>
+    bool descend(BatchState &s, Item child)
+    {
+        if (s.cursor.R + arrayNodePow >= keySize)
+            return false;
+        if (enter(s.cursor, *s.slot, child))
+        {
+            s.slot = &s.cursor.local[slotOf(s.hashValue, s.cursor.R)];
+            __builtin_prefetch(s.slot, RW, 3);
+        }
+        return true;
     }
 
     ArrayNode head;
+    Counter counters[Policy::CounterStripes] = {};
     std::size_t arrayNodePow;
     std::size_t keySize;
-    std::hash<Key> hashKey;
+    typename Policy::template Hash<Key> hashKey;
 };
 } // namespace DNFC
 
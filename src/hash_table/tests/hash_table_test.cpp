@@ -3,13 +3,36 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <thread>
+#include <set>
+#include <atomic>
+#include <algorithm>
 #include <pthread.h>
+#include <string.h>
+#include <netinet/in.h>
 #include <gtest/gtest.h>
 
 #include "../hashtable.hpp"
+#include "../fixedkey.hpp"
+#include "../hashers.hpp"
 
 using namespace DNFC;
 
+// Key type for which every two consecutive keys share the same hash
+struct CollidingKey
+{
+    int value;
+    bool operator==(const CollidingKey &other) const { return value == other.value; }
+};
+
+namespace std
+{
+template <>
+struct hash<CollidingKey>
+{
+    std::size_t operator()(const CollidingKey &key) const { return key.value / 2; }
+};
+} // namespace std
+
 /**
  * Standard tests part
  */
@@ -65,6 +88,324 @@ TEST(HashTableTest, TriggerResizingOnInsert)
     for(int j = 0; j < 16; j++)
         EXPECT_EQ(hm.get(j), j);
 }
+
+TEST(HashTableTest, BatchInsert)
+{
+    HashTable<int, int, TestHashTablePolicy> hm;
+    int keys[100];
+    for (int i = 0; i < 100; i++)
+        keys[i] = i;
+    EXPECT_EQ(hm.insertBatch(keys, keys, 100), 100);
+    EXPECT_EQ(hm.insertBatch(keys, keys, 100), 0);
+    for (int j = 0; j < 100; j++)
+        EXPECT_EQ(hm.get(j), j);
+}
+
+TEST(HashTableTest, BatchGet)
+{
+    HashTable<int, int, TestHashTablePolicy> hm;
+    int keys[100];
+    int out[100];
+    for (int i = 0; i < 100; i++)
+    {
+        keys[i] = i;
+        if (i % 2)
+            hm.insert(i, i);
+    }
+    hm.getBatch(keys, out, 100);
+    for (int j = 0; j < 100; j++)
+        EXPECT_EQ(out[j], j % 2 ? j : int{});
+}
+
+TEST(HashTableTest, SameHashDifferentKey)
+{
+    HashTable<CollidingKey, int, TestHashTablePolicy> hm;
+    EXPECT_TRUE(hm.insert(CollidingKey{2}, 2));
+    EXPECT_EQ(hm.get(CollidingKey{3}), int{});
+    EXPECT_FALSE(hm.remove(CollidingKey{3}));
+    EXPECT_EQ(hm.get(CollidingKey{2}), 2);
+}
+
+TEST(HashTableTest, SameHashBothStored)
+{
+    HashTable<CollidingKey, int, TestHashTablePolicy> hm;
+    EXPECT_TRUE(hm.insert(CollidingKey{2}, 2));
+    EXPECT_TRUE(hm.insert(CollidingKey{3}, 3));
+    EXPECT_TRUE(hm.insert(CollidingKey{4}, 4));
+    EXPECT_FALSE(hm.insert(CollidingKey{3}, 0));
+    EXPECT_EQ(hm.size(), 3);
+    EXPECT_EQ(hm.get(CollidingKey{2}), 2);
+    EXPECT_EQ(hm.get(CollidingKey{3}), 3);
+
+    CollidingKey keys[2] = {{2}, {3}};
+    int out[2];
+    hm.getBatch(keys, out, 2);
+    EXPECT_EQ(out[0], 2);
+    EXPECT_EQ(out[1], 3);
+    EXPECT_EQ(hm.snapshot().size(), 3);
+
+    EXPECT_TRUE(hm.remove(CollidingKey{2}));
+    EXPECT_EQ(hm.get(CollidingKey{2}), int{});
+    EXPECT_EQ(hm.get(CollidingKey{3}), 3);
+    EXPECT_TRUE(hm.remove(CollidingKey{3}));
+    EXPECT_FALSE(hm.remove(CollidingKey{3}));
+    EXPECT_EQ(hm.get(CollidingKey{3}), int{});
+    EXPECT_EQ(hm.get(CollidingKey{4}), 4);
+    EXPECT_EQ(hm.size(), 1);
+}
+
+TEST(HashTableTest, FixedSizeKeys)
+{
+    HashTable<FixedKey<13>, int> hm;
+    FixedKey<13> keys[64] = {};
+    for (int i = 0; i < 64; i++)
+    {
+        keys[i].bytes[i % 13] = i + 1;
+        EXPECT_TRUE(hm.insert(keys[i], i));
+    }
+    for (int j = 0; j < 64; j++)
+        EXPECT_EQ(hm.get(keys[j]), j);
+}
+
+class CRC32CHashTablePolicy : public TestHashTablePolicy
+{
+    public:
+    template <typename Key>
+    using Hash = CRC32CHash<Key>;
+};
+
+TEST(HashTableTest, PolicyHasher)
+{
+    HashTable<int, int, CRC32CHashTablePolicy> hm;
+    for (int i = 0; i < 64; i++)
+        EXPECT_TRUE(hm.insert(i, i));
+    for (int j = 0; j < 64; j++)
+        EXPECT_EQ(hm.get(j), j);
+}
+
+// Counts the nodes and ArrayNodes the table takes from and gives back to its allocators
+std::atomic<int> allocatorCreated(0);
+std::atomic<int> allocatorDestroyed(0);
+
+template <typename T>
+struct CountingAllocator
+{
+    template <typename... Args>
+    static T *create(Args &&... args)
+    {
+        ++allocatorCreated;
+        return NewAllocator<T>::create(std::forward<Args>(args)...);
+    }
+
+    static void destroy(T *ptr)
+    {
+        ++allocatorDestroyed;
+        NewAllocator<T>::destroy(ptr);
+    }
+};
+
+// Hazard pointers scanning at every retirement
+class EagerHazardPointerPolicy : public DefaultHazardPointerPolicy
+{
+    public:
+    const static int ScanFactor = 0;
+    const static int ScanMinimum = 1;
+};
+
+class CountingHashTablePolicy : public TestHashTablePolicy
+{
+    public:
+    template <typename T>
+    using NodeAllocator = CountingAllocator<T>;
+    template <typename T>
+    using ArrayAllocator = CountingAllocator<T>;
+    template <typename T, typename Deleter>
+    using Reclaimer = HazardPointer<T, EagerHazardPointerPolicy, Deleter>;
+};
+
+TEST(HashTableTest, PolicyAllocators)
+{
+    HashTable<int, int, CountingHashTablePolicy> hm;
+    EXPECT_EQ(allocatorCreated, 1); // Root ArrayNode
+    for (int i = 0; i < 64; i++)
+        EXPECT_TRUE(hm.insert(i, i));
+    EXPECT_GE(allocatorCreated, 65);
+
+    // The node of a duplicate goes straight back to the allocator
+    int created = allocatorCreated, destroyed = allocatorDestroyed;
+    EXPECT_FALSE(hm.insert(0, 0));
+    EXPECT_EQ(allocatorCreated, created + 1);
+    EXPECT_EQ(allocatorDestroyed, destroyed + 1);
+
+    // Removed nodes and folded ArrayNodes are reclaimed through the allocators
+    for (int i = 0; i < 64; i++)
+        EXPECT_TRUE(hm.remove(i));
+    EXPECT_GT(hm.compact(), 0);
+    EXPECT_GT(allocatorDestroyed, destroyed + 1);
+    EXPECT_LE(allocatorDestroyed, allocatorCreated);
+}
+
+class EpochHashTablePolicy : public DefaultHashTablePolicy
+{
+    public:
+    template <typename T, typename Deleter>
+    using Reclaimer = EpochPointer<T, Deleter>;
+};
+
+class CountingEpochHashTablePolicy : public CountingHashTablePolicy
+{
+    public:
+    template <typename T, typename Deleter>
+    using Reclaimer = EpochPointer<T, Deleter>;
+};
+
+TEST(HashTableTest, EpochReclaimer)
+{
+    HashTable<int, int, CountingEpochHashTablePolicy> hm;
+    {
+        // A burst of lookups in a single region
+        Epoch::Region region;
+        for (int i = 0; i < 256; i++)
+            EXPECT_TRUE(hm.insert(i, i));
+        for (int j = 0; j < 256; j++)
+            EXPECT_EQ(hm.get(j), j);
+    }
+
+    int destroyed = allocatorDestroyed;
+    for (int i = 0; i < 256; i++)
+        EXPECT_TRUE(hm.remove(i));
+    EXPECT_GT(hm.compact(), 0);
+    for (int i = 0; i < 4; i++)
+        Epoch::collect();
+    EXPECT_GE(allocatorDestroyed, destroyed + 256);
+    EXPECT_EQ(hm.snapshot().size(), 0);
+}
+
+TEST(HashTableTest, CRC32CHash)
+{
+    FixedKey<9> key;
+    memcpy(key.bytes, "123456789", 9);
+    EXPECT_EQ(HashDetail::crc32cSoftware(0xffffffff, key.bytes, 9), 0x1CF96D7Cu); // ~0xE3069283
+    EXPECT_EQ((CRC32CHash<FixedKey<9>>()(key) & 0xffffffff), 0x1CF96D7Cu);
+}
+
+TEST(HashTableTest, ToeplitzHashIsRSSHash)
+{
+    // Microsoft RSS verification suite: 66.9.149.187:2794 -> 161.142.100.80:1766 (TCP)
+    FixedKey<13> key = {{IPPROTO_TCP, 66, 9, 149, 187, 161, 142, 100, 80, 0x0a, 0xea, 0x06, 0xe6}};
+    EXPECT_EQ((ToeplitzHash<FixedKey<13>, 1>()(key) & 0xffffffff), 0x51ccc178u);
+
+    FixedKey<8> addresses = {{66, 9, 149, 187, 161, 142, 100, 80}};
+    EXPECT_EQ(ToeplitzHash<FixedKey<8>>()(addresses) & 0xffffffff, 0x323e8fc2u);
+}
+
+TEST(HashTableTest, Size)
+{
+    HashTable<int, int, TestHashTablePolicy> hm;
+    int keys[40];
+    for (int i = 0; i < 40; i++)
+        keys[i] = i + 100;
+    for (int i = 0; i < 60; i++)
+        hm.insert(i, i);
+    hm.insertBatch(keys, keys, 40);
+    for (int i = 0; i < 20; i++)
+        hm.remove(i);
+    hm.remove(1000);
+    EXPECT_EQ(hm.size(), 80);
+}
+
+TEST(HashTableTest, ForEach)
+{
+    HashTable<int, int, TestHashTablePolicy> hm;
+    for (int i = 0; i < 100; i++)
+        hm.insert(i, i * 2);
+    hm.remove(50);
+
+    std::set<int> visited;
+    hm.forEach([&visited](const int &key, const int &data) {
+        EXPECT_EQ(data, key * 2);
+        EXPECT_TRUE(visited.insert(key).second);
+    });
+    EXPECT_EQ(visited.size(), 99);
+    EXPECT_EQ(visited.count(50), 0);
+}
+
+TEST(HashTableTest, ParallelForEach)
+{
+    HashTable<int, int> hm;
+    for (int i = 0; i < 10000; i++)
+        hm.insert(i, i);
+
+    std::atomic<long> sum(0);
+    std::atomic<int> visited(0);
+    hm.forEach([&](const int &, const int &data) {
+        sum += data;
+        visited++;
+    }, 4);
+    EXPECT_EQ(visited.load(), 10000);
+    EXPECT_EQ(sum.load(), 10000L * 9999 / 2);
+}
+
+TEST(HashTableTest, ForEachOnEveryCore)
+{
+    HashTable<int, int> hm;
+    for (int i = 0; i < 1000; i++)
+        hm.insert(i, i);
+
+    // 0 threads is one per core, not an endless walk
+    std::atomic<int> visited(0);
+    hm.forEach([&visited](const int &, const int &) { visited++; }, 0);
+    EXPECT_EQ(visited.load(), 1000);
+}
+
+TEST(HashTableTest, Snapshot)
+{
+    HashTable<int, int, TestHashTablePolicy> hm;
+    for (int i = 0; i < 16; i++)
+        hm.insert(i, i + 1);
+
+    auto entries = hm.snapshot();
+    std::sort(entries.begin(), entries.end());
+    ASSERT_EQ(entries.size(), 16);
+    for (int i = 0; i < 16; i++)
+        EXPECT_EQ(entries[i], std::make_pair(i, i + 1));
+}
+TEST(HashTableTest, VisitAndRemoveIf)
+{
+    HashTable<int, int, TestHashTablePolicy> hm;
+    for (int i = 0; i < 16; i++)
+        hm.insert(i, i);
+
+    EXPECT_TRUE(hm.visit(3, [](int &data) { data += 100; }));
+    EXPECT_FALSE(hm.visit(50, [](int &data) { data = 0; }));
+    EXPECT_EQ(hm.get(3), 103);
+
+    auto above = [](const int &data) { return data > 50; };
+    EXPECT_FALSE(hm.removeIf(4, above));
+    EXPECT_TRUE(hm.removeIf(3, above));
+    EXPECT_FALSE(hm.visit(3, [](int &) {}));
+    EXPECT_EQ(hm.size(), 15);
+}
+TEST(HashTableTest, Compact)
+{
+    HashTable<int, int, TestHashTablePolicy> hm;
+    for (int i = 0; i < 256; i++)
+        hm.insert(i, i);
+    for (int i = 0; i < 256; i++)
+        if (i != 77)
+            hm.remove(i);
+
+    // Every ArrayNode collapses, the remaining entry goes back to the root
+    EXPECT_GT(hm.compact(), 0);
+    EXPECT_EQ(hm.compact(), 0);
+    EXPECT_EQ(hm.get(77), 77);
+    EXPECT_EQ(hm.snapshot().size(), 1);
+
+    for (int i = 0; i < 256; i++)
+        hm.insert(i, i + 1);
+    for (int j = 0; j < 256; j++)
+        EXPECT_EQ(hm.get(j), j == 77 ? 77 : j + 1);
+}
 // Standard tests part
 
 /**
@@ -112,6 +453,88 @@ TEST(HashTableTest, StressGet)
         worker.join();
 }
 
+TEST(HashTableTest, StressForEach)
+{
+    std::vector<std::thread> workers;
+    DNFC::HashTable<int, int> hm;
+    for (int i = 0; i < nbThreads; ++i)
+        hm.insert(i, i);
+
+    // Entries inserted before the walk and never removed must all be visited
+    for (int i = 0; i < 8; ++i)
+    {
+        workers.push_back(std::thread([&hm, i] {
+            for (int k = nbThreads + i; k < 8 * nbThreads; k += 8)
+            {
+                hm.insert(k, k);
+                hm.remove(k);
+            }
+        }));
+    }
+
+    std::atomic<int> stable(0);
+    hm.forEach([&stable](const int &key, const int &) {
+        if (key < nbThreads)
+            stable++;
+    }, 4);
+
+    for (auto &worker : workers)
+        worker.join();
+    EXPECT_EQ(stable.load(), nbThreads);
+    EXPECT_EQ(hm.size(), nbThreads);
+}
+
+template <typename Policy>
+void stressCompact()
+{
+    std::vector<std::thread> workers;
+    std::atomic<bool> stop(false);
+    DNFC::HashTable<int, int, Policy> hm;
+    for (int i = 0; i < nbThreads; ++i)
+        hm.insert(i, i);
+
+    // Keys below nbThreads stay, the others churn while the table is compacted
+    for (int i = 0; i < 8; ++i)
+    {
+        workers.push_back(std::thread([&hm, i] {
+            for (int round = 0; round < 20; ++round)
+            {
+                for (int k = nbThreads + i; k < 16 * nbThreads; k += 8)
+                    hm.insert(k, k);
+                for (int k = 0; k < nbThreads; ++k)
+                    EXPECT_EQ(hm.get(k), k);
+                for (int k = nbThreads + i; k < 16 * nbThreads; k += 8)
+                    EXPECT_TRUE(hm.remove(k));
+            }
+        }));
+    }
+    std::thread compactor([&hm, &stop] {
+        while (!stop.load())
+            hm.compact();
+    });
+
+    for (auto &worker : workers)
+        worker.join();
+    stop = true;
+    compactor.join();
+
+    hm.compact();
+    EXPECT_EQ(hm.size(), nbThreads);
+    EXPECT_EQ(hm.snapshot().size(), nbThreads);
+    for (int k = 0; k < nbThreads; ++k)
+        EXPECT_EQ(hm.get(k), k);
+}
+
+TEST(HashTableTest, StressCompact)
+{
+    stressCompact<DefaultHashTablePolicy>();
+}
+
+TEST(HashTableTest, StressCompactEpoch)
+{
+    stressCompact<EpochHashTablePolicy>();
+}
+
 TEST(HashTableTest, StressRemove)
 {
     std::vector<std::thread> workers;
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <netinet/in.h>
+
+#include "../dynamichypercuts.hpp"
+
+/**
+ * Static classification benchmark
+ *
+ * Build a HyperCuts tree of ClassBench-like 5-tuple rules over Ethernet frames: source
+ * and destination prefixes from a few hundred /16 networks, TCP, UDP or any protocol,
+ * mostly wildcard source ports and well-known, low or wildcard destination ports.
+ * Then classify frames, 90% of them drawn from a random rule, and print the build time
+ * (by one thread per core, then by a single thread), the size of the tree and the time
+ * of a lookup: mean over the whole stream (best of Runs), then the 99th percentile and
+ * the worst over the frames, each frame timed alone as its best of 3 passes, and the
+ * mean over the stream classified by bursts of
+ * HyperCuts::BurstSize frames (best of Runs). Then remove and insert back random rules
+ * of a DynamicHyperCuts, as an ACL update would, and print the mean and worst time of
+ * an update and the mean of a lookup by bursts once updated.
+ * Usage: hypercuts_bench [number of rules] [number of frames]
+ */
+using namespace DNFC;
+
+class SerialPolicy : public DefaultHyperCutsPolicy
+{
+  public:
+    const static std::size_t BuildThreads = 1;
+};
+
+const std::size_t FrameLength = 54;
+const unsigned Runs = 5;
+const unsigned Updates = 100;
+
+// Protocol, source and destination addresses, source and destination ports
+const uint32_t Offsets[5] = {23 * 8, 26 * 8, 30 * 8, 34 * 8, 36 * 8};
+const uint32_t Lengths[5] = {8, 32, 32, 16, 16};
+
+struct Rules
+{
+    std::vector<classifier_rule> rules;
+    std::vector<classifier_field> fields;
+    std::vector<classifier_field *> fieldPointers;
+    std::vector<classifier_rule *> pointers;
+    std::vector<uint32_t> actions;
+};
+
+uint32_t prefixMask(uint32_t length)
+{
+    return length >= 32 ? 0 : UINT32_MAX >> length;
+}
+
+void makeRules(Rules &set, std::size_t nbRules, std::mt19937 &random)
+{
+    const uint16_t wellKnown[] = {20, 21, 22, 23, 25, 53, 67, 80, 110, 123, 143, 161, 179, 389, 443, 445,
+                                  465, 514, 587, 636, 993, 995, 1433, 1521, 3306, 3389, 5060, 5432, 8080, 8443};
+    std::vector<uint32_t> networks(300);
+    for (uint32_t &network : networks)
+        network = random() & 0xffff0000;
+
+    set.rules.resize(nbRules);
+    set.fields.resize(nbRules * 5);
+    set.fieldPointers.resize(nbRules * 5);
+    set.pointers.resize(nbRules);
+    set.actions.resize(nbRules);
+    for (std::size_t i = 0; i < nbRules; ++i)
+    {
+        classifier_field *fields = &set.fields[i * 5];
+        unsigned draw = random() % 100;
+        fields[0].mask = draw < 10 ? 0xff : 0;
+        fields[0].value = draw < 70 ? IPPROTO_TCP : IPPROTO_UDP;
+        const uint32_t sourcePrefixes[] = {0, 8, 16, 16, 24, 24, 24, 32, 32, 32};
+        const uint32_t destinationPrefixes[] = {0, 16, 16, 24, 24, 24, 24, 32, 32, 32};
+        fields[1].mask = prefixMask(sourcePrefixes[random() % 10]);
+        fields[1].value = networks[random() % networks.size()] | (random() & 0xffff);
+        fields[2].mask = prefixMask(destinationPrefixes[random() % 10]);
+        fields[2].value = networks[random() % networks.size()] | (random() & 0xffff);
+        draw = random() % 100;
+        fields[3].mask = draw < 85 ? 0xffff : draw < 90 ? 0x3ff : 0;
+        fields[3].value = draw < 90 ? 0 : 1024 + random() % 64512;
+        draw = random() % 100;
+        fields[4].mask = draw < 20 ? 0xffff : draw < 30 ? 0x3ff : 0;
+        fields[4].value = draw < 30 ? 0 : draw < 85 ? wellKnown[random() % 30] : random() % 65536;
+        if (fields[0].mask && fields[1].mask == UINT32_MAX && fields[2].mask == UINT32_MAX && fields[3].mask &&
+            fields[4].mask)
+            fields[4].mask = 0; // No catch-all rule, it would hide all the rules behind it
+        for (std::size_t j = 0; j < 5; ++j)
+        {
+            fields[j].id = j;
+            fields[j].offset = Offsets[j];
+            fields[j].bit_length = Lengths[j];
+            fields[j].value &= ~fields[j].mask;
+            set.fieldPointers[i * 5 + j] = &fields[j];
+        }
+        set.actions[i] = i;
+        set.rules[i].id = i;
+        set.rules[i].fields = &set.fieldPointers[i * 5];
+        set.rules[i].nb_fields = 5;
+        set.rules[i].action = &set.actions[i];
+        set.pointers[i] = &set.rules[i];
+    }
+}
+
+void writeField(uint8_t *frame, std::size_t j, uint32_t value)
+{
+    for (std::size_t byte = 0; byte < Lengths[j] / 8; ++byte)
+        frame[Offsets[j] / 8 + byte] = value >> (Lengths[j] - 8 * (byte + 1));
+}
+
+void makeFrame(uint8_t *frame, const Rules &set, std::mt19937 &random)
+{
+    memset(frame, 0, FrameLength);
+    frame[12] = 0x08;
+    frame[14] = 0x45;
+    bool fromRule = random() % 10 != 0;
+    const classifier_rule &rule = set.rules[random() % set.rules.size()];
+    for (std::size_t j = 0; j < 5; ++j)
+    {
+        uint32_t value = random();
+        if (fromRule)
+            value = rule.fields[j]->value | (value & rule.fields[j]->mask);
+        writeField(frame, j, value);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t nbRules = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+    std::size_t nbFrames = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100000;
+
+    std::mt19937 random(42);
+    Rules set;
+    makeRules(set, nbRules, random);
+    HyperCuts<> tree(set.pointers.data(), nbRules);
+    const HyperCuts<>::Statistics &stats = tree.statistics();
+    const HyperCuts<SerialPolicy>::Statistics serial =
+        HyperCuts<SerialPolicy>(set.pointers.data(), nbRules).statistics();
+    printf("# %zu rules, built in %.1f ms by %zu threads (%.1f ms by one): %zu trees, %zu nodes, %zu leaves, "
+           "depth %zu, %zu rules checked per tree at most, %.2f MB\n",
+           nbRules, stats.buildTime / 1e3, stats.threads, serial.buildTime / 1e3, stats.trees, stats.nodes,
+           stats.leaves, stats.depth, stats.maxRules, stats.bytes / 1e6);
+
+    std::vector<uint8_t> frames(nbFrames * FrameLength);
+    for (std::size_t i = 0; i < nbFrames; ++i)
+        makeFrame(&frames[i * FrameLength], set, random);
+
+    // The whole stream as the static stage sees it, one frame at a time then by bursts
+    const std::size_t Burst = HyperCuts<>::BurstSize;
+    std::vector<const uint8_t *> headers(nbFrames);
+    std::vector<std::size_t> lengths(nbFrames, FrameLength), found(nbFrames);
+    for (std::size_t i = 0; i < nbFrames; ++i)
+        headers[i] = &frames[i * FrameLength];
+    std::size_t matched = 0, burstMatched = 0;
+    double mean = 1e12, burstMean = 1e12;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned run = 0; run < Runs; ++run)
+    {
+        matched = 0;
+        start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < nbFrames; ++i)
+            matched += tree.find(headers[i], FrameLength) != HyperCuts<>::NotFound;
+        mean = std::min(mean, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+                                  nbFrames);
+
+        burstMatched = 0;
+        start = std::chrono::steady_clock::now();
+        for (std::size_t base = 0; base < nbFrames; base += Burst)
+        {
+            std::size_t size = std::min(Burst, nbFrames - base);
+            tree.findBurst(&headers[base], &lengths[base], size, &found[base]);
+            for (std::size_t i = 0; i < size; ++i)
+                burstMatched += found[base + i] != HyperCuts<>::NotFound;
+        }
+        burstMean = std::min(burstMean, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start)
+                                                .count() /
+                                            nbFrames);
+    }
+    if (burstMatched != matched)
+        fprintf(stderr, "Bursts matched %zu frames instead of %zu\n", burstMatched, matched);
+
+    // Each frame alone, less the cost of reading the clock
+    std::vector<double> times(nbFrames, 1e12);
+    double clockCost = 1e12;
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        for (std::size_t i = 0; i < nbFrames; ++i)
+        {
+            auto before = std::chrono::steady_clock::now();
+            auto after = std::chrono::steady_clock::now();
+            clockCost = std::min(clockCost, std::chrono::duration<double, std::nano>(after - before).count());
+            before = std::chrono::steady_clock::now();
+            volatile std::size_t rule = tree.find(&frames[i * FrameLength], FrameLength);
+            (void)rule;
+            after = std::chrono::steady_clock::now();
+            times[i] = std::min(times[i], std::chrono::duration<double, std::nano>(after - before).count());
+        }
+    }
+    for (double &time : times)
+        time = std::max(0.0, time - clockCost);
+    std::sort(times.begin(), times.end());
+
+    printf("%12s %12s %12s %12s %12s\n", "matched", "mean ns", "p99 ns", "worst ns", "burst ns");
+    printf("%11.1f%% %12.1f %12.1f %12.1f %12.1f\n", 100.0 * matched / nbFrames, mean, times[nbFrames * 99 / 100],
+           times.back(), burstMean);
+
+    // Each update publishes a new delta tree, the base is rebuilt in the background
+    DynamicHyperCuts<> dynamic(set.pointers.data(), nbRules);
+    double updateMean = 0, updateWorst = 0;
+    std::size_t i = 0;
+    for (unsigned update = 0; update < 2 * Updates; ++update)
+    {
+        if (update % 2 == 0)
+            i = random() % (nbRules - 1);
+        start = std::chrono::steady_clock::now();
+        if (update % 2 == 0)
+            dynamic.remove(set.pointers[i]);
+        else
+            dynamic.insert(set.pointers[i], set.pointers[i + 1]);
+        double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        updateMean += time / (2 * Updates);
+        updateWorst = std::max(updateWorst, time);
+    }
+    std::vector<void *> actions(Burst);
+    double dynamicMean = 1e12;
+    for (unsigned run = 0; run < Runs; ++run)
+    {
+        start = std::chrono::steady_clock::now();
+        for (std::size_t base = 0; base < nbFrames; base += Burst)
+            dynamic.searchBurst(&headers[base], &lengths[base], std::min(Burst, nbFrames - base), actions.data());
+        dynamicMean = std::min(dynamicMean, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() -
+                                                                                     start)
+                                                    .count() /
+                                                nbFrames);
+    }
+    DynamicHyperCuts<>::Statistics dynamicStats = dynamic.statistics();
+    printf("# %u removals and insertions: %.2f ms per update, worst %.2f ms; then %zu rules in the delta tree, "
+           "%zu deleted from the base, %zu builds, %.1f ns per frame by bursts\n",
+           Updates, updateMean, updateWorst, dynamicStats.deltaRules, dynamicStats.deletedRules, dynamicStats.rebuilds,
+           dynamicMean);
+    return 0;
+}
@@ -0,0 +1,548 @@
+#ifndef _DYNAMICHYPERCUTSHPP_
+#define _DYNAMICHYPERCUTSHPP_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../SMR/epoch.hpp"
+#include "hypercuts.hpp"
+
+namespace DNFC
+{
+
+/**
+ * DefaultDynamicHyperCutsPolicy
+ *
+ * The base tree is rebuilt in the background once the rules inserted and the rules
+ * deleted since the last build reach DeltaRules, or the base rules over DeltaFraction
+ * when there are more.
+ */
+class DefaultDynamicHyperCutsPolicy : public DefaultHyperCutsPolicy
+{
+  public:
+    const static std::size_t DeltaRules = 256;
+    const static std::size_t DeltaFraction = 16;
+};
+
+/**
+ * DynamicHyperCuts
+ *
+ * HyperCuts classifier whose rules can be inserted and removed while other threads
+ * search it. A flattened HyperCuts tree cannot be patched in place under its readers,
+ * so a version of the classifier is
+ *   - a base tree, shared by the versions until the next rebuild,
+ *   - a small delta tree of the rules inserted since,
+ *   - for each rule deleted from the base, the subtree replacing it: a tree of the
+ *     later base rules overlapping it, cut down to its region. When the base finds a
+ *     deleted rule for a header, the first base rule matching it is the one this
+ *     subtree finds, or behind that one if it is deleted too.
+ * The first rule matching a header is the earliest of the base and delta rules found.
+ * An insertion rebuilds the small delta tree, a deletion builds the subtree of the
+ * rule, then the update publishes a new version sharing everything else with an
+ * atomic store; searches run inside an Epoch region, and the previous version is
+ * retired through the Epoch. Once the updates pile up (see the policy), a background
+ * thread rebuilds the base from all the rules, without blocking the updates or the
+ * searches, and publishes it with the updates made meanwhile.
+ *
+ * A rule is identified by its address, and its fields are copied: the caller may
+ * change or free it once inserted, but passes the same address to remove it.
+ */
+template <typename Policy = DefaultDynamicHyperCutsPolicy>
+class DynamicHyperCuts
+{
+  public:
+    using Tree = HyperCuts<Policy>;
+
+    const static std::size_t BurstSize = Tree::BurstSize;
+
+    struct Statistics
+    {
+        typename Tree::Statistics base;
+        std::size_t deltaRules;   // Inserted since the last build
+        std::size_t deletedRules; // Since the last build
+        std::size_t rebuilds;     // Of the base tree, the first one included
+    };
+
+    /**
+     * Constructor
+     *
+     * Build the classifier of 'nbRules' distinct rules, by priority. Throw
+     * std::invalid_argument as HyperCuts does.
+     */
+    DynamicHyperCuts(const classifier_rule *const *rules, std::size_t nbRules)
+        : current(nullptr), nbDeleted(0), numbering(0), rebuilds(0), wanted(false), stopping(false)
+    {
+        std::vector<std::shared_ptr<const Rule>> copies;
+        std::vector<uint64_t> keys;
+        for (std::size_t i = 0; i < nbRules; ++i)
+        {
+            uint64_t key = (i + 1) * Gap;
+            copies.push_back(copyOf(rules[i]));
+            keys.push_back(key);
+            live.emplace(key, copies.back());
+            keyOf[rules[i]] = key;
+            use(*copies.back(), 1);
+        }
+        std::vector<const classifier_rule *> pointers;
+        for (const auto &rule : copies)
+            pointers.push_back(&rule->rule);
+        std::shared_ptr<const Tree> tree = std::make_shared<const Tree>(pointers.data(), pointers.size());
+        install(std::move(copies), std::move(keys), std::move(tree));
+        rebuilder = std::thread([this] { rebuildLoop(); });
+    }
+
+    ~DynamicHyperCuts()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        rebuilder.join();
+        delete current.load(std::memory_order_relaxed);
+    }
+
+    DynamicHyperCuts(const DynamicHyperCuts &) = delete;
+    DynamicHyperCuts &operator=(const DynamicHyperCuts &) = delete;
+
+    /**
+     * search
+     *
+     * Set 'action' to the action of the first rule matching the 'length' bytes of
+     * 'header' and return true, or return false when none does.
+     */
+    bool search(const uint8_t *header, std::size_t length, void *&action) const
+    {
+        void *matched;
+        if (!searchBurst(&header, &length, 1, &matched))
+            return false;
+        action = matched;
+        return true;
+    }
+
+    /**
+     * searchBurst
+     *
+     * search for 'n' headers, setting 'matched' to the actions of their first rules,
+     * or to nullptr for the headers no rule matches. Return how many match a rule. All
+     * the headers are classified by the same version.
+     */
+    std::size_t searchBurst(const uint8_t *const *headers, const std::size_t *lengths, std::size_t n,
+                            void **matched) const
+    {
+        Epoch::Region region;
+        const Version &version = *current.load(std::memory_order_acquire);
+        std::size_t base[BurstSize], delta[BurstSize], count = 0;
+        for (std::size_t start = 0; start < n; start += BurstSize)
+        {
+            std::size_t size = std::min(n - start, std::size_t(BurstSize));
+            version.base->tree->findBurst(headers + start, lengths + start, size, base);
+            if (version.delta)
+                version.delta->tree->findBurst(headers + start, lengths + start, size, delta);
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                uint64_t key = UINT64_MAX;
+                void *action = nullptr;
+                std::size_t rule = base[i];
+                while (rule != Tree::NotFound && version.deleted[rule / 64] >> (rule % 64) & 1)
+                {
+                    const Behind &behind = *version.behind.at(rule);
+                    std::size_t found = behind.tree->find(headers[start + i], lengths[start + i]);
+                    rule = found == Tree::NotFound ? found : behind.rules[found];
+                }
+                if (rule != Tree::NotFound)
+                {
+                    key = version.base->keys[rule];
+                    action = version.base->tree->action(rule);
+                }
+                rule = version.delta ? delta[i] : Tree::NotFound;
+                if (rule != Tree::NotFound && version.delta->keys[rule] < key)
+                {
+                    key = version.delta->keys[rule];
+                    action = version.delta->tree->action(rule);
+                }
+                matched[start + i] = action;
+                count += key != UINT64_MAX;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * insert
+     *
+     * Insert 'rule' just before the rule 'before', or after all the rules when it is
+     * nullptr. Return false when 'rule' is already in the classifier or 'before' is
+     * not. Throw std::invalid_argument when a field of 'rule' is longer than 32 bits
+     * or the rules would use more than MaxDimensions fields.
+     */
+    bool insert(const classifier_rule *rule, const classifier_rule *before = nullptr)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (keyOf.count(rule) || (before && !keyOf.count(before)))
+            return false;
+        std::shared_ptr<const Rule> copy = copyOf(rule);
+        check(*copy);
+        uint64_t key = keyBefore(before);
+        live.emplace(key, copy);
+        keyOf[rule] = key;
+        use(*copy, 1);
+        delta.insert(key);
+        publish();
+        return true;
+    }
+
+    /**
+     * remove
+     *
+     * Remove 'rule', return false when it is not in the classifier.
+     */
+    bool remove(const classifier_rule *rule)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = keyOf.find(rule);
+        if (found == keyOf.end())
+            return false;
+        uint64_t key = found->second;
+        auto entry = live.find(key);
+        std::shared_ptr<const Rule> copy = entry->second;
+        keyOf.erase(found);
+        live.erase(entry);
+        use(*copy, -1);
+        delta.erase(key);
+
+        std::size_t index = std::lower_bound(baseKeys.begin(), baseKeys.end(), key) - baseKeys.begin();
+        if (index < baseKeys.size() && baseRules[index] == copy)
+        {
+            markDeleted(index);
+            behind[index] = uncover(index);
+        }
+        publish();
+        return true;
+    }
+
+    /**
+     * rebuild
+     *
+     * Rebuild the base tree from all the rules and publish it. The updates made during
+     * the build go to the delta tree of the new base.
+     */
+    void rebuild()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;)
+        {
+            std::vector<std::shared_ptr<const Rule>> rules;
+            std::vector<uint64_t> keys;
+            for (const auto &entry : live)
+            {
+                keys.push_back(entry.first);
+                rules.push_back(entry.second);
+            }
+            uint64_t numbered = numbering;
+            guard.unlock();
+
+            std::vector<const classifier_rule *> pointers;
+            for (const auto &rule : rules)
+                pointers.push_back(&rule->rule);
+            std::shared_ptr<const Tree> tree = std::make_shared<const Tree>(pointers.data(), pointers.size());
+
+            guard.lock();
+            if (numbered == numbering) // Otherwise the keys of the rules changed meanwhile
+            {
+                install(std::move(rules), std::move(keys), std::move(tree));
+                return;
+            }
+        }
+    }
+
+    Statistics statistics() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return Statistics{baseLayer->tree->statistics(), delta.size(), nbDeleted, rebuilds};
+    }
+
+  private:
+    // Spacing of the keys of the rules when they are numbered
+    const static uint64_t Gap = uint64_t(1) << 32;
+
+    // Copy of a rule and its fields
+    struct Rule
+    {
+        classifier_rule rule;
+        std::vector<classifier_field> fields;
+        std::vector<classifier_field *> pointers;
+    };
+
+    // A tree, and the key of each of its rules: the lower, the higher the priority
+    struct Layer
+    {
+        std::shared_ptr<const Tree> tree;
+        std::vector<uint64_t> keys;
+    };
+
+    // Subtree replacing a deleted base rule, and the base index of each of its rules
+    struct Behind
+    {
+        std::shared_ptr<const Tree> tree;
+        std::vector<uint32_t> rules;
+    };
+
+    struct Version
+    {
+        std::shared_ptr<const Layer> base;
+        std::shared_ptr<const Layer> delta; // nullptr when empty
+        std::vector<uint64_t> deleted;      // Bit i for the rule i of the base
+        std::map<std::size_t, std::shared_ptr<const Behind>> behind; // By deleted base rule
+    };
+
+    std::atomic<Version *> current;
+
+    // The state below is only used by the updates, under 'lock'
+    mutable std::mutex lock;
+    std::map<uint64_t, std::shared_ptr<const Rule>> live;
+    std::unordered_map<const classifier_rule *, uint64_t> keyOf;
+    std::map<std::pair<uint32_t, uint32_t>, std::size_t> dimensionUses; // By (offset, bit_length)
+    std::vector<std::shared_ptr<const Rule>> baseRules;
+    std::vector<uint64_t> baseKeys; // Increasing, as the priorities of the base rules
+    std::shared_ptr<const Layer> baseLayer;
+    std::vector<uint64_t> deleted;
+    std::size_t nbDeleted;
+    std::map<std::size_t, std::shared_ptr<const Behind>> behind;
+    std::set<uint64_t> delta; // Keys of the rules inserted since the base
+    uint64_t numbering;       // Incremented when the keys change
+    std::size_t rebuilds;
+
+    std::condition_variable wakeup;
+    bool wanted;
+    bool stopping;
+    std::thread rebuilder;
+
+    // Copy of 'rule', matching only in 'region' if any
+    static std::shared_ptr<const Rule> copyOf(const classifier_rule *rule, const Rule *region = nullptr)
+    {
+        std::shared_ptr<Rule> copy = std::make_shared<Rule>();
+        copy->rule = *rule;
+        for (uint32_t j = 0; j < rule->nb_fields; ++j)
+            copy->fields.push_back(*rule->fields[j]);
+        if (region)
+            copy->fields.insert(copy->fields.end(), region->fields.begin(), region->fields.end());
+        for (classifier_field &field : copy->fields)
+            copy->pointers.push_back(&field);
+        copy->rule.fields = copy->pointers.data();
+        copy->rule.nb_fields = static_cast<uint32_t>(copy->fields.size());
+        return copy;
+    }
+
+    // Throw when the rule could not be added to a tree
+    void check(const Rule &rule) const
+    {
+        std::set<std::pair<uint32_t, uint32_t>> added;
+        for (const classifier_field &field : rule.fields)
+        {
+            if (field.bit_length > 32)
+                throw std::invalid_argument("HyperCuts: fields are at most 32 bits long");
+            if (field.bit_length && !dimensionUses.count({field.offset, field.bit_length}))
+                added.insert({field.offset, field.bit_length});
+        }
+        if (dimensionUses.size() + added.size() > Policy::MaxDimensions)
+            throw std::invalid_argument("HyperCuts: too many distinct fields");
+    }
+
+    void use(const Rule &rule, int count)
+    {
+        for (const classifier_field &field : rule.fields)
+        {
+            if (!field.bit_length)
+                continue;
+            std::size_t &uses = dimensionUses[{field.offset, field.bit_length}];
+            uses += count;
+            if (!uses)
+                dimensionUses.erase({field.offset, field.bit_length});
+        }
+    }
+
+    // Whether a header can match both rules, when their fields on the same bits agree
+    static bool overlap(const Rule &a, const Rule &b)
+    {
+        for (const classifier_field &x : a.fields)
+        {
+            for (const classifier_field &y : b.fields)
+            {
+                if (!x.bit_length || x.offset != y.offset || x.bit_length != y.bit_length)
+                    continue;
+                uint32_t all = x.bit_length == 32 ? UINT32_MAX : (uint32_t(1) << x.bit_length) - 1;
+                if ((x.value ^ y.value) & ~x.mask & ~y.mask & all)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    bool isDeleted(std::size_t index) const
+    {
+        return deleted[index / 64] >> (index % 64) & 1;
+    }
+
+    void markDeleted(std::size_t index)
+    {
+        deleted[index / 64] |= uint64_t(1) << (index % 64);
+        ++nbDeleted;
+    }
+
+    /**
+     * Subtree of the base rules after the deleted base rule 'index' that overlap it,
+     * each cut down to the region of the deleted rule, where the subtree is searched:
+     * when the base finds the deleted rule for a header, the first base rule matching
+     * it is among them, or behind one of them deleted since.
+     */
+    std::shared_ptr<const Behind> uncover(std::size_t index) const
+    {
+        std::shared_ptr<Behind> result = std::make_shared<Behind>();
+        std::vector<std::shared_ptr<const Rule>> clipped;
+        std::vector<const classifier_rule *> pointers;
+        const Rule &region = *baseRules[index];
+        for (std::size_t j = index + 1; j < baseRules.size(); ++j)
+        {
+            if (isDeleted(j) || !overlap(region, *baseRules[j]))
+                continue;
+            clipped.push_back(copyOf(&baseRules[j]->rule, &region));
+            pointers.push_back(&clipped.back()->rule);
+            result->rules.push_back(static_cast<uint32_t>(j));
+        }
+        result->tree = std::make_shared<const Tree>(pointers.data(), pointers.size());
+        return result;
+    }
+
+    // Key of a rule inserted before the rule 'before' (after all the rules if nullptr)
+    uint64_t keyBefore(const classifier_rule *before)
+    {
+        for (;;)
+        {
+            auto next = before ? live.find(keyOf.at(before)) : live.end();
+            uint64_t low = next == live.begin() ? 0 : std::prev(next)->first;
+            uint64_t high = next == live.end() ? UINT64_MAX : next->first;
+            if (high - low > Gap && !before)
+                return low + Gap;
+            if (high - low >= 2)
+                return low + (high - low) / 2;
+            renumber();
+        }
+    }
+
+    // Space the keys of the live and base rules by Gap again, in the same order
+    void renumber()
+    {
+        std::vector<uint64_t> order(baseKeys);
+        for (const auto &entry : live)
+            order.push_back(entry.first);
+        std::sort(order.begin(), order.end());
+        order.erase(std::unique(order.begin(), order.end()), order.end());
+        auto renumbered = [&order](uint64_t key) {
+            return (std::lower_bound(order.begin(), order.end(), key) - order.begin() + 1) * Gap;
+        };
+
+        std::map<uint64_t, std::shared_ptr<const Rule>> rules;
+        for (const auto &entry : live)
+            rules.emplace(renumbered(entry.first), entry.second);
+        live.swap(rules);
+        for (auto &entry : keyOf)
+            entry.second = renumbered(entry.second);
+        for (uint64_t &key : baseKeys)
+            key = renumbered(key);
+        std::set<uint64_t> keys;
+        for (uint64_t key : delta)
+            keys.insert(renumbered(key));
+        delta.swap(keys);
+        baseLayer = std::make_shared<const Layer>(Layer{baseLayer->tree, baseKeys});
+        ++numbering;
+    }
+
+    // Make a tree of 'rules', of keys 'keys', the base, with the delta of the current rules
+    void install(std::vector<std::shared_ptr<const Rule>> rules, std::vector<uint64_t> keys,
+                 std::shared_ptr<const Tree> tree)
+    {
+        baseRules = std::move(rules);
+        baseKeys = std::move(keys);
+        baseLayer = std::make_shared<const Layer>(Layer{std::move(tree), baseKeys});
+        deleted.assign(baseRules.size() / 64 + 1, 0);
+        nbDeleted = 0;
+        behind.clear();
+        delta.clear();
+        for (std::size_t i = 0; i < baseRules.size(); ++i)
+        {
+            auto found = live.find(baseKeys[i]);
+            if (found == live.end() || found->second != baseRules[i])
+                markDeleted(i);
+        }
+        for (const auto &entry : live)
+        {
+            std::size_t index = std::lower_bound(baseKeys.begin(), baseKeys.end(), entry.first) - baseKeys.begin();
+            if (index == baseKeys.size() || baseRules[index] != entry.second)
+                delta.insert(entry.first);
+        }
+        for (std::size_t i = 0; i < baseRules.size(); ++i)
+            if (isDeleted(i))
+                behind[i] = uncover(i);
+        ++rebuilds;
+        publish();
+    }
+
+    // Build the delta tree and publish the new version
+    void publish()
+    {
+        Version *version = new Version{baseLayer, nullptr, deleted, behind};
+        if (!delta.empty())
+        {
+            std::vector<const classifier_rule *> rules;
+            std::vector<uint64_t> keys;
+            for (uint64_t key : delta)
+            {
+                rules.push_back(&live.at(key)->rule);
+                keys.push_back(key);
+            }
+            std::shared_ptr<const Tree> tree = std::make_shared<const Tree>(rules.data(), rules.size());
+            version->delta = std::make_shared<const Layer>(Layer{std::move(tree), std::move(keys)});
+        }
+        Epoch::retire(current.exchange(version, std::memory_order_acq_rel));
+        Epoch::collect();
+
+        std::size_t limit = std::max(std::size_t(Policy::DeltaRules), baseRules.size() / Policy::DeltaFraction);
+        if (delta.size() + nbDeleted >= limit && !wanted)
+        {
+            wanted = true;
+            wakeup.notify_one();
+        }
+    }
+
+    void rebuildLoop()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;)
+        {
+            wakeup.wait(guard, [this] { return wanted || stopping; });
+            if (stopping)
+                return;
+            guard.unlock();
+            rebuild();
+            guard.lock();
+            wanted = false;
+        }
+    }
+};
+} // namespace DNFC
+
+#endif
@@ -0,0 +1,104 @@
+#include <stdio.h>
+
+#include "hypercuts.h"
+#include "dynamichypercuts.hpp"
+
+struct hypercuts_classifier
+{
+   hypercuts_classifier(struct classifier_rule** rules, uint32_t nb_rules)
+      : tree(rules, nb_rules) {}
+
+   DNFC::DynamicHyperCuts<> tree;
+};
+
+
+
+hypercuts_classifier* new_hypercuts_classifier(struct classifier_rule*** rules,
+                                               uint32_t* nb_rules,
+                                               bool verbose)
+{
+   hypercuts_classifier* classifier = new hypercuts_classifier(*rules, *nb_rules);
+   if(verbose)
+      hypercuts_print(classifier);
+   return classifier;
+}
+
+
+
+bool hypercuts_search(hypercuts_classifier* classifier,
+                      const unsigned char* header,
+                      size_t header_len,
+                      void** action)
+{
+   return classifier->tree.search(header, header_len, *action);
+}
+
+
+
+size_t hypercuts_search_burst(hypercuts_classifier* classifier,
+                              const unsigned char* const* headers,
+                              const size_t* header_lens,
+                              size_t n,
+                              void** actions)
+{
+   return classifier->tree.searchBurst(headers, header_lens, n, actions);
+}
+
+
+
+bool hypercuts_insert(hypercuts_classifier* classifier,
+                      const struct classifier_rule* rule,
+                      const struct classifier_rule* before)
+{
+   try
+   {
+      return classifier->tree.insert(rule, before);
+   }
+   catch(const std::invalid_argument& error)
+   {
+      fprintf(stderr, "%s\n", error.what());
+      return false;
+   }
+}
+
+
+
+bool hypercuts_remove(hypercuts_classifier* classifier,
+                      const struct classifier_rule* rule)
+{
+   return classifier->tree.remove(rule);
+}
+
+
+
+void hypercuts_print(hypercuts_classifier* classifier)
+{
+   const DNFC::DynamicHyperCuts<>::Statistics stats = classifier->tree.statistics();
+   printf("HyperCuts: %zu rules over %zu fields, in %zu trees built in %.1f ms by %zu threads\n",
+          stats.base.rules, stats.base.dimensions, stats.base.trees, stats.base.buildTime / 1e3, stats.base.threads);
+   printf("   %zu nodes (%zu leaves), depth %zu, at most %zu rules checked per tree\n",
+          stats.base.nodes, stats.base.leaves, stats.base.depth, stats.base.maxRules);
+   printf("   %zu bytes\n", stats.base.bytes);
+   printf("   %zu rules in the delta tree, %zu deleted, %zu builds\n",
+          stats.deltaRules, stats.deletedRules, stats.rebuilds);
+}
+
+
+
+void free_hypercuts_classifier(hypercuts_classifier* classifier)
+{
+   delete classifier;
+}
+
+
+
+void* chkmalloc(size_t size)
+{
+   void* result = malloc(size);
+   if(!result)
+   {
+      fprintf(stderr, "Out of memory (%zu bytes)\n", size);
+      exit(EXIT_FAILURE);
+   }
+   return result;
+}
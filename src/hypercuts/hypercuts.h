@@ -0,0 +1,84 @@
+#ifndef _HYPERCUTSH_
+#define _HYPERCUTSH_
+
+/*H**********************************************************************
+ * FILENAME :        hypercuts.h
+ *
+ * DESCRIPTION :
+ *        C interface of the static classifier: a HyperCuts decision tree
+ *        over classifier_rules (see hypercuts.hpp), flattened into arrays of
+ *        64 bytes nodes with index-based children, so that a lookup touches
+ *        a few cache lines whatever the number of rules. Rules can be
+ *        inserted and removed while other threads search the classifier
+ *        (see dynamichypercuts.hpp).
+ *
+ * PUBLIC STRUCTURE :
+ *       hypercuts_classifier
+ *
+ * AUTHOR :    Pieroux Alexandre
+ *H*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "../classifier_rule/classifier_rule.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct hypercuts_classifier hypercuts_classifier;
+
+/* Build the classifier of the '*nb_rules' rules of '*rules', the first rule matching
+   a header wins. The rules are copied and their 'action' is what hypercuts_search
+   returns, so it must be set before; the address of a rule identifies it for
+   hypercuts_remove. With 'verbose', print the statistics of the tree once built. */
+hypercuts_classifier* new_hypercuts_classifier(struct classifier_rule*** rules,
+                                               uint32_t* nb_rules,
+                                               bool verbose);
+
+/* Set 'action' to the action of the first rule matching the 'header_len' bytes of
+   'header' and return true, or return false when no rule matches. The fields of the
+   rules are offsets in bits from the start of 'header', those beyond 'header_len'
+   read as zeros. */
+bool hypercuts_search(hypercuts_classifier* classifier,
+                      const unsigned char* header,
+                      size_t header_len,
+                      void** action);
+
+/* hypercuts_search for the 'n' headers of 'headers', of 'header_lens' bytes, going
+   down the tree for all of them at once: set 'actions' to the actions of their first
+   rules, or to NULL for the headers no rule matches, and return how many match. */
+size_t hypercuts_search_burst(hypercuts_classifier* classifier,
+                              const unsigned char* const* headers,
+                              const size_t* header_lens,
+                              size_t n,
+                              void** actions);
+
+/* Insert 'rule' just before the rule 'before', or after all the rules when 'before'
+   is NULL, copied as by new_hypercuts_classifier. Return false when 'rule' is already in
+   the classifier, 'before' is not, or the fields of 'rule' cannot be classified.
+   Searches running meanwhile see the classifier before or after the insertion. */
+bool hypercuts_insert(hypercuts_classifier* classifier,
+                      const struct classifier_rule* rule,
+                      const struct classifier_rule* before);
+
+/* Remove 'rule', return false when it is not in the classifier. */
+bool hypercuts_remove(hypercuts_classifier* classifier,
+                      const struct classifier_rule* rule);
+
+/* Print the rules, nodes, depth and memory of the tree, and the pending updates. */
+void hypercuts_print(hypercuts_classifier* classifier);
+
+void free_hypercuts_classifier(hypercuts_classifier* classifier);
+
+/* malloc that exits when out of memory, for the C modules */
+void* chkmalloc(size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
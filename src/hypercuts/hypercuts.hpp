@@ -0,0 +1,1010 @@
+#ifndef _HYPERCUTSHPP_
+#define _HYPERCUTSHPP_
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "../classifier_rule/classifier_rule.h"
+#include "../static_classifier/fieldset.hpp"
+#include "taskpool.hpp"
+
+namespace DNFC
+{
+
+namespace HyperCutsDetail
+{
+#if defined(__x86_64__)
+inline bool hasAVX2()
+{
+    static bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+} // namespace HyperCutsDetail
+
+/**
+ * DefaultHyperCutsPolicy
+ *
+ * A node holding at most LeafRules rules is a leaf. Other nodes are cut along up to
+ * MaxCutDimensions dimensions at once, into at most 2^MaxCutBits children, and the
+ * children of a node of n rules hold at most SpaceFactor * n rules in all, copies of
+ * the rules spanning several children included. Over a whole tree of n rules, the
+ * nodes of a level hold at most TreeSpaceFactor * n rules. Nodes deeper than MaxDepth
+ * are leaves whatever their size. The rules can use at most MaxDimensions distinct
+ * fields, and are split into at most MaxTrees trees. The trees are built by
+ * BuildThreads threads (0 for one per core), the subtrees of at least ParallelRules
+ * rules being tasks of their own. Fewer rules than that are built by the calling
+ * thread alone, and every thread count builds the same tree.
+ */
+class DefaultHyperCutsPolicy
+{
+  public:
+    const static std::size_t LeafRules = 8;
+    const static std::size_t MaxCutDimensions = 4;
+    const static std::size_t MaxCutBits = 12;
+    const static std::size_t SpaceFactor = 8;
+    const static std::size_t TreeSpaceFactor = 64;
+    const static std::size_t MaxDepth = 16;
+    const static std::size_t MaxDimensions = 16;
+    const static std::size_t MaxTrees = 4;
+    const static std::size_t BuildThreads = 0;
+    const static std::size_t ParallelRules = 1024;
+};
+
+/**
+ * HyperCutsNode
+ *
+ * A node of the flattened tree, one cache line and no pointer. An internal node cuts
+ * up to MaxCuts dimensions at once: the child of a header is
+ *   edges[first + sum over the cuts i of ((value[dimension[i]] >> shift[i]) & (2^bits[i] - 1)) << p(i)]
+ * where p(i) is the sum of the bits of the cuts before i. An internal node lists inline
+ * the rules pushed up from its children. The nbRules rules of a leaf are in groups of
+ * up to 8 from blocks[first], by priority: the care words of the w rules of a group on
+ * each dimension, then their value words, then their indices, w words apart.
+ */
+struct alignas(64) HyperCutsNode
+{
+    const static std::size_t MaxCuts = 4;
+    const static std::size_t InlineRules = 10;
+
+    uint32_t first;
+    uint32_t nbRules;
+    uint8_t nbCuts; // 0 for a leaf
+    uint8_t padding[3];
+    uint8_t dimension[MaxCuts];
+    uint8_t shift[MaxCuts];
+    uint8_t bits[MaxCuts];
+    uint32_t rules[InlineRules];
+};
+
+static_assert(sizeof(HyperCutsNode) == 64, "A HyperCutsNode is one cache line");
+
+/**
+ * HyperCuts
+ *
+ * Static packet classifier over classifier_rules (see FieldSet), the first of the
+ * rules matching a header wins. Every dimension of the FieldSet is a dimension of
+ * the tree, along which the rules match ranges of values.
+ *
+ * The rules are split by the fields on which they are wide into a few decision trees,
+ * built once by cutting each node along the dimensions where its rules differ the most
+ * (HyperCuts, Singh et al.), then laid out in flat arrays of HyperCutsNodes, child
+ * indices, leaf rules and rule masks. A lookup extracts the fields of the header, goes
+ * down all the trees in step, one node (one cache line) and one child index per level,
+ * and checks the few rules of the leaves and those pushed up in the nodes on the way.
+ */
+template <typename Policy = DefaultHyperCutsPolicy>
+class HyperCuts
+{
+    static_assert(Policy::MaxCutDimensions <= HyperCutsNode::MaxCuts, "A node cuts at most 4 dimensions");
+
+  public:
+    const static std::size_t NotFound = SIZE_MAX;
+
+    // Headers classified in step by findBurst
+    const static std::size_t BurstSize = 32;
+
+    // Rules of a leaf checked at once
+    const static std::size_t Lanes = 8;
+
+    struct Statistics
+    {
+        std::size_t rules;
+        std::size_t dimensions;
+        std::size_t trees;
+        std::size_t nodes;
+        std::size_t leaves;
+        std::size_t depth;        // Of the deepest leaf, the root is at depth 0
+        std::size_t maxRules;     // Rules checked down a tree at most
+        std::size_t bytes;        // Of the flattened tree and rules
+        std::size_t threads;      // That built the tree
+        std::size_t buildTime;    // In microseconds
+    };
+
+    /**
+     * Constructor
+     *
+     * Build the tree of 'nbRules' rules, by priority. Throw std::invalid_argument when
+     * a field is longer than 32 bits or the rules use more than MaxDimensions fields.
+     */
+    HyperCuts(const classifier_rule *const *rules, std::size_t nbRules)
+        : fields(rules, nbRules, "HyperCuts"), kernel(leafKernel()), stats()
+    {
+        auto start = std::chrono::steady_clock::now();
+        addRanges();
+        Box box;
+        for (std::size_t d = 0; d < fields.dimensions(); ++d)
+        {
+            box.base[d] = 0;
+            box.sizeBits[d] = static_cast<uint8_t>(fields.dimension(d).bitLength);
+        }
+
+        // Each tree in a part of its own when they are built in parallel, then one after the other
+        std::size_t nbThreads = Policy::BuildThreads ? Policy::BuildThreads : std::thread::hardware_concurrency();
+        std::unique_ptr<TaskPool> pool;
+        if (nbThreads > 1 && nbRules >= Policy::ParallelRules)
+            pool.reset(new TaskPool(nbThreads));
+        std::vector<std::vector<uint32_t>> sets = separate();
+        std::vector<Part> parts(pool ? sets.size() : 1);
+        std::vector<uint32_t> partRoots(sets.size());
+        TaskPool::Group group;
+        for (std::size_t t = 0; t < sets.size(); ++t)
+        {
+            std::size_t budget = Policy::TreeSpaceFactor * sets[t].size();
+            if (!pool)
+            {
+                partRoots[t] = build(parts[0], sets[t], box, 0, 0, budget, nullptr);
+                continue;
+            }
+            pool->spawn(group, [this, &parts, &partRoots, &sets, &box, &pool, t, budget] {
+                partRoots[t] = build(parts[t], sets[t], box, 0, 0, budget, pool.get());
+            });
+        }
+        if (pool)
+            pool->wait(group);
+        Part all;
+        for (std::size_t t = 0; t < sets.size(); ++t)
+            roots.push_back(pool ? splice(all, parts[t], partRoots[t]) : partRoots[t]);
+        if (!pool)
+            std::swap(all, parts[0]);
+        nodes.swap(all.nodes);
+        edges.swap(all.edges);
+        blocks.swap(all.blocks);
+        blocks.resize(blocks.size() + Lanes); // Read by the last vector loads
+
+        stats.rules = nbRules;
+        stats.dimensions = fields.dimensions();
+        stats.trees = roots.size();
+        stats.nodes = nodes.size();
+        stats.leaves = std::count_if(nodes.begin(), nodes.end(), [](const HyperCutsNode &node) { return !node.nbCuts; });
+        stats.depth = all.depth;
+        stats.maxRules = all.maxRules;
+        stats.threads = pool ? pool->size() : 1;
+        stats.bytes = nodes.size() * sizeof(HyperCutsNode) + edges.size() * sizeof(uint32_t) +
+                      blocks.size() * sizeof(uint32_t) + fields.bytes();
+        std::vector<Range>().swap(ranges);
+        stats.buildTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start)
+                              .count();
+    }
+
+    /**
+     * find
+     *
+     * Index of the first rule matching the 'length' bytes of 'header', NotFound when
+     * none does. Fields beyond 'length' are read as zeros.
+     */
+    std::size_t find(const uint8_t *header, std::size_t length) const
+    {
+        std::size_t rule;
+        findBurst(&header, &length, 1, &rule);
+        return rule;
+    }
+
+    /**
+     * findBurst
+     *
+     * find for 'n' headers, setting 'rules'. Up to BurstSize headers go down all the
+     * trees in step: each round, every walk reads the node or child index prefetched
+     * the round before and prefetches the next one, so that the cache misses of
+     * the walks overlap instead of following each other.
+     */
+    void findBurst(const uint8_t *const *headers, const std::size_t *lengths, std::size_t n,
+                   std::size_t *rules) const
+    {
+        std::size_t nbDimensions = fields.dimensions(), nbTrees = roots.size();
+        uint32_t values[BurstSize][Policy::MaxDimensions];
+        Walk walks[BurstSize * Policy::MaxTrees];
+        for (std::size_t base = 0; base < n; base += BurstSize)
+        {
+            std::size_t size = std::min(n - base, std::size_t(BurstSize)), nbWalks = 0;
+            std::size_t *best = rules + base;
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                fields.extract(headers[base + i], lengths[base + i], values[i]);
+                best[i] = NotFound;
+                for (std::size_t t = 0; t < nbTrees; ++t)
+                    walks[nbWalks++] = Walk{roots[t], static_cast<uint16_t>(i), Walk::Node};
+            }
+
+            while (nbWalks)
+            {
+                std::size_t kept = 0;
+                for (std::size_t w = 0; w < nbWalks; ++w)
+                {
+                    Walk walk = walks[w];
+                    const uint32_t *value = values[walk.header];
+                    if (walk.step == Walk::Edge)
+                    {
+                        walk.index = edges[walk.index];
+                        __builtin_prefetch(&nodes[walk.index]);
+                        walk.step = Walk::Node;
+                        walks[kept++] = walk;
+                        continue;
+                    }
+                    const HyperCutsNode &node = nodes[walk.index];
+                    if (walk.step == Walk::Leaf)
+                    {
+                        best[walk.header] = kernel(&blocks[node.first], node.nbRules, nbDimensions, value,
+                                                   best[walk.header]);
+                        continue;
+                    }
+                    if (!node.nbCuts)
+                    {
+                        const char *block = reinterpret_cast<const char *>(&blocks[node.first]);
+                        std::size_t width = std::min(std::size_t(Lanes), std::size_t(node.nbRules));
+                        std::size_t bytes = (2 * nbDimensions + 1) * width * sizeof(uint32_t);
+                        for (std::size_t line = 0; line < bytes; line += 64)
+                            __builtin_prefetch(block + line);
+                        walk.step = Walk::Leaf;
+                        walks[kept++] = walk;
+                        continue;
+                    }
+                    if (node.nbRules)
+                        best[walk.header] = scan(node, value, best[walk.header]);
+                    walk.index = node.first + static_cast<uint32_t>(childOf(node, value));
+                    __builtin_prefetch(&edges[walk.index]);
+                    walk.step = Walk::Edge;
+                    walks[kept++] = walk;
+                }
+                nbWalks = kept;
+            }
+        }
+    }
+
+    /**
+     * search
+     *
+     * Set 'action' to the action of the first rule matching 'header' and return true,
+     * or return false when none does.
+     */
+    bool search(const uint8_t *header, std::size_t length, void *&action) const
+    {
+        std::size_t rule = find(header, length);
+        if (rule == NotFound)
+            return false;
+        action = fields.action(rule);
+        return true;
+    }
+
+    /**
+     * searchBurst
+     *
+     * search for 'n' headers, setting 'matched' to the actions of their first rules,
+     * or to nullptr for the headers no rule matches. Return how many match a rule.
+     */
+    std::size_t searchBurst(const uint8_t *const *headers, const std::size_t *lengths, std::size_t n,
+                            void **matched) const
+    {
+        std::size_t rules[BurstSize], count = 0;
+        for (std::size_t base = 0; base < n; base += BurstSize)
+        {
+            std::size_t size = std::min(n - base, std::size_t(BurstSize));
+            findBurst(headers + base, lengths + base, size, rules);
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                matched[base + i] = rules[i] == NotFound ? nullptr : fields.action(rules[i]);
+                count += rules[i] != NotFound;
+            }
+        }
+        return count;
+    }
+
+    // Action of the rule 'rule', an index returned by find
+    void *action(std::size_t rule) const
+    {
+        return fields.action(rule);
+    }
+
+    const Statistics &statistics() const
+    {
+        return stats;
+    }
+
+  private:
+    using Fields = FieldSet<Policy::MaxDimensions>;
+
+    // Values matched by a rule on a dimension, exact unless its mask has holes
+    struct Range
+    {
+        uint32_t low;
+        uint32_t high;
+        bool exact;
+    };
+
+    // Region of a node: 2^sizeBits values from base on each dimension
+    struct Box
+    {
+        uint32_t base[Policy::MaxDimensions];
+        uint8_t sizeBits[Policy::MaxDimensions];
+    };
+
+    // A header going down a tree, at a node, at the child index 'index' of a node, or at a leaf
+    struct Walk
+    {
+        enum Step : uint16_t
+        {
+            Node,
+            Edge,
+            Leaf
+        };
+
+        uint32_t index;
+        uint16_t header;
+        Step step;
+    };
+
+    using LeafKernel = std::size_t (*)(const uint32_t *, std::size_t, std::size_t, const uint32_t *, std::size_t);
+
+    // Nodes, child indices and leaf blocks of subtrees built by the same task
+    struct Part
+    {
+        std::vector<HyperCutsNode> nodes;
+        std::vector<uint32_t> edges;
+        std::vector<uint32_t> blocks;
+        std::map<std::vector<uint32_t>, uint32_t> leaves; // Node of each distinct leaf
+        std::size_t depth = 0;
+        std::size_t maxRules = 0;
+    };
+
+    struct Cuts
+    {
+        std::size_t count;
+        std::size_t totalBits;
+        uint8_t dimension[HyperCutsNode::MaxCuts];
+        uint8_t bits[HyperCutsNode::MaxCuts];
+        uint8_t shift[HyperCutsNode::MaxCuts];
+    };
+
+    Fields fields;
+    std::vector<HyperCutsNode> nodes;
+    std::vector<uint32_t> edges;
+    std::vector<uint32_t> blocks;
+    std::vector<uint32_t> roots;
+    LeafKernel kernel;
+    Statistics stats;
+
+    // Only while building: ranges[rule * dimensions + d]
+    std::vector<Range> ranges;
+
+    static std::size_t childOf(const HyperCutsNode &node, const uint32_t *values)
+    {
+        std::size_t child = 0;
+        unsigned position = 0;
+        for (std::size_t i = 0; i < node.nbCuts; ++i)
+        {
+            child |= std::size_t((values[node.dimension[i]] >> node.shift[i]) & Fields::lowMask(node.bits[i]))
+                     << position;
+            position += node.bits[i];
+        }
+        return child;
+    }
+
+    // First rule pushed up in the node matching the values, if it comes before 'best'
+    std::size_t scan(const HyperCutsNode &node, const uint32_t *values, std::size_t best) const
+    {
+        for (std::size_t i = 0; i < node.nbRules && node.rules[i] < best; ++i)
+            if (fields.matches(node.rules[i], values))
+                return node.rules[i];
+        return best;
+    }
+
+
+    // Kernel of the widest instruction set of the CPU
+    static LeafKernel leafKernel()
+    {
+#if defined(__x86_64__)
+        if (HyperCutsDetail::hasAVX2())
+            return scanAVX2;
+#endif
+        return scanScalar;
+    }
+
+    /**
+     * First of the 'nbRules' rules of a leaf 'block' matching the values, if it comes
+     * before 'best'. One rule at a time, stopping at the first that matches.
+     */
+    static std::size_t scanScalar(const uint32_t *block, std::size_t nbRules, std::size_t nbDimensions,
+                                  const uint32_t *values, std::size_t best)
+    {
+        for (std::size_t group = 0; group < nbRules; group += Lanes)
+        {
+            std::size_t width = std::min(std::size_t(Lanes), nbRules - group);
+            const uint32_t *ids = block + 2 * nbDimensions * width;
+            for (std::size_t k = 0; k < width; ++k)
+            {
+                if (ids[k] >= best)
+                    return best;
+                uint32_t differ = 0;
+                for (std::size_t d = 0; d < nbDimensions; ++d)
+                    differ |= (values[d] & block[d * width + k]) ^ block[(nbDimensions + d) * width + k];
+                if (!differ)
+                    return ids[k];
+            }
+            block += (2 * nbDimensions + 1) * width;
+        }
+        return best;
+    }
+
+#if defined(__x86_64__)
+    /**
+     * The rules of a group at once, the first lane matching is the first rule. The
+     * lanes beyond the width of a group read the next words, up to 8 past the end of
+     * the blocks, and are ignored.
+     */
+    __attribute__((target("avx2"))) static std::size_t scanAVX2(const uint32_t *block, std::size_t nbRules,
+                                                                std::size_t nbDimensions, const uint32_t *values,
+                                                                std::size_t best)
+    {
+        for (std::size_t group = 0; group < nbRules; group += Lanes)
+        {
+            std::size_t width = std::min(std::size_t(Lanes), nbRules - group);
+            const uint32_t *ids = block + 2 * nbDimensions * width;
+            if (ids[0] >= best)
+                return best;
+            __m256i differ = _mm256_setzero_si256();
+            for (std::size_t d = 0; d < nbDimensions; ++d)
+            {
+                __m256i value = _mm256_set1_epi32(static_cast<int>(values[d]));
+                __m256i care = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + d * width));
+                __m256i wanted =
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + (nbDimensions + d) * width));
+                differ = _mm256_or_si256(differ, _mm256_xor_si256(_mm256_and_si256(value, care), wanted));
+            }
+            uint32_t matched = static_cast<uint32_t>(
+                _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(differ, _mm256_setzero_si256()))));
+            matched &= (1u << width) - 1;
+            if (matched)
+                return std::min<std::size_t>(ids[__builtin_ctz(matched)], best);
+            block += (2 * nbDimensions + 1) * width;
+        }
+        return best;
+    }
+#endif
+
+    // Values matched by each rule on every dimension
+    void addRanges()
+    {
+        std::size_t nbDimensions = fields.dimensions();
+        ranges.resize(fields.rules() * nbDimensions);
+        for (std::size_t i = 0; i < fields.rules(); ++i)
+        {
+            const uint32_t *care = fields.care(i), *value = fields.value(i);
+            for (std::size_t d = 0; d < nbDimensions; ++d)
+            {
+                uint32_t wildcard = ~care[d] & Fields::lowMask(fields.dimension(d).bitLength);
+                ranges[i * nbDimensions + d] = Range{value[d], value[d] | wildcard, !(wildcard & (wildcard + 1))};
+            }
+        }
+    }
+
+    /**
+     * Split the possible rules by the dimensions on which they are wide, spanning at
+     * least half of the values, as EffiCuts (Vamanan et al.) does: in a tree of their
+     * own, the narrow rules are no longer copied in all the children of a cut along a
+     * dimension where other rules are wide. A lookup goes down every tree, so beyond
+     * MaxTrees sets, the smallest one joins the closest one.
+     */
+    std::vector<std::vector<uint32_t>> separate() const
+    {
+        std::map<uint32_t, std::vector<uint32_t>> sets; // By the dimensions on which the rules are wide
+        for (std::size_t i = 0; i < fields.rules(); ++i)
+        {
+            if (!fields.possible(i))
+                continue;
+            uint32_t wide = 0;
+            for (std::size_t d = 0; d < fields.dimensions(); ++d)
+            {
+                const Range &range = ranges[i * fields.dimensions() + d];
+                if (uint64_t(range.high - range.low) * 2 > Fields::lowMask(fields.dimension(d).bitLength))
+                    wide |= uint32_t(1) << d;
+            }
+            sets[wide].push_back(static_cast<uint32_t>(i));
+        }
+
+        while (sets.size() > Policy::MaxTrees)
+        {
+            auto smallest = sets.begin();
+            for (auto set = sets.begin(); set != sets.end(); ++set)
+                if (set->second.size() < smallest->second.size())
+                    smallest = set;
+            // Into the set wide on the fewest more dimensions, or the fewest different ones
+            auto closest = sets.end();
+            int closestCost = 0;
+            for (auto set = sets.begin(); set != sets.end(); ++set)
+            {
+                if (set == smallest)
+                    continue;
+                int cost = __builtin_popcount(set->first ^ smallest->first) +
+                           (smallest->first & ~set->first ? int(fields.dimensions()) : 0);
+                if (closest == sets.end() || cost < closestCost)
+                {
+                    closest = set;
+                    closestCost = cost;
+                }
+            }
+            std::vector<uint32_t> merged;
+            std::merge(smallest->second.begin(), smallest->second.end(), closest->second.begin(),
+                       closest->second.end(), std::back_inserter(merged));
+            uint32_t wide = smallest->first | closest->first;
+            sets.erase(smallest);
+            sets.erase(closest);
+            std::vector<uint32_t> &into = sets[wide];
+            std::vector<uint32_t> all;
+            std::merge(into.begin(), into.end(), merged.begin(), merged.end(), std::back_inserter(all));
+            into.swap(all);
+        }
+
+        std::vector<std::vector<uint32_t>> result;
+        for (auto &set : sets)
+            if (!set.second.empty())
+                result.push_back(std::move(set.second));
+        if (result.empty())
+            result.emplace_back();
+        return result;
+    }
+
+    Range clipped(uint32_t rule, const Box &box, std::size_t d) const
+    {
+        Range range = ranges[rule * fields.dimensions() + d];
+        uint32_t top = static_cast<uint32_t>(box.base[d] + ((uint64_t(1) << box.sizeBits[d]) - 1));
+        range.low = std::max(range.low, box.base[d]);
+        range.high = std::min(range.high, top);
+        return range;
+    }
+
+    // Drop the rules behind the first one covering the whole box, they never match in it
+    void dropCovered(std::vector<uint32_t> &ids, const Box &box) const
+    {
+        for (std::size_t i = 0; i < ids.size(); ++i)
+        {
+            bool covers = true;
+            for (std::size_t d = 0; d < fields.dimensions() && covers; ++d)
+            {
+                const Range &range = ranges[ids[i] * fields.dimensions() + d];
+                uint64_t top = box.base[d] + ((uint64_t(1) << box.sizeBits[d]) - 1);
+                covers = range.exact && range.low <= box.base[d] && range.high >= top;
+            }
+            if (covers)
+            {
+                ids.resize(i + 1);
+                return;
+            }
+        }
+    }
+
+    /**
+     * Drop the rules that an earlier rule matches wherever they do in the box, such as
+     * copies of a rule. Quadratic, so only for the nodes that could not be cut enough.
+     */
+    bool dropShadowed(std::vector<uint32_t> &ids, const Box &box) const
+    {
+        std::size_t nbDimensions = fields.dimensions(), kept = 0;
+        std::vector<Range> keptRanges;
+        keptRanges.reserve(ids.size() * nbDimensions);
+        for (std::size_t j = 0; j < ids.size(); ++j)
+        {
+            Range range[Policy::MaxDimensions];
+            for (std::size_t d = 0; d < nbDimensions; ++d)
+                range[d] = clipped(ids[j], box, d);
+            bool shadowed = false;
+            for (std::size_t i = 0; i < kept && !shadowed; ++i)
+            {
+                const Range *earlier = &keptRanges[i * nbDimensions];
+                shadowed = true;
+                for (std::size_t d = 0; d < nbDimensions && shadowed; ++d)
+                    shadowed = earlier[d].exact && earlier[d].low <= range[d].low && earlier[d].high >= range[d].high;
+            }
+            if (shadowed)
+                continue;
+            ids[kept++] = ids[j];
+            keptRanges.insert(keptRanges.end(), range, range + nbDimensions);
+        }
+        bool dropped = kept < ids.size();
+        ids.resize(kept);
+        return dropped;
+    }
+
+    std::size_t distinctRanges(const std::vector<uint32_t> &ids, const Box &box, std::size_t d) const
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> seen;
+        seen.reserve(ids.size());
+        for (uint32_t id : ids)
+        {
+            Range range = clipped(id, box, d);
+            seen.emplace_back(range.low, range.high);
+        }
+        std::sort(seen.begin(), seen.end());
+        return std::unique(seen.begin(), seen.end()) - seen.begin();
+    }
+
+    // Most rules in one of the 2^bits slices of dimension 'd' of the box
+    std::size_t worstSlice(const std::vector<uint32_t> &ids, const Box &box, std::size_t d, unsigned bits) const
+    {
+        unsigned shift = box.sizeBits[d] - bits;
+        std::vector<int32_t> starts((std::size_t(1) << bits) + 1, 0);
+        for (uint32_t id : ids)
+        {
+            Range range = clipped(id, box, d);
+            ++starts[(range.low - box.base[d]) >> shift];
+            --starts[((range.high - box.base[d]) >> shift) + 1];
+        }
+        std::size_t worst = 0;
+        int32_t current = 0;
+        for (int32_t start : starts)
+        {
+            current += start;
+            worst = std::max(worst, std::size_t(current));
+        }
+        return worst;
+    }
+
+    // Rules in all the children of a cut of 'bits[i]' bits along each 'dimension[i]'
+    std::size_t copies(const std::vector<uint32_t> &ids, const Box &box, const uint8_t *dimension,
+                       const std::size_t *bits, std::size_t count) const
+    {
+        std::size_t total = 0;
+        for (uint32_t id : ids)
+        {
+            std::size_t spanned = 1;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                if (!bits[i])
+                    continue;
+                std::size_t d = dimension[i];
+                Range range = clipped(id, box, d);
+                unsigned shift = box.sizeBits[d] - bits[i];
+                spanned *= ((range.high - box.base[d]) >> shift) - ((range.low - box.base[d]) >> shift) + 1;
+            }
+            total += spanned;
+        }
+        return total;
+    }
+
+    /**
+     * Cut the dimensions with the most distinct ranges, those above the mean, then
+     * give one more bit at a time to the dimension where it shrinks the largest slice
+     * the most, while the children and their rules stay under 'space'.
+     */
+    bool chooseCuts(const std::vector<uint32_t> &ids, const Box &box, std::size_t space, Cuts &cuts) const
+    {
+        std::vector<std::pair<std::size_t, std::size_t>> candidates; // (distinct ranges, dimension)
+        std::size_t total = 0;
+        for (std::size_t d = 0; d < fields.dimensions(); ++d)
+        {
+            if (!box.sizeBits[d])
+                continue;
+            std::size_t distinct = distinctRanges(ids, box, d);
+            if (distinct > 1)
+            {
+                candidates.emplace_back(distinct, d);
+                total += distinct;
+            }
+        }
+        if (candidates.empty())
+            return false;
+        std::sort(candidates.rbegin(), candidates.rend());
+        std::size_t count = 0;
+        while (count < candidates.size() && count < Policy::MaxCutDimensions &&
+               candidates[count].first * candidates.size() >= total)
+            ++count;
+
+        std::size_t bits[HyperCutsNode::MaxCuts] = {}, worst[HyperCutsNode::MaxCuts];
+        uint8_t dimension[HyperCutsNode::MaxCuts];
+        for (std::size_t i = 0; i < count; ++i)
+            dimension[i] = static_cast<uint8_t>(candidates[i].second);
+        std::fill(worst, worst + count, ids.size());
+        std::size_t totalBits = 0;
+        while (totalBits < Policy::MaxCutBits)
+        {
+            std::size_t best = count, bestWorst = 0;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                std::size_t d = candidates[i].second;
+                if (bits[i] == box.sizeBits[d])
+                    continue;
+                std::size_t next = worstSlice(ids, box, d, bits[i] + 1);
+                if (next >= worst[i] || (best != count && next * worst[best] >= bestWorst * worst[i]))
+                    continue;
+                ++bits[i];
+                bool fits = (std::size_t(1) << (totalBits + 1)) + copies(ids, box, dimension, bits, count) <= space;
+                --bits[i];
+                if (fits)
+                {
+                    best = i;
+                    bestWorst = next;
+                }
+            }
+            if (best == count)
+                break;
+            ++bits[best];
+            worst[best] = bestWorst;
+            ++totalBits;
+        }
+
+        cuts.count = 0;
+        cuts.totalBits = totalBits;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (!bits[i])
+                continue;
+            std::size_t d = candidates[i].second;
+            cuts.dimension[cuts.count] = static_cast<uint8_t>(d);
+            cuts.bits[cuts.count] = static_cast<uint8_t>(bits[i]);
+            cuts.shift[cuts.count] = static_cast<uint8_t>(box.sizeBits[d] - bits[i]);
+            ++cuts.count;
+        }
+        return totalBits > 0;
+    }
+
+    // Rules of each child, in the order of the cuts as in childOf
+    void partition(const std::vector<uint32_t> &ids, const Box &box, const Cuts &cuts,
+                   std::vector<std::vector<uint32_t>> &children) const
+    {
+        std::size_t low[HyperCutsNode::MaxCuts], high[HyperCutsNode::MaxCuts], at[HyperCutsNode::MaxCuts];
+        for (uint32_t id : ids)
+        {
+            for (std::size_t i = 0; i < cuts.count; ++i)
+            {
+                Range range = clipped(id, box, cuts.dimension[i]);
+                low[i] = (range.low - box.base[cuts.dimension[i]]) >> cuts.shift[i];
+                high[i] = (range.high - box.base[cuts.dimension[i]]) >> cuts.shift[i];
+                at[i] = low[i];
+            }
+            for (;;)
+            {
+                std::size_t child = 0;
+                unsigned position = 0;
+                for (std::size_t i = 0; i < cuts.count; ++i)
+                {
+                    child |= at[i] << position;
+                    position += cuts.bits[i];
+                }
+                children[child].push_back(id);
+
+                std::size_t i = 0;
+                while (i < cuts.count && at[i] == high[i])
+                {
+                    at[i] = low[i];
+                    ++i;
+                }
+                if (i == cuts.count)
+                    break;
+                ++at[i];
+            }
+        }
+    }
+
+    Box childBox(const Box &box, const Cuts &cuts, std::size_t child) const
+    {
+        Box result = box;
+        for (std::size_t i = 0; i < cuts.count; ++i)
+        {
+            std::size_t d = cuts.dimension[i];
+            uint32_t coordinate = static_cast<uint32_t>(child & Fields::lowMask(cuts.bits[i]));
+            child >>= cuts.bits[i];
+            result.sizeBits[d] = cuts.shift[i];
+            result.base[d] = box.base[d] + (coordinate << cuts.shift[i]);
+        }
+        return result;
+    }
+
+    // Leaves with the same rules are shared, whatever their region
+    uint32_t leaf(Part &part, const std::vector<uint32_t> &ids, std::size_t above) const
+    {
+        part.maxRules = std::max(part.maxRules, above + ids.size());
+        auto found = part.leaves.find(ids);
+        if (found != part.leaves.end())
+            return found->second;
+
+        std::vector<uint32_t> &blocks = part.blocks;
+        HyperCutsNode node;
+        std::memset(&node, 0, sizeof(node));
+        node.nbRules = static_cast<uint32_t>(ids.size());
+        node.first = static_cast<uint32_t>(blocks.size());
+        std::size_t nbDimensions = fields.dimensions();
+        for (std::size_t group = 0; group < ids.size(); group += Lanes)
+        {
+            std::size_t width = std::min(std::size_t(Lanes), ids.size() - group);
+            uint32_t *block = &*blocks.insert(blocks.end(), (2 * nbDimensions + 1) * width, 0);
+            for (std::size_t k = 0; k < width; ++k)
+            {
+                uint32_t id = ids[group + k];
+                const uint32_t *words = fields.care(id); // Then its value words
+                for (std::size_t d = 0; d < 2 * nbDimensions; ++d)
+                    block[d * width + k] = words[d];
+                block[2 * nbDimensions * width + k] = id;
+            }
+        }
+        uint32_t index = static_cast<uint32_t>(part.nodes.size());
+        part.nodes.push_back(node);
+        part.leaves.emplace(ids, index);
+        return index;
+    }
+
+    /**
+     * Append the subtrees of 'from' to 'into' and return the index of its node 'root'
+     * there. The leaves of 'from' with the same rules as a leaf of 'into' are shared,
+     * as a serial build shares them, so that both trees are the same.
+     */
+    uint32_t splice(Part &into, const Part &from, uint32_t root) const
+    {
+        std::vector<const std::vector<uint32_t> *> rulesOf(from.nodes.size());
+        for (const auto &leaf : from.leaves)
+            rulesOf[leaf.second] = &leaf.first;
+
+        std::size_t words = 2 * fields.dimensions() + 1;
+        uint32_t edgeBase = static_cast<uint32_t>(into.edges.size());
+        std::vector<uint32_t> index(from.nodes.size());
+        for (std::size_t i = 0; i < from.nodes.size(); ++i)
+        {
+            HyperCutsNode node = from.nodes[i];
+            if (node.nbCuts)
+                node.first += edgeBase;
+            else
+            {
+                auto found = into.leaves.find(*rulesOf[i]);
+                if (found != into.leaves.end())
+                {
+                    index[i] = found->second;
+                    continue;
+                }
+                const uint32_t *block = &from.blocks[node.first];
+                node.first = static_cast<uint32_t>(into.blocks.size());
+                into.blocks.insert(into.blocks.end(), block, block + words * node.nbRules);
+                into.leaves.emplace(*rulesOf[i], static_cast<uint32_t>(into.nodes.size()));
+            }
+            index[i] = static_cast<uint32_t>(into.nodes.size());
+            into.nodes.push_back(node);
+        }
+        for (uint32_t edge : from.edges)
+            into.edges.push_back(index[edge]);
+        into.depth = std::max(into.depth, from.depth);
+        into.maxRules = std::max(into.maxRules, from.maxRules);
+        return index[root];
+    }
+
+    /**
+     * Build the subtree of the rules 'ids' in 'box', under nodes holding 'above' rules,
+     * and return its index. The first rules spanning the box along all the cuts stay
+     * in the node (pushed up, as in HyperCuts) rather than going to every child. The
+     * children share the 'budget' of rules per level of the subtree by their rules.
+     * With a 'pool', the children of at least ParallelRules rules are built by tasks
+     * in parts of their own, then appended to 'part'.
+     */
+    uint32_t build(Part &part, std::vector<uint32_t> &ids, const Box &box, std::size_t depth, std::size_t above,
+                   std::size_t budget, TaskPool *pool) const
+    {
+        part.depth = std::max(part.depth, depth);
+        dropCovered(ids, box);
+        if (ids.size() <= Policy::LeafRules)
+            return leaf(part, ids, above);
+        Cuts cuts;
+        std::vector<uint32_t> pushed;
+        std::vector<std::vector<uint32_t>> children;
+        std::size_t space = std::min(budget, Policy::SpaceFactor * ids.size());
+        bool progress = depth < Policy::MaxDepth && chooseCuts(ids, box, space, cuts);
+        if (progress)
+        {
+            std::vector<uint32_t> rest;
+            for (uint32_t id : ids)
+            {
+                bool spans = pushed.size() < HyperCutsNode::InlineRules;
+                for (std::size_t i = 0; i < cuts.count && spans; ++i)
+                {
+                    Range range = clipped(id, box, cuts.dimension[i]);
+                    spans = range.high - range.low == Fields::lowMask(box.sizeBits[cuts.dimension[i]]);
+                }
+                (spans ? pushed : rest).push_back(id);
+            }
+            children.resize(std::size_t(1) << cuts.totalBits);
+            partition(rest, box, cuts, children);
+            progress = false;
+            for (const auto &child : children)
+                progress |= child.size() < ids.size();
+        }
+        if (!progress)
+        {
+            if (dropShadowed(ids, box))
+                return build(part, ids, box, depth, above, budget, pool);
+            return leaf(part, ids, above);
+        }
+        std::vector<uint32_t>().swap(ids);
+
+        std::vector<uint32_t> &edges = part.edges;
+        HyperCutsNode node;
+        std::memset(&node, 0, sizeof(node));
+        node.first = static_cast<uint32_t>(edges.size());
+        node.nbRules = static_cast<uint32_t>(pushed.size());
+        std::copy(pushed.begin(), pushed.end(), node.rules);
+        node.nbCuts = static_cast<uint8_t>(cuts.count);
+        std::copy(cuts.dimension, cuts.dimension + cuts.count, node.dimension);
+        std::copy(cuts.shift, cuts.shift + cuts.count, node.shift);
+        std::copy(cuts.bits, cuts.bits + cuts.count, node.bits);
+        edges.resize(edges.size() + children.size());
+
+        std::size_t copies = 0, large = 0;
+        for (const auto &child : children)
+        {
+            copies += child.size();
+            large += child.size() >= Policy::ParallelRules;
+        }
+        std::vector<Part> parts(pool ? large : 0);
+        std::vector<std::pair<std::size_t, uint32_t>> tasks; // Child and root in its part
+        tasks.reserve(parts.size());
+        TaskPool::Group group;
+        for (std::size_t child = 0; child < children.size(); ++child)
+        {
+            std::size_t size = children[child].size();
+            std::size_t share = std::max(size, budget * size / std::max<std::size_t>(copies, 1));
+            if (pool && size >= Policy::ParallelRules)
+            {
+                tasks.emplace_back(child, 0);
+                Part &into = parts[tasks.size() - 1];
+                uint32_t &root = tasks.back().second;
+                std::vector<uint32_t> &rules = children[child];
+                Box region = childBox(box, cuts, child);
+                std::size_t below = above + pushed.size();
+                pool->spawn(group, [this, &into, &root, &rules, region, depth, below, share, pool] {
+                    root = build(into, rules, region, depth + 1, below, share, pool);
+                });
+                continue;
+            }
+            edges[node.first + child] = build(part, children[child], childBox(box, cuts, child), depth + 1,
+                                              above + pushed.size(), share, pool);
+        }
+        if (!tasks.empty())
+        {
+            pool->wait(group);
+            for (std::size_t k = 0; k < tasks.size(); ++k)
+                edges[node.first + tasks[k].first] = splice(part, parts[k], tasks[k].second);
+        }
+        auto first = edges.begin() + node.first, last = first + children.size();
+        bool same = std::all_of(first, last, [first](uint32_t edge) { return edge == *first; });
+        if (same && pushed.empty()) // All the children are one node, skip this one
+        {
+            uint32_t only = edges[node.first];
+            if (edges.size() == node.first + children.size())
+                edges.resize(node.first);
+            return only;
+        }
+        part.nodes.push_back(node);
+        return static_cast<uint32_t>(part.nodes.size() - 1);
+    }
+};
+} // namespace DNFC
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef _TASKPOOLHPP_
+#define _TASKPOOLHPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace DNFC
+{
+
+/**
+ * TaskPool
+ *
+ * Work-stealing pool for fork-join tasks, such as building the subtrees of a tree.
+ * Every thread of the pool, the one that created it included, has its own deque: a
+ * thread pushes the tasks it spawns at the back of its deque and runs them from the
+ * back, most recent first, while idle threads steal the oldest ones, usually the
+ * largest, from the front of the others. A thread waiting for a Group of tasks runs
+ * tasks meanwhile instead of blocking, so tasks can spawn and wait for tasks.
+ */
+class TaskPool
+{
+  public:
+    /**
+     * Group
+     *
+     * Tasks waited for together. The first exception thrown by one of them is
+     * rethrown by 'wait'.
+     */
+    class Group
+    {
+      public:
+        Group() : pending(0) {}
+
+      private:
+        friend class TaskPool;
+
+        std::atomic<std::size_t> pending;
+        std::mutex lock;
+        std::exception_ptr error;
+    };
+
+    // 'nbThreads' threads run the tasks, the one creating the pool and nbThreads - 1 others
+    explicit TaskPool(std::size_t nbThreads) : workers(nbThreads ? nbThreads : 1), queued(0), stopping(false)
+    {
+        ids.push_back(std::this_thread::get_id());
+        for (std::size_t i = 1; i < workers.size(); ++i)
+            threads.emplace_back([this, i] { work(i); });
+        for (std::thread &thread : threads)
+            ids.push_back(thread.get_id());
+    }
+
+    ~TaskPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(idleLock);
+            stopping = true;
+        }
+        idle.notify_all();
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+    TaskPool(const TaskPool &) = delete;
+    TaskPool &operator=(const TaskPool &) = delete;
+
+    std::size_t size() const
+    {
+        return workers.size();
+    }
+
+    // Run 'task' in any thread of the pool, as part of 'group'
+    void spawn(Group &group, std::function<void()> task)
+    {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        Worker &worker = workers[self()];
+        {
+            std::lock_guard<std::mutex> guard(worker.lock);
+            worker.tasks.push_back(Task{std::move(task), &group});
+        }
+        queued.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> guard(idleLock);
+        }
+        idle.notify_one();
+    }
+
+    // Run tasks until those of 'group' are done, then rethrow the exception of one if any
+    void wait(Group &group)
+    {
+        std::size_t index = self();
+        while (group.pending.load(std::memory_order_acquire))
+        {
+            Task task;
+            if (take(index, task))
+                run(task);
+            else
+                std::this_thread::yield();
+        }
+        if (group.error)
+            std::rethrow_exception(group.error);
+    }
+
+  private:
+    struct Task
+    {
+        std::function<void()> work;
+        Group *group;
+    };
+
+    struct Worker
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<Worker> workers;
+    std::vector<std::thread> threads;
+    std::vector<std::thread::id> ids; // Of the thread of each worker
+    std::atomic<std::size_t> queued;
+    std::mutex idleLock;
+    std::condition_variable idle;
+    bool stopping;
+
+    // Worker of the calling thread, that of the creator for a thread out of the pool
+    std::size_t self() const
+    {
+        std::thread::id id = std::this_thread::get_id();
+        for (std::size_t i = 1; i < ids.size(); ++i)
+            if (ids[i] == id)
+                return i;
+        return 0;
+    }
+
+    // The newest task of the worker 'index', or else the oldest task of another one
+    bool take(std::size_t index, Task &task)
+    {
+        if (!queued.load(std::memory_order_acquire))
+            return false;
+        for (std::size_t k = 0; k < workers.size(); ++k)
+        {
+            Worker &worker = workers[(index + k) % workers.size()];
+            std::lock_guard<std::mutex> guard(worker.lock);
+            if (worker.tasks.empty())
+                continue;
+            if (k == 0)
+            {
+                task = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+            }
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    static void run(Task &task)
+    {
+        try
+        {
+            task.work();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> guard(task.group->lock);
+            if (!task.group->error)
+                task.group->error = std::current_exception();
+        }
+        task.group->pending.fetch_sub(1, std::memory_order_release);
+    }
+
+    void work(std::size_t index)
+    {
+        for (;;)
+        {
+            Task task;
+            if (take(index, task))
+            {
+                run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(idleLock);
+            idle.wait(guard, [this] { return stopping || queued.load(std::memory_order_acquire); });
+            if (stopping)
+                return;
+        }
+    }
+};
+} // namespace DNFC
+
+#endif
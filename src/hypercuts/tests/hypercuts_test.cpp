@@ -1,10 +1,14 @@
 #define _BSD_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 extern "C" {
   #include "../hypercuts.h"
 }
+#include "../hypercuts.hpp"
 
 #include <gtest/gtest.h>
 
@@ -17,6 +21,9 @@ classifier_rule **get_random_rules(uint32_t size, uint32_t dimension_limit);
 classifier_field **get_random_dimensions(uint32_t size);
 u_char *get_header(classifier_rule rule);
 uint32_t rand_interval(uint32_t min, uint32_t max);
+uint32_t linear_search(classifier_rule **rules, uint32_t nb_rules, const u_char *header, size_t header_len);
+classifier_rule *new_rule(uint32_t id, uint32_t nb_fields);
+void set_field(classifier_rule *rule, uint32_t index, uint32_t offset, uint32_t bit_length, uint32_t mask, uint32_t value);
 
 TEST(Hypecuts, RandomRules)
 {
@@ -25,15 +32,350 @@ TEST(Hypecuts, RandomRules)
   hypercuts_classifier *classifier = new_hypercuts_classifier(&rules, &nb_rules, false);
   hypercuts_print(classifier);
 
+    // The rules overlap: the header of a rule is matched by it or a rule before it
     for (uint32_t i = 0; i < nb_rules; ++i){
         u_char *h = get_header(*rules[i]);
-        uint32_t result;
+        uint32_t result = UINT32_MAX;
         void* r = NULL;
         if(hypercuts_search(classifier, h, HEADER_LENGTH, &r))
             result = *(uint32_t *)r;
-        EXPECT_EQ(result, rules[i]->id);
-        free(h);
+        EXPECT_LE(result, rules[i]->id);
+        EXPECT_EQ(result, linear_search(rules, nb_rules, h, HEADER_LENGTH));
+        delete[] h;
     }
+  free_hypercuts_classifier(classifier);
+}
+
+TEST(Hypecuts, FirstRuleWins)
+{
+  classifier_rule *rules[3];
+  rules[0] = new_rule(0, 1);
+  set_field(rules[0], 0, 8, 8, 0x0f, 0x20);    // Byte 1 in [0x20, 0x2f]
+  rules[1] = new_rule(1, 1);
+  set_field(rules[1], 0, 8, 8, 0xff, 0);       // Any byte 1
+  rules[2] = new_rule(2, 1);
+  set_field(rules[2], 0, 8, 8, 0, 0x21);       // Behind both
+  classifier_rule **list = rules;
+  uint32_t nb_rules = 3;
+  hypercuts_classifier *classifier = new_hypercuts_classifier(&list, &nb_rules, false);
+
+  u_char header[4] = {0, 0x21, 0, 0};
+  void *action = NULL;
+  ASSERT_TRUE(hypercuts_search(classifier, header, sizeof(header), &action));
+  EXPECT_EQ(*(uint32_t *)action, 0u);
+  header[1] = 0x30;
+  ASSERT_TRUE(hypercuts_search(classifier, header, sizeof(header), &action));
+  EXPECT_EQ(*(uint32_t *)action, 1u);
+  free_hypercuts_classifier(classifier);
+}
+
+TEST(Hypecuts, NoMatch)
+{
+  classifier_rule *rules[1];
+  rules[0] = new_rule(0, 2);
+  set_field(rules[0], 0, 0, 16, 0, 0x0800);
+  set_field(rules[0], 1, 20, 4, 0x3, 0x4);     // Nibble at bit 20 in [4, 7]
+  classifier_rule **list = rules;
+  uint32_t nb_rules = 1;
+  hypercuts_classifier *classifier = new_hypercuts_classifier(&list, &nb_rules, false);
+
+  u_char header[4] = {0x08, 0x00, 0x06, 0};
+  void *action = NULL;
+  EXPECT_TRUE(hypercuts_search(classifier, header, sizeof(header), &action));
+  header[2] = 0x0a;
+  action = NULL;
+  EXPECT_FALSE(hypercuts_search(classifier, header, sizeof(header), &action));
+  EXPECT_EQ(action, (void *)NULL);
+
+  // The bytes beyond the header read as zeros
+  EXPECT_FALSE(hypercuts_search(classifier, header, 1, &action));
+  free_hypercuts_classifier(classifier);
+}
+
+TEST(Hypecuts, MaskWithHoles)
+{
+  uint32_t nb_rules = 64;
+  classifier_rule **rules = new classifier_rule *[nb_rules];
+  for (uint32_t i = 0; i < nb_rules; ++i)
+  {
+    // The 2 middle bits of the 2 bytes are wildcards, the others spell i
+    rules[i] = new_rule(i, 1);
+    uint32_t value = ((i & 0x7) << 13) | (((i >> 3) & 0x7) << 5);
+    set_field(rules[i], 0, 16, 16, 0x1818, value);
+  }
+  hypercuts_classifier *classifier = new_hypercuts_classifier(&rules, &nb_rules, false);
+
+  for (uint32_t v = 0; v < 0x10000; v += 7)
+  {
+    u_char header[4] = {0, 0, (u_char)(v >> 8), (u_char)v};
+    uint32_t result = UINT32_MAX;
+    void *action = NULL;
+    if (hypercuts_search(classifier, header, sizeof(header), &action))
+      result = *(uint32_t *)action;
+    EXPECT_EQ(result, linear_search(rules, nb_rules, header, sizeof(header)));
+  }
+  free_hypercuts_classifier(classifier);
+}
+
+TEST(Hypecuts, FiveTuples)
+{
+  // Prefixes of the addresses, exact or wildcard ports and protocol of IPv4 TCP or UDP
+  // headers: protocol at bit 72, addresses at 96 and 128, ports at 160 and 176
+  const uint32_t offsets[5] = {72, 96, 128, 160, 176}, lengths[5] = {8, 32, 32, 16, 16};
+  uint32_t nb_rules = 10000;
+  classifier_rule **rules = new classifier_rule *[nb_rules];
+  srand(7);
+  for (uint32_t i = 0; i < nb_rules; ++i)
+  {
+    rules[i] = new_rule(i, 5);
+    for (uint32_t j = 0; j < 5; ++j)
+    {
+      uint32_t all = lengths[j] == 32 ? UINT32_MAX : (1u << lengths[j]) - 1;
+      uint32_t wildcards;
+      if (j == 1 || j == 2)
+      {
+        uint32_t prefix = 8 * (rand() % 5);
+        wildcards = prefix == 32 ? 0 : all >> prefix;
+      }
+      else
+        wildcards = rand() % 3 ? 0 : all;
+      uint32_t value = (j == 0 ? (rand() % 2 ? 6 : 17) : j < 3 ? (10u << 24) | (rand() % 64) << 16 | rand() % 256 : rand() % 64);
+      set_field(rules[i], j, offsets[j], lengths[j], wildcards, value & ~wildcards);
+    }
+  }
+  hypercuts_classifier *classifier = new_hypercuts_classifier(&rules, &nb_rules, false);
+
+  u_char header[40];
+  for (uint32_t n = 0; n < 20000; ++n)
+  {
+    memset(header, 0, sizeof(header));
+    header[9] = rand() % 2 ? 6 : 17;
+    for (int j = 12; j < 20; j += 4)
+    {
+      header[j] = 10;
+      header[j + 1] = rand() % 64;
+      header[j + 2] = 0;
+      header[j + 3] = rand() % 256;
+    }
+    header[21] = rand() % 64;
+    header[23] = rand() % 64;
+    uint32_t result = UINT32_MAX;
+    void *action = NULL;
+    if (hypercuts_search(classifier, header, sizeof(header), &action))
+      result = *(uint32_t *)action;
+    EXPECT_EQ(result, linear_search(rules, nb_rules, header, sizeof(header)));
+  }
+  free_hypercuts_classifier(classifier);
+}
+
+TEST(Hypecuts, Burst)
+{
+  uint32_t nb_rules = NB_RULES;
+  classifier_rule **rules = get_random_rules(nb_rules, NB_DIMENSIONS);
+  hypercuts_classifier *classifier = new_hypercuts_classifier(&rules, &nb_rules, false);
+
+  // Bursts of any size, with short headers among them
+  const unsigned char **headers = new const unsigned char *[nb_rules];
+  size_t *header_lens = new size_t[nb_rules];
+  void **actions = new void *[nb_rules];
+  for (uint32_t i = 0; i < nb_rules; ++i)
+  {
+    headers[i] = get_header(*rules[i]);
+    header_lens[i] = i % 7 ? HEADER_LENGTH : i % HEADER_LENGTH;
+  }
+  for (uint32_t base = 0, n = 1; base < nb_rules; base += n, n = n * 3 % 101 + 1)
+  {
+    n = std::min(n, nb_rules - base);
+    size_t matched = hypercuts_search_burst(classifier, headers + base, header_lens + base, n, actions + base);
+    size_t expected = 0;
+    for (uint32_t i = base; i < base + n; ++i)
+    {
+      void *action = NULL;
+      expected += hypercuts_search(classifier, headers[i], header_lens[i], &action);
+      EXPECT_EQ(actions[i], action);
+    }
+    EXPECT_EQ(matched, expected);
+  }
+
+  for (uint32_t i = 0; i < nb_rules; ++i)
+    delete[] headers[i];
+  delete[] headers;
+  delete[] header_lens;
+  delete[] actions;
+  free_hypercuts_classifier(classifier);
+}
+
+TEST(Hypecuts, InsertRemove)
+{
+  uint32_t nb_rules = 1500, nb_built = 1000;
+  classifier_rule **rules = get_random_rules(nb_rules, NB_DIMENSIONS);
+  hypercuts_classifier *classifier = new_hypercuts_classifier(&rules, &nb_built, false);
+
+  // The rules in the classifier, by priority, and those out of it
+  std::vector<classifier_rule *> in(rules, rules + nb_built), out(rules + nb_built, rules + nb_rules);
+  EXPECT_FALSE(hypercuts_insert(classifier, in[0], NULL));
+  EXPECT_FALSE(hypercuts_insert(classifier, out[0], out[1]));
+  EXPECT_FALSE(hypercuts_remove(classifier, out[0]));
+
+  for (uint32_t update = 0; update < 300; ++update)
+  {
+    if (update % 3 == 2 || out.empty())
+    {
+      // Remove a rule, of the base tree for the first ones
+      size_t i = rand() % in.size();
+      ASSERT_TRUE(hypercuts_remove(classifier, in[i]));
+      out.push_back(in[i]);
+      in.erase(in.begin() + i);
+    }
+    else
+    {
+      // Insert a rule before another one, the same for a while so that the keys run out, or last
+      size_t o = rand() % out.size();
+      size_t i = update < 100 ? in.size() / 2 : rand() % (in.size() + 1);
+      ASSERT_TRUE(hypercuts_insert(classifier, out[o], i < in.size() ? in[i] : NULL));
+      in.insert(in.begin() + i, out[o]);
+      out.erase(out.begin() + o);
+    }
+
+    for (uint32_t n = 0; n < 20; ++n)
+    {
+      u_char *header = get_header(*rules[rand() % nb_rules]);
+      uint32_t result = UINT32_MAX;
+      void *action = NULL;
+      if (hypercuts_search(classifier, header, HEADER_LENGTH, &action))
+        result = *(uint32_t *)action;
+      ASSERT_EQ(result, linear_search(in.data(), in.size(), header, HEADER_LENGTH));
+      delete[] header;
+    }
+  }
+  hypercuts_print(classifier);
+  free_hypercuts_classifier(classifier);
+}
+
+TEST(Hypecuts, UpdateWhileSearching)
+{
+  // Readers classify the headers of the first rules while the last ones come and go
+  uint32_t nb_rules = NB_RULES, nb_fixed = 500;
+  classifier_rule **rules = get_random_rules(nb_rules, NB_DIMENSIONS);
+  hypercuts_classifier *classifier = new_hypercuts_classifier(&rules, &nb_rules, false);
+  std::vector<u_char *> headers;
+  std::vector<uint32_t> expected;
+  for (uint32_t i = 0; i < nb_fixed; ++i)
+  {
+    headers.push_back(get_header(*rules[i]));
+    expected.push_back(linear_search(rules, nb_fixed, headers.back(), HEADER_LENGTH));
+  }
+
+  std::atomic<bool> done(false);
+  std::atomic<size_t> wrong(0), searches(0);
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 2; ++r)
+  {
+    readers.emplace_back([&] {
+      while (!done.load())
+      {
+        for (uint32_t i = 0; i < nb_fixed; ++i)
+        {
+          void *action = NULL;
+          if (!hypercuts_search(classifier, headers[i], HEADER_LENGTH, &action) || *(uint32_t *)action != expected[i])
+            ++wrong;
+        }
+        ++searches;
+      }
+    });
+  }
+  for (uint32_t update = 0; update < 200; ++update)
+  {
+    classifier_rule *rule = rules[nb_fixed + rand() % (nb_rules - nb_fixed)];
+    if (!hypercuts_remove(classifier, rule))
+    {
+      EXPECT_TRUE(hypercuts_insert(classifier, rule, NULL));
+    }
+  }
+  while (searches.load() < 4)
+    std::this_thread::yield();
+  done = true;
+  for (std::thread &reader : readers)
+    reader.join();
+  EXPECT_EQ(wrong.load(), 0u);
+
+  for (u_char *header : headers)
+    delete[] header;
+  free_hypercuts_classifier(classifier);
+}
+
+class SerialPolicy : public DNFC::DefaultHyperCutsPolicy
+{
+public:
+  const static size_t BuildThreads = 1;
+};
+
+class ParallelPolicy : public DNFC::DefaultHyperCutsPolicy
+{
+public:
+  const static size_t BuildThreads = 4;
+  const static size_t ParallelRules = 16;
+};
+
+TEST(Hypecuts, ParallelBuild)
+{
+  // Subtrees of a few rules built by tasks on 4 threads, whatever the cores, make the same tree
+  uint32_t nb_rules = 5000;
+  classifier_rule **rules = get_random_rules(nb_rules, NB_DIMENSIONS);
+  DNFC::HyperCuts<SerialPolicy> serial(rules, nb_rules);
+  DNFC::HyperCuts<ParallelPolicy> parallel(rules, nb_rules);
+  EXPECT_EQ(serial.statistics().threads, 1u);
+  EXPECT_EQ(parallel.statistics().threads, 4u);
+  EXPECT_EQ(parallel.statistics().depth, serial.statistics().depth);
+  EXPECT_EQ(parallel.statistics().maxRules, serial.statistics().maxRules);
+  EXPECT_EQ(parallel.statistics().nodes, serial.statistics().nodes);
+  EXPECT_EQ(parallel.statistics().leaves, serial.statistics().leaves);
+  EXPECT_EQ(parallel.statistics().bytes, serial.statistics().bytes);
+
+  for (uint32_t n = 0; n < 2 * nb_rules; ++n)
+  {
+    u_char *header = get_header(*rules[n % nb_rules]);
+    if (n >= nb_rules)
+      header[rand() % HEADER_LENGTH] ^= 1 << (rand() % 8);
+    ASSERT_EQ(parallel.find(header, HEADER_LENGTH), serial.find(header, HEADER_LENGTH));
+    delete[] header;
+  }
+}
+
+size_t sum_tasks(DNFC::TaskPool &pool, size_t low, size_t high)
+{
+  if (high - low < 64)
+  {
+    size_t sum = 0;
+    for (size_t i = low; i < high; ++i)
+      sum += i;
+    return sum;
+  }
+  size_t left = 0, middle = low + (high - low) / 2;
+  DNFC::TaskPool::Group group;
+  pool.spawn(group, [&] { left = sum_tasks(pool, low, middle); });
+  size_t right = sum_tasks(pool, middle, high);
+  pool.wait(group);
+  return left + right;
+}
+
+TEST(TaskPool, ForkJoin)
+{
+  DNFC::TaskPool pool(3);
+  EXPECT_EQ(pool.size(), 3u);
+  EXPECT_EQ(sum_tasks(pool, 0, 100000), 100000ull * 99999 / 2);
+
+  // The exception of a task reaches the thread waiting for it
+  DNFC::TaskPool::Group group;
+  std::atomic<int> done(0);
+  for (int i = 0; i < 8; ++i)
+    pool.spawn(group, [&, i] {
+      ++done;
+      if (i == 5)
+        throw std::runtime_error("task");
+    });
+  EXPECT_THROW(pool.wait(group), std::runtime_error);
+  EXPECT_EQ(done.load(), 8);
 }
 
 int main(int argc, char **argv)
@@ -120,7 +462,7 @@ classifier_field **get_random_dimensions(uint32_t size)
   for (uint32_t i = 0; i < size; ++i)
   {
     result[i] = new classifier_field;
-    result[i]->bit_length = rand() % (bit_length_limit + 1);
+    result[i]->bit_length = 1 + rand() % bit_length_limit;
     result[i]->offset = prev_offset + (rand() % (bit_length_limit - result[i]->bit_length + 1));
     prev_offset = result[i]->bit_length + result[i]->offset;
   }
@@ -129,8 +471,8 @@ classifier_field **get_random_dimensions(uint32_t size)
 
 u_char *get_header(classifier_rule rule)
 {
-  int size = ((HEADER_LENGTH - 1) / 8) + 1;
-  u_char *result = new u_char[size];
+  // HEADER_LENGTH bytes, as passed to hypercuts_search
+  u_char *result = new u_char[HEADER_LENGTH]();
   for (size_t i = 0; i < rule.nb_fields; i++)
   {
     uint32_t value = rand_interval(rule.fields[i]->value, rule.fields[i]->mask | rule.fields[i]->value);
@@ -138,10 +480,10 @@ u_char *get_header(classifier_rule rule)
     uint32_t shift = rule.fields[i]->offset % 8;
 
     value = value << (32 - rule.fields[i]->bit_length - shift);
-    result[index + 3] = value & 0xff;
-    result[index + 2] = (value >> 8) & 0xff;
-    result[index + 1] = (value >> 16) & 0xff;
-    result[index] = (value >> 24) & 0xff;
+    result[index + 3] |= value & 0xff;
+    result[index + 2] |= (value >> 8) & 0xff;
+    result[index + 1] |= (value >> 16) & 0xff;
+    result[index] |= (value >> 24) & 0xff;
   }
   return result;
 }
@@ -163,3 +505,43 @@ uint32_t rand_interval(uint32_t min, uint32_t max)
 
   return min + (r / buckets);
 }
+
+// Bit by bit, first rule whose fields all match, UINT32_MAX when none does
+uint32_t linear_search(classifier_rule **rules, uint32_t nb_rules, const u_char *header, size_t header_len)
+{
+  for (uint32_t i = 0; i < nb_rules; ++i)
+  {
+    bool match = true;
+    for (uint32_t j = 0; j < rules[i]->nb_fields && match; ++j)
+    {
+      const classifier_field *field = rules[i]->fields[j];
+      uint32_t value = 0;
+      for (uint32_t b = field->offset; b < field->offset + field->bit_length; ++b)
+        value = (value << 1) | (b / 8 < header_len ? (header[b / 8] >> (7 - b % 8)) & 1 : 0);
+      match = ((value ^ field->value) & ~field->mask & (uint32_t)((1ull << field->bit_length) - 1)) == 0;
+    }
+    if (match)
+      return *(uint32_t *)rules[i]->action;
+  }
+  return UINT32_MAX;
+}
+
+classifier_rule *new_rule(uint32_t id, uint32_t nb_fields)
+{
+  classifier_rule *rule = new classifier_rule;
+  rule->id = id;
+  rule->nb_fields = nb_fields;
+  rule->fields = new classifier_field *[nb_fields];
+  rule->action = new uint32_t(id);
+  for (uint32_t i = 0; i < nb_fields; ++i)
+    rule->fields[i] = new classifier_field();
+  return rule;
+}
+
+void set_field(classifier_rule *rule, uint32_t index, uint32_t offset, uint32_t bit_length, uint32_t mask, uint32_t value)
+{
+  rule->fields[index]->offset = offset;
+  rule->fields[index]->bit_length = bit_length;
+  rule->fields[index]->mask = mask;
+  rule->fields[index]->value = value;
+}
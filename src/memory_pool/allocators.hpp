@@ -0,0 +1,128 @@
+#ifndef _ALLOCATORSH_
+#define _ALLOCATORSH_
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include "memorypool.hpp"
+
+namespace DNFC
+{
+
+/**
+ * Allocators of the objects of the lock-free structures. They are stateless: 'create'
+ * constructs an object and 'destroy' destroys it and frees its memory, whichever thread
+ * calls them, so that objects can be reclaimed by HazardPointers (see AllocatorDeleter).
+ * They can be selected by the structures policies:
+ *
+ *   class Policy : public DefaultHashTablePolicy
+ *   {
+ *     public:
+ *       template <typename T>
+ *       using NodeAllocator = DNFC::PoolAllocator<T>;
+ *   };
+ */
+
+/**
+ * NewAllocator
+ *
+ * Plain new and delete.
+ */
+template <typename T>
+struct NewAllocator
+{
+    template <typename... Args>
+    static T *create(Args &&... args)
+    {
+        return new T(std::forward<Args>(args)...);
+    }
+
+    static void destroy(T *ptr)
+    {
+        delete ptr;
+    }
+};
+
+/**
+ * CacheAlignedAllocator
+ *
+ * new and delete of objects aligned on cache lines, so that an object spans as few lines
+ * as possible and never shares one with another object.
+ */
+template <typename T, std::size_t LineSize = 64>
+struct CacheAlignedAllocator
+{
+    const static std::size_t Alignment = std::max(LineSize, alignof(T));
+
+    template <typename... Args>
+    static T *create(Args &&... args)
+    {
+        void *memory = ::operator new(sizeof(T), std::align_val_t(Alignment));
+        try
+        {
+            return new (memory) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            ::operator delete(memory, std::align_val_t(Alignment));
+            throw;
+        }
+    }
+
+    static void destroy(T *ptr)
+    {
+        if (!ptr)
+            return;
+        ptr->~T();
+        ::operator delete(ptr, std::align_val_t(Alignment));
+    }
+};
+
+/**
+ * PoolAllocator
+ *
+ * Objects taken from a process-wide DNFC::pool of T aligned on 'Alignment' bytes. The
+ * pool is never destroyed: objects can still be reclaimed through HazardPointers while
+ * the process exits.
+ */
+template <typename T, typename PoolPolicy = DefaultPoolPolicy, std::size_t Alignment = alignof(T)>
+struct PoolAllocator
+{
+    template <typename... Args>
+    static T *create(Args &&... args)
+    {
+        return objects().create(std::forward<Args>(args)...);
+    }
+
+    static void destroy(T *ptr)
+    {
+        if (ptr)
+            objects().free(ptr);
+    }
+
+    static pool<T, PoolPolicy> &objects()
+    {
+        static pool<T, PoolPolicy> *instance = new pool<T, PoolPolicy>(std::max(Alignment, alignof(T)));
+        return *instance;
+    }
+};
+
+/**
+ * AllocatorDeleter
+ *
+ * Deleter giving objects back to their allocator, to be used as the Deleter of the
+ * HazardPointers retiring them.
+ */
+template <typename Allocator>
+struct AllocatorDeleter
+{
+    template <typename T>
+    void operator()(T *ptr) const
+    {
+        Allocator::destroy(ptr);
+    }
+};
+} // namespace DNFC
+
+#endif
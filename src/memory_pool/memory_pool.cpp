@@ -0,0 +1,44 @@
+#include "memory_pool.h"
+#include "memorypool.hpp"
+
+struct memory_pool
+{
+   explicit memory_pool(size_t object_size) : objects(object_size) {}
+
+   DNFC::RawPool<> objects;
+};
+
+
+
+memory_pool* new_memory_pool(size_t object_size)
+{
+   return new memory_pool(object_size);
+}
+
+
+
+void* memory_pool_alloc(memory_pool* pool)
+{
+   return pool->objects.allocate();
+}
+
+
+
+void memory_pool_free(memory_pool* pool, void* object)
+{
+   pool->objects.deallocate(object);
+}
+
+
+
+size_t memory_pool_allocated(memory_pool* pool)
+{
+   return pool->objects.stats().allocated;
+}
+
+
+
+void free_memory_pool(memory_pool* pool)
+{
+   delete pool;
+}
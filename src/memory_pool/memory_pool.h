@@ -0,0 +1,44 @@
+#ifndef _MEMORY_POOLH_
+#define _MEMORY_POOLH_
+
+/*H**********************************************************************
+ * FILENAME :        memory_pool.h
+ *
+ * DESCRIPTION :
+ *        C interface of the concurrent memory pool (see memorypool.hpp).
+ *        Objects of a fixed size are carved from huge-page backed slabs of
+ *        the NUMA node of the allocating thread and recycled through per-
+ *        thread caches, so allocating and freeing on the packet path never
+ *        calls malloc. Any thread can free an object allocated by another.
+ *
+ * PUBLIC STRUCTURE :
+ *       memory_pool
+ *
+ * AUTHOR :    Pieroux Alexandre
+ *H*/
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct memory_pool memory_pool;
+
+memory_pool* new_memory_pool(size_t object_size);
+
+void* memory_pool_alloc(memory_pool* pool);
+
+void memory_pool_free(memory_pool* pool, void* object);
+
+/* Number of objects allocated and not freed yet. */
+size_t memory_pool_allocated(memory_pool* pool);
+
+/* Unmap the memory of the pool, including the objects still allocated. */
+void free_memory_pool(memory_pool* pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,79 +1,504 @@
 #ifndef _MEMORYPOOLH_
 #define _MEMORYPOOLH_
 
-#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
 #include <new>
+#include <utility>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
 
 namespace DNFC
 {
-template <typename T, std::size_t max>
-struct pool
+
+/**
+ * Pool default policy
+ *
+ * Slabs of SlabSize bytes (the size of a huge page, a power of two) are carved into
+ * objects. Threads keep up to 2 * BatchSize free objects per NUMA node in a private
+ * cache and exchange them with the shared depot of the node BatchSize at a time. The
+ * first MaxThreads threads alive at the same time get a cache, the others share a
+ * locked one.
+ */
+class DefaultPoolPolicy
 {
   public:
-    pool(pool const &) = delete;
-    pool &operator=(pool const &) = delete;
+    const static std::size_t SlabSize = 2 * 1024 * 1024;
+    const static std::size_t BatchSize = 64;
+    const static std::size_t MaxThreads = 128;
+    const static std::size_t MaxNodes = 8;
+    const static bool HugePages = true;
+};
+
+/**
+ * PoolStats
+ *
+ * Snapshot of the counters of a pool, read without stopping the threads using it.
+ */
+struct PoolStats
+{
+    std::size_t slabs;         // Slabs mapped
+    std::size_t hugePageSlabs; // Slabs backed by explicit huge pages (MAP_HUGETLB)
+    std::size_t bytesMapped;
+    std::size_t allocated;     // Objects handed out and not freed yet
+    std::size_t cached;        // Free objects in the thread caches
+    std::size_t depot;         // Free objects in the depots
+};
+
+namespace PoolDetail
+{
+const int MaxSlots = 1024;
+
+// Number of NUMA nodes of the machine, 1 when it cannot be found
+inline int numaNodes()
+{
+    static int nodes = [] {
+        int first = 0, last = 0;
+        FILE *possible = fopen("/sys/devices/system/node/possible", "r");
+        if (!possible)
+            return 1;
+        int read = fscanf(possible, "%d-%d", &first, &last);
+        fclose(possible);
+        return read == 2 ? last + 1 : 1;
+    }();
+    return nodes;
+}
+
+inline int currentNode()
+{
+    unsigned int cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+        return 0;
+    return node;
+}
+
+// Prefer 'node' for the pages of [addr, addr + length), no-op when it fails
+inline void bindToNode(void *addr, std::size_t length, int node)
+{
+    unsigned long mask = 1UL << node;
+    syscall(SYS_mbind, addr, length, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+}
 
-    pool()
+/**
+ * Map 'size' bytes aligned on 'size': with explicit huge pages when asked and
+ * available, otherwise with regular pages marked for transparent huge pages.
+ */
+inline void *mapAligned(std::size_t size, bool hugePages, bool &huge)
+{
+    huge = false;
+    if (hugePages)
     {
-        allocBlock();
+        void *slab = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (slab != MAP_FAILED && (reinterpret_cast<uintptr_t>(slab) & (size - 1)) == 0)
+        {
+            huge = true;
+            return slab;
+        }
+        if (slab != MAP_FAILED)
+            munmap(slab, size);
     }
 
-    pool(pool &&o) noexcept
+    // Over-map to find an aligned range and give back the rest
+    void *range = mmap(nullptr, 2 * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (range == MAP_FAILED)
+        throw std::bad_alloc();
+    uintptr_t begin = reinterpret_cast<uintptr_t>(range);
+    uintptr_t aligned = (begin + size - 1) & ~(size - 1);
+    if (aligned > begin)
+        munmap(range, aligned - begin);
+    if (aligned + size < begin + 2 * size)
+        munmap(reinterpret_cast<void *>(aligned + size), begin + 2 * size - aligned - size);
+    if (hugePages)
+        madvise(reinterpret_cast<void *>(aligned), size, MADV_HUGEPAGE);
+    return reinterpret_cast<void *>(aligned);
+}
+
+/**
+ * ThreadSlot
+ *
+ * Small index of the calling thread among the threads alive, reused once a thread
+ * exits, and the NUMA node the thread ran on when it got it. Threads beyond
+ * MaxSlots get -1.
+ */
+class ThreadSlot
+{
+  public:
+    static int index()
     {
-        swap(o);
+        return get().slot;
     }
 
-    pool &operator=(pool &&o) noexcept
+    static int node()
     {
-        swap(o);
-        return *this;
+        return get().numaNode;
     }
 
-    void swap(pool &other) noexcept
+  private:
+    ThreadSlot() : slot(-1), numaNode(currentNode())
     {
-        std::swap(head, other.m_head);
-        std::swap(max, other.max);
+        for (int word = 0; word < MaxSlots / 64 && slot < 0; ++word)
+        {
+            uint64_t bits = used()[word].load(std::memory_order_relaxed);
+            while (~bits)
+            {
+                int bit = __builtin_ctzll(~bits);
+                if (used()[word].compare_exchange_weak(bits, bits | (1ULL << bit),
+                                                       std::memory_order_acquire, std::memory_order_relaxed))
+                {
+                    slot = word * 64 + bit;
+                    break;
+                }
+            }
+        }
+        if (numaNode >= numaNodes())
+            numaNode = 0;
     }
 
-    T *alloc()
+    ~ThreadSlot()
     {
-        if (head == nullptr)
-            allocBlock();
+        if (slot >= 0)
+            used()[slot / 64].fetch_and(~(1ULL << (slot % 64)), std::memory_order_release);
+    }
 
-        node *result = head;
-        head = result->next;
+    static ThreadSlot &get()
+    {
+        static thread_local ThreadSlot self;
+        return self;
+    }
 
-        return reinterpret_cast<T *>(result);
+    static std::atomic<uint64_t> *used()
+    {
+        static std::atomic<uint64_t> bits[MaxSlots / 64] = {};
+        return bits;
     }
 
-    void free(T *ptr)
+    int slot;
+    int numaNode;
+};
+} // namespace PoolDetail
+
+/**
+ * RawPool
+ *
+ * Concurrent allocator of fixed-size objects. Any thread can allocate and free,
+ * including objects allocated by other threads:
+ *   - a thread allocates from its private cache of the NUMA node it runs on, refilled
+ *     with a batch from the depot of the node, or carved from a new slab of the node;
+ *   - a freed object goes to the cache of the node its slab belongs to (found from
+ *     the address, slabs being aligned on their size), a cache growing past two
+ *     batches gives one back to the depot of the node.
+ * The depots are lock-free stacks of batches tagged against ABA; slab memory is never
+ * given back before the pool is destroyed, so reading a stale batch link is safe.
+ * Objects still allocated when the pool is destroyed become invalid.
+ */
+template <typename Policy = DefaultPoolPolicy>
+class RawPool
+{
+  public:
+    RawPool(std::size_t objectSize, std::size_t alignment = alignof(std::max_align_t))
+        : nodes(std::min<int>(PoolDetail::numaNodes(), Policy::MaxNodes))
+    {
+        if (alignment < alignof(FreeObject))
+            alignment = alignof(FreeObject);
+        slotSize = (std::max(objectSize, sizeof(FreeObject)) + alignment - 1) & ~(alignment - 1);
+        firstOffset = (sizeof(SlabHeader) + alignment - 1) & ~(alignment - 1);
+        if (firstOffset + Policy::BatchSize * slotSize > Policy::SlabSize)
+            throw std::bad_alloc();
+    }
+
+    RawPool(const RawPool &) = delete;
+    RawPool &operator=(const RawPool &) = delete;
+
+    ~RawPool()
+    {
+        for (auto &arena : arenas)
+        {
+            for (SlabHeader *slab = arena.slabs; slab;)
+            {
+                SlabHeader *next = slab->next;
+                munmap(slab, Policy::SlabSize);
+                slab = next;
+            }
+        }
+    }
+
+    void *allocate()
+    {
+        // Nodes beyond MaxNodes share the arenas of the first ones
+        int node = PoolDetail::ThreadSlot::node() % nodes;
+        Cache *cache = threadCache();
+        if (!cache)
+        {
+            std::lock_guard<std::mutex> lock(sharedLock);
+            return allocateFrom(shared, node);
+        }
+        return allocateFrom(*cache, node);
+    }
+
+    void deallocate(void *ptr)
     {
-        ptr->T::~T();
-        node *newPtr = reinterpret_cast<node *>(ptr);
-        newPtr->next = head;
-        head = newPtr;
+        Cache *cache = threadCache();
+        if (!cache)
+        {
+            std::lock_guard<std::mutex> lock(sharedLock);
+            deallocateTo(shared, ptr);
+            return;
+        }
+        deallocateTo(*cache, ptr);
+    }
+
+    // Size of the objects as carved in the slabs
+    std::size_t objectSize() const
+    {
+        return slotSize;
+    }
+
+    PoolStats stats() const
+    {
+        PoolStats result = {};
+        long allocated = 0;
+        for (int node = 0; node < nodes; ++node)
+        {
+            const Arena &arena = arenas[node];
+            result.slabs += arena.slabCount.load(std::memory_order_relaxed);
+            result.hugePageSlabs += arena.hugeSlabCount.load(std::memory_order_relaxed);
+            result.depot += arena.depotBatches.load(std::memory_order_relaxed) * Policy::BatchSize;
+        }
+        for (std::size_t t = 0; t <= Policy::MaxThreads; ++t)
+        {
+            const Cache &cache = t < Policy::MaxThreads ? caches[t] : shared;
+            allocated += cache.allocations.load(std::memory_order_relaxed);
+            allocated -= cache.frees.load(std::memory_order_relaxed);
+            for (int node = 0; node < nodes; ++node)
+                result.cached += cache.lists[node].count.load(std::memory_order_relaxed);
+        }
+        result.bytesMapped = result.slabs * Policy::SlabSize;
+        result.allocated = allocated > 0 ? allocated : 0;
+        return result;
     }
 
   private:
-    union node {
-        alignas(alignof(T)) char data[sizeof(T)];
-        node *next;
+    // A free object: 'next' links the objects of a batch, 'nextBatch' the batches of a depot
+    struct FreeObject
+    {
+        FreeObject *next;
+        FreeObject *nextBatch;
     };
 
-    node *head = nullptr;
+    struct SlabHeader
+    {
+        SlabHeader *next;
+        int node;
+    };
 
-    void allocBlock()
+    struct FreeList
     {
-        uint64_t allocSize = sizeof(T) * max;
-        head = reinterpret_cast<node *>(std::malloc(allocSize));
-        if (head == nullptr)
-            throw std::bad_alloc();
+        FreeObject *head = nullptr;
+        std::atomic<std::size_t> count{0}; // Only written by the owner, read by 'stats'
+    };
+
+    struct alignas(64) Cache
+    {
+        FreeList lists[Policy::MaxNodes];
+        std::atomic<std::size_t> allocations{0};
+        std::atomic<std::size_t> frees{0};
+    };
+
+    struct alignas(64) Arena
+    {
+        std::atomic<uint64_t> depot{0}; // Top batch in the low 48 bits, ABA tag above
+        std::atomic<std::size_t> depotBatches{0};
+        std::mutex refillLock;
+        SlabHeader *slabs = nullptr;
+        char *bump = nullptr;
+        char *end = nullptr;
+        std::atomic<std::size_t> slabCount{0};
+        std::atomic<std::size_t> hugeSlabCount{0};
+    };
+
+    const static uint64_t PointerMask = (1ULL << 48) - 1;
+
+    Cache *threadCache()
+    {
+        int slot = PoolDetail::ThreadSlot::index();
+        return slot >= 0 && static_cast<std::size_t>(slot) < Policy::MaxThreads ? &caches[slot] : nullptr;
+    }
+
+    static void bump(std::atomic<std::size_t> &counter, long delta)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    void *allocateFrom(Cache &cache, int node)
+    {
+        FreeList &list = cache.lists[node];
+        if (!list.head)
+        {
+            list.head = popBatch(arenas[node]);
+            if (!list.head)
+                list.head = carveBatch(node);
+            bump(list.count, Policy::BatchSize);
+        }
+
+        FreeObject *object = list.head;
+        list.head = object->next;
+        bump(list.count, -1);
+        bump(cache.allocations, 1);
+        return object;
+    }
+
+    void deallocateTo(Cache &cache, void *ptr)
+    {
+        int node = nodeOf(ptr);
+        FreeList &list = cache.lists[node];
+        FreeObject *object = static_cast<FreeObject *>(ptr);
+        object->next = list.head;
+        list.head = object;
+        bump(list.count, 1);
+        bump(cache.frees, 1);
+
+        // Give a batch back to the node, keeping one for the next allocations
+        if (list.count.load(std::memory_order_relaxed) >= 2 * Policy::BatchSize)
+        {
+            FreeObject *batch = list.head;
+            FreeObject *last = batch;
+            for (std::size_t i = 1; i < Policy::BatchSize; ++i)
+                last = last->next;
+            list.head = last->next;
+            last->next = nullptr;
+            bump(list.count, -static_cast<long>(Policy::BatchSize));
+            pushBatch(arenas[node], batch);
+        }
+    }
+
+    int nodeOf(void *ptr)
+    {
+        uintptr_t slab = reinterpret_cast<uintptr_t>(ptr) & ~(Policy::SlabSize - 1);
+        return reinterpret_cast<SlabHeader *>(slab)->node;
+    }
+
+    /**
+     * Depot operations
+     */
+    void pushBatch(Arena &arena, FreeObject *batch)
+    {
+        uint64_t top = arena.depot.load(std::memory_order_relaxed);
+        uint64_t tagged;
+        do
+        {
+            __atomic_store_n(&batch->nextBatch, reinterpret_cast<FreeObject *>(top & PointerMask), __ATOMIC_RELAXED);
+            tagged = ((top & ~PointerMask) + (1ULL << 48)) | reinterpret_cast<uintptr_t>(batch);
+        } while (!arena.depot.compare_exchange_weak(top, tagged, std::memory_order_release, std::memory_order_relaxed));
+        arena.depotBatches.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    FreeObject *popBatch(Arena &arena)
+    {
+        uint64_t top = arena.depot.load(std::memory_order_acquire);
+        for (;;)
+        {
+            FreeObject *batch = reinterpret_cast<FreeObject *>(top & PointerMask);
+            if (!batch)
+                return nullptr;
+
+            // 'batch' may be popped and reused meanwhile: the tag makes the CAS fail then
+            FreeObject *nextBatch = __atomic_load_n(&batch->nextBatch, __ATOMIC_RELAXED);
+            uint64_t next = ((top & ~PointerMask) + (1ULL << 48)) | reinterpret_cast<uintptr_t>(nextBatch);
+            if (arena.depot.compare_exchange_weak(top, next, std::memory_order_acquire, std::memory_order_acquire))
+            {
+                arena.depotBatches.fetch_sub(1, std::memory_order_relaxed);
+                return batch;
+            }
+        }
+    }
+
+    /**
+     * Slab operations
+     */
+    FreeObject *carveBatch(int node)
+    {
+        Arena &arena = arenas[node];
+        std::lock_guard<std::mutex> lock(arena.refillLock);
+        if (arena.end - arena.bump < static_cast<std::ptrdiff_t>(Policy::BatchSize * slotSize))
+        {
+            bool huge;
+            char *slab = static_cast<char *>(PoolDetail::mapAligned(Policy::SlabSize, Policy::HugePages, huge));
+            if (nodes > 1)
+                PoolDetail::bindToNode(slab, Policy::SlabSize, node);
+
+            SlabHeader *header = reinterpret_cast<SlabHeader *>(slab);
+            header->node = node;
+            header->next = arena.slabs;
+            arena.slabs = header;
+            arena.bump = slab + firstOffset;
+            arena.end = slab + Policy::SlabSize;
+            arena.slabCount.fetch_add(1, std::memory_order_relaxed);
+            if (huge)
+                arena.hugeSlabCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        FreeObject *batch = reinterpret_cast<FreeObject *>(arena.bump);
+        for (std::size_t i = 0; i < Policy::BatchSize; ++i)
+        {
+            FreeObject *object = reinterpret_cast<FreeObject *>(arena.bump + i * slotSize);
+            object->next = i + 1 < Policy::BatchSize ? reinterpret_cast<FreeObject *>(arena.bump + (i + 1) * slotSize) : nullptr;
+        }
+        arena.bump += Policy::BatchSize * slotSize;
+        return batch;
+    }
+
+    int nodes;
+    std::size_t slotSize;
+    std::size_t firstOffset;
+    Arena arenas[Policy::MaxNodes];
+    Cache caches[Policy::MaxThreads];
+    std::mutex sharedLock;
+    Cache shared; // Cache of the threads beyond MaxThreads
+};
+
+/**
+ * pool
+ *
+ * Typed front-end of a RawPool: 'alloc' returns uninitialized storage for a T,
+ * 'create' constructs it in place and 'free' destroys it and gives its storage back.
+ * The objects can be aligned beyond alignof(T), on cache lines for instance.
+ */
+template <typename T, typename Policy = DefaultPoolPolicy>
+class pool
+{
+  public:
+    explicit pool(std::size_t alignment = alignof(T)) : objects(sizeof(T), std::max(alignment, alignof(T))) {}
 
-        for (int i = 1; i < allocSize; i++)
-            head[i - 1].next = &head[i];
+    T *alloc()
+    {
+        return static_cast<T *>(objects.allocate());
+    }
 
-        head[allocSize - 1].next = nullptr;
+    template <typename... Args>
+    T *create(Args &&... args)
+    {
+        return new (alloc()) T(std::forward<Args>(args)...);
     }
+
+    void free(T *ptr)
+    {
+        ptr->~T();
+        objects.deallocate(ptr);
+    }
+
+    PoolStats stats() const
+    {
+        return objects.stats();
+    }
+
+  private:
+    RawPool<Policy> objects;
 };
 } // namespace DNFC
 
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+#include <gtest/gtest.h>
+
+#include "../memorypool.hpp"
+#include "../memory_pool.h"
+#include "../allocators.hpp"
+
+using namespace DNFC;
+
+class TestPolicy : public DNFC::DefaultPoolPolicy
+{
+  public:
+    const static std::size_t BatchSize = 4;
+    const static std::size_t MaxThreads = 4;
+};
+
+class OneNodePolicy : public DNFC::DefaultPoolPolicy
+{
+  public:
+    const static std::size_t BatchSize = 4;
+    const static std::size_t MaxNodes = 1;
+};
+
+struct Item
+{
+    Item(int v) : value(v) { ++alive; }
+    ~Item() { --alive; }
+
+    int value;
+    char padding[20];
+    static std::atomic<int> alive;
+};
+std::atomic<int> Item::alive(0);
+
+TEST(MemoryPool, CreateAndFree)
+{
+    pool<Item> items;
+    std::vector<Item *> created;
+    for (int i = 0; i < 1000; ++i)
+        created.push_back(items.create(i));
+
+    std::set<Item *> distinct(created.begin(), created.end());
+    EXPECT_EQ(distinct.size(), created.size());
+    EXPECT_EQ(Item::alive, 1000);
+    for (int i = 0; i < 1000; ++i)
+        EXPECT_EQ(created[i]->value, i);
+    EXPECT_EQ(items.stats().allocated, 1000u);
+
+    for (Item *item : created)
+        items.free(item);
+    EXPECT_EQ(Item::alive, 0);
+    EXPECT_EQ(items.stats().allocated, 0u);
+}
+
+TEST(MemoryPool, Reuse)
+{
+    pool<Item, TestPolicy> items;
+    Item *first = items.create(1);
+    items.free(first);
+    Item *second = items.create(2);
+    EXPECT_EQ(first, second);
+    items.free(second);
+
+    // Churn stays within the first slab
+    for (int round = 0; round < 100; ++round)
+    {
+        std::vector<Item *> created;
+        for (int i = 0; i < 100; ++i)
+            created.push_back(items.create(i));
+        for (Item *item : created)
+            items.free(item);
+    }
+    PoolStats stats = items.stats();
+    EXPECT_EQ(stats.slabs, 1u);
+    EXPECT_EQ(stats.bytesMapped, std::size_t(TestPolicy::SlabSize));
+    EXPECT_EQ(stats.allocated, 0u);
+    EXPECT_LE(stats.cached, 2 * TestPolicy::BatchSize);
+    EXPECT_GT(stats.depot, 0u);
+}
+
+TEST(MemoryPool, Alignment)
+{
+    struct alignas(64) Line
+    {
+        char bytes[64];
+    };
+    pool<Line> lines;
+    for (int i = 0; i < 100; ++i)
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(lines.alloc()) % 64, 0u);
+
+    RawPool<> small(1);
+    EXPECT_GE(small.objectSize(), 2 * sizeof(void *));
+}
+
+TEST(MemoryPool, Allocators)
+{
+    struct Block
+    {
+        long slots[64];
+        Block() : slots() { slots[0] = 1; }
+    };
+
+    Block *aligned = CacheAlignedAllocator<Block>::create();
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % 64, 0u);
+    EXPECT_EQ(aligned->slots[0], 1);
+    CacheAlignedAllocator<Block>::destroy(aligned);
+
+    using Allocator = PoolAllocator<Block, DefaultPoolPolicy, 64>;
+    std::vector<Block *> pooled;
+    for (int i = 0; i < 100; ++i)
+    {
+        pooled.push_back(Allocator::create());
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(pooled.back()) % 64, 0u);
+        EXPECT_EQ(pooled.back()->slots[0], 1);
+    }
+    EXPECT_EQ(Allocator::objects().stats().allocated, 100u);
+    for (Block *block : pooled)
+        AllocatorDeleter<Allocator>()(block);
+    EXPECT_EQ(Allocator::objects().stats().allocated, 0u);
+}
+
+TEST(MemoryPool, CrossThreadFree)
+{
+    pool<Item, TestPolicy> items;
+    const int nbItems = 100000;
+    std::vector<Item *> created(nbItems);
+
+    std::thread producer([&] {
+        for (int i = 0; i < nbItems; ++i)
+            created[i] = items.create(i);
+    });
+    producer.join();
+
+    std::thread consumer([&] {
+        for (int i = 0; i < nbItems; ++i)
+        {
+            EXPECT_EQ(created[i]->value, i);
+            items.free(created[i]);
+        }
+    });
+    consumer.join();
+
+    EXPECT_EQ(Item::alive, 0);
+    EXPECT_EQ(items.stats().allocated, 0u);
+
+    // The objects freed by the consumer went back to the depot and are reused
+    std::size_t slabs = items.stats().slabs;
+    for (int i = 0; i < nbItems; ++i)
+        created[i] = items.create(i);
+    EXPECT_EQ(items.stats().slabs, slabs);
+    for (Item *item : created)
+        items.free(item);
+}
+
+TEST(MemoryPool, Concurrent)
+{
+    // More threads than caches: the last ones share the locked cache
+    pool<Item, TestPolicy> items;
+    const int nbThreads = 8;
+    const int nbRounds = 2000;
+    std::vector<std::vector<Item *>> handoff(nbThreads);
+    std::vector<std::thread> threads;
+    std::atomic<bool> failed(false);
+
+    for (int t = 0; t < nbThreads; ++t)
+    {
+        threads.emplace_back([&, t] {
+            std::vector<Item *> mine;
+            for (int round = 0; round < nbRounds; ++round)
+            {
+                for (int i = 0; i < 16; ++i)
+                    mine.push_back(items.create(t * nbRounds + round));
+                for (int i = 0; i < 8; ++i)
+                {
+                    Item *item = mine.back();
+                    mine.pop_back();
+                    if (item->value / nbRounds != t)
+                        failed = true;
+                    items.free(item);
+                }
+            }
+            handoff[t] = std::move(mine);
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    EXPECT_FALSE(failed);
+    EXPECT_EQ(items.stats().allocated, std::size_t(nbThreads * nbRounds * 8));
+
+    // Free everything from other threads than the allocating ones
+    threads.clear();
+    for (int t = 0; t < nbThreads; ++t)
+    {
+        threads.emplace_back([&, t] {
+            for (Item *item : handoff[(t + 1) % nbThreads])
+                items.free(item);
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    EXPECT_EQ(Item::alive, 0);
+    EXPECT_EQ(items.stats().allocated, 0u);
+}
+
+TEST(MemoryPool, MoreNodesThanArenas)
+{
+    // A thread on each CPU, whatever its node, allocates from the only arena
+    pool<Item, OneNodePolicy> items;
+    unsigned nbCpus = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (unsigned cpu = 0; cpu < nbCpus; ++cpu)
+    {
+        threads.emplace_back([&items, cpu] {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            std::vector<Item *> mine;
+            for (int i = 0; i < 100; ++i)
+                mine.push_back(items.create(i));
+            for (Item *item : mine)
+                items.free(item);
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    EXPECT_EQ(items.stats().allocated, 0u);
+    EXPECT_EQ(items.stats().slabs, 1u);
+}
+
+TEST(MemoryPool, CInterface)
+{
+    memory_pool *pool = new_memory_pool(24);
+    void *objects[100];
+    for (int i = 0; i < 100; ++i)
+    {
+        objects[i] = memory_pool_alloc(pool);
+        memset(objects[i], i, 24);
+    }
+    EXPECT_EQ(memory_pool_allocated(pool), 100u);
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_EQ(static_cast<unsigned char *>(objects[i])[23], i);
+        memory_pool_free(pool, objects[i]);
+    }
+    EXPECT_EQ(memory_pool_allocated(pool), 0u);
+    free_memory_pool(pool);
+}
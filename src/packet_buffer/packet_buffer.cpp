@@ -0,0 +1,67 @@
+#include "packet_buffer.h"
+#include "packetbuffer.hpp"
+
+struct packet_pool
+{
+   packet_pool(size_t nb_buffers, size_t data_room) : buffers(nb_buffers, data_room) {}
+
+   DNFC::PacketPool buffers;
+};
+
+
+
+packet_pool* new_packet_pool(size_t nb_buffers, size_t data_room)
+{
+   return new packet_pool(nb_buffers, data_room);
+}
+
+
+
+struct packet_buffer* packet_pool_alloc(packet_pool* pool)
+{
+   return pool->buffers.alloc();
+}
+
+
+
+size_t packet_pool_alloc_n(packet_pool* pool,
+                           struct packet_buffer** buffers,
+                           size_t n)
+{
+   return pool->buffers.allocBatch(buffers, n);
+}
+
+
+
+size_t packet_pool_available(packet_pool* pool)
+{
+   return pool->buffers.available();
+}
+
+
+
+void free_packet_pool(packet_pool* pool)
+{
+   delete pool;
+}
+
+
+
+void packet_buffer_ref(struct packet_buffer* buffer)
+{
+   DNFC::PacketPool::ref(buffer);
+}
+
+
+
+void packet_buffer_free(struct packet_buffer* buffer)
+{
+   DNFC::PacketPool::free(buffer);
+}
+
+
+
+void packet_buffer_free_n(struct packet_buffer** buffers, size_t n)
+{
+   DNFC::PacketPool::freeBatch(buffers, n);
+}
@@ -0,0 +1,112 @@
+#ifndef _PACKET_BUFFERH_
+#define _PACKET_BUFFERH_
+
+/*H**********************************************************************
+ * FILENAME :        packet_buffer.h
+ *
+ * DESCRIPTION :
+ *        Preallocated packet buffers (see packetbuffer.hpp). A buffer is a
+ *        descriptor with a fixed-size data area: the packet is received or
+ *        written after PACKET_HEADROOM bytes of headroom, and the descriptor
+ *        carries a reference count and the metadata filled in along the way
+ *        (parsed offsets, flow hash, flow tag). The same buffer goes through
+ *        classification and the rule queues without any copy or allocation,
+ *        and returns to its pool when its last reference is dropped.
+ *
+ * PUBLIC STRUCTURES :
+ *       packet_buffer
+ *       packet_pool
+ *
+ * AUTHOR :    Pieroux Alexandre
+ *H*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PACKET_HEADROOM 128
+
+/* packet_buffer flags */
+#define PACKET_PARSED     0x01  /* l3_offset, l4_offset and l4_proto are set */
+#define PACKET_HASH_VALID 0x02  /* hash is set */
+
+/* Descriptor of a buffer, one cache line. */
+struct packet_buffer
+{
+   void* pool;                     // Pool the buffer goes back to
+   unsigned char* buf;             // Start of the headroom
+   void* tag;                      // Flow tag, set by the classifier
+   void* user;                     // Free for the owner of the buffer
+   uint32_t refcnt;                // Updated atomically, see packet_buffer_ref/free
+   uint32_t hash;                  // Flow hash when PACKET_HASH_VALID
+   uint16_t data_off;              // Offset of the packet in buf
+   uint16_t data_len;              // Length of the packet
+   uint16_t buf_len;               // Headroom and data room
+   uint16_t l3_offset;             // From the start of the packet when PACKET_PARSED
+   uint16_t l4_offset;
+   uint8_t l4_proto;               // IPPROTO_*
+   uint8_t flags;                  // PACKET_* flags
+};
+
+typedef struct packet_pool packet_pool;
+
+/* 'nb_buffers' buffers of PACKET_HEADROOM + 'data_room' bytes, mapped and faulted in
+   at once. 'data_room' is at most 65535 - PACKET_HEADROOM. */
+packet_pool* new_packet_pool(size_t nb_buffers, size_t data_room);
+
+/* Return a buffer with one reference and an empty packet, NULL when all are in use. */
+struct packet_buffer* packet_pool_alloc(packet_pool* pool);
+
+/* Allocate up to 'n' buffers into 'buffers', return how many were. */
+size_t packet_pool_alloc_n(packet_pool* pool,
+                           struct packet_buffer** buffers,
+                           size_t n);
+
+/* Buffers not in use. */
+size_t packet_pool_available(packet_pool* pool);
+
+/* Unmap the buffers of the pool, including the ones still in use. */
+void free_packet_pool(packet_pool* pool);
+
+void packet_buffer_ref(struct packet_buffer* buffer);
+
+/* Drop a reference, the buffer goes back to its pool with the last one. */
+void packet_buffer_free(struct packet_buffer* buffer);
+
+void packet_buffer_free_n(struct packet_buffer** buffers, size_t n);
+
+static inline unsigned char* packet_buffer_data(const struct packet_buffer* buffer)
+{
+   return buffer->buf + buffer->data_off;
+}
+
+/* Grow the packet by 'len' bytes at its end, return where they start or NULL when the
+   data room is too small. */
+static inline unsigned char* packet_buffer_append(struct packet_buffer* buffer, uint16_t len)
+{
+   if((size_t)buffer->data_off + buffer->data_len + len > buffer->buf_len)
+      return NULL;
+   unsigned char* tail = packet_buffer_data(buffer) + buffer->data_len;
+   buffer->data_len += len;
+   return tail;
+}
+
+/* Grow the packet by 'len' bytes in the headroom, return its new start or NULL when
+   the headroom is too small. */
+static inline unsigned char* packet_buffer_prepend(struct packet_buffer* buffer, uint16_t len)
+{
+   if(len > buffer->data_off)
+      return NULL;
+   buffer->data_off -= len;
+   buffer->data_len += len;
+   return packet_buffer_data(buffer);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
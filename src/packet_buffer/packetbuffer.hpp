@@ -0,0 +1,211 @@
+#ifndef _PACKETBUFFERH_
+#define _PACKETBUFFERH_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <sys/mman.h>
+
+#include "packet_buffer.h"
+#include "../memory_pool/memorypool.hpp"
+#include "../queue/ringbuffer.hpp"
+
+namespace DNFC
+{
+
+/**
+ * PacketPool
+ *
+ * Fixed set of packet buffers (see packet_buffer.h) mapped when the pool is built,
+ * with huge pages when possible and on the NUMA node of the building thread, and
+ * faulted in right away so that the packet path never takes a page fault. The free
+ * buffers wait in a RingBuffer: a burst of buffers is allocated or given back with a
+ * single CAS, and nothing is ever allocated after construction.
+ *
+ * Descriptors sit in their own array, one per cache line, apart from the data areas
+ * so that reading the metadata of a burst does not pull the packets in.
+ */
+class PacketPool
+{
+  public:
+    const static std::size_t Headroom = PACKET_HEADROOM;
+    const static std::size_t LineSize = 64;
+
+    static_assert(sizeof(packet_buffer) <= LineSize, "A descriptor must fit in a cache line");
+
+    PacketPool(std::size_t nbBuffers, std::size_t dataRoom)
+        : nbBuffers(nbBuffers), bufferSize(roundUp(Headroom + dataRoom, LineSize)), freeList(nbBuffers)
+    {
+        if (Headroom + dataRoom > UINT16_MAX)
+            throw std::bad_alloc();
+
+        // Descriptors first, then the data areas
+        std::size_t length = roundUp(nbBuffers * (LineSize + bufferSize), DefaultPoolPolicy::SlabSize);
+        region = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (region == MAP_FAILED)
+        {
+            region = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (region == MAP_FAILED)
+                throw std::bad_alloc();
+            madvise(region, length, MADV_HUGEPAGE);
+        }
+        mapped = length;
+        if (PoolDetail::numaNodes() > 1)
+            PoolDetail::bindToNode(region, length, PoolDetail::currentNode());
+
+        unsigned char *descriptors = static_cast<unsigned char *>(region);
+        unsigned char *data = descriptors + nbBuffers * LineSize;
+        for (std::size_t i = 0; i < nbBuffers; ++i)
+        {
+            packet_buffer *buffer = new (descriptors + i * LineSize) packet_buffer();
+            buffer->pool = this;
+            buffer->buf = data + i * bufferSize;
+            buffer->buf_len = static_cast<uint16_t>(Headroom + dataRoom);
+            freeList.push(buffer);
+        }
+        // Fault the data areas in
+        for (std::size_t offset = 0; offset < nbBuffers * bufferSize; offset += 4096)
+            data[offset] = 0;
+    }
+
+    ~PacketPool()
+    {
+        munmap(region, mapped);
+    }
+
+    PacketPool(const PacketPool &) = delete;
+    PacketPool &operator=(const PacketPool &) = delete;
+
+    /**
+     * alloc
+     *
+     * Return a buffer with one reference and an empty packet after the headroom, or
+     * nullptr when they are all in use.
+     */
+    packet_buffer *alloc()
+    {
+        packet_buffer *buffer;
+        if (!freeList.pop(buffer))
+            return nullptr;
+        reset(buffer);
+        return buffer;
+    }
+
+    /**
+     * allocBatch
+     *
+     * Allocate up to 'n' buffers into 'buffers' and return how many were.
+     */
+    std::size_t allocBatch(packet_buffer **buffers, std::size_t n)
+    {
+        std::size_t count = freeList.popBatch(buffers, n);
+        for (std::size_t i = 0; i < count; ++i)
+            reset(buffers[i]);
+        return count;
+    }
+
+    static void ref(packet_buffer *buffer)
+    {
+        __atomic_add_fetch(&buffer->refcnt, 1, __ATOMIC_RELAXED);
+    }
+
+    /**
+     * free
+     *
+     * Drop a reference to 'buffer', giving it back to its pool with the last one. A
+     * buffer with a single reference is given back without an atomic decrement.
+     */
+    static void free(packet_buffer *buffer)
+    {
+        if (release(buffer))
+            static_cast<PacketPool *>(buffer->pool)->recycle(&buffer, 1);
+    }
+
+    /**
+     * freeBatch
+     *
+     * Drop a reference to each of the 'n' buffers, the ones given back to the same pool
+     * in a row are pushed together.
+     */
+    static void freeBatch(packet_buffer **buffers, std::size_t n)
+    {
+        const std::size_t Run = 64;
+        packet_buffer *run[Run];
+        std::size_t length = 0;
+        PacketPool *pool = nullptr;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            if (!release(buffers[i]))
+                continue;
+            PacketPool *owner = static_cast<PacketPool *>(buffers[i]->pool);
+            if (length == Run || (length && owner != pool))
+            {
+                pool->recycle(run, length);
+                length = 0;
+            }
+            pool = owner;
+            run[length++] = buffers[i];
+        }
+        if (length)
+            pool->recycle(run, length);
+    }
+
+    // Buffers not in use
+    std::size_t available() const
+    {
+        return freeList.size();
+    }
+
+    std::size_t capacity() const
+    {
+        return nbBuffers;
+    }
+
+  private:
+    static std::size_t roundUp(std::size_t size, std::size_t alignment)
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    /**
+     * Put 'n' buffers back in the free list. It holds all the buffers so it is never
+     * full, but a push fails while a thread allocating the buffer of the cell it needs
+     * has not finished reading it: retry until that thread is done.
+     */
+    void recycle(packet_buffer **buffers, std::size_t n)
+    {
+        for (std::size_t pushed = 0; pushed < n;)
+            pushed += freeList.pushBatch(buffers + pushed, n - pushed);
+    }
+
+    // Drop a reference, return true when it was the last one
+    static bool release(packet_buffer *buffer)
+    {
+        if (__atomic_load_n(&buffer->refcnt, __ATOMIC_ACQUIRE) == 1)
+            return true;
+        return __atomic_sub_fetch(&buffer->refcnt, 1, __ATOMIC_ACQ_REL) == 0;
+    }
+
+    static void reset(packet_buffer *buffer)
+    {
+        buffer->tag = nullptr;
+        buffer->user = nullptr;
+        buffer->refcnt = 1;
+        buffer->hash = 0;
+        buffer->data_off = Headroom;
+        buffer->data_len = 0;
+        buffer->l3_offset = 0;
+        buffer->l4_offset = 0;
+        buffer->l4_proto = 0;
+        buffer->flags = 0;
+    }
+
+    const std::size_t nbBuffers;
+    const std::size_t bufferSize;
+    void *region;
+    std::size_t mapped;
+    RingBuffer<packet_buffer *> freeList;
+};
+} // namespace DNFC
+
+#endif
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <set>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../packetbuffer.hpp"
+
+using namespace DNFC;
+
+TEST(PacketBuffer, Layout)
+{
+    PacketPool pool(64, 2048);
+    EXPECT_EQ(pool.capacity(), 64u);
+    EXPECT_EQ(pool.available(), 64u);
+
+    packet_buffer *buffer = pool.alloc();
+    ASSERT_NE(buffer, nullptr);
+    EXPECT_EQ(pool.available(), 63u);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(buffer) % 64, 0u);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(buffer->buf) % 64, 0u);
+    EXPECT_EQ(buffer->refcnt, 1u);
+    EXPECT_EQ(buffer->data_len, 0u);
+    EXPECT_EQ(packet_buffer_data(buffer), buffer->buf + PACKET_HEADROOM);
+
+    // The packet is written in place, then grows in the headroom for an encapsulation
+    unsigned char *payload = packet_buffer_append(buffer, 1500);
+    ASSERT_NE(payload, nullptr);
+    memset(payload, 0xab, 1500);
+    EXPECT_EQ(packet_buffer_append(buffer, 1000), nullptr);
+    unsigned char *header = packet_buffer_prepend(buffer, 14);
+    ASSERT_NE(header, nullptr);
+    EXPECT_EQ(header + 14, payload);
+    EXPECT_EQ(buffer->data_len, 1514u);
+    EXPECT_EQ(packet_buffer_prepend(buffer, PACKET_HEADROOM), nullptr);
+
+    // A buffer comes back reset
+    buffer->tag = buffer;
+    buffer->flags = PACKET_PARSED;
+    PacketPool::free(buffer);
+    EXPECT_EQ(pool.available(), 64u);
+    std::vector<packet_buffer *> all(64);
+    EXPECT_EQ(pool.allocBatch(all.data(), 64), 64u);
+    for (packet_buffer *b : all)
+    {
+        EXPECT_EQ(b->tag, nullptr);
+        EXPECT_EQ(b->flags, 0);
+        EXPECT_EQ(b->data_off, PACKET_HEADROOM);
+    }
+    PacketPool::freeBatch(all.data(), all.size());
+}
+
+TEST(PacketBuffer, Exhaustion)
+{
+    PacketPool pool(8, 256);
+    packet_buffer *buffers[16];
+    EXPECT_EQ(pool.allocBatch(buffers, 16), 8u);
+    EXPECT_EQ(pool.alloc(), nullptr);
+
+    std::set<packet_buffer *> distinct(buffers, buffers + 8);
+    EXPECT_EQ(distinct.size(), 8u);
+
+    PacketPool::freeBatch(buffers, 8);
+    EXPECT_EQ(pool.available(), 8u);
+}
+
+TEST(PacketBuffer, References)
+{
+    PacketPool pool(4, 256);
+    packet_buffer *buffer = pool.alloc();
+    PacketPool::ref(buffer);
+    PacketPool::ref(buffer);
+    PacketPool::free(buffer);
+    PacketPool::free(buffer);
+    EXPECT_EQ(pool.available(), 3u);
+    PacketPool::free(buffer);
+    EXPECT_EQ(pool.available(), 4u);
+
+    // Buffers of two pools freed in one batch go back to their own pool
+    PacketPool other(4, 256);
+    packet_buffer *mixed[4] = {pool.alloc(), other.alloc(), other.alloc(), pool.alloc()};
+    PacketPool::ref(mixed[0]);
+    PacketPool::freeBatch(mixed, 4);
+    EXPECT_EQ(pool.available(), 3u);
+    EXPECT_EQ(other.available(), 4u);
+    PacketPool::free(mixed[0]);
+    EXPECT_EQ(pool.available(), 4u);
+}
+
+TEST(PacketBuffer, CInterface)
+{
+    packet_pool *pool = new_packet_pool(16, 1024);
+    struct packet_buffer *buffers[4];
+    EXPECT_EQ(packet_pool_alloc_n(pool, buffers, 4), 4u);
+    struct packet_buffer *single = packet_pool_alloc(pool);
+    EXPECT_EQ(packet_pool_available(pool), 11u);
+
+    packet_buffer_ref(single);
+    packet_buffer_free(single);
+    EXPECT_EQ(packet_pool_available(pool), 11u);
+    packet_buffer_free(single);
+    packet_buffer_free_n(buffers, 4);
+    EXPECT_EQ(packet_pool_available(pool), 16u);
+    free_packet_pool(pool);
+}
+
+TEST(PacketBuffer, StressAllocFree)
+{
+    // Buffers are handed between threads, each one is only ever owned by one of them
+    const int nbThreads = 4, nbRounds = 20000;
+    PacketPool pool(256, 128);
+    std::atomic<bool> shared(false);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < nbThreads; ++t)
+    {
+        threads.emplace_back([&, t] {
+            packet_buffer *burst[32];
+            for (int i = 0; i < nbRounds; ++i)
+            {
+                std::size_t n = pool.allocBatch(burst, 1 + (i + t) % 32);
+                for (std::size_t k = 0; k < n; ++k)
+                {
+                    if (burst[k]->user)
+                        shared = true;
+                    burst[k]->user = burst;
+                }
+                for (std::size_t k = 0; k < n; ++k)
+                    burst[k]->user = nullptr;
+                if (i % 2)
+                    PacketPool::freeBatch(burst, n);
+                else
+                    for (std::size_t k = 0; k < n; ++k)
+                        PacketPool::free(burst[k]);
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    EXPECT_FALSE(shared);
+    EXPECT_EQ(pool.available(), 256u);
+}
@@ -0,0 +1,186 @@
+#ifndef _BURSTPARSERH_
+#define _BURSTPARSERH_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "flowparser.hpp"
+
+namespace DNFC
+{
+
+/**
+ * BurstParser
+ *
+ * FlowParser for a burst of packets, built around the layouts of nearly all the
+ * traffic: Ethernet, then IPv4 without options or IPv6 without extension headers, then
+ * TCP or UDP. The Ethernet type, IP version, header length, fragment offset and
+ * protocol of each packet are checked against both layouts, the key of a packet with
+ * one of them is then filled straight from fixed offsets, and every other packet goes
+ * through FlowParser: the keys are the same either way. The next packets are
+ * prefetched while one is parsed.
+ */
+template <typename Policy = DefaultFlowParserPolicy>
+class BurstParser
+{
+  public:
+    // Packets shorter than that never have a common layout
+    const static std::size_t IPv4Length = 14 + 20 + 14;
+    const static std::size_t IPv6Length = 14 + 40 + 14;
+
+    /**
+     * parse
+     *
+     * FlowParser::parse for 'n' packets, filling 'keys'. Return how many are flows.
+     */
+    static std::size_t parse(const uint8_t *const *pckts, const std::size_t *lengths, flow_key *keys, std::size_t n,
+                             flow_key_layer layer = FLOW_KEY_INNER)
+    {
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            if (i + PrefetchDistance < n)
+                __builtin_prefetch(pckts[i + PrefetchDistance], 0, 3);
+            const uint8_t *pckt = pckts[i];
+            int version = layout(pckt, lengths[i]);
+            bool built = version == 4 ? buildIPv4(pckt, keys[i], layer) : version == 6 && buildIPv6(pckt, keys[i], layer);
+            count += built || FlowParser<Policy>::parse(pckt, lengths[i], keys[i], layer);
+        }
+        return count;
+    }
+    /**
+     * parse
+     *
+     * Parse 'n' packet buffers and cache the offsets, protocol and hash of the flows in
+     * their descriptor, like FlowParser::parse. Return how many are flows.
+     */
+    static std::size_t parse(packet_buffer *const *pckts, flow_key *keys, std::size_t n,
+                             flow_key_layer layer = FLOW_KEY_INNER)
+    {
+        const std::size_t Chunk = 32;
+        const uint8_t *data[Chunk];
+        std::size_t lengths[Chunk];
+        std::size_t count = 0;
+        for (std::size_t base = 0; base < n; base += Chunk)
+        {
+            std::size_t size = std::min(n - base, Chunk);
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                data[i] = packet_buffer_data(pckts[base + i]);
+                lengths[i] = pckts[base + i]->data_len;
+            }
+            count += parse(data, lengths, keys + base, size, layer);
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                const flow_key &key = keys[base + i];
+                if (!key.version)
+                    continue;
+                packet_buffer *pckt = pckts[base + i];
+                pckt->l3_offset = key.l3_offset;
+                pckt->l4_offset = key.l4_offset;
+                pckt->l4_proto = key.proto;
+                pckt->hash = key.hash;
+                pckt->flags |= PACKET_PARSED | PACKET_HASH_VALID;
+            }
+        }
+        return count;
+    }
+
+  private:
+    const static std::size_t PrefetchDistance = 4;
+
+    static bool isTransport(uint8_t protocol)
+    {
+        return protocol == IPPROTO_TCP || protocol == IPPROTO_UDP;
+    }
+
+    // 4 or 6 when the packet has the common layout of that version, 0 otherwise
+    static int layout(const uint8_t *pckt, std::size_t length)
+    {
+        if (length < IPv4Length)
+            return 0;
+        if (pckt[12] == 0x08 && pckt[13] == 0x00 && pckt[14] == 0x45 && !((pckt[20] & 0x1f) | pckt[21]) &&
+            isTransport(pckt[23]))
+            return 4;
+        if (length >= IPv6Length && pckt[12] == 0x86 && pckt[13] == 0xdd && (pckt[14] >> 4) == 6 && isTransport(pckt[20]))
+            return 6;
+        return 0;
+    }
+
+    // VXLAN packets are left to FlowParser, which enters them
+    static bool isVxlan(const uint8_t *pckt, std::size_t l4, uint8_t protocol, flow_key_layer layer)
+    {
+        return Policy::MaxTunnels && layer == FLOW_KEY_INNER && protocol == IPPROTO_UDP &&
+               ((pckt[l4 + 2] << 8) | pckt[l4 + 3]) == Policy::VxlanPort;
+    }
+
+    /**
+     * Words of the hash of a key (see FlowParser::hash), straight from the packet: the
+     * common layouts have at least 8 bytes from the ports on, and no tunnel nor VLAN tag.
+     */
+    static void hashWords(const uint8_t *pckt, std::size_t l4, uint8_t protocol, uint8_t version, uint64_t *words)
+    {
+        typedef FlowParser<Policy> Parser;
+        if (version == 4)
+        {
+            words[0] = Parser::word(pckt + 26) & 0xffffffff;
+            words[1] = 0;
+            words[2] = Parser::word(pckt + 30) & 0xffffffff;
+            words[3] = 0;
+        }
+        else
+        {
+            for (std::size_t i = 0; i < 4; ++i)
+                words[i] = Parser::word(pckt + 22 + 8 * i);
+        }
+        words[4] = (Parser::word(pckt + l4) & 0xffffffff) | (uint64_t(protocol) << 32) | (uint64_t(version) << 40);
+        words[5] = 0;
+    }
+
+    // Fields after the ports, the same for both layouts but the version and the L4 offset
+    static void finish(const uint8_t *pckt, flow_key &key, uint8_t protocol, uint8_t version, uint16_t l4,
+                       const uint64_t *words)
+    {
+        key.proto = protocol;
+        key.version = version;
+        key.tcp_flags = protocol == IPPROTO_TCP ? pckt[l4 + 13] : 0;
+        key.l3_offset = 14;
+        key.l4_offset = l4;
+        key.outer_l3_offset = 14;
+        key.hash = FlowParser<Policy>::hash(words);
+    }
+
+    static bool buildIPv4(const uint8_t *pckt, flow_key &key, flow_key_layer layer)
+    {
+        uint8_t protocol = pckt[23];
+        if (isVxlan(pckt, 34, protocol, layer))
+            return false;
+        uint64_t words[6];
+        hashWords(pckt, 34, protocol, 4, words);
+        std::memset(&key, 0, sizeof(key));
+        std::memcpy(key.src, pckt + 26, 4);
+        std::memcpy(key.dst, pckt + 30, 4);
+        std::memcpy(&key.src_port, pckt + 34, 4);
+        finish(pckt, key, protocol, 4, 34, words);
+        return true;
+    }
+
+    static bool buildIPv6(const uint8_t *pckt, flow_key &key, flow_key_layer layer)
+    {
+        uint8_t protocol = pckt[20];
+        if (isVxlan(pckt, 54, protocol, layer))
+            return false;
+        uint64_t words[6];
+        hashWords(pckt, 54, protocol, 6, words);
+        std::memcpy(key.src, pckt + 22, 32); // Source and destination addresses follow each other
+        std::memset(&key.src_port, 0, sizeof(key) - 32);
+        std::memcpy(&key.src_port, pckt + 54, 4);
+        finish(pckt, key, protocol, 6, 54, words);
+        return true;
+    }
+};
+} // namespace DNFC
+
+#endif
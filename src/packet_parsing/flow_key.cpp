@@ -0,0 +1,42 @@
+#include "flow_key.h"
+#include "burstparser.hpp"
+
+
+
+bool parse_flow_key(const unsigned char* pckt,
+                    size_t pckt_len,
+                    enum flow_key_layer layer,
+                    struct flow_key* key)
+{
+   return DNFC::FlowParser<>::parse(pckt, pckt_len, *key, layer);
+}
+
+
+
+bool parse_packet(struct packet_buffer* pckt,
+                  enum flow_key_layer layer,
+                  struct flow_key* key)
+{
+   return DNFC::FlowParser<>::parse(pckt, *key, layer);
+}
+
+
+
+size_t parse_flow_keys(const unsigned char* const* pckts,
+                       const size_t* pckt_lens,
+                       size_t n,
+                       enum flow_key_layer layer,
+                       struct flow_key* keys)
+{
+   return DNFC::BurstParser<>::parse(pckts, pckt_lens, keys, n, layer);
+}
+
+
+
+size_t parse_packets(struct packet_buffer* const* pckts,
+                     size_t n,
+                     enum flow_key_layer layer,
+                     struct flow_key* keys)
+{
+   return DNFC::BurstParser<>::parse(pckts, keys, n, layer);
+}
@@ -0,0 +1,100 @@
+#ifndef _FLOW_KEYH_
+#define _FLOW_KEYH_
+
+/*H**********************************************************************
+ * FILENAME :        flow_key.h
+ *
+ * DESCRIPTION :
+ *        Normalized key of the flow of a packet, filled by a single pass
+ *        over its headers (see flowparser.hpp) through VLAN tags, MPLS
+ *        labels, IPv6 extension headers and GRE, VXLAN or IP in IP tunnels.
+ *        The key has the same layout for IPv4 and IPv6 and fits in one cache
+ *        line: it is built once per packet and read by the dynamic classifier
+ *        (flow tables and worker choice), and the offsets found on the way are
+ *        cached in the packet_buffer. The static classifiers match their rules
+ *        on any bits of the raw headers, which the key does not keep.
+ *
+ * PUBLIC STRUCTURE :
+ *       flow_key
+ *
+ * AUTHOR :    Pieroux Alexandre
+ *H*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../packet_buffer/packet_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Headers that the parser went through, in flow_key.encap */
+#define FLOW_KEY_VLAN     0x01     /* 802.1Q or 802.1ad (QinQ) tags */
+#define FLOW_KEY_MPLS     0x02
+#define FLOW_KEY_IPV6_EXT 0x04     /* IPv6 extension headers */
+#define FLOW_KEY_GRE      0x08
+#define FLOW_KEY_VXLAN    0x10
+#define FLOW_KEY_IPIP     0x20     /* IPv4 or IPv6 directly in IP */
+
+/* Headers the key is taken from when the packet is tunneled (GRE, VXLAN, IP in IP) */
+enum flow_key_layer
+{
+   FLOW_KEY_INNER,                 // The innermost packet
+   FLOW_KEY_OUTER                  // The tunnel itself, only TCP or UDP tunnels are flows
+};
+
+/* Addresses and ports are kept in network byte order. */
+struct flow_key
+{
+   uint8_t src[16];                // IPv4 addresses in the first 4 bytes, zeros after
+   uint8_t dst[16];
+   uint16_t src_port;
+   uint16_t dst_port;
+   uint8_t proto;                  // IPPROTO_TCP or IPPROTO_UDP
+   uint8_t version;                // 4 or 6, 0 when the packet is not TCP or UDP over IP
+   uint8_t tcp_flags;              // Flags of a TCP packet, 0 otherwise
+   uint8_t encap;                  // FLOW_KEY_* flags
+   uint16_t l3_offset;             // From the start of the packet
+   uint16_t l4_offset;
+   uint32_t hash;                  // Of the 5-tuple, tunnel ID and VLAN ID of the flow
+   uint32_t tunnel_id;             // VXLAN VNI or GRE key of the innermost tunnel
+   uint16_t vlan_id;               // VLAN ID of the outermost tag
+   uint16_t outer_l3_offset;       // Outermost IP header
+   uint8_t padding[8];
+} __attribute__((packed, aligned(64)));
+
+/* Fill 'key' from the headers of the packet, from the inner or outer packet of a
+   tunnel depending on 'layer'. Return false when it is not a TCP or UDP packet over
+   IPv4 or IPv6, or its headers go beyond what the parser handles: 'key' is then
+   zeroed. */
+bool parse_flow_key(const unsigned char* pckt,
+                    size_t pckt_len,
+                    enum flow_key_layer layer,
+                    struct flow_key* key);
+
+/* parse_flow_key on the packet of 'pckt', also caching the offsets, the protocol and
+   the hash in its descriptor (PACKET_PARSED | PACKET_HASH_VALID) when it succeeds. */
+bool parse_packet(struct packet_buffer* pckt,
+                  enum flow_key_layer layer,
+                  struct flow_key* key);
+
+/* parse_flow_key for 'n' packets (see burstparser.hpp), return how many are flows. */
+size_t parse_flow_keys(const unsigned char* const* pckts,
+                       const size_t* pckt_lens,
+                       size_t n,
+                       enum flow_key_layer layer,
+                       struct flow_key* keys);
+
+/* parse_packet for 'n' packets, return how many are flows. */
+size_t parse_packets(struct packet_buffer* const* pckts,
+                     size_t n,
+                     enum flow_key_layer layer,
+                     struct flow_key* keys);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,392 @@
+#ifndef _FLOWPARSERH_
+#define _FLOWPARSERH_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+
+#include "flow_key.h"
+
+namespace DNFC
+{
+
+static_assert(sizeof(flow_key) == 64 && alignof(flow_key) == 64, "A flow key must be one cache line");
+
+namespace ParserDetail
+{
+// What follows an IP header
+enum NextHeader : uint8_t
+{
+    Other,
+    Transport,
+    Extension,
+    Fragment,
+    Authentication,
+    Gre,
+    IPv4InIP,
+    IPv6InIP
+};
+
+// Kind of header by protocol number
+struct NextHeaders
+{
+    NextHeader kinds[256];
+
+    constexpr NextHeaders() : kinds()
+    {
+        kinds[IPPROTO_TCP] = Transport;
+        kinds[IPPROTO_UDP] = Transport;
+        kinds[IPPROTO_HOPOPTS] = Extension;
+        kinds[IPPROTO_ROUTING] = Extension;
+        kinds[IPPROTO_DSTOPTS] = Extension;
+        kinds[IPPROTO_FRAGMENT] = Fragment;
+        kinds[IPPROTO_AH] = Authentication;
+        kinds[IPPROTO_GRE] = Gre;
+        kinds[IPPROTO_IPIP] = IPv4InIP;
+        kinds[IPPROTO_IPV6] = IPv6InIP;
+    }
+};
+
+inline constexpr NextHeaders nextHeaders{};
+} // namespace ParserDetail
+
+/**
+ * DefaultFlowParserPolicy
+ *
+ * Limits of the header walk: a packet with more VLAN tags, MPLS labels, IPv6 extension
+ * headers or nested tunnels is left unparsed. VxlanPort is the UDP destination port
+ * of VXLAN.
+ */
+class DefaultFlowParserPolicy
+{
+  public:
+    const static unsigned MaxVlanTags = 2;
+    const static unsigned MaxMplsLabels = 8;
+    const static unsigned MaxExtensionHeaders = 8;
+    const static unsigned MaxTunnels = 2;
+    const static uint16_t VxlanPort = 4789;
+};
+
+/**
+ * FlowParser
+ *
+ * Single pass over the headers of a packet filling a flow_key on the way: Ethernet
+ * with its VLAN tags, MPLS labels, IPv4 or IPv6 with its extension headers, then TCP
+ * or UDP. GRE, VXLAN and IP in IP tunnels are either entered, so that the key is
+ * the one of the innermost packet, or taken as the flow themselves (FLOW_KEY_OUTER).
+ *
+ * What follows an IP header is looked up in a table by protocol number. The usual
+ * Ethernet, IPv4 and TCP packet goes through a few comparisons, that table and the
+ * reads of its fields. Every read is checked against the length of the packet and
+ * nothing is allocated, so the classifiers can work from the key instead of parsing
+ * the packet again.
+ */
+template <typename Policy = DefaultFlowParserPolicy>
+class FlowParser
+{
+  public:
+    /**
+     * parse
+     *
+     * Fill 'key' from the headers of the packet. Return false when it is not a TCP or
+     * UDP packet over IP or goes beyond the limits of Policy, 'key' is then zeroed.
+     * Fragments after the first one carry no transport header and are not parsed
+     * either.
+     */
+    static bool parse(const uint8_t *pckt, std::size_t pcktLength, flow_key &key,
+                      flow_key_layer layer = FLOW_KEY_INNER)
+    {
+        std::memset(&key, 0, sizeof(key));
+        if (!walk(pckt, pcktLength, key, layer))
+        {
+            std::memset(&key, 0, sizeof(key));
+            return false;
+        }
+        key.hash = hash(key);
+        return true;
+    }
+
+    /**
+     * parse
+     *
+     * Parse the packet of 'pckt' and, when it is a flow, cache the offsets, the
+     * protocol and the hash of its key in the descriptor.
+     */
+    static bool parse(packet_buffer *pckt, flow_key &key, flow_key_layer layer = FLOW_KEY_INNER)
+    {
+        if (!parse(packet_buffer_data(pckt), pckt->data_len, key, layer))
+            return false;
+        pckt->l3_offset = key.l3_offset;
+        pckt->l4_offset = key.l4_offset;
+        pckt->l4_proto = key.proto;
+        pckt->hash = key.hash;
+        pckt->flags |= PACKET_PARSED | PACKET_HASH_VALID;
+        return true;
+    }
+
+    /**
+     * hash
+     *
+     * Hash of the addresses, the ports, the protocol and the version of 'key': its 38
+     * first bytes, and of its tunnel and VLAN IDs, so that the tenants reusing a
+     * 5-tuple in their own VXLAN network or VLAN are told apart.
+     */
+    static uint32_t hash(const flow_key &key)
+    {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&key);
+        uint64_t words[6] = {word(bytes),
+                             word(bytes + 8),
+                             word(bytes + 16),
+                             word(bytes + 24),
+                             word(bytes + 32) & 0xffffffffffffull,
+                             word(bytes + offsetof(flow_key, tunnel_id)) & 0xffffffffffffull};
+        return hash(words);
+    }
+
+    /**
+     * hash
+     *
+     * Hash of a key held in 6 words (see word): its 38 first bytes, then the 6 bytes of
+     * its tunnel and VLAN IDs. Each word is multiplied by its own odd constant so that
+     * the products do not wait for each other, then their sum is mixed and its high
+     * half kept.
+     */
+    static uint32_t hash(const uint64_t *words)
+    {
+        uint64_t h = words[0] * 0x9e3779b97f4a7c15ull + words[1] * 0xbf58476d1ce4e5b9ull +
+                     words[2] * 0x94d049bb133111ebull + words[3] * 0xff51afd7ed558ccdull +
+                     words[4] * 0xc4ceb9fe1a85ec53ull + words[5] * 0x2545f4914f6cdd1dull;
+        h ^= h >> 29;
+        h *= 0xd6e8feb86659fd93ull;
+        return static_cast<uint32_t>(h >> 32);
+    }
+
+    /**
+     * word
+     *
+     * The 8 bytes from 'bytes' as a little-endian word, whatever the byte order of the
+     * CPU.
+     */
+    static uint64_t word(const uint8_t *bytes)
+    {
+        uint64_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        value = __builtin_bswap64(value);
+#endif
+        return value;
+    }
+
+  private:
+    const static uint16_t EtherTypeQinQ = 0x88a8;
+    const static uint16_t EtherTypeQinQOld = 0x9100;
+    const static uint16_t EtherTypeMpls = 0x8847;
+    const static uint16_t EtherTypeMplsMulticast = 0x8848;
+    const static uint16_t EtherTypeBridging = 0x6558; // Ethernet in GRE
+
+    static uint16_t read16(const uint8_t *bytes)
+    {
+        return (bytes[0] << 8) | bytes[1];
+    }
+
+    /**
+     * Walk the headers from the Ethernet one, entering up to MaxTunnels tunnels when
+     * the inner layer is asked for, and fill everything but the hash of 'key'.
+     */
+    static bool walk(const uint8_t *pckt, std::size_t length, flow_key &key, flow_key_layer layer)
+    {
+        std::size_t offset = 0;
+        uint16_t etherType = 0;
+        bool ethernet = true;
+        for (unsigned tunnels = 0;; ++tunnels)
+        {
+            if (ethernet && !parseEthernet(pckt, length, offset, etherType, key))
+                return false;
+            if ((etherType == EtherTypeMpls || etherType == EtherTypeMplsMulticast) &&
+                !parseMpls(pckt, length, offset, etherType, key))
+                return false;
+
+            uint8_t protocol;
+            if (!parseNetwork(pckt, length, offset, etherType, protocol, key))
+                return false;
+            if (!tunnels)
+                key.outer_l3_offset = key.l3_offset;
+
+            bool enter = layer == FLOW_KEY_INNER && tunnels < Policy::MaxTunnels;
+            switch (ParserDetail::nextHeaders.kinds[protocol])
+            {
+            case ParserDetail::Transport:
+                // TCP and UDP both start with the source and destination ports
+                if (length < offset + 4)
+                    return false;
+                if (protocol == IPPROTO_UDP && enter && read16(pckt + offset + 2) == Policy::VxlanPort &&
+                    enterVxlan(pckt, length, offset, key))
+                {
+                    ethernet = true;
+                    continue;
+                }
+                std::memcpy(&key.src_port, pckt + offset, 2);
+                std::memcpy(&key.dst_port, pckt + offset + 2, 2);
+                if (protocol == IPPROTO_TCP && length >= offset + 14)
+                    key.tcp_flags = pckt[offset + 13];
+                key.proto = protocol;
+                key.l4_offset = static_cast<uint16_t>(offset);
+                return true;
+            case ParserDetail::Gre:
+                if (!enter || !enterGre(pckt, length, offset, etherType, key))
+                    return false;
+                ethernet = etherType == EtherTypeBridging;
+                continue;
+            case ParserDetail::IPv4InIP:
+            case ParserDetail::IPv6InIP:
+                if (!enter)
+                    return false;
+                etherType = protocol == IPPROTO_IPIP ? ETHERTYPE_IP : ETHERTYPE_IPV6;
+                key.encap |= FLOW_KEY_IPIP;
+                ethernet = false;
+                continue;
+            default:
+                return false;
+            }
+        }
+    }
+
+    // Ethernet header and VLAN tags, leave 'offset' after them
+    static bool parseEthernet(const uint8_t *pckt, std::size_t length, std::size_t &offset, uint16_t &etherType,
+                              flow_key &key)
+    {
+        if (length < offset + sizeof(struct ether_header))
+            return false;
+        etherType = read16(pckt + offset + 12);
+        offset += sizeof(struct ether_header);
+        for (unsigned tags = 0; etherType == ETHERTYPE_VLAN || etherType == EtherTypeQinQ || etherType == EtherTypeQinQOld;
+             ++tags)
+        {
+            if (tags == Policy::MaxVlanTags || length < offset + 4)
+                return false;
+            if (!(key.encap & FLOW_KEY_VLAN))
+                key.vlan_id = read16(pckt + offset) & 0xfff;
+            key.encap |= FLOW_KEY_VLAN;
+            etherType = read16(pckt + offset + 2);
+            offset += 4;
+        }
+        return true;
+    }
+
+    // MPLS labels up to the bottom of the stack, the payload has no type: guess it from the IP version
+    static bool parseMpls(const uint8_t *pckt, std::size_t length, std::size_t &offset, uint16_t &etherType,
+                          flow_key &key)
+    {
+        for (unsigned labels = 0;; ++labels)
+        {
+            if (labels == Policy::MaxMplsLabels || length < offset + 4)
+                return false;
+            bool bottom = pckt[offset + 2] & 1;
+            offset += 4;
+            if (bottom)
+                break;
+        }
+        key.encap |= FLOW_KEY_MPLS;
+        if (length <= offset)
+            return false;
+        etherType = pckt[offset] >> 4 == 4 ? ETHERTYPE_IP : pckt[offset] >> 4 == 6 ? ETHERTYPE_IPV6 : 0;
+        return true;
+    }
+
+    /**
+     * IPv4 or IPv6 header, and the IPv6 extension headers: fill the addresses of 'key'
+     * and leave 'offset' on the header of 'protocol'.
+     */
+    static bool parseNetwork(const uint8_t *pckt, std::size_t length, std::size_t &offset, uint16_t etherType,
+                             uint8_t &protocol, flow_key &key)
+    {
+        const uint8_t *iph = pckt + offset;
+        if (key.version) // Inner header of a tunnel
+            std::memset(key.src, 0, sizeof(key.src) + sizeof(key.dst));
+
+        if (etherType == ETHERTYPE_IP)
+        {
+            if (length < offset + 20 || (iph[0] >> 4) != 4)
+                return false;
+            std::size_t headerLength = (iph[0] & 0xf) << 2;
+            if (headerLength < 20 || ((iph[6] & 0x1f) | iph[7]))
+                return false;
+            protocol = iph[9];
+            std::memcpy(key.src, iph + 12, 4);
+            std::memcpy(key.dst, iph + 16, 4);
+            key.version = 4;
+            key.l3_offset = static_cast<uint16_t>(offset);
+            offset += headerLength;
+            return true;
+        }
+        if (etherType != ETHERTYPE_IPV6 || length < offset + 40 || (iph[0] >> 4) != 6)
+            return false;
+
+        protocol = iph[6];
+        std::memcpy(key.src, iph + 8, 16);
+        std::memcpy(key.dst, iph + 24, 16);
+        key.version = 6;
+        key.l3_offset = static_cast<uint16_t>(offset);
+        offset += 40;
+        for (unsigned headers = 0;; ++headers)
+        {
+            ParserDetail::NextHeader kind = ParserDetail::nextHeaders.kinds[protocol];
+            if (kind != ParserDetail::Extension && kind != ParserDetail::Fragment && kind != ParserDetail::Authentication)
+                return true;
+            if (headers == Policy::MaxExtensionHeaders || length < offset + 8)
+                return false;
+
+            const uint8_t *ext = pckt + offset;
+            if (kind == ParserDetail::Fragment && (read16(ext + 2) & 0xfff8))
+                return false;
+            protocol = ext[0];
+            offset += kind == ParserDetail::Fragment ? 8 : kind == ParserDetail::Authentication ? (ext[1] + 2) << 2 : (ext[1] + 1) << 3;
+            key.encap |= FLOW_KEY_IPV6_EXT;
+        }
+    }
+
+    // UDP and VXLAN headers, a packet to the VXLAN port without a VNI is an ordinary UDP packet
+    static bool enterVxlan(const uint8_t *pckt, std::size_t length, std::size_t &offset, flow_key &key)
+    {
+        const uint8_t *vxlan = pckt + offset + 8;
+        if (length < offset + 16 || !(vxlan[0] & 0x08))
+            return false;
+        key.tunnel_id = (vxlan[4] << 16) | (vxlan[5] << 8) | vxlan[6];
+        key.encap |= FLOW_KEY_VXLAN;
+        offset += 16;
+        return true;
+    }
+
+    // GRE header with its optional checksum, key and sequence number; source routing is not supported
+    static bool enterGre(const uint8_t *pckt, std::size_t length, std::size_t &offset, uint16_t &etherType,
+                         flow_key &key)
+    {
+        if (length < offset + 4)
+            return false;
+        const uint8_t *gre = pckt + offset;
+        if ((gre[0] & 0x40) || (gre[1] & 0x07))
+            return false;
+        std::size_t headerLength = 4;
+        if (gre[0] & 0x80)
+            headerLength += 4;
+        if (gre[0] & 0x20)
+        {
+            if (length < offset + headerLength + 4)
+                return false;
+            const uint8_t *greKey = gre + headerLength;
+            key.tunnel_id = (uint32_t(greKey[0]) << 24) | (greKey[1] << 16) | (greKey[2] << 8) | greKey[3];
+            headerLength += 4;
+        }
+        if (gre[0] & 0x10)
+            headerLength += 4;
+        etherType = read16(gre + 2);
+        key.encap |= FLOW_KEY_GRE;
+        offset += headerLength;
+        return true;
+    }
+};
+} // namespace DNFC
+
+#endif
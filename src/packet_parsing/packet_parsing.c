@@ -46,7 +46,7 @@ void parse_ipv6h(struct ip6_hdr** ipv6h,
                  struct tcphdr** tcp_out,
                  struct udphdr** udp_out)
 {
-   switch (ntohs((*ipv6h)->ip6_ctlun.ip6_un1.ip6_un1_nxt))
+   switch ((*ipv6h)->ip6_ctlun.ip6_un1.ip6_un1_nxt)
    {
       case IPPROTO_TCP:
          *tcp_out = (struct tcphdr *)((*ipv6h) + 1);
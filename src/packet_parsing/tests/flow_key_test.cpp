@@ -0,0 +1,580 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <gtest/gtest.h>
+
+#include "../burstparser.hpp"
+#include "../../packet_buffer/packetbuffer.hpp"
+
+using namespace DNFC;
+
+// Ethernet frame of a TCP or UDP packet, with 'options' bytes of IPv4 options
+static size_t make_ipv4(uint8_t *pckt, uint8_t protocol, uint16_t sport, uint16_t dport, size_t options = 0)
+{
+    memset(pckt, 0, 128);
+    pckt[12] = 0x08;
+    pckt[13] = 0x00;
+    uint8_t *iph = pckt + 14;
+    iph[0] = 0x40 | ((20 + options) >> 2);
+    iph[9] = protocol;
+    const uint8_t src[4] = {10, 0, 0, 1}, dst[4] = {192, 168, 1, 2};
+    memcpy(iph + 12, src, 4);
+    memcpy(iph + 16, dst, 4);
+    uint8_t *l4 = iph + 20 + options;
+    uint16_t ports[2] = {htons(sport), htons(dport)};
+    memcpy(l4, ports, 4);
+    return 14 + 20 + options + 20;
+}
+
+static size_t make_ipv6(uint8_t *pckt, uint8_t protocol, uint16_t sport, uint16_t dport)
+{
+    memset(pckt, 0, 128);
+    pckt[12] = 0x86;
+    pckt[13] = 0xdd;
+    uint8_t *ip6h = pckt + 14;
+    ip6h[0] = 0x60;
+    ip6h[6] = protocol;
+    for (int i = 0; i < 16; ++i)
+    {
+        ip6h[8 + i] = 0x20 + i;
+        ip6h[24 + i] = 0x40 + i;
+    }
+    uint16_t ports[2] = {htons(sport), htons(dport)};
+    memcpy(ip6h + 40, ports, 4);
+    return 14 + 40 + 8;
+}
+
+// Frame built header by header, the fields not given are zero
+struct Frame
+{
+    uint8_t bytes[512];
+    size_t length = 0;
+
+    uint8_t *add(size_t n)
+    {
+        uint8_t *header = bytes + length;
+        memset(header, 0, n);
+        length += n;
+        return header;
+    }
+
+    void ethernet(uint16_t type)
+    {
+        uint8_t *header = add(14);
+        header[12] = type >> 8;
+        header[13] = type & 0xff;
+    }
+
+    void vlan(uint16_t id, uint16_t type)
+    {
+        uint8_t *header = add(4);
+        header[0] = id >> 8;
+        header[1] = id & 0xff;
+        header[2] = type >> 8;
+        header[3] = type & 0xff;
+    }
+
+    void ipv4(uint8_t protocol, uint8_t host)
+    {
+        uint8_t *header = add(20);
+        header[0] = 0x45;
+        header[9] = protocol;
+        header[12] = 10;
+        header[15] = host;
+        header[16] = 10;
+        header[19] = 1;
+    }
+
+    void ipv6(uint8_t next, uint8_t host)
+    {
+        uint8_t *header = add(40);
+        header[0] = 0x60;
+        header[6] = next;
+        header[8] = 0x20;
+        header[23] = host;
+        header[24] = 0x20;
+        header[39] = 1;
+    }
+
+    // IPv6 extension header of 'size' bytes
+    void extension(uint8_t next, size_t size, uint8_t lengthField)
+    {
+        uint8_t *header = add(size);
+        header[0] = next;
+        header[1] = lengthField;
+    }
+
+    void ports(uint16_t sport, uint16_t dport, size_t size = 8)
+    {
+        uint8_t *header = add(size);
+        header[0] = sport >> 8;
+        header[1] = sport & 0xff;
+        header[2] = dport >> 8;
+        header[3] = dport & 0xff;
+    }
+
+    bool parse(flow_key &key, flow_key_layer layer = FLOW_KEY_INNER)
+    {
+        return parse_flow_key(bytes, length, layer, &key);
+    }
+};
+
+TEST(FlowKey, Layout)
+{
+    EXPECT_EQ(sizeof(flow_key), 64u);
+    EXPECT_EQ(alignof(flow_key), 64u);
+    flow_key keys[2];
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(&keys[1]) % 64, 0u);
+}
+
+TEST(FlowKey, IPv4)
+{
+    uint8_t pckt[128];
+    size_t length = make_ipv4(pckt, IPPROTO_TCP, 1234, 80, 8);
+    pckt[14 + 28 + 13] = TH_FIN | TH_ACK;
+
+    flow_key key;
+    ASSERT_TRUE(parse_flow_key(pckt, length, FLOW_KEY_INNER, &key));
+    EXPECT_EQ(key.version, 4);
+    EXPECT_EQ(key.proto, IPPROTO_TCP);
+    EXPECT_EQ(memcmp(key.src, pckt + 26, 4), 0);
+    EXPECT_EQ(memcmp(key.dst, pckt + 30, 4), 0);
+    for (int i = 4; i < 16; ++i)
+        EXPECT_EQ(key.src[i] | key.dst[i], 0);
+    EXPECT_EQ(ntohs(key.src_port), 1234);
+    EXPECT_EQ(ntohs(key.dst_port), 80);
+    EXPECT_EQ(key.tcp_flags, TH_FIN | TH_ACK);
+    EXPECT_EQ(key.l3_offset, 14);
+    EXPECT_EQ(key.l4_offset, 42);
+    EXPECT_EQ(key.hash, FlowParser<>::hash(key));
+}
+
+TEST(FlowKey, IPv6)
+{
+    uint8_t pckt[128];
+    size_t length = make_ipv6(pckt, IPPROTO_UDP, 53, 5353);
+
+    flow_key key;
+    ASSERT_TRUE(parse_flow_key(pckt, length, FLOW_KEY_INNER, &key));
+    EXPECT_EQ(key.version, 6);
+    EXPECT_EQ(key.proto, IPPROTO_UDP);
+    EXPECT_EQ(memcmp(key.src, pckt + 22, 16), 0);
+    EXPECT_EQ(memcmp(key.dst, pckt + 38, 16), 0);
+    EXPECT_EQ(ntohs(key.src_port), 53);
+    EXPECT_EQ(ntohs(key.dst_port), 5353);
+    EXPECT_EQ(key.tcp_flags, 0);
+    EXPECT_EQ(key.l3_offset, 14);
+    EXPECT_EQ(key.l4_offset, 54);
+}
+
+TEST(FlowKey, NotAFlow)
+{
+    uint8_t pckt[128];
+    flow_key key;
+
+    size_t length = make_ipv4(pckt, IPPROTO_ICMP, 0, 0);
+    EXPECT_FALSE(parse_flow_key(pckt, length, FLOW_KEY_INNER, &key));
+    EXPECT_EQ(key.version, 0);
+
+    // ARP
+    length = make_ipv4(pckt, IPPROTO_TCP, 1, 2);
+    pckt[13] = 0x06;
+    EXPECT_FALSE(parse_flow_key(pckt, length, FLOW_KEY_INNER, &key));
+
+    // Truncated before the ports, or in the Ethernet header
+    length = make_ipv4(pckt, IPPROTO_UDP, 1, 2);
+    EXPECT_FALSE(parse_flow_key(pckt, 14 + 20 + 3, FLOW_KEY_INNER, &key));
+    EXPECT_EQ(key.version, 0);
+    EXPECT_FALSE(parse_flow_key(pckt, 10, FLOW_KEY_INNER, &key));
+    EXPECT_TRUE(parse_flow_key(pckt, 14 + 20 + 4, FLOW_KEY_INNER, &key));
+
+    // Header length below the minimum, wrong version, fragment after the first one
+    pckt[14] = 0x44;
+    EXPECT_FALSE(parse_flow_key(pckt, length, FLOW_KEY_INNER, &key));
+    pckt[14] = 0x65;
+    EXPECT_FALSE(parse_flow_key(pckt, length, FLOW_KEY_INNER, &key));
+    pckt[14] = 0x45;
+    pckt[14 + 7] = 0x10;
+    EXPECT_FALSE(parse_flow_key(pckt, length, FLOW_KEY_INNER, &key));
+    pckt[14 + 6] = 0x20; // First fragment, more to come
+    pckt[14 + 7] = 0x00;
+    EXPECT_TRUE(parse_flow_key(pckt, length, FLOW_KEY_INNER, &key));
+
+    length = make_ipv6(pckt, IPPROTO_ICMPV6, 0, 0);
+    EXPECT_FALSE(parse_flow_key(pckt, length, FLOW_KEY_INNER, &key));
+}
+
+TEST(FlowKey, Hash)
+{
+    uint8_t pckt[128];
+    flow_key first, second;
+
+    // Every packet of a flow has the same hash whatever its TCP flags
+    size_t length = make_ipv4(pckt, IPPROTO_TCP, 1000, 80);
+    ASSERT_TRUE(parse_flow_key(pckt, length, FLOW_KEY_INNER, &first));
+    pckt[14 + 20 + 13] = TH_SYN;
+    ASSERT_TRUE(parse_flow_key(pckt, length, FLOW_KEY_INNER, &second));
+    EXPECT_EQ(first.hash, second.hash);
+
+    // Flows differing in any field of the 5-tuple are spread
+    uint32_t hashes[64];
+    for (uint16_t i = 0; i < 64; ++i)
+    {
+        length = make_ipv4(pckt, i % 2 ? IPPROTO_TCP : IPPROTO_UDP, 1000 + i / 2, 80);
+        ASSERT_TRUE(parse_flow_key(pckt, length, FLOW_KEY_INNER, &first));
+        hashes[i] = first.hash;
+    }
+    std::sort(hashes, hashes + 64);
+    EXPECT_EQ(std::unique(hashes, hashes + 64), hashes + 64);
+}
+
+TEST(FlowKey, PacketBuffer)
+{
+    PacketPool pool(4, 2048);
+    packet_buffer *buffer = pool.alloc();
+    ASSERT_NE(buffer, nullptr);
+    flow_key key;
+
+    size_t length = make_ipv6(packet_buffer_append(buffer, 62), IPPROTO_TCP, 4000, 443);
+    ASSERT_EQ(length, 62u);
+    ASSERT_TRUE(parse_packet(buffer, FLOW_KEY_INNER, &key));
+    EXPECT_EQ(buffer->flags, PACKET_PARSED | PACKET_HASH_VALID);
+    EXPECT_EQ(buffer->l3_offset, 14);
+    EXPECT_EQ(buffer->l4_offset, 54);
+    EXPECT_EQ(buffer->l4_proto, IPPROTO_TCP);
+    EXPECT_EQ(buffer->hash, key.hash);
+    PacketPool::free(buffer);
+
+    // Nothing is cached for a packet that is not a flow
+    buffer = pool.alloc();
+    make_ipv4(packet_buffer_append(buffer, 54), IPPROTO_ICMP, 0, 0);
+    EXPECT_FALSE(parse_packet(buffer, FLOW_KEY_INNER, &key));
+    EXPECT_EQ(buffer->flags, 0);
+    PacketPool::free(buffer);
+}
+
+TEST(FlowKey, Vlan)
+{
+    Frame frame;
+    frame.ethernet(0x88a8);
+    frame.vlan(100, ETHERTYPE_VLAN);
+    frame.vlan(200, ETHERTYPE_IP);
+    frame.ipv4(IPPROTO_TCP, 1);
+    frame.ports(1000, 80, 20);
+
+    flow_key key;
+    ASSERT_TRUE(frame.parse(key));
+    EXPECT_EQ(key.encap, FLOW_KEY_VLAN);
+    EXPECT_EQ(key.vlan_id, 100);
+    EXPECT_EQ(key.l3_offset, 22);
+    EXPECT_EQ(key.l4_offset, 42);
+    EXPECT_EQ(ntohs(key.dst_port), 80);
+
+    // One tag more than DefaultFlowParserPolicy::MaxVlanTags
+    Frame deep;
+    deep.ethernet(ETHERTYPE_VLAN);
+    deep.vlan(1, ETHERTYPE_VLAN);
+    deep.vlan(2, ETHERTYPE_VLAN);
+    deep.vlan(3, ETHERTYPE_IP);
+    deep.ipv4(IPPROTO_TCP, 1);
+    deep.ports(1000, 80, 20);
+    EXPECT_FALSE(deep.parse(key));
+}
+
+TEST(FlowKey, Mpls)
+{
+    Frame frame;
+    frame.ethernet(0x8847);
+    frame.add(4)[1] = 0x10;
+    frame.add(4)[2] = 0x01; // Bottom of the stack
+    frame.ipv6(IPPROTO_UDP, 1);
+    frame.ports(53, 53);
+
+    flow_key key;
+    ASSERT_TRUE(frame.parse(key));
+    EXPECT_EQ(key.version, 6);
+    EXPECT_EQ(key.encap, FLOW_KEY_MPLS);
+    EXPECT_EQ(key.l3_offset, 22);
+
+    // No bottom of the stack in the packet
+    frame.bytes[20] = 0;
+    EXPECT_FALSE(frame.parse(key));
+}
+
+TEST(FlowKey, IPv6Extensions)
+{
+    Frame frame;
+    frame.ethernet(ETHERTYPE_IPV6);
+    frame.ipv6(IPPROTO_HOPOPTS, 1);
+    frame.extension(IPPROTO_ROUTING, 8, 0);
+    frame.extension(IPPROTO_FRAGMENT, 16, 1);
+    uint8_t *fragment = frame.add(8);
+    fragment[0] = IPPROTO_AH;
+    fragment[3] = 0x01; // First fragment, more to come
+    frame.extension(IPPROTO_TCP, 24, 4);
+    frame.ports(22, 40000, 20);
+
+    flow_key key;
+    ASSERT_TRUE(frame.parse(key));
+    EXPECT_EQ(key.encap, FLOW_KEY_IPV6_EXT);
+    EXPECT_EQ(key.proto, IPPROTO_TCP);
+    EXPECT_EQ(key.l4_offset, 14 + 40 + 8 + 16 + 8 + 24);
+    EXPECT_EQ(ntohs(key.src_port), 22);
+
+    // Later fragment
+    fragment[2] = 0x01;
+    EXPECT_FALSE(frame.parse(key));
+
+    // More than DefaultFlowParserPolicy::MaxExtensionHeaders
+    Frame deep;
+    deep.ethernet(ETHERTYPE_IPV6);
+    deep.ipv6(IPPROTO_DSTOPTS, 1);
+    for (int i = 0; i < 9; ++i)
+        deep.extension(i < 8 ? uint8_t(IPPROTO_DSTOPTS) : uint8_t(IPPROTO_UDP), 8, 0);
+    deep.ports(1, 2);
+    EXPECT_FALSE(deep.parse(key));
+}
+
+TEST(FlowKey, Vxlan)
+{
+    Frame frame;
+    frame.ethernet(ETHERTYPE_IP);
+    frame.ipv4(IPPROTO_UDP, 1);
+    frame.ports(50000, 4789);
+    uint8_t *vxlan = frame.add(8);
+    vxlan[0] = 0x08;
+    vxlan[4] = 0x12;
+    vxlan[5] = 0x34;
+    vxlan[6] = 0x56;
+    frame.ethernet(ETHERTYPE_IP);
+    frame.ipv4(IPPROTO_TCP, 7);
+    frame.ports(80, 443, 20);
+
+    flow_key inner, outer;
+    ASSERT_TRUE(frame.parse(inner));
+    EXPECT_EQ(inner.encap, FLOW_KEY_VXLAN);
+    EXPECT_EQ(inner.tunnel_id, 0x123456u);
+    EXPECT_EQ(inner.proto, IPPROTO_TCP);
+    EXPECT_EQ(inner.src[3], 7);
+    EXPECT_EQ(ntohs(inner.src_port), 80);
+    EXPECT_EQ(inner.outer_l3_offset, 14);
+    EXPECT_EQ(inner.l3_offset, 14 + 20 + 16 + 14);
+
+    ASSERT_TRUE(frame.parse(outer, FLOW_KEY_OUTER));
+    EXPECT_EQ(outer.proto, IPPROTO_UDP);
+    EXPECT_EQ(outer.src[3], 1);
+    EXPECT_EQ(ntohs(outer.dst_port), 4789);
+    EXPECT_EQ(outer.l3_offset, 14);
+    EXPECT_NE(inner.hash, outer.hash);
+
+    // The same inner 5-tuple in another VXLAN network is another flow
+    flow_key other;
+    vxlan[6] = 0x57;
+    ASSERT_TRUE(frame.parse(other));
+    EXPECT_EQ(other.tunnel_id, 0x123457u);
+    EXPECT_EQ(memcmp(&other, &inner, offsetof(flow_key, hash)), 0);
+    EXPECT_NE(other.hash, inner.hash);
+
+    // Without the VNI flag this is an ordinary UDP packet
+    vxlan[0] = 0;
+    ASSERT_TRUE(frame.parse(inner));
+    EXPECT_EQ(inner.proto, IPPROTO_UDP);
+    EXPECT_EQ(inner.encap, 0);
+}
+
+TEST(FlowKey, Gre)
+{
+    // GRE with a key carrying IPv6 directly
+    Frame frame;
+    frame.ethernet(ETHERTYPE_IP);
+    frame.ipv4(IPPROTO_GRE, 1);
+    uint8_t *gre = frame.add(8);
+    gre[0] = 0x20;
+    gre[2] = 0x86;
+    gre[3] = 0xdd;
+    gre[7] = 42;
+    frame.ipv6(IPPROTO_UDP, 9);
+    frame.ports(1, 2);
+
+    flow_key key;
+    ASSERT_TRUE(frame.parse(key));
+    EXPECT_EQ(key.encap, FLOW_KEY_GRE);
+    EXPECT_EQ(key.tunnel_id, 42u);
+    EXPECT_EQ(key.version, 6);
+    EXPECT_EQ(key.src[15], 9);
+    EXPECT_FALSE(frame.parse(key, FLOW_KEY_OUTER));
+
+    // Source routing is not supported
+    gre[0] |= 0x40;
+    EXPECT_FALSE(frame.parse(key));
+
+    // Ethernet in GRE (NVGRE) with a checksum
+    Frame bridged;
+    bridged.ethernet(ETHERTYPE_IPV6);
+    bridged.ipv6(IPPROTO_GRE, 1);
+    gre = bridged.add(8);
+    gre[0] = 0x80;
+    gre[2] = 0x65;
+    gre[3] = 0x58;
+    bridged.ethernet(ETHERTYPE_VLAN);
+    bridged.vlan(7, ETHERTYPE_IP);
+    bridged.ipv4(IPPROTO_TCP, 3);
+    bridged.ports(1, 2, 20);
+    ASSERT_TRUE(bridged.parse(key));
+    EXPECT_EQ(key.encap, FLOW_KEY_GRE | FLOW_KEY_VLAN);
+    EXPECT_EQ(key.vlan_id, 7);
+    EXPECT_EQ(key.version, 4);
+    for (int i = 4; i < 16; ++i)
+        EXPECT_EQ(key.src[i] | key.dst[i], 0);
+}
+
+TEST(FlowKey, IPInIP)
+{
+    Frame frame;
+    frame.ethernet(ETHERTYPE_IP);
+    for (int i = 0; i < 3; ++i)
+        frame.ipv4(IPPROTO_IPIP, i);
+    frame.ipv4(IPPROTO_UDP, 3);
+    frame.ports(1, 2);
+
+    // One tunnel more than DefaultFlowParserPolicy::MaxTunnels
+    flow_key key;
+    EXPECT_FALSE(frame.parse(key));
+
+    Frame nested;
+    nested.ethernet(ETHERTYPE_IPV6);
+    nested.ipv6(IPPROTO_IPIP, 1);
+    nested.ipv4(IPPROTO_IPV6, 2);
+    nested.ipv6(IPPROTO_UDP, 3);
+    nested.ports(1, 2);
+    ASSERT_TRUE(nested.parse(key));
+    EXPECT_EQ(key.encap, FLOW_KEY_IPIP);
+    EXPECT_EQ(key.version, 6);
+    EXPECT_EQ(key.src[15], 3);
+    EXPECT_EQ(key.outer_l3_offset, 14);
+    EXPECT_EQ(key.l3_offset, 14 + 40 + 20);
+}
+
+// Every layout of the tests above, and each of them cut at every length
+static std::vector<Frame> corpus()
+{
+    std::vector<Frame> frames;
+    Frame frame;
+    frame.length = make_ipv4(frame.bytes, IPPROTO_TCP, 1234, 80);
+    frame.bytes[47] = TH_SYN;
+    frames.push_back(frame);
+    frame.length = make_ipv4(frame.bytes, IPPROTO_UDP, 53, 4789);
+    frames.push_back(frame);
+    frame.bytes[50] = 0x08; // VXLAN header, no inner packet
+    frames.push_back(frame);
+    frame.length = make_ipv4(frame.bytes, IPPROTO_TCP, 1, 2, 12);
+    frames.push_back(frame);
+    frame.length = make_ipv4(frame.bytes, IPPROTO_ICMP, 0, 0);
+    frames.push_back(frame);
+    frame.length = make_ipv4(frame.bytes, IPPROTO_UDP, 1, 2);
+    frame.bytes[20] = 0x20;
+    frames.push_back(frame);
+    frame.bytes[21] = 0x01;
+    frames.push_back(frame);
+    frame.length = make_ipv6(frame.bytes, IPPROTO_TCP, 443, 50000);
+    frame.length += 12;
+    frame.bytes[67] = TH_FIN;
+    frames.push_back(frame);
+    frame.length = make_ipv6(frame.bytes, IPPROTO_UDP, 1, 4789);
+    frames.push_back(frame);
+
+    Frame vxlan;
+    vxlan.ethernet(ETHERTYPE_IPV6);
+    vxlan.ipv6(IPPROTO_UDP, 1);
+    vxlan.ports(50000, 4789);
+    vxlan.add(8)[0] = 0x08;
+    vxlan.ethernet(ETHERTYPE_IP);
+    vxlan.ipv4(IPPROTO_TCP, 7);
+    vxlan.ports(80, 443, 20);
+    frames.push_back(vxlan);
+
+    Frame tagged;
+    tagged.ethernet(ETHERTYPE_VLAN);
+    tagged.vlan(5, ETHERTYPE_IP);
+    tagged.ipv4(IPPROTO_UDP, 1);
+    tagged.ports(1, 2, 20);
+    frames.push_back(tagged);
+
+    std::size_t whole = frames.size();
+    for (std::size_t f = 0; f < whole; ++f)
+        for (std::size_t length = 0; length < frames[f].length; ++length)
+        {
+            frames.push_back(frames[f]);
+            frames.back().length = length;
+        }
+    return frames;
+}
+
+TEST(FlowKey, BurstMatchesParser)
+{
+    std::vector<Frame> frames = corpus();
+    std::vector<const uint8_t *> pckts;
+    std::vector<size_t> lengths;
+    for (Frame &frame : frames)
+    {
+        pckts.push_back(frame.bytes);
+        lengths.push_back(frame.length);
+    }
+
+    std::vector<flow_key> expected(frames.size()), keys(frames.size());
+    for (flow_key_layer layer : {FLOW_KEY_INNER, FLOW_KEY_OUTER})
+    {
+        size_t flows = 0;
+        for (size_t i = 0; i < frames.size(); ++i)
+            flows += FlowParser<>::parse(pckts[i], lengths[i], expected[i], layer);
+        EXPECT_GT(flows, 10u);
+
+        // Bursts of every size, so that the prefetches stop anywhere
+        for (size_t burst = 1; burst <= 33; burst += 4)
+        {
+            memset(keys.data(), 0xff, keys.size() * sizeof(flow_key));
+            size_t count = 0;
+            for (size_t base = 0; base < frames.size(); base += burst)
+            {
+                size_t n = std::min(burst, frames.size() - base);
+                count += BurstParser<>::parse(pckts.data() + base, lengths.data() + base, keys.data() + base, n, layer);
+            }
+            EXPECT_EQ(count, flows);
+            for (size_t i = 0; i < frames.size(); ++i)
+                ASSERT_EQ(memcmp(&keys[i], &expected[i], sizeof(flow_key)), 0) << i << " " << burst;
+        }
+    }
+}
+
+TEST(FlowKey, BurstPacketBuffers)
+{
+    PacketPool pool(40, 2048);
+    packet_buffer *buffers[40];
+    flow_key keys[40];
+    ASSERT_EQ(pool.allocBatch(buffers, 40), 40u);
+    for (int i = 0; i < 40; ++i)
+    {
+        if (i % 4 == 3)
+            make_ipv4(packet_buffer_append(buffers[i], 54), IPPROTO_ICMP, 0, 0);
+        else if (i % 2)
+            make_ipv6(packet_buffer_append(buffers[i], 74), IPPROTO_UDP, i, 53);
+        else
+            make_ipv4(packet_buffer_append(buffers[i], 60), IPPROTO_TCP, i, 80);
+    }
+
+    EXPECT_EQ(parse_packets(buffers, 40, FLOW_KEY_INNER, keys), 30u);
+    for (int i = 0; i < 40; ++i)
+    {
+        flow_key key;
+        bool flow = parse_flow_key(packet_buffer_data(buffers[i]), buffers[i]->data_len, FLOW_KEY_INNER, &key);
+        EXPECT_EQ(memcmp(&key, &keys[i], sizeof(key)), 0);
+        EXPECT_EQ(buffers[i]->flags, flow ? PACKET_PARSED | PACKET_HASH_VALID : 0);
+        EXPECT_EQ(buffers[i]->hash, flow ? key.hash : 0);
+        EXPECT_EQ(buffers[i]->l4_offset, flow ? key.l4_offset : 0);
+    }
+    PacketPool::freeBatch(buffers, 40);
+}
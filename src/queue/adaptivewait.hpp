@@ -0,0 +1,175 @@
+#ifndef _ADAPTIVEWAITH_
+#define _ADAPTIVEWAITH_
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <thread>
+
+#include <linux/futex.h>
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace DNFC
+{
+namespace WaitDetail
+{
+// Whether membarrier can order the memory accesses of the other threads (Linux 4.14), registered once
+inline bool asymmetricFences()
+{
+    static bool supported = [] {
+        long commands = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0);
+        return commands > 0 && (commands & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+               syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+    }();
+    return supported;
+}
+} // namespace WaitDetail
+
+/**
+ * AdaptiveWait default policy
+ *
+ * A consumer first polls SpinCount times with a pause in between, which keeps the
+ * latency of a loaded queue at a few hundred nanoseconds, then yields its core
+ * YieldCount times before parking on a futex.
+ */
+class DefaultWaitPolicy
+{
+  public:
+    const static int SpinCount = 256;
+    const static int YieldCount = 16;
+};
+
+/**
+ * AdaptiveWait
+ *
+ * Lets the consumers of a non-blocking queue wait for an item without burning their
+ * core: 'wait' retries a pop while spinning, then yielding, then parked on a futex,
+ * and producers call 'notify' after each push. A consumer registers itself as a
+ * waiter before its last try, so a producer only reads the number of waiters when
+ * nobody is parked, the system call is left to the idle case. The push and that read
+ * must not be reordered: a parking consumer issues a membarrier, which fences every
+ * thread of the process, so that the producers only need a compiler barrier. Without
+ * membarrier, every notify issues a fence.
+ */
+template <class Policy = DefaultWaitPolicy>
+class alignas(64) AdaptiveWait
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    AdaptiveWait() : sequence(0), waiters(0), asymmetric(WaitDetail::asymmetricFences()) {}
+
+    AdaptiveWait(const AdaptiveWait &) = delete;
+    AdaptiveWait &operator=(const AdaptiveWait &) = delete;
+
+    /**
+     * wait
+     *
+     * Call 'tryPop' until it returns true or 'timeout' elapsed, return its last
+     * result. A timeout of nanoseconds::max() waits forever.
+     */
+    template <typename TryPop>
+    bool wait(TryPop tryPop, std::chrono::nanoseconds timeout)
+    {
+        for (int i = 0; i < Policy::SpinCount; ++i)
+        {
+            if (tryPop())
+                return true;
+            pause();
+        }
+
+        Clock::time_point now = Clock::now();
+        Clock::time_point deadline = timeout >= Clock::time_point::max() - now ? Clock::time_point::max() : now + timeout;
+        for (int i = 0; i < Policy::YieldCount; ++i)
+        {
+            if (tryPop())
+                return true;
+            if (Clock::now() >= deadline)
+                return false;
+            std::this_thread::yield();
+        }
+
+        for (;;)
+        {
+            // Register before the last try, a push after it then sees the waiter
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+            if (asymmetric)
+                syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+            else
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            uint32_t key = sequence.load(std::memory_order_acquire);
+            if (tryPop())
+            {
+                waiters.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            now = Clock::now();
+            if (now >= deadline)
+            {
+                waiters.fetch_sub(1, std::memory_order_relaxed);
+                return false;
+            }
+            park(key, deadline == Clock::time_point::max() ? nullptr : &deadline, now);
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * notify
+     *
+     * Wake up to 'count' parked consumers, after 'count' items were pushed.
+     */
+    void notify(std::size_t count = 1)
+    {
+        if (asymmetric)
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        else
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (__builtin_expect(waiters.load(std::memory_order_relaxed) == 0, 1))
+            return;
+        sequence.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, &sequence, FUTEX_WAKE_PRIVATE, count > INT_MAX ? INT_MAX : int(count), nullptr, nullptr, 0);
+    }
+
+    // Consumers registered as waiters
+    uint32_t nbWaiters() const
+    {
+        return waiters.load(std::memory_order_relaxed);
+    }
+
+  private:
+    static void pause()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    // Sleep until a notify changed the sequence from 'key', or until the deadline
+    void park(uint32_t key, const Clock::time_point *deadline, Clock::time_point now)
+    {
+        struct timespec remaining;
+        if (deadline)
+        {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(*deadline - now).count();
+            remaining.tv_sec = ns / 1000000000;
+            remaining.tv_nsec = ns % 1000000000;
+        }
+        syscall(SYS_futex, &sequence, FUTEX_WAIT_PRIVATE, key, deadline ? &remaining : nullptr, nullptr, 0);
+    }
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "The futex word must be a plain 32 bits integer");
+
+    std::atomic<uint32_t> sequence; // Futex word, changed by every notify that found waiters
+    std::atomic<uint32_t> waiters;
+    bool asymmetric; // Fences of the producers left to the parking consumers
+};
+} // namespace DNFC
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../ringbuffer.hpp"
+#include "../spscring.hpp"
+
+/**
+ * Ring throughput microbenchmark
+ *
+ * Producers push pointers and consumers pop them as fast as they can, one at a time
+ * and in bursts of 32, through one shared MPMC RingBuffer and through a RingMatrix of
+ * SPSC rings where each producer feeds its own consumer. Usage: ring_buffer_bench
+ * [max threads per side] [capacity] [milliseconds per run]
+ */
+using namespace DNFC;
+
+const std::size_t BurstSize = 32;
+
+struct Shared
+{
+    RingBuffer<void *> ring;
+
+    Shared(std::size_t, std::size_t capacity) : ring(capacity) {}
+
+    std::size_t push(std::size_t, void **items, std::size_t n)
+    {
+        return n == 1 ? ring.push(items[0]) : ring.pushBatch(items, n);
+    }
+
+    std::size_t pop(std::size_t, void **items, std::size_t n)
+    {
+        return n == 1 ? ring.pop(items[0]) : ring.popBatch(items, n);
+    }
+};
+
+struct Matrix
+{
+    RingMatrix<void *> rings;
+
+    Matrix(std::size_t nbThreads, std::size_t capacity) : rings(nbThreads, nbThreads, capacity) {}
+
+    std::size_t push(std::size_t t, void **items, std::size_t n)
+    {
+        return n == 1 ? rings.push(t, t, items[0]) : rings.pushBatch(t, t, items, n);
+    }
+
+    std::size_t pop(std::size_t t, void **items, std::size_t n)
+    {
+        return n == 1 ? rings.pop(t, items[0]) : rings.popBatch(t, items, n);
+    }
+};
+
+template <typename Queue>
+double run(std::size_t nbThreads, std::size_t capacity, std::size_t burst, int milliseconds)
+{
+    Queue queue(nbThreads, capacity);
+    std::atomic<bool> start(false);
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long long> totalOps(0);
+    std::vector<std::thread> workers;
+
+    for (std::size_t t = 0; t < 2 * nbThreads; ++t)
+    {
+        bool producer = t < nbThreads;
+        std::size_t index = t % nbThreads;
+        workers.push_back(std::thread([&, producer, index] {
+            void *items[BurstSize];
+            for (std::size_t i = 0; i < BurstSize; ++i)
+                items[i] = &items[i];
+            unsigned long long ops = 0;
+            while (!start.load(std::memory_order_acquire))
+                std::this_thread::yield();
+
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                std::size_t done = producer ? queue.push(index, items, burst) : queue.pop(index, items, burst);
+                if (!done)
+                    std::this_thread::yield();
+                if (!producer)
+                    ops += done;
+            }
+            totalOps.fetch_add(ops, std::memory_order_relaxed);
+        }));
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+    stop.store(true, std::memory_order_relaxed);
+    for (auto &worker : workers)
+        worker.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+    return totalOps.load() / elapsed.count() / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t maxThreads = argc > 1 ? atoi(argv[1]) : 16;
+    std::size_t capacity = argc > 2 ? atoi(argv[2]) : 4096;
+    int milliseconds = argc > 3 ? atoi(argv[3]) : 500;
+
+    printf("# capacity %zu, %d ms per run, %u hardware threads, items popped Mops/s\n",
+           capacity, milliseconds, std::thread::hardware_concurrency());
+    printf("%8s %12s %12s %12s %12s\n", "threads", "mpmc", "mpmc/burst", "spsc", "spsc/burst");
+    for (std::size_t t = 1; t <= maxThreads; t *= 2)
+        printf("%8zu %12.3f %12.3f %12.3f %12.3f\n", t,
+               run<Shared>(t, capacity, 1, milliseconds), run<Shared>(t, capacity, BurstSize, milliseconds),
+               run<Matrix>(t, capacity, 1, milliseconds), run<Matrix>(t, capacity, BurstSize, milliseconds));
+    return 0;
+}
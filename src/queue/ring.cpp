@@ -0,0 +1,174 @@
+#include "ring.h"
+#include "ringbuffer.hpp"
+#include "spscring.hpp"
+
+struct ring
+{
+   explicit ring(size_t capacity) : items(capacity) {}
+
+   DNFC::RingBuffer<void*> items;
+};
+
+struct ring_matrix
+{
+   ring_matrix(size_t nb_producers, size_t nb_consumers, size_t capacity)
+      : items(nb_producers, nb_consumers, capacity) {}
+
+   DNFC::RingMatrix<void*> items;
+};
+
+static std::chrono::nanoseconds to_timeout(uint64_t timeout_ns)
+{
+   if(timeout_ns > uint64_t(std::chrono::nanoseconds::max().count()))
+      return std::chrono::nanoseconds::max();
+   return std::chrono::nanoseconds(timeout_ns);
+}
+
+
+
+ring* new_ring(size_t capacity)
+{
+   return new ring(capacity);
+}
+
+
+
+bool ring_push(ring* ring, void* item)
+{
+   return ring->items.push(item);
+}
+
+
+
+void* ring_pop(ring* ring)
+{
+   void* item = NULL;
+   ring->items.pop(item);
+   return item;
+}
+
+
+
+void* ring_pop_wait(ring* ring, uint64_t timeout_ns)
+{
+   void* item = NULL;
+   ring->items.popWait(item, to_timeout(timeout_ns));
+   return item;
+}
+
+
+
+size_t ring_push_n(ring* ring,
+                   void** items,
+                   size_t n)
+{
+   return ring->items.pushBatch(items, n);
+}
+
+
+
+size_t ring_pop_n(ring* ring,
+                  void** items,
+                  size_t n)
+{
+   return ring->items.popBatch(items, n);
+}
+
+
+
+size_t ring_size(ring* ring)
+{
+   return ring->items.size();
+}
+
+
+
+void free_ring(ring* ring)
+{
+   delete ring;
+}
+
+
+
+ring_matrix* new_ring_matrix(size_t nb_producers,
+                             size_t nb_consumers,
+                             size_t capacity)
+{
+   return new ring_matrix(nb_producers, nb_consumers, capacity);
+}
+
+
+
+bool ring_matrix_push(ring_matrix* matrix,
+                      size_t producer,
+                      size_t consumer,
+                      void* item)
+{
+   return matrix->items.push(producer, consumer, item);
+}
+
+
+
+size_t ring_matrix_push_n(ring_matrix* matrix,
+                          size_t producer,
+                          size_t consumer,
+                          void** items,
+                          size_t n)
+{
+   return matrix->items.pushBatch(producer, consumer, items, n);
+}
+
+
+
+void* ring_matrix_pop(ring_matrix* matrix, size_t consumer)
+{
+   void* item = NULL;
+   matrix->items.pop(consumer, item);
+   return item;
+}
+
+
+
+size_t ring_matrix_pop_n(ring_matrix* matrix,
+                         size_t consumer,
+                         void** items,
+                         size_t n)
+{
+   return matrix->items.popBatch(consumer, items, n);
+}
+
+
+
+void* ring_matrix_pop_wait(ring_matrix* matrix,
+                           size_t consumer,
+                           uint64_t timeout_ns)
+{
+   void* item = NULL;
+   matrix->items.popWait(consumer, item, to_timeout(timeout_ns));
+   return item;
+}
+
+
+
+size_t ring_matrix_pop_n_wait(ring_matrix* matrix,
+                              size_t consumer,
+                              void** items,
+                              size_t n,
+                              uint64_t timeout_ns)
+{
+   return matrix->items.popBatchWait(consumer, items, n, to_timeout(timeout_ns));
+}
+
+
+
+size_t ring_matrix_size(ring_matrix* matrix)
+{
+   return matrix->items.size();
+}
+
+
+
+void free_ring_matrix(ring_matrix* matrix)
+{
+   delete matrix;
+}
@@ -0,0 +1,108 @@
+#ifndef _RINGH_
+#define _RINGH_
+
+/*H**********************************************************************
+ * FILENAME :        ring.h
+ *
+ * DESCRIPTION :
+ *        C interface of the bounded lock-free multi-producer multi-consumer
+ *        ring of pointers (see ringbuffer.hpp), and of the matrix of
+ *        single-producer single-consumer rings for fixed sets of producers
+ *        and consumers (see spscring.hpp). Pushing and popping never
+ *        allocate, capacities are rounded up to a power of two.
+ *
+ * PUBLIC STRUCTURES :
+ *       ring
+ *       ring_matrix
+ *
+ * AUTHOR :    Pieroux Alexandre
+ *H*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Timeout of the *_wait functions to wait until an item comes. */
+#define RING_WAIT_FOREVER UINT64_MAX
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ring ring;
+
+ring* new_ring(size_t capacity);
+
+/* Return false when the ring is full. */
+bool ring_push(ring* ring, void* item);
+
+/* Return NULL when the ring is empty. */
+void* ring_pop(ring* ring);
+
+/* Wait up to 'timeout_ns' for an item (spinning, then yielding, then sleeping), return
+   NULL when none came. */
+void* ring_pop_wait(ring* ring, uint64_t timeout_ns);
+
+/* Push the first of the 'n' items there is room for, return how many were. */
+size_t ring_push_n(ring* ring, void** items, size_t n);
+
+/* Pop up to 'n' items into 'items', return how many were. */
+size_t ring_pop_n(ring* ring, void** items, size_t n);
+
+size_t ring_size(ring* ring);
+
+void free_ring(ring* ring);
+
+typedef struct ring_matrix ring_matrix;
+
+/* One ring of 'capacity' pointers for each (producer, consumer) pair. */
+ring_matrix* new_ring_matrix(size_t nb_producers,
+                             size_t nb_consumers,
+                             size_t capacity);
+
+/* Only from the thread of 'producer', return false when the ring to 'consumer' is full. */
+bool ring_matrix_push(ring_matrix* matrix,
+                      size_t producer,
+                      size_t consumer,
+                      void* item);
+
+/* Only from the thread of 'producer', push the first of the 'n' items there is room for
+   in the ring to 'consumer', return how many were. */
+size_t ring_matrix_push_n(ring_matrix* matrix,
+                          size_t producer,
+                          size_t consumer,
+                          void** items,
+                          size_t n);
+
+/* Only from the thread of 'consumer', return NULL when all of its rings are empty. */
+void* ring_matrix_pop(ring_matrix* matrix, size_t consumer);
+
+/* Only from the thread of 'consumer', pop up to 'n' items into 'items', return how many were. */
+size_t ring_matrix_pop_n(ring_matrix* matrix,
+                         size_t consumer,
+                         void** items,
+                         size_t n);
+
+/* Only from the thread of 'consumer', wait up to 'timeout_ns' for an item, return NULL
+   when none came. */
+void* ring_matrix_pop_wait(ring_matrix* matrix,
+                           size_t consumer,
+                           uint64_t timeout_ns);
+
+/* Only from the thread of 'consumer', wait up to 'timeout_ns' for at least one item and
+   pop up to 'n' into 'items', return how many were. */
+size_t ring_matrix_pop_n_wait(ring_matrix* matrix,
+                              size_t consumer,
+                              void** items,
+                              size_t n,
+                              uint64_t timeout_ns);
+
+size_t ring_matrix_size(ring_matrix* matrix);
+
+void free_ring_matrix(ring_matrix* matrix);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
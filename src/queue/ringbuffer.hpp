@@ -0,0 +1,240 @@
+#ifndef _RINGBUFFERH_
+#define _RINGBUFFERH_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "adaptivewait.hpp"
+
+namespace DNFC
+{
+
+/**
+ * RingBuffer
+ *
+ * Bounded lock-free multi-producer multi-consumer queue over an array (Vyukov): each
+ * cell carries a sequence number telling whether it is free for the producer of the
+ * current lap (sequence == position) or holds the item of that producer for the
+ * consumer (sequence == position + 1). Producers and consumers only contend on their
+ * own end, each on its own cache line, and never allocate. The capacity is rounded up
+ * to a power of two.
+ *
+ * The batch operations claim as many consecutive cells as they can with a single CAS,
+ * so a burst of packets costs one atomic operation on the shared index. Consumers
+ * that would rather wait than poll an empty ring use 'popWait' (see AdaptiveWait).
+ */
+template <typename T>
+class RingBuffer
+{
+  public:
+    explicit RingBuffer(std::size_t capacity) : mask(roundUp(capacity) - 1), cells(new Cell[mask + 1])
+    {
+        for (std::size_t i = 0; i <= mask; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    /**
+     * push
+     *
+     * Append 'item', return false when the ring is full.
+     */
+    bool push(T item)
+    {
+        std::size_t pos = tail.load(std::memory_order_relaxed);
+        Cell *cell;
+        for (;;)
+        {
+            cell = &cells[pos & mask];
+            std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = tail.load(std::memory_order_relaxed);
+        }
+        cell->data = std::move(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        waiter.notify();
+        return true;
+    }
+
+    /**
+     * pop
+     *
+     * Take the oldest item into 'item', return false when the ring is empty.
+     */
+    bool pop(T &item)
+    {
+        std::size_t pos = head.load(std::memory_order_relaxed);
+        Cell *cell;
+        for (;;)
+        {
+            cell = &cells[pos & mask];
+            std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = head.load(std::memory_order_relaxed);
+        }
+        item = std::move(cell->data);
+        cell->sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * pushBatch
+     *
+     * Append the first items of 'items', as many of the 'n' as there is room for, and
+     * return how many were.
+     */
+    std::size_t pushBatch(const T *items, std::size_t n)
+    {
+        std::size_t pos, count;
+        if (!claim(tail, 0, n, pos, count))
+            return 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            Cell &cell = cells[(pos + i) & mask];
+            cell.data = items[i];
+            cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        waiter.notify(count);
+        return count;
+    }
+
+    /**
+     * popBatch
+     *
+     * Take up to 'n' of the oldest items into 'items' and return how many were.
+     */
+    std::size_t popBatch(T *items, std::size_t n)
+    {
+        std::size_t pos, count;
+        if (!claim(head, 1, n, pos, count))
+            return 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            Cell &cell = cells[(pos + i) & mask];
+            items[i] = std::move(cell.data);
+            cell.sequence.store(pos + i + mask + 1, std::memory_order_release);
+        }
+        return count;
+    }
+
+    /**
+     * popWait
+     *
+     * Take the oldest item into 'item', waiting up to 'timeout' for one; return false
+     * when none came.
+     */
+    bool popWait(T &item, std::chrono::nanoseconds timeout)
+    {
+        return waiter.wait([&] { return pop(item); }, timeout);
+    }
+
+    /**
+     * popBatchWait
+     *
+     * Take up to 'n' of the oldest items into 'items', waiting up to 'timeout' for at
+     * least one; return how many were taken.
+     */
+    std::size_t popBatchWait(T *items, std::size_t n, std::chrono::nanoseconds timeout)
+    {
+        std::size_t count = 0;
+        waiter.wait([&] { return (count = popBatch(items, n)) != 0; }, timeout);
+        return count;
+    }
+
+    // Number of items, only exact when no operation is in progress
+    std::size_t size() const
+    {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        return t > h ? t - h : 0;
+    }
+
+    std::size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+  private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        T data;
+    };
+
+    static std::size_t roundUp(std::size_t capacity)
+    {
+        std::size_t result = 2;
+        while (result < capacity)
+            result <<= 1;
+        return result;
+    }
+
+    /**
+     * claim
+     *
+     * Move 'index' (the tail for producers, the head for consumers) over the longest
+     * run of up to 'n' consecutive cells ready for this side, i.e. whose sequence is
+     * their position plus 'offset'. Return false when not even one is.
+     */
+    bool claim(std::atomic<std::size_t> &index, std::size_t offset, std::size_t n, std::size_t &pos, std::size_t &count)
+    {
+        pos = index.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            count = 0;
+            while (count < n && count <= mask)
+            {
+                std::size_t sequence = cells[(pos + count) & mask].sequence.load(std::memory_order_acquire);
+                if (sequence != pos + count + offset)
+                    break;
+                ++count;
+            }
+
+            if (count == 0)
+            {
+                // Either the ring is full (or empty), or another thread moved the index
+                std::size_t sequence = cells[pos & mask].sequence.load(std::memory_order_acquire);
+                if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + offset) < 0)
+                    return false;
+                pos = index.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            if (index.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+                return true;
+        }
+    }
+
+    alignas(64) std::atomic<std::size_t> head;
+    alignas(64) std::atomic<std::size_t> tail;
+    AdaptiveWait<> waiter;
+    alignas(64) const std::size_t mask;
+    std::unique_ptr<Cell[]> cells;
+};
+} // namespace DNFC
+
+#endif
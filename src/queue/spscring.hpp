@@ -0,0 +1,307 @@
+#ifndef _SPSCRINGH_
+#define _SPSCRINGH_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "adaptivewait.hpp"
+
+namespace DNFC
+{
+
+/**
+ * SpscRing
+ *
+ * Bounded wait-free single-producer single-consumer queue over an array. Each side
+ * owns its index and only publishes it with a release store, no CAS is involved; it
+ * also keeps a copy of the index of the other side and only reads the shared one
+ * again when that copy says the ring is full (or empty), so that the cache line of
+ * the other side is rarely pulled. The capacity is rounded up to a power of two.
+ *
+ * Only one thread may push and only one thread may pop at any given time.
+ */
+template <typename T>
+class SpscRing
+{
+  public:
+    explicit SpscRing(std::size_t capacity)
+        : tail(0), cachedHead(0), head(0), cachedTail(0), mask(roundUp(capacity) - 1), cells(new T[mask + 1])
+    {
+    }
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    /**
+     * push
+     *
+     * Append 'item', return false when the ring is full. Producer only.
+     */
+    bool push(T item)
+    {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        if (t - cachedHead > mask)
+        {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t - cachedHead > mask)
+                return false;
+        }
+        cells[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * pop
+     *
+     * Take the oldest item into 'item', return false when the ring is empty. Consumer
+     * only.
+     */
+    bool pop(T &item)
+    {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        if (h == cachedTail)
+        {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h == cachedTail)
+                return false;
+        }
+        item = std::move(cells[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * pushBatch
+     *
+     * Append the first items of 'items', as many of the 'n' as there is room for, and
+     * return how many were. Producer only.
+     */
+    std::size_t pushBatch(const T *items, std::size_t n)
+    {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        std::size_t room = mask + 1 - (t - cachedHead);
+        if (room < n)
+        {
+            cachedHead = head.load(std::memory_order_acquire);
+            room = mask + 1 - (t - cachedHead);
+        }
+        std::size_t count = n < room ? n : room;
+        for (std::size_t i = 0; i < count; ++i)
+            cells[(t + i) & mask] = items[i];
+        if (count)
+            tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+
+    /**
+     * popBatch
+     *
+     * Take up to 'n' of the oldest items into 'items' and return how many were.
+     * Consumer only.
+     */
+    std::size_t popBatch(T *items, std::size_t n)
+    {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        std::size_t available = cachedTail - h;
+        if (available < n)
+        {
+            cachedTail = tail.load(std::memory_order_acquire);
+            available = cachedTail - h;
+        }
+        std::size_t count = n < available ? n : available;
+        for (std::size_t i = 0; i < count; ++i)
+            items[i] = std::move(cells[(h + i) & mask]);
+        if (count)
+            head.store(h + count, std::memory_order_release);
+        return count;
+    }
+
+    // Number of items, only exact from the producer or the consumer thread
+    std::size_t size() const
+    {
+        std::size_t h = head.load(std::memory_order_acquire);
+        std::size_t t = tail.load(std::memory_order_acquire);
+        return t > h ? t - h : 0;
+    }
+
+    std::size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+  private:
+    static std::size_t roundUp(std::size_t capacity)
+    {
+        std::size_t result = 2;
+        while (result < capacity)
+            result <<= 1;
+        return result;
+    }
+
+    // Producer side
+    alignas(64) std::atomic<std::size_t> tail;
+    std::size_t cachedHead;
+
+    // Consumer side
+    alignas(64) std::atomic<std::size_t> head;
+    std::size_t cachedTail;
+
+    alignas(64) const std::size_t mask;
+    std::unique_ptr<T[]> cells;
+};
+
+/**
+ * RingMatrix
+ *
+ * Queue with a fixed set of producers and consumers made of one SpscRing for each
+ * (producer, consumer) pair: a producer chooses the consumer of each item and no ring
+ * is ever shared by two producers or two consumers. A consumer drains the rings of
+ * its column round-robin, starting after the ring it last took an item from, so that
+ * no producer starves the others. Each consumer also has an AdaptiveWait, notified by
+ * the producers pushing to it, to wait for an item with 'popWait'.
+ */
+template <typename T>
+class RingMatrix
+{
+  public:
+    /**
+     * Constructor
+     *
+     * 'capacity' is the capacity of each of the producers * consumers rings.
+     */
+    RingMatrix(std::size_t producers, std::size_t consumers, std::size_t capacity)
+        : producers(producers ? producers : 1), consumers(consumers ? consumers : 1),
+          cursors(new Cursor[this->consumers]), waiters(new AdaptiveWait<>[this->consumers])
+    {
+        rings.reserve(this->producers * this->consumers);
+        for (std::size_t i = 0; i < this->producers * this->consumers; ++i)
+            rings.emplace_back(new SpscRing<T>(capacity));
+    }
+
+    RingMatrix(const RingMatrix &) = delete;
+    RingMatrix &operator=(const RingMatrix &) = delete;
+
+    // Append 'item' for 'consumer', return false when their ring is full. Only the thread of 'producer'.
+    bool push(std::size_t producer, std::size_t consumer, T item)
+    {
+        if (!ring(producer, consumer).push(std::move(item)))
+            return false;
+        waiters[consumer].notify();
+        return true;
+    }
+
+    std::size_t pushBatch(std::size_t producer, std::size_t consumer, const T *items, std::size_t n)
+    {
+        std::size_t count = ring(producer, consumer).pushBatch(items, n);
+        if (count)
+            waiters[consumer].notify(1);
+        return count;
+    }
+
+    /**
+     * pop
+     *
+     * Take the next item for 'consumer' into 'item', return false when none of its
+     * rings has one. Only the thread of 'consumer'.
+     */
+    bool pop(std::size_t consumer, T &item)
+    {
+        std::size_t &next = cursors[consumer].next;
+        for (std::size_t i = 0; i < producers; ++i)
+        {
+            std::size_t producer = next;
+            next = next + 1 == producers ? 0 : next + 1;
+            if (ring(producer, consumer).pop(item))
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * popBatch
+     *
+     * Take up to 'n' items for 'consumer', a batch from each of its rings in turn, and
+     * return how many were. Only the thread of 'consumer'.
+     */
+    std::size_t popBatch(std::size_t consumer, T *items, std::size_t n)
+    {
+        std::size_t &next = cursors[consumer].next;
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < producers && count < n; ++i)
+        {
+            std::size_t producer = next;
+            next = next + 1 == producers ? 0 : next + 1;
+            count += ring(producer, consumer).popBatch(items + count, n - count);
+        }
+        return count;
+    }
+
+    /**
+     * popWait
+     *
+     * Take the next item for 'consumer' into 'item', waiting up to 'timeout' for one;
+     * return false when none came. Only the thread of 'consumer'.
+     */
+    bool popWait(std::size_t consumer, T &item, std::chrono::nanoseconds timeout)
+    {
+        return waiters[consumer].wait([&] { return pop(consumer, item); }, timeout);
+    }
+
+    /**
+     * popBatchWait
+     *
+     * Take up to 'n' items for 'consumer', waiting up to 'timeout' for at least one;
+     * return how many were taken. Only the thread of 'consumer'.
+     */
+    std::size_t popBatchWait(std::size_t consumer, T *items, std::size_t n, std::chrono::nanoseconds timeout)
+    {
+        std::size_t count = 0;
+        waiters[consumer].wait([&] { return (count = popBatch(consumer, items, n)) != 0; }, timeout);
+        return count;
+    }
+
+    // Number of items in every ring, only an estimate while they are used
+    std::size_t size() const
+    {
+        std::size_t result = 0;
+        for (auto &r : rings)
+            result += r->size();
+        return result;
+    }
+
+    std::size_t nbProducers() const
+    {
+        return producers;
+    }
+
+    std::size_t nbConsumers() const
+    {
+        return consumers;
+    }
+
+    SpscRing<T> &ring(std::size_t producer, std::size_t consumer)
+    {
+        return *rings[producer * consumers + consumer];
+    }
+
+  private:
+    // Round-robin position of a consumer, on its own cache line
+    struct alignas(64) Cursor
+    {
+        std::size_t next = 0;
+    };
+
+    const std::size_t producers;
+    const std::size_t consumers;
+    std::vector<std::unique_ptr<SpscRing<T>>> rings;
+    std::unique_ptr<Cursor[]> cursors;
+    std::unique_ptr<AdaptiveWait<>[]> waiters;
+};
+} // namespace DNFC
+
+#endif
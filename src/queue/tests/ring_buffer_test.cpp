@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <time.h>
+#include <gtest/gtest.h>
+
+#include "../ringbuffer.hpp"
+#include "../spscring.hpp"
+#include "../ring.h"
+
+using namespace DNFC;
+
+TEST(RingBuffer, PowerOfTwoCapacity)
+{
+    EXPECT_EQ(RingBuffer<int>(1).capacity(), 2u);
+    EXPECT_EQ(RingBuffer<int>(64).capacity(), 64u);
+    EXPECT_EQ(RingBuffer<int>(100).capacity(), 128u);
+}
+
+TEST(RingBuffer, PushPopInOrder)
+{
+    RingBuffer<int> ring(8);
+    int item;
+    EXPECT_FALSE(ring.pop(item));
+    for (int i = 0; i < 8; ++i)
+        EXPECT_TRUE(ring.push(i));
+    EXPECT_FALSE(ring.push(8));
+    EXPECT_EQ(ring.size(), 8u);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        EXPECT_TRUE(ring.pop(item));
+        EXPECT_EQ(item, i);
+    }
+    EXPECT_FALSE(ring.pop(item));
+
+    // Wrap around many times
+    for (int i = 0; i < 1000; ++i)
+    {
+        EXPECT_TRUE(ring.push(i));
+        EXPECT_TRUE(ring.pop(item));
+        EXPECT_EQ(item, i);
+    }
+}
+
+TEST(RingBuffer, Batch)
+{
+    RingBuffer<int> ring(16);
+    int in[32], out[32];
+    for (int i = 0; i < 32; ++i)
+        in[i] = i;
+
+    // Only the room left is taken
+    EXPECT_EQ(ring.pushBatch(in, 10), 10u);
+    EXPECT_EQ(ring.pushBatch(in + 10, 22), 6u);
+    EXPECT_EQ(ring.pushBatch(in, 1), 0u);
+
+    EXPECT_EQ(ring.popBatch(out, 4), 4u);
+    EXPECT_EQ(ring.popBatch(out + 4, 32), 12u);
+    EXPECT_EQ(ring.popBatch(out, 32), 0u);
+    for (int i = 0; i < 16; ++i)
+        EXPECT_EQ(out[i], i);
+}
+
+TEST(RingBuffer, CInterface)
+{
+    ring *r = new_ring(4);
+    int values[6] = {0, 1, 2, 3, 4, 5};
+    void *items[6];
+    for (int i = 0; i < 6; ++i)
+        items[i] = &values[i];
+
+    EXPECT_TRUE(ring_push(r, items[0]));
+    EXPECT_EQ(ring_push_n(r, items + 1, 5), 3u);
+    EXPECT_EQ(ring_size(r), 4u);
+    EXPECT_EQ(ring_pop(r), items[0]);
+
+    void *out[4];
+    EXPECT_EQ(ring_pop_n(r, out, 4), 3u);
+    EXPECT_EQ(out[2], items[3]);
+    EXPECT_EQ(ring_pop(r), nullptr);
+    free_ring(r);
+}
+
+TEST(RingBuffer, StressMPMC)
+{
+    // Every item pushed is popped exactly once, in order for each producer
+    const int nbProducers = 4, nbConsumers = 4, nbItems = 100000;
+    RingBuffer<long> ring(256);
+    std::vector<std::thread> threads;
+    std::vector<std::atomic<int>> seen(nbProducers * nbItems);
+    std::atomic<long> popped(0);
+    std::atomic<bool> outOfOrder(false);
+
+    for (int p = 0; p < nbProducers; ++p)
+    {
+        threads.emplace_back([&, p] {
+            long batch[8];
+            for (int i = 0; i < nbItems;)
+            {
+                // Alternate single and batch pushes
+                if (i % 3)
+                {
+                    if (ring.push(long(p) * nbItems + i))
+                        ++i;
+                    else
+                        std::this_thread::yield();
+                    continue;
+                }
+                int n = std::min(8, nbItems - i);
+                for (int k = 0; k < n; ++k)
+                    batch[k] = long(p) * nbItems + i + k;
+                std::size_t pushed = ring.pushBatch(batch, n);
+                if (!pushed)
+                    std::this_thread::yield();
+                i += pushed;
+            }
+        });
+    }
+    for (int c = 0; c < nbConsumers; ++c)
+    {
+        threads.emplace_back([&] {
+            long last[nbProducers];
+            std::fill(last, last + nbProducers, -1L);
+            long batch[8];
+            while (popped.load() < long(nbProducers) * nbItems)
+            {
+                std::size_t n = ring.popBatch(batch, 8);
+                if (!n)
+                    std::this_thread::yield();
+                for (std::size_t k = 0; k < n; ++k)
+                {
+                    int producer = batch[k] / nbItems;
+                    if (batch[k] <= last[producer])
+                        outOfOrder = true;
+                    last[producer] = batch[k];
+                    ++seen[batch[k]];
+                }
+                popped += n;
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    EXPECT_FALSE(outOfOrder);
+    for (auto &count : seen)
+        EXPECT_EQ(count.load(), 1);
+}
+
+TEST(SpscRing, PushPopAndBatch)
+{
+    SpscRing<int> ring(5);
+    EXPECT_EQ(ring.capacity(), 8u);
+    int item;
+    EXPECT_FALSE(ring.pop(item));
+    for (int i = 0; i < 8; ++i)
+        EXPECT_TRUE(ring.push(i));
+    EXPECT_FALSE(ring.push(8));
+    EXPECT_TRUE(ring.pop(item));
+    EXPECT_EQ(item, 0);
+
+    int in[4] = {8, 9, 10, 11}, out[16];
+    EXPECT_EQ(ring.pushBatch(in, 4), 1u);
+    EXPECT_EQ(ring.popBatch(out, 16), 8u);
+    for (int i = 0; i < 8; ++i)
+        EXPECT_EQ(out[i], i + 1);
+    EXPECT_EQ(ring.size(), 0u);
+}
+
+TEST(SpscRing, StressInOrder)
+{
+    const long nbItems = 1000000;
+    SpscRing<long> ring(64);
+    std::thread producer([&] {
+        long batch[8];
+        for (long i = 0; i < nbItems;)
+        {
+            std::size_t pushed;
+            if (i % 2)
+                pushed = ring.push(i);
+            else
+            {
+                long n = std::min(8L, nbItems - i);
+                for (long k = 0; k < n; ++k)
+                    batch[k] = i + k;
+                pushed = ring.pushBatch(batch, n);
+            }
+            if (!pushed)
+                std::this_thread::yield();
+            i += pushed;
+        }
+    });
+
+    long expected = 0, batch[8];
+    bool ordered = true;
+    while (expected < nbItems)
+    {
+        std::size_t n = ring.popBatch(batch, 8);
+        if (!n)
+            std::this_thread::yield();
+        for (std::size_t k = 0; k < n; ++k)
+            ordered &= batch[k] == expected++;
+    }
+    producer.join();
+    EXPECT_TRUE(ordered);
+}
+
+TEST(RingMatrix, RoundRobin)
+{
+    RingMatrix<int> matrix(3, 2, 4);
+    for (int p = 0; p < 3; ++p)
+        for (int i = 0; i < 2; ++i)
+            EXPECT_TRUE(matrix.push(p, 1, p * 10 + i));
+    EXPECT_EQ(matrix.size(), 6u);
+
+    // The consumer 0 has nothing, the consumer 1 takes one item of each producer in turn
+    int item;
+    EXPECT_FALSE(matrix.pop(0, item));
+    int expected[6] = {0, 10, 20, 1, 11, 21};
+    for (int i = 0; i < 6; ++i)
+    {
+        EXPECT_TRUE(matrix.pop(1, item));
+        EXPECT_EQ(item, expected[i]);
+    }
+    EXPECT_FALSE(matrix.pop(1, item));
+
+    // The batches take what each ring has in turn
+    for (int p = 0; p < 3; ++p)
+        matrix.push(p, 0, p);
+    int out[8];
+    EXPECT_EQ(matrix.popBatch(0, out, 2), 2u);
+    EXPECT_EQ(matrix.popBatch(0, out + 2, 8), 1u);
+}
+
+TEST(RingMatrix, CInterface)
+{
+    ring_matrix *matrix = new_ring_matrix(2, 2, 2);
+    int values[3];
+    EXPECT_TRUE(ring_matrix_push(matrix, 0, 1, &values[0]));
+    EXPECT_TRUE(ring_matrix_push(matrix, 1, 1, &values[1]));
+    EXPECT_TRUE(ring_matrix_push(matrix, 1, 0, &values[2]));
+    EXPECT_EQ(ring_matrix_size(matrix), 3u);
+
+    void *out[4];
+    EXPECT_EQ(ring_matrix_pop_n(matrix, 1, out, 4), 2u);
+    EXPECT_EQ(ring_matrix_pop(matrix, 0), &values[2]);
+    EXPECT_EQ(ring_matrix_pop(matrix, 0), nullptr);
+    free_ring_matrix(matrix);
+}
+
+TEST(RingMatrix, StressEveryItemOnce)
+{
+    // Each producer spreads its items over the consumers, which see them in order
+    const int nbProducers = 3, nbConsumers = 2, nbItems = 100000;
+    RingMatrix<long> matrix(nbProducers, nbConsumers, 32);
+    std::vector<std::atomic<int>> seen(nbProducers * nbItems);
+    std::atomic<long> popped(0);
+    std::atomic<bool> outOfOrder(false);
+    std::vector<std::thread> threads;
+
+    for (int p = 0; p < nbProducers; ++p)
+    {
+        threads.emplace_back([&, p] {
+            for (int i = 0; i < nbItems;)
+                if (matrix.push(p, i % nbConsumers, long(p) * nbItems + i))
+                    ++i;
+                else
+                    std::this_thread::yield();
+        });
+    }
+    for (int c = 0; c < nbConsumers; ++c)
+    {
+        threads.emplace_back([&, c] {
+            long last[nbProducers], batch[8];
+            std::fill(last, last + nbProducers, -1L);
+            while (popped.load() < long(nbProducers) * nbItems)
+            {
+                std::size_t n = matrix.popBatch(c, batch, 8);
+                if (!n)
+                    std::this_thread::yield();
+                for (std::size_t k = 0; k < n; ++k)
+                {
+                    int producer = batch[k] / nbItems;
+                    if (batch[k] <= last[producer] || batch[k] % nbItems % nbConsumers != c)
+                        outOfOrder = true;
+                    last[producer] = batch[k];
+                    ++seen[batch[k]];
+                }
+                popped += n;
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    EXPECT_FALSE(outOfOrder);
+    for (auto &count : seen)
+        EXPECT_EQ(count.load(), 1);
+}
+
+TEST(AdaptiveWait, TimesOut)
+{
+    RingBuffer<int> ring(4);
+    int item;
+    auto begin = std::chrono::steady_clock::now();
+    EXPECT_FALSE(ring.popWait(item, std::chrono::milliseconds(20)));
+    EXPECT_GE(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(20));
+
+    ring_matrix *matrix = new_ring_matrix(1, 1, 4);
+    EXPECT_EQ(ring_matrix_pop_wait(matrix, 0, 1000000), nullptr);
+    free_ring_matrix(matrix);
+}
+
+TEST(AdaptiveWait, ParkedConsumerSleeps)
+{
+    // A consumer waiting on an idle ring is woken by the push and barely used its core
+    RingBuffer<int> ring(4);
+    std::atomic<bool> parked(false);
+    double cpuMs = 0;
+    int item = 0;
+    std::thread consumer([&] {
+        struct timespec begin, end;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+        parked = true;
+        EXPECT_TRUE(ring.popWait(item, std::chrono::nanoseconds::max()));
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+        cpuMs = (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+    });
+    while (!parked)
+        std::this_thread::yield();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    ring.push(42);
+    consumer.join();
+
+    EXPECT_EQ(item, 42);
+    EXPECT_LT(cpuMs, 50.0);
+}
+
+TEST(AdaptiveWait, StressNoLostWakeup)
+{
+    // Producers pause now and then so that consumers park, every item must still arrive
+    const int nbProducers = 2, nbConsumers = 3, nbItems = 20000;
+    RingMatrix<int> matrix(nbProducers, nbConsumers, 16);
+    std::atomic<int> received(0);
+    std::vector<std::thread> threads;
+
+    for (int c = 0; c < nbConsumers; ++c)
+    {
+        threads.emplace_back([&, c] {
+            int batch[4];
+            for (;;)
+            {
+                std::size_t n = matrix.popBatchWait(c, batch, 4, std::chrono::nanoseconds::max());
+                for (std::size_t k = 0; k < n; ++k)
+                {
+                    if (batch[k] < 0)
+                        return;
+                    ++received;
+                }
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (int p = 0; p < nbProducers; ++p)
+    {
+        producers.emplace_back([&, p] {
+            for (int i = 0; i < nbItems;)
+            {
+                if (matrix.push(p, i % nbConsumers, i))
+                    ++i;
+                if (i % 1000 == 0)
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        });
+    }
+    for (auto &producer : producers)
+        producer.join();
+    for (int c = 0; c < nbConsumers; ++c)
+        while (!matrix.push(0, c, -1))
+            std::this_thread::yield();
+    for (auto &thread : threads)
+        thread.join();
+
+    EXPECT_EQ(received, nbProducers * nbItems);
+}
@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include <netinet/in.h>
+
+#include "../../hypercuts/hypercuts.hpp"
+#include "../tuplespace.hpp"
+#include "../bitvector.hpp"
+
+/**
+ * Static engines benchmark
+ *
+ * Compare the static classification engines on the same 5-tuple rules: the filters of
+ * a ClassBench file (Taylor and Turner), one per line as
+ *   @198.51.100.0/24  203.0.113.7/32  0 : 65535  1024 : 65535  0x06/0xFF  ...
+ * or ClassBench-like filters drawn at random (see hypercuts_bench) with port ranges.
+ * Port ranges are split into prefixes, a filter becoming the cross product of the
+ * prefixes of its two ranges, all with the action of the filter. Frames are then
+ * drawn as in hypercuts_bench, 90% of them from a random filter, and each engine
+ * prints its build time, the heap it keeps, the mean time of a lookup one frame at a
+ * time and by bursts (best of Runs), and the frames it classifies differently from
+ * HyperCuts, which should be none.
+ * Usage: static_classifier_bench [filter file | number of filters] [number of frames]
+ */
+using namespace DNFC;
+
+const std::size_t FrameLength = 54;
+const unsigned Runs = 5;
+const std::size_t Burst = 32;
+
+// Protocol, source and destination addresses, source and destination ports
+const uint32_t Offsets[5] = {23 * 8, 26 * 8, 30 * 8, 34 * 8, 36 * 8};
+const uint32_t Lengths[5] = {8, 32, 32, 16, 16};
+
+struct Filter
+{
+    uint32_t source;
+    uint32_t sourceLength;
+    uint32_t destination;
+    uint32_t destinationLength;
+    uint16_t ports[2][2]; // Lowest and highest source port, then destination port
+    uint8_t protocol;
+    uint8_t protocolMask; // 0xff for an exact protocol, 0 for any
+};
+
+struct Rules
+{
+    std::vector<classifier_rule> rules;
+    std::vector<classifier_field> fields;
+    std::vector<classifier_field *> fieldPointers;
+    std::vector<classifier_rule *> pointers;
+    std::vector<uint32_t> actions; // Index of the filter of each rule
+};
+
+struct Frames
+{
+    std::vector<uint8_t> bytes;
+    std::vector<const uint8_t *> headers;
+    std::vector<std::size_t> lengths;
+};
+
+uint32_t prefixMask(uint32_t length)
+{
+    return length >= 32 ? 0 : UINT32_MAX >> length;
+}
+
+bool readFilters(const char *path, std::vector<Filter> &filters)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+    char line[512];
+    while (fgets(line, sizeof(line), file))
+    {
+        unsigned s[4], d[4], sourceLength, destinationLength, ports[4], protocol, protocolMask;
+        if (sscanf(line, "@%u.%u.%u.%u/%u %u.%u.%u.%u/%u %u : %u %u : %u %x/%x", &s[0], &s[1], &s[2], &s[3],
+                   &sourceLength, &d[0], &d[1], &d[2], &d[3], &destinationLength, &ports[0], &ports[1], &ports[2],
+                   &ports[3], &protocol, &protocolMask) != 16)
+            continue;
+        Filter filter;
+        filter.source = (s[0] << 24) | (s[1] << 16) | (s[2] << 8) | s[3];
+        filter.sourceLength = sourceLength;
+        filter.destination = (d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3];
+        filter.destinationLength = destinationLength;
+        for (std::size_t k = 0; k < 4; ++k)
+            filter.ports[k / 2][k % 2] = ports[k];
+        filter.protocol = protocol;
+        filter.protocolMask = protocolMask;
+        filters.push_back(filter);
+    }
+    fclose(file);
+    return true;
+}
+
+// Filters with the proportions of the ClassBench ACL seeds: mostly /16 to /32 prefixes,
+// any source port, exact, well-known, ephemeral or arbitrary destination port ranges
+void makeFilters(std::vector<Filter> &filters, std::size_t nbFilters, std::mt19937 &random)
+{
+    const uint16_t wellKnown[] = {20, 21, 22, 23, 25, 53, 67, 80, 110, 123, 143, 161, 179, 389, 443, 445,
+                                  465, 514, 587, 636, 993, 995, 1433, 1521, 3306, 3389, 5060, 5432, 8080, 8443};
+    const uint32_t sourcePrefixes[] = {0, 8, 16, 16, 24, 24, 24, 32, 32, 32};
+    const uint32_t destinationPrefixes[] = {0, 16, 16, 24, 24, 24, 24, 32, 32, 32};
+    std::vector<uint32_t> networks(300);
+    for (uint32_t &network : networks)
+        network = random() & 0xffff0000;
+
+    filters.resize(nbFilters);
+    for (Filter &filter : filters)
+    {
+        filter.sourceLength = sourcePrefixes[random() % 10];
+        filter.source = (networks[random() % networks.size()] | (random() & 0xffff)) & ~prefixMask(filter.sourceLength);
+        filter.destinationLength = destinationPrefixes[random() % 10];
+        filter.destination =
+            (networks[random() % networks.size()] | (random() & 0xffff)) & ~prefixMask(filter.destinationLength);
+        unsigned draw = random() % 100;
+        filter.ports[0][0] = draw < 85 ? 0 : 1024;
+        filter.ports[0][1] = 65535;
+        draw = random() % 100;
+        uint16_t port = wellKnown[random() % 30];
+        uint16_t low = random() % 65536, high = low + random() % (65536 - low);
+        filter.ports[1][0] = draw < 20 ? 0 : draw < 30 ? 1024 : draw < 80 ? port : low;
+        filter.ports[1][1] = draw < 20 ? 65535 : draw < 30 ? 65535 : draw < 80 ? port : high;
+        draw = random() % 100;
+        filter.protocol = draw < 70 ? IPPROTO_TCP : IPPROTO_UDP;
+        filter.protocolMask = draw < 90 ? 0xff : 0;
+        if (!filter.sourceLength && !filter.destinationLength && !filter.protocolMask && filter.ports[1][0] == 0 &&
+            filter.ports[1][1] == 65535)
+            filter.protocolMask = 0xff; // No catch-all filter, it would hide all the filters behind it
+    }
+}
+
+// Prefixes covering [low, high] as (value, wildcard mask) pairs
+std::vector<std::pair<uint32_t, uint32_t>> rangePrefixes(uint32_t low, uint32_t high)
+{
+    std::vector<std::pair<uint32_t, uint32_t>> prefixes;
+    for (uint64_t value = low; value <= high;)
+    {
+        uint32_t size = 1;
+        while ((value & (2 * size - 1)) == 0 && value + 2 * size - 1 <= high && size < 65536)
+            size *= 2;
+        prefixes.emplace_back(static_cast<uint32_t>(value), size - 1);
+        value += size;
+    }
+    return prefixes;
+}
+
+void makeRules(Rules &set, const std::vector<Filter> &filters)
+{
+    std::vector<uint32_t> filterOf;
+    for (std::size_t f = 0; f < filters.size(); ++f)
+    {
+        const Filter &filter = filters[f];
+        auto sources = rangePrefixes(filter.ports[0][0], filter.ports[0][1]);
+        auto destinations = rangePrefixes(filter.ports[1][0], filter.ports[1][1]);
+        for (const auto &source : sources)
+        {
+            for (const auto &destination : destinations)
+            {
+                const uint32_t masks[5] = {uint32_t(~filter.protocolMask & 0xff), prefixMask(filter.sourceLength),
+                                           prefixMask(filter.destinationLength), source.second, destination.second};
+                const uint32_t values[5] = {filter.protocol, filter.source, filter.destination, source.first,
+                                            destination.first};
+                for (std::size_t j = 0; j < 5; ++j)
+                {
+                    classifier_field field;
+                    field.id = j;
+                    field.offset = Offsets[j];
+                    field.bit_length = Lengths[j];
+                    field.mask = masks[j];
+                    field.value = values[j] & ~masks[j];
+                    set.fields.push_back(field);
+                }
+                filterOf.push_back(f);
+            }
+        }
+    }
+
+    std::size_t nbRules = filterOf.size();
+    set.actions.resize(filters.size());
+    set.rules.resize(nbRules);
+    set.fieldPointers.resize(nbRules * 5);
+    set.pointers.resize(nbRules);
+    for (std::size_t f = 0; f < filters.size(); ++f)
+        set.actions[f] = f;
+    for (std::size_t i = 0; i < nbRules; ++i)
+    {
+        for (std::size_t j = 0; j < 5; ++j)
+            set.fieldPointers[i * 5 + j] = &set.fields[i * 5 + j];
+        set.rules[i].id = i;
+        set.rules[i].fields = &set.fieldPointers[i * 5];
+        set.rules[i].nb_fields = 5;
+        set.rules[i].action = &set.actions[filterOf[i]];
+        set.pointers[i] = &set.rules[i];
+    }
+}
+
+void writeField(uint8_t *frame, std::size_t j, uint32_t value)
+{
+    for (std::size_t byte = 0; byte < Lengths[j] / 8; ++byte)
+        frame[Offsets[j] / 8 + byte] = value >> (Lengths[j] - 8 * (byte + 1));
+}
+
+void makeFrames(Frames &frames, std::size_t nbFrames, const std::vector<Filter> &filters, std::mt19937 &random)
+{
+    frames.bytes.assign(nbFrames * FrameLength, 0);
+    frames.headers.resize(nbFrames);
+    frames.lengths.assign(nbFrames, FrameLength);
+    for (std::size_t i = 0; i < nbFrames; ++i)
+    {
+        uint8_t *frame = &frames.bytes[i * FrameLength];
+        frame[12] = 0x08;
+        frame[14] = 0x45;
+        const Filter &filter = filters[random() % filters.size()];
+        uint32_t values[5];
+        for (uint32_t &value : values)
+            value = random();
+        if (random() % 10 != 0)
+        {
+            values[0] = filter.protocolMask ? filter.protocol : values[0];
+            values[1] = filter.source | (values[1] & prefixMask(filter.sourceLength));
+            values[2] = filter.destination | (values[2] & prefixMask(filter.destinationLength));
+            for (std::size_t k = 0; k < 2; ++k)
+                values[3 + k] = filter.ports[k][0] + values[3 + k] % (filter.ports[k][1] - filter.ports[k][0] + 1);
+        }
+        for (std::size_t j = 0; j < 5; ++j)
+            writeField(frame, j, values[j]);
+        frames.headers[i] = frame;
+    }
+}
+
+// Allocated from the heap and by mmap, for the large blocks
+std::size_t heapBytes()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+template <typename Engine>
+void run(const char *name, const Rules &set, const Frames &frames, std::vector<void *> &reference)
+{
+    std::size_t nbFrames = frames.headers.size();
+    std::size_t heap = heapBytes();
+    auto start = std::chrono::steady_clock::now();
+    Engine *engine;
+    try
+    {
+        engine = new Engine(set.pointers.data(), set.pointers.size());
+    }
+    catch (const std::exception &error)
+    {
+        printf("%-12s %s\n", name, error.what());
+        return;
+    }
+    double buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    heap = heapBytes() - heap;
+
+    std::vector<void *> actions(nbFrames);
+    double mean = 1e12, burstMean = 1e12;
+    std::size_t matched = 0;
+    for (unsigned run = 0; run < Runs; ++run)
+    {
+        matched = 0;
+        start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < nbFrames; ++i)
+        {
+            void *action = nullptr;
+            matched += engine->search(frames.headers[i], FrameLength, action);
+        }
+        mean = std::min(mean, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+                                  nbFrames);
+
+        start = std::chrono::steady_clock::now();
+        for (std::size_t base = 0; base < nbFrames; base += Burst)
+            engine->searchBurst(&frames.headers[base], &frames.lengths[base], std::min(Burst, nbFrames - base),
+                                &actions[base]);
+        burstMean = std::min(burstMean, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start)
+                                                .count() /
+                                            nbFrames);
+    }
+
+    std::size_t differ = 0;
+    if (reference.empty())
+        reference = actions;
+    for (std::size_t i = 0; i < nbFrames; ++i)
+        differ += actions[i] != reference[i];
+    printf("%-12s %12.1f %12.2f %11.1f%% %12.1f %12.1f %12zu\n", name, buildTime, heap / 1e6, 100.0 * matched / nbFrames,
+           mean, burstMean, differ);
+    delete engine;
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t nbFrames = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100000;
+    std::mt19937 random(42);
+    std::vector<Filter> filters;
+    char *end = nullptr;
+    std::size_t nbFilters = argc > 1 ? strtoul(argv[1], &end, 10) : 10000;
+    if (argc > 1 && *end)
+    {
+        if (!readFilters(argv[1], filters) || filters.empty())
+        {
+            fprintf(stderr, "No ClassBench filter in %s\n", argv[1]);
+            return 1;
+        }
+    }
+    else
+        makeFilters(filters, nbFilters, random);
+
+    Rules set;
+    makeRules(set, filters);
+    Frames frames;
+    makeFrames(frames, nbFrames, filters, random);
+    printf("# %zu filters, %zu rules once the port ranges are split, %zu frames\n", filters.size(), set.rules.size(),
+           nbFrames);
+
+    std::vector<void *> reference;
+    printf("%-12s %12s %12s %12s %12s %12s %12s\n", "engine", "build ms", "heap MB", "matched", "mean ns", "burst ns",
+           "differ");
+    run<HyperCuts<>>("HyperCuts", set, frames, reference);
+    run<TupleSpace<>>("TupleSpace", set, frames, reference);
+    run<BitVector<>>("BitVector", set, frames, reference);
+    return 0;
+}
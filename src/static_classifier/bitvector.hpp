@@ -0,0 +1,409 @@
+#ifndef _BITVECTORHPP_
+#define _BITVECTORHPP_
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "fieldset.hpp"
+
+namespace DNFC
+{
+
+namespace BitVectorDetail
+{
+#if defined(__x86_64__)
+inline bool hasAVX2()
+{
+    static bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+} // namespace BitVectorDetail
+
+/**
+ * DefaultBitVectorPolicy
+ *
+ * The rules use at most MaxDimensions distinct fields. The class of a value on a field
+ * of at most DirectBits bits is read from a table of all its values, on a longer field
+ * it is searched for among the bounds of its intervals. Building throws rather than
+ * letting the bit vectors take more than MaxBytes.
+ */
+class DefaultBitVectorPolicy
+{
+  public:
+    const static std::size_t MaxDimensions = 16;
+    const static std::size_t DirectBits = 16;
+    const static std::size_t MaxBytes = std::size_t(1) << 30;
+};
+
+/**
+ * BitVector
+ *
+ * Static packet classifier over classifier_rules (see FieldSet), the first of the
+ * rules matching a header wins. The rules are projected on each field (Lakshman and
+ * Stiliadis): the bounds of their ranges cut its values into intervals, and the rules
+ * spanning an interval make its bit vector, rule i being bit i. As in the first phase
+ * of RFC (Gupta and McKeown), the intervals with the same rules share one equivalence
+ * class, so that a field stores each distinct bit vector once. A lookup finds the
+ * class of each field of the header, ANDs their bit vectors and takes the first bit
+ * set. Each bit vector starts with an aggregate of one bit per chunk of 256 rules
+ * holding some rule (Baboescu and Varghese): only the chunks set in all the fields
+ * are ANDed, a chunk at a time with AVX2 when the CPU supports it.
+ *
+ * A field with holes in its mask is projected on the range from its lowest to its
+ * highest value, so the rules having one are checked again once their bit comes up.
+ * The time barely depends on the rules, the memory grows with the number of rules
+ * times the number of distinct intervals.
+ */
+template <typename Policy = DefaultBitVectorPolicy>
+class BitVector
+{
+  public:
+    const static std::size_t NotFound = SIZE_MAX;
+
+    // Headers classified together by findBurst
+    const static std::size_t BurstSize = 32;
+
+    // Rules of a chunk, ANDed at once
+    const static std::size_t ChunkRules = 256;
+
+    struct Statistics
+    {
+        std::size_t rules;
+        std::size_t dimensions;
+        std::size_t intervals; // Over all the fields
+        std::size_t classes;   // Distinct bit vectors over all the fields
+        std::size_t bytes;     // Of the bit vectors, classes and rule masks
+        std::size_t buildTime; // In microseconds
+    };
+
+    /**
+     * Constructor
+     *
+     * Build the bit vectors of 'nbRules' rules, by priority. Throw std::invalid_argument
+     * when a field is longer than 32 bits or the rules use more than MaxDimensions
+     * fields, std::length_error when the bit vectors would take more than MaxBytes.
+     */
+    BitVector(const classifier_rule *const *rules, std::size_t nbRules)
+        : fields(rules, nbRules, "BitVector"), kernel(chunkKernel()), unconstrained(NotFound), stats()
+    {
+        auto start = std::chrono::steady_clock::now();
+        chunks = (nbRules + ChunkRules - 1) / ChunkRules;
+        summaryWords = (chunks + 63) / 64;
+        stride = summaryWords + chunks * ChunkWords;
+        inexact.assign(chunks * ChunkWords, 0);
+        projections.resize(fields.dimensions());
+        for (std::size_t d = 0; d < fields.dimensions(); ++d)
+            project(d);
+        if (!fields.dimensions())
+            for (std::size_t i = 0; i < nbRules && unconstrained == NotFound; ++i)
+                if (fields.possible(i))
+                    unconstrained = i;
+
+        stats.rules = nbRules;
+        stats.dimensions = fields.dimensions();
+        stats.bytes = fields.bytes() + inexact.size() * sizeof(uint64_t);
+        for (const Projection &projection : projections)
+            stats.bytes += projection.vectors.size() * sizeof(uint64_t) +
+                           (projection.bounds.size() + projection.classes.size()) * sizeof(uint32_t);
+        stats.buildTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start)
+                              .count();
+    }
+
+    /**
+     * find
+     *
+     * Index of the first rule matching the 'length' bytes of 'header', NotFound when
+     * none does. Fields beyond 'length' are read as zeros.
+     */
+    std::size_t find(const uint8_t *header, std::size_t length) const
+    {
+        std::size_t rule;
+        findBurst(&header, &length, 1, &rule);
+        return rule;
+    }
+
+    /**
+     * findBurst
+     *
+     * find for 'n' headers, setting 'rules'. The classes of all the fields of up to
+     * BurstSize headers are found first, prefetching the aggregates of their bit
+     * vectors, then the bit vectors of each header are ANDed.
+     */
+    void findBurst(const uint8_t *const *headers, const std::size_t *lengths, std::size_t n,
+                   std::size_t *rules) const
+    {
+        std::size_t nbDimensions = fields.dimensions();
+        uint32_t values[BurstSize][Policy::MaxDimensions];
+        const uint64_t *vectors[BurstSize][Policy::MaxDimensions];
+        for (std::size_t base = 0; base < n; base += BurstSize)
+        {
+            std::size_t size = std::min(n - base, std::size_t(BurstSize));
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                fields.extract(headers[base + i], lengths[base + i], values[i]);
+                for (std::size_t d = 0; d < nbDimensions; ++d)
+                {
+                    const Projection &projection = projections[d];
+                    vectors[i][d] = &projection.vectors[classOf(projection, values[i][d]) * stride];
+                    __builtin_prefetch(vectors[i][d]);
+                }
+            }
+            for (std::size_t i = 0; i < size; ++i)
+                rules[base + i] = firstMatch(vectors[i], values[i]);
+        }
+    }
+
+    /**
+     * search
+     *
+     * Set 'action' to the action of the first rule matching 'header' and return true,
+     * or return false when none does.
+     */
+    bool search(const uint8_t *header, std::size_t length, void *&action) const
+    {
+        std::size_t rule = find(header, length);
+        if (rule == NotFound)
+            return false;
+        action = fields.action(rule);
+        return true;
+    }
+
+    /**
+     * searchBurst
+     *
+     * search for 'n' headers, setting 'matched' to the actions of their first rules,
+     * or to nullptr for the headers no rule matches. Return how many match a rule.
+     */
+    std::size_t searchBurst(const uint8_t *const *headers, const std::size_t *lengths, std::size_t n,
+                            void **matched) const
+    {
+        std::size_t rules[BurstSize], count = 0;
+        for (std::size_t base = 0; base < n; base += BurstSize)
+        {
+            std::size_t size = std::min(n - base, std::size_t(BurstSize));
+            findBurst(headers + base, lengths + base, size, rules);
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                matched[base + i] = rules[i] == NotFound ? nullptr : fields.action(rules[i]);
+                count += rules[i] != NotFound;
+            }
+        }
+        return count;
+    }
+
+    const Statistics &statistics() const
+    {
+        return stats;
+    }
+
+  private:
+    const static std::size_t ChunkWords = ChunkRules / 64;
+
+    // Sets 'words' to the AND of the chunk at 'offset' of the bit vectors, return whether a bit is set
+    using ChunkKernel = bool (*)(const uint64_t *const *, std::size_t, std::size_t, uint64_t *);
+
+    // A field cut into intervals, each with the class of its rules
+    struct Projection
+    {
+        std::vector<uint32_t> bounds;  // First value of each interval, empty when the classes are direct
+        std::vector<uint32_t> classes; // Of each interval, or of each value
+        std::vector<uint64_t> vectors; // Aggregate then chunks of each class, 'stride' words apart
+    };
+
+    FieldSet<Policy::MaxDimensions> fields;
+    std::vector<Projection> projections;
+    std::vector<uint64_t> inexact; // Rules to check again, with holes in a mask
+    std::size_t chunks;
+    std::size_t summaryWords;
+    std::size_t stride;
+    ChunkKernel kernel;
+    std::size_t unconstrained; // First rule when the rules have no field
+    Statistics stats;
+
+    static uint32_t classOf(const Projection &projection, uint32_t value)
+    {
+        if (projection.bounds.empty())
+            return projection.classes[value];
+        std::size_t interval = std::upper_bound(projection.bounds.begin(), projection.bounds.end(), value) -
+                               projection.bounds.begin() - 1;
+        return projection.classes[interval];
+    }
+
+    std::size_t firstMatch(const uint64_t *const *vectors, const uint32_t *values) const
+    {
+        std::size_t nbDimensions = fields.dimensions();
+        if (!nbDimensions)
+            return unconstrained;
+        for (std::size_t s = 0; s < summaryWords; ++s)
+        {
+            uint64_t summary = vectors[0][s];
+            for (std::size_t d = 1; d < nbDimensions; ++d)
+                summary &= vectors[d][s];
+            for (; summary; summary &= summary - 1)
+            {
+                std::size_t chunk = s * 64 + __builtin_ctzll(summary);
+                uint64_t words[ChunkWords];
+                if (!kernel(vectors, nbDimensions, summaryWords + chunk * ChunkWords, words))
+                    continue;
+                for (std::size_t w = 0; w < ChunkWords; ++w)
+                {
+                    for (; words[w]; words[w] &= words[w] - 1)
+                    {
+                        std::size_t word = chunk * ChunkWords + w, rule = word * 64 + __builtin_ctzll(words[w]);
+                        if (!(inexact[word] >> (rule % 64) & 1) || fields.matches(rule, values))
+                            return rule;
+                    }
+                }
+            }
+        }
+        return NotFound;
+    }
+
+    // Kernel of the widest instruction set of the CPU
+    static ChunkKernel chunkKernel()
+    {
+#if defined(__x86_64__)
+        if (BitVectorDetail::hasAVX2())
+            return andAVX2;
+#endif
+        return andScalar;
+    }
+
+    static bool andScalar(const uint64_t *const *vectors, std::size_t nbDimensions, std::size_t offset,
+                          uint64_t *words)
+    {
+        uint64_t any = 0;
+        for (std::size_t w = 0; w < ChunkWords; ++w)
+        {
+            words[w] = vectors[0][offset + w];
+            for (std::size_t d = 1; d < nbDimensions; ++d)
+                words[w] &= vectors[d][offset + w];
+            any |= words[w];
+        }
+        return any;
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("avx2"))) static bool andAVX2(const uint64_t *const *vectors, std::size_t nbDimensions,
+                                                        std::size_t offset, uint64_t *words)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(vectors[0] + offset));
+        for (std::size_t d = 1; d < nbDimensions; ++d)
+            chunk = _mm256_and_si256(chunk, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(vectors[d] + offset)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(words), chunk);
+        return !_mm256_testz_si256(chunk, chunk);
+    }
+#endif
+
+    // Random word of each rule, the XOR of those of a set of rules is the key of its class
+    static uint64_t signature(uint64_t rule)
+    {
+        uint64_t z = (rule + 1) * 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    /**
+     * Cut the dimension 'd' at the bounds of the ranges of the rules and sweep over
+     * them, adding the rules whose range starts and removing those whose range ended,
+     * to give every interval the class of the rules it holds.
+     */
+    void project(std::size_t d)
+    {
+        struct Bound
+        {
+            uint64_t value;
+            uint32_t rule;
+        };
+        std::vector<Bound> bounds;
+        uint32_t all = fields.lowMask(fields.dimension(d).bitLength);
+        for (std::size_t i = 0; i < fields.rules(); ++i)
+        {
+            if (!fields.possible(i))
+                continue;
+            uint32_t wildcard = ~fields.care(i)[d] & all, low = fields.value(i)[d];
+            bounds.push_back(Bound{low, static_cast<uint32_t>(i)});
+            if (uint64_t(low | wildcard) + 1 <= all)
+                bounds.push_back(Bound{uint64_t(low | wildcard) + 1, static_cast<uint32_t>(i)});
+            if (wildcard & (wildcard + 1))
+                inexact[i / 64] |= uint64_t(1) << (i % 64);
+        }
+        std::sort(bounds.begin(), bounds.end(), [](const Bound &a, const Bound &b) { return a.value < b.value; });
+
+        Projection &projection = projections[d];
+        std::unordered_multimap<uint64_t, uint32_t> known; // Classes by the signature of their rules
+        std::vector<uint64_t> rules(chunks * ChunkWords);
+        uint64_t key = 0;
+        for (std::size_t next = 0, value = 0;;)
+        {
+            for (; next < bounds.size() && bounds[next].value == value; ++next)
+            {
+                rules[bounds[next].rule / 64] ^= uint64_t(1) << (bounds[next].rule % 64);
+                key ^= signature(bounds[next].rule);
+            }
+            projection.bounds.push_back(static_cast<uint32_t>(value));
+            projection.classes.push_back(classOfRules(projection, rules, key, known));
+            if (next == bounds.size())
+                break;
+            value = bounds[next].value;
+        }
+        stats.intervals += projection.bounds.size();
+        stats.classes += projection.vectors.size() / stride;
+
+        // A table of all the values of a short field
+        if (fields.dimension(d).bitLength > Policy::DirectBits)
+            return;
+        std::vector<uint32_t> direct(uint64_t(all) + 1);
+        for (std::size_t k = 0; k < projection.bounds.size(); ++k)
+        {
+            uint64_t end = k + 1 < projection.bounds.size() ? projection.bounds[k + 1] : uint64_t(all) + 1;
+            std::fill(direct.begin() + projection.bounds[k], direct.begin() + end, projection.classes[k]);
+        }
+        projection.classes.swap(direct);
+        std::vector<uint32_t>().swap(projection.bounds);
+    }
+
+    // Class of the 'rules' of an interval, a new one when no interval had them before
+    uint32_t classOfRules(Projection &projection, const std::vector<uint64_t> &rules, uint64_t key,
+                          std::unordered_multimap<uint64_t, uint32_t> &known)
+    {
+        auto range = known.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it)
+            if (std::equal(rules.begin(), rules.end(), projection.vectors.begin() + it->second * stride + summaryWords))
+                return it->second;
+
+        std::size_t used = stride * sizeof(uint64_t);
+        for (const Projection &other : projections)
+            used += other.vectors.size() * sizeof(uint64_t);
+        if (used > Policy::MaxBytes)
+            throw std::length_error("BitVector: the bit vectors would take more than MaxBytes");
+
+        uint32_t id = static_cast<uint32_t>(projection.vectors.size() / stride);
+        projection.vectors.resize(projection.vectors.size() + summaryWords);
+        for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            bool any = false;
+            for (std::size_t w = 0; w < ChunkWords; ++w)
+                any |= rules[chunk * ChunkWords + w] != 0;
+            if (any)
+                projection.vectors[id * stride + chunk / 64] |= uint64_t(1) << (chunk % 64);
+        }
+        projection.vectors.insert(projection.vectors.end(), rules.begin(), rules.end());
+        known.emplace(key, id);
+        return id;
+    }
+};
+} // namespace DNFC
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef _FIELDSETHPP_
+#define _FIELDSETHPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../classifier_rule/classifier_rule.h"
+
+namespace DNFC
+{
+
+/**
+ * FieldSet
+ *
+ * The fields of a set of classifier_rules, flattened for the static classifiers. A
+ * field of a rule is the 'bit_length' bits (at most 32) from bit 'offset' of the
+ * header, big-endian, and matches when the bits outside its 'mask' are those of its
+ * 'value'. Every distinct (offset, bit_length) pair is a dimension, at most
+ * MaxDimensions of them, and rule i matches the values v of a header when
+ * (v[d] & care(i)[d]) == value(i)[d] on every dimension d. A field absent from a
+ * rule, or 0 bits long, matches any value; a rule whose fields disagree on the same
+ * bits matches nothing.
+ */
+template <std::size_t MaxDimensions>
+class FieldSet
+{
+  public:
+    struct Dimension
+    {
+        uint32_t offset; // In bits
+        uint32_t bitLength;
+    };
+
+    /**
+     * Constructor
+     *
+     * Flatten the fields of 'nbRules' rules. Throw std::invalid_argument, its message
+     * starting with 'engine', when a field is longer than 32 bits or the rules use
+     * more than MaxDimensions fields.
+     */
+    FieldSet(const classifier_rule *const *rules, std::size_t nbRules, const char *engine)
+    {
+        for (std::size_t i = 0; i < nbRules; ++i)
+            for (uint32_t j = 0; j < rules[i]->nb_fields; ++j)
+                if (rules[i]->fields[j]->bit_length)
+                    dimensionOf(*rules[i]->fields[j], engine);
+
+        std::size_t nbDimensions = dims.size();
+        masks.assign(nbRules * 2 * nbDimensions, 0);
+        impossible.assign(nbRules, false);
+        for (std::size_t i = 0; i < nbRules; ++i)
+        {
+            uint32_t *care = &masks[i * 2 * nbDimensions], *value = care + nbDimensions;
+            for (uint32_t j = 0; j < rules[i]->nb_fields; ++j)
+            {
+                const classifier_field &field = *rules[i]->fields[j];
+                if (!field.bit_length)
+                    continue;
+                std::size_t d = dimensionOf(field, engine);
+                uint32_t fieldCare = ~field.mask & lowMask(field.bit_length);
+                uint32_t fieldValue = field.value & fieldCare;
+                if ((value[d] ^ fieldValue) & care[d] & fieldCare) // Two fields on the same bits disagree
+                    impossible[i] = true;
+                care[d] |= fieldCare;
+                value[d] |= fieldValue;
+            }
+            actions.push_back(rules[i]->action);
+        }
+    }
+
+    std::size_t rules() const
+    {
+        return actions.size();
+    }
+
+    std::size_t dimensions() const
+    {
+        return dims.size();
+    }
+
+    const Dimension &dimension(std::size_t d) const
+    {
+        return dims[d];
+    }
+
+    const uint32_t *care(std::size_t rule) const
+    {
+        return &masks[rule * 2 * dims.size()];
+    }
+
+    const uint32_t *value(std::size_t rule) const
+    {
+        return &masks[rule * 2 * dims.size() + dims.size()];
+    }
+
+    // Whether some header matches the rule
+    bool possible(std::size_t rule) const
+    {
+        return !impossible[rule];
+    }
+
+    void *action(std::size_t rule) const
+    {
+        return actions[rule];
+    }
+
+    bool matches(std::size_t rule, const uint32_t *values) const
+    {
+        const uint32_t *ruleCare = care(rule), *ruleValue = value(rule);
+        uint32_t differ = 0;
+        for (std::size_t d = 0; d < dims.size(); ++d)
+            differ |= (values[d] & ruleCare[d]) ^ ruleValue[d];
+        return !differ && !impossible[rule];
+    }
+
+    // Values of the dimensions in the 'length' bytes of 'header', the bytes beyond read as zeros
+    void extract(const uint8_t *header, std::size_t length, uint32_t *values) const
+    {
+        for (std::size_t d = 0; d < dims.size(); ++d)
+        {
+            std::size_t first = dims[d].offset / 8;
+            uint64_t window = 0;
+            if (first + sizeof(window) <= length)
+            {
+                std::memcpy(&window, header + first, sizeof(window));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                window = __builtin_bswap64(window);
+#endif
+            }
+            else
+            {
+                for (std::size_t i = 0; i < sizeof(window); ++i)
+                    window = (window << 8) | (first + i < length ? header[first + i] : 0);
+            }
+            unsigned shift = 64 - dims[d].offset % 8 - dims[d].bitLength;
+            values[d] = static_cast<uint32_t>(window >> shift) & lowMask(dims[d].bitLength);
+        }
+    }
+
+    static uint32_t lowMask(uint32_t bitLength)
+    {
+        return static_cast<uint32_t>((uint64_t(1) << bitLength) - 1);
+    }
+
+    // Bytes of the flattened fields
+    std::size_t bytes() const
+    {
+        return masks.size() * sizeof(uint32_t) + actions.size() * sizeof(void *) + impossible.size() / 8;
+    }
+
+  private:
+    std::vector<Dimension> dims;
+    std::vector<uint32_t> masks; // Care words then value words of each rule
+    std::vector<void *> actions;
+    std::vector<bool> impossible;
+
+    std::size_t dimensionOf(const classifier_field &field, const char *engine)
+    {
+        if (field.bit_length > 32)
+            throw std::invalid_argument(std::string(engine) + ": fields are at most 32 bits long");
+        for (std::size_t d = 0; d < dims.size(); ++d)
+            if (dims[d].offset == field.offset && dims[d].bitLength == field.bit_length)
+                return d;
+        if (dims.size() == MaxDimensions)
+            throw std::invalid_argument(std::string(engine) + ": too many distinct fields");
+        dims.push_back(Dimension{field.offset, field.bit_length});
+        return dims.size() - 1;
+    }
+};
+} // namespace DNFC
+
+#endif
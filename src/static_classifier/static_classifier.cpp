@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <exception>
+
+#include "static_classifier.h"
+#include "../hypercuts/hypercuts.h"
+#include "tuplespace.hpp"
+#include "bitvector.hpp"
+
+struct static_classifier
+{
+   const struct static_classifier_ops* ops;
+   void* engine;
+};
+
+
+
+/*          Engines              */
+
+namespace
+{
+
+// Operations of an engine with the interface of DNFC::HyperCuts, that cannot be updated
+template <typename Engine>
+struct StaticOps
+{
+   static void* build(struct classifier_rule** rules, uint32_t nb_rules)
+   {
+      try
+      {
+         return new Engine(rules, nb_rules);
+      }
+      catch(const std::exception& error)
+      {
+         // Invalid rules, too many of them, or out of memory
+         fprintf(stderr, "%s\n", error.what());
+         return NULL;
+      }
+   }
+
+   static bool search(void* engine, const unsigned char* header, size_t header_len, void** action)
+   {
+      return static_cast<Engine*>(engine)->search(header, header_len, *action);
+   }
+
+   static size_t search_burst(void* engine,
+                              const unsigned char* const* headers,
+                              const size_t* header_lens,
+                              size_t n,
+                              void** actions)
+   {
+      return static_cast<Engine*>(engine)->searchBurst(headers, header_lens, n, actions);
+   }
+
+   static void destroy(void* engine)
+   {
+      delete static_cast<Engine*>(engine);
+   }
+};
+
+void* build_hypercuts(struct classifier_rule** rules, uint32_t nb_rules)
+{
+   try
+   {
+      return new_hypercuts_classifier(&rules, &nb_rules, false);
+   }
+   catch(const std::exception& error)
+   {
+      fprintf(stderr, "%s\n", error.what());
+      return NULL;
+   }
+}
+
+void print_tuple_space(void* engine)
+{
+   const DNFC::TupleSpace<>::Statistics& stats = static_cast<DNFC::TupleSpace<>*>(engine)->statistics();
+   printf("TupleSpace: %zu rules over %zu fields, built in %.1f ms\n",
+          stats.rules, stats.dimensions, stats.buildTime / 1e3);
+   printf("   %zu tuples, %zu entries\n", stats.tuples, stats.entries);
+}
+
+void print_bit_vector(void* engine)
+{
+   const DNFC::BitVector<>::Statistics& stats = static_cast<DNFC::BitVector<>*>(engine)->statistics();
+   printf("BitVector: %zu rules over %zu fields, built in %.1f ms\n",
+          stats.rules, stats.dimensions, stats.buildTime / 1e3);
+   printf("   %zu intervals, %zu classes\n", stats.intervals, stats.classes);
+   printf("   %zu bytes\n", stats.bytes);
+}
+
+const struct static_classifier_ops engines[STATIC_NB_ENGINES] =
+{
+   {
+      "HyperCuts",
+      build_hypercuts,
+      [](void* engine, const unsigned char* header, size_t header_len, void** action) {
+         return hypercuts_search(static_cast<hypercuts_classifier*>(engine), header, header_len, action);
+      },
+      [](void* engine, const unsigned char* const* headers, const size_t* header_lens, size_t n, void** actions) {
+         return hypercuts_search_burst(static_cast<hypercuts_classifier*>(engine), headers, header_lens, n, actions);
+      },
+      [](void* engine, const struct classifier_rule* rule, const struct classifier_rule* before) {
+         return hypercuts_insert(static_cast<hypercuts_classifier*>(engine), rule, before);
+      },
+      [](void* engine, const struct classifier_rule* rule) {
+         return hypercuts_remove(static_cast<hypercuts_classifier*>(engine), rule);
+      },
+      [](void* engine) { hypercuts_print(static_cast<hypercuts_classifier*>(engine)); },
+      [](void* engine) { free_hypercuts_classifier(static_cast<hypercuts_classifier*>(engine)); }
+   },
+   {
+      "TupleSpace",
+      StaticOps<DNFC::TupleSpace<>>::build,
+      StaticOps<DNFC::TupleSpace<>>::search,
+      StaticOps<DNFC::TupleSpace<>>::search_burst,
+      NULL,
+      NULL,
+      print_tuple_space,
+      StaticOps<DNFC::TupleSpace<>>::destroy
+   },
+   {
+      "BitVector",
+      StaticOps<DNFC::BitVector<>>::build,
+      StaticOps<DNFC::BitVector<>>::search,
+      StaticOps<DNFC::BitVector<>>::search_burst,
+      NULL,
+      NULL,
+      print_bit_vector,
+      StaticOps<DNFC::BitVector<>>::destroy
+   }
+};
+
+} // namespace
+
+/*          Engines              */
+
+
+
+const struct static_classifier_ops* static_engine_ops(enum static_engine engine)
+{
+   return engine < STATIC_NB_ENGINES ? &engines[engine] : NULL;
+}
+
+
+
+static_classifier* new_static_classifier(const struct static_classifier_ops* ops,
+                                         struct classifier_rule*** rules,
+                                         uint32_t* nb_rules,
+                                         bool verbose)
+{
+   if(!ops)
+      return NULL;
+   void* engine = ops->build(*rules, *nb_rules);
+   if(!engine)
+      return NULL;
+
+   static_classifier* classifier = new static_classifier{ops, engine};
+   if(verbose)
+      static_classifier_print(classifier);
+   return classifier;
+}
+
+
+
+bool static_classifier_search(static_classifier* classifier,
+                              const unsigned char* header,
+                              size_t header_len,
+                              void** action)
+{
+   return classifier->ops->search(classifier->engine, header, header_len, action);
+}
+
+
+
+size_t static_classifier_search_burst(static_classifier* classifier,
+                                      const unsigned char* const* headers,
+                                      const size_t* header_lens,
+                                      size_t n,
+                                      void** actions)
+{
+   return classifier->ops->search_burst(classifier->engine, headers, header_lens, n, actions);
+}
+
+
+
+bool static_classifier_insert(static_classifier* classifier,
+                              const struct classifier_rule* rule,
+                              const struct classifier_rule* before)
+{
+   if(!classifier->ops->insert)
+   {
+      fprintf(stderr, "%s: rules cannot be inserted once built\n", classifier->ops->name);
+      return false;
+   }
+   return classifier->ops->insert(classifier->engine, rule, before);
+}
+
+
+
+bool static_classifier_remove(static_classifier* classifier,
+                              const struct classifier_rule* rule)
+{
+   if(!classifier->ops->remove)
+   {
+      fprintf(stderr, "%s: rules cannot be removed once built\n", classifier->ops->name);
+      return false;
+   }
+   return classifier->ops->remove(classifier->engine, rule);
+}
+
+
+
+void static_classifier_print(static_classifier* classifier)
+{
+   classifier->ops->print(classifier->engine);
+}
+
+
+
+void free_static_classifier(static_classifier* classifier)
+{
+   classifier->ops->destroy(classifier->engine);
+   delete classifier;
+}
@@ -0,0 +1,101 @@
+#ifndef _STATIC_CLASSIFIERH_
+#define _STATIC_CLASSIFIERH_
+
+/*H**********************************************************************
+ * FILENAME :        static_classifier.h
+ *
+ * DESCRIPTION :
+ *        C interface of the static stage of DNFC, the first rule matching a
+ *        header wins. The same interface runs one of several engines, picked
+ *        when the classifier is built: which one is the fastest, or fits in
+ *        memory, depends on the rule set.
+ *
+ * PUBLIC STRUCTURE :
+ *       static_classifier
+ *       static_classifier_ops
+ *
+ * AUTHOR :    Pieroux Alexandre
+ *H*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../classifier_rule/classifier_rule.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum static_engine
+{
+   STATIC_HYPERCUTS,    // Decision trees, a few cache lines per lookup, rules can be inserted and removed (hypercuts.h)
+   STATIC_TUPLE_SPACE,  // A hash table per set of masks, memory linear in the rules (tuplespace.hpp)
+   STATIC_BIT_VECTOR,   // Bit vectors of the rules of each range of each field (bitvector.hpp)
+   STATIC_NB_ENGINES
+};
+
+/* Operations of an engine, on the object returned by its 'build'. 'insert' and
+   'remove' are NULL for the engines that cannot be updated once built. */
+struct static_classifier_ops
+{
+   const char* name;
+   void* (*build)(struct classifier_rule** rules, uint32_t nb_rules);
+   bool (*search)(void* engine, const unsigned char* header, size_t header_len, void** action);
+   size_t (*search_burst)(void* engine,
+                          const unsigned char* const* headers,
+                          const size_t* header_lens,
+                          size_t n,
+                          void** actions);
+   bool (*insert)(void* engine, const struct classifier_rule* rule, const struct classifier_rule* before);
+   bool (*remove)(void* engine, const struct classifier_rule* rule);
+   void (*print)(void* engine);
+   void (*destroy)(void* engine);
+};
+
+typedef struct static_classifier static_classifier;
+
+/* Operations of 'engine' */
+const struct static_classifier_ops* static_engine_ops(enum static_engine engine);
+
+/* Build the classifier of the '*nb_rules' rules of '*rules' with the engine of 'ops',
+   such as static_engine_ops(STATIC_TUPLE_SPACE), as new_hypercuts_classifier does.
+   Return NULL, printing why, when the engine cannot classify the rules. With
+   'verbose', print the statistics of the engine once built. */
+static_classifier* new_static_classifier(const struct static_classifier_ops* ops,
+                                         struct classifier_rule*** rules,
+                                         uint32_t* nb_rules,
+                                         bool verbose);
+
+/* See hypercuts_search */
+bool static_classifier_search(static_classifier* classifier,
+                              const unsigned char* header,
+                              size_t header_len,
+                              void** action);
+
+/* See hypercuts_search_burst */
+size_t static_classifier_search_burst(static_classifier* classifier,
+                                      const unsigned char* const* headers,
+                                      const size_t* header_lens,
+                                      size_t n,
+                                      void** actions);
+
+/* See hypercuts_insert, return false when the engine cannot be updated */
+bool static_classifier_insert(static_classifier* classifier,
+                              const struct classifier_rule* rule,
+                              const struct classifier_rule* before);
+
+/* See hypercuts_remove, return false when the engine cannot be updated */
+bool static_classifier_remove(static_classifier* classifier,
+                              const struct classifier_rule* rule);
+
+/* Print the name and the statistics of the engine */
+void static_classifier_print(static_classifier* classifier);
+
+void free_static_classifier(static_classifier* classifier);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
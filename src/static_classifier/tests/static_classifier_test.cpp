@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <vector>
+
+extern "C" {
+  #include "../static_classifier.h"
+}
+#include "../tuplespace.hpp"
+#include "../bitvector.hpp"
+
+#include <gtest/gtest.h>
+
+#define HEADER_LENGTH 40
+
+using namespace DNFC;
+
+// Protocol, addresses and ports of an IPv4 header followed by TCP or UDP, in bits
+const uint32_t offsets[5] = {72, 96, 128, 160, 176}, lengths[5] = {8, 32, 32, 16, 16};
+
+struct RuleSet
+{
+  std::vector<classifier_rule> rules;
+  std::vector<classifier_field> fields;
+  std::vector<classifier_field *> fieldPointers;
+  std::vector<classifier_rule *> pointers;
+  std::vector<uint32_t> actions;
+};
+
+void make_rules(RuleSet &set, uint32_t nb_rules);
+void make_header(const RuleSet &set, u_char *header);
+uint32_t linear_search(const RuleSet &set, const u_char *header, size_t header_len);
+
+TEST(StaticClassifier, EnginesAgree)
+{
+  RuleSet set;
+  make_rules(set, 3000);
+  srand(11);
+  std::vector<u_char> headers(5000 * HEADER_LENGTH);
+  std::vector<const u_char *> pointers(5000);
+  std::vector<size_t> lens(5000, HEADER_LENGTH);
+  for (size_t i = 0; i < pointers.size(); ++i)
+  {
+    pointers[i] = &headers[i * HEADER_LENGTH];
+    make_header(set, &headers[i * HEADER_LENGTH]);
+  }
+
+  for (int engine = 0; engine < STATIC_NB_ENGINES; ++engine)
+  {
+    classifier_rule **list = set.pointers.data();
+    uint32_t nb_rules = set.pointers.size();
+    static_classifier *classifier =
+        new_static_classifier(static_engine_ops((enum static_engine)engine), &list, &nb_rules, true);
+    ASSERT_TRUE(classifier != NULL);
+
+    std::vector<void *> actions(pointers.size());
+    size_t matched = static_classifier_search_burst(classifier, pointers.data(), lens.data(), pointers.size(),
+                                                    actions.data());
+    size_t expected_matches = 0;
+    for (size_t i = 0; i < pointers.size(); ++i)
+    {
+      uint32_t expected = linear_search(set, pointers[i], HEADER_LENGTH);
+      expected_matches += expected != UINT32_MAX;
+      void *action = NULL;
+      uint32_t result = UINT32_MAX;
+      if (static_classifier_search(classifier, pointers[i], HEADER_LENGTH, &action))
+        result = *(uint32_t *)action;
+      ASSERT_EQ(result, expected) << static_engine_ops((enum static_engine)engine)->name << " header " << i;
+      EXPECT_EQ(actions[i] ? *(uint32_t *)actions[i] : UINT32_MAX, expected);
+    }
+    EXPECT_EQ(matched, expected_matches);
+    EXPECT_GT(matched, pointers.size() / 2);
+    EXPECT_LT(matched, pointers.size());
+    free_static_classifier(classifier);
+  }
+}
+
+TEST(StaticClassifier, Updates)
+{
+  RuleSet set;
+  make_rules(set, 100);
+  for (int engine = 0; engine < STATIC_NB_ENGINES; ++engine)
+  {
+    classifier_rule **list = set.pointers.data();
+    uint32_t nb_rules = 99;
+    static_classifier *classifier =
+        new_static_classifier(static_engine_ops((enum static_engine)engine), &list, &nb_rules, false);
+    ASSERT_TRUE(classifier != NULL);
+
+    // Only the decision trees take updates
+    bool updatable = engine == STATIC_HYPERCUTS;
+    EXPECT_EQ(static_classifier_insert(classifier, set.pointers[99], set.pointers[0]), updatable);
+    EXPECT_EQ(static_classifier_remove(classifier, set.pointers[1]), updatable);
+    free_static_classifier(classifier);
+  }
+}
+
+TEST(StaticClassifier, Unclassifiable)
+{
+  classifier_field field = {0, 40, 0, 0, 1};
+  classifier_field *fields = &field;
+  classifier_rule rule = {0, &fields, 1, NULL};
+  classifier_rule *rules = &rule;
+  for (int engine = 0; engine < STATIC_NB_ENGINES; ++engine)
+  {
+    classifier_rule **list = &rules;
+    uint32_t nb_rules = 1;
+    EXPECT_TRUE(new_static_classifier(static_engine_ops((enum static_engine)engine), &list, &nb_rules, false) == NULL);
+  }
+  EXPECT_TRUE(static_engine_ops(STATIC_NB_ENGINES) == NULL);
+}
+
+TEST(TupleSpace, Tuples)
+{
+  // Two rules of the same tuple and values, one of another tuple, one matching nothing
+  classifier_field fields[5] = {{0, 8, 0, 0, 6}, {0, 8, 0, 0, 6}, {0, 8, 0, 0xf, 0x10},
+                                {0, 8, 0, 0, 1}, {0, 8, 0, 0, 2}};
+  classifier_field *pointers[5] = {&fields[0], &fields[1], &fields[2], &fields[3], &fields[4]};
+  uint32_t actions[4] = {0, 1, 2, 3};
+  classifier_rule rules[4] = {{0, &pointers[0], 1, &actions[0]}, {1, &pointers[1], 1, &actions[1]},
+                              {2, &pointers[2], 1, &actions[2]}, {3, &pointers[3], 2, &actions[3]}};
+  classifier_rule *list[4] = {&rules[0], &rules[1], &rules[2], &rules[3]};
+  TupleSpace<> space(list, 4);
+  EXPECT_EQ(space.statistics().tuples, 2u);
+  EXPECT_EQ(space.statistics().entries, 2u);
+
+  uint8_t header[1] = {6};
+  EXPECT_EQ(space.find(header, 1), 0u);
+  header[0] = 0x1a;
+  EXPECT_EQ(space.find(header, 1), 2u);
+  header[0] = 1;
+  EXPECT_TRUE(space.find(header, 1) == TupleSpace<>::NotFound);
+}
+
+class SmallBitVectorPolicy : public DefaultBitVectorPolicy
+{
+  public:
+    const static std::size_t MaxBytes = 4096;
+};
+
+TEST(BitVector, Classes)
+{
+  RuleSet set;
+  make_rules(set, 600);
+  BitVector<> vectors(set.pointers.data(), set.pointers.size());
+  const BitVector<>::Statistics &stats = vectors.statistics();
+  EXPECT_EQ(stats.dimensions, 5u);
+  EXPECT_LE(stats.classes, stats.intervals);
+  EXPECT_GT(stats.bytes, 0u);
+
+  // 600 rules take 3 chunks and an aggregate word per class
+  EXPECT_THROW(BitVector<SmallBitVectorPolicy>(set.pointers.data(), set.pointers.size()), std::length_error);
+}
+
+/*
+ * Random ClassBench-like rules: address prefixes, exact, wildcard or masked ports
+ * (some with holes in their mask), TCP, UDP or any protocol. Some rules leave out
+ * fields other than the source address, and one matches nothing.
+ */
+void make_rules(RuleSet &set, uint32_t nb_rules)
+{
+  srand(3);
+  set.rules.resize(nb_rules);
+  set.fields.resize(nb_rules * 6);
+  set.fieldPointers.resize(nb_rules * 6);
+  set.pointers.resize(nb_rules);
+  set.actions.resize(nb_rules);
+  for (uint32_t i = 0; i < nb_rules; ++i)
+  {
+    classifier_field *fields = &set.fields[i * 6];
+    uint32_t nb_fields = 0;
+    for (uint32_t j = 0; j < 5; ++j)
+    {
+      if (j != 1 && rand() % 8 == 0)
+        continue;
+      uint32_t all = lengths[j] == 32 ? UINT32_MAX : (1u << lengths[j]) - 1, mask;
+      if (j == 0)
+        mask = rand() % 4 ? 0 : all;
+      else if (j <= 2)
+      {
+        uint32_t prefix = 16 + rand() % 17;
+        mask = prefix == 32 ? 0 : all >> prefix;
+      }
+      else
+      {
+        const uint32_t masks[4] = {0, 0xffff, 0x3ff, 0x0f0f};
+        mask = masks[rand() % 4];
+      }
+      uint32_t value = j == 0 ? (rand() % 2 ? 6 : 17) : j <= 2 ? 0x0a000000 | (rand() & 0xffff) : rand() % 64;
+      fields[nb_fields++] = {j, lengths[j], offsets[j], mask, value & ~mask};
+    }
+    if (i == nb_rules / 2) // Two protocols at once
+    {
+      fields[0] = {0, 8, 72, 0, 6};
+      fields[1] = {0, 8, 72, 0, 17};
+      nb_fields = 2;
+    }
+    for (uint32_t j = 0; j < nb_fields; ++j)
+      set.fieldPointers[i * 6 + j] = &fields[j];
+    set.actions[i] = i;
+    set.rules[i] = {i, &set.fieldPointers[i * 6], nb_fields, &set.actions[i]};
+    set.pointers[i] = &set.rules[i];
+  }
+}
+
+// A header matching a random rule, its wildcards random, or a random header
+void make_header(const RuleSet &set, u_char *header)
+{
+  for (size_t i = 0; i < HEADER_LENGTH; ++i)
+    header[i] = rand() % 4 ? 0 : rand();
+  header[9] = rand() % 2 ? 6 : 17;
+  if (rand() % 8 == 0)
+    return;
+  const classifier_rule &rule = set.rules[rand() % set.rules.size()];
+  for (uint32_t j = 0; j < rule.nb_fields; ++j)
+  {
+    const classifier_field &field = *rule.fields[j];
+    uint32_t value = field.value | (rand() & field.mask);
+    for (uint32_t byte = 0; byte < field.bit_length / 8; ++byte)
+      header[field.offset / 8 + byte] = value >> (field.bit_length - 8 * (byte + 1));
+  }
+}
+
+uint32_t linear_search(const RuleSet &set, const u_char *header, size_t header_len)
+{
+  for (const classifier_rule &rule : set.rules)
+  {
+    bool matches = true;
+    for (uint32_t j = 0; j < rule.nb_fields && matches; ++j)
+    {
+      const classifier_field &field = *rule.fields[j];
+      uint32_t value = 0;
+      for (uint32_t byte = 0; byte < field.bit_length / 8; ++byte)
+      {
+        size_t index = field.offset / 8 + byte;
+        value = (value << 8) | (index < header_len ? header[index] : 0);
+      }
+      matches = ((value ^ field.value) & ~field.mask) == 0;
+    }
+    if (matches)
+      return rule.id;
+  }
+  return UINT32_MAX;
+}
@@ -0,0 +1,319 @@
+#ifndef _TUPLESPACEHPP_
+#define _TUPLESPACEHPP_
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "../hash_table/hashtable.hpp"
+#include "../hash_table/hashers.hpp"
+#include "../hash_table/fixedkey.hpp"
+#include "../SMR/epoch.hpp"
+#include "fieldset.hpp"
+
+namespace DNFC
+{
+
+/**
+ * DefaultTupleSpacePolicy
+ *
+ * The rules use at most MaxDimensions distinct fields, the masked values of which make
+ * the keys of the hash tables. The prefix of a field of a rule gives its tuple once
+ * rounded down to a multiple of PrefixStep bits, unless the whole field is exact, and
+ * the rules of an entry of more than MaxListRules rules go to tuples of half the step.
+ * With a PrefixStep of 1, every distinct set of prefixes has its own tuple. A burst
+ * looks up at least BatchKeys headers at once in a table, fewer one at a time. The
+ * tables never change once built, so their lookups only mark an Epoch region instead
+ * of publishing HazardPointers.
+ */
+class DefaultTupleSpacePolicy : public DefaultHashTablePolicy
+{
+  public:
+    const static std::size_t MaxDimensions = 8;
+    const static std::size_t PrefixStep = 16;
+    const static std::size_t MaxListRules = 256;
+    const static std::size_t BatchKeys = 8;
+
+    template <typename Key>
+    using Hash = DNFC::WyHash<Key>;
+
+    template <typename T, typename Deleter>
+    using Reclaimer = DNFC::EpochPointer<T, Deleter>;
+};
+
+/**
+ * TupleSpace
+ *
+ * Static packet classifier over classifier_rules (see FieldSet), the first of the
+ * rules matching a header wins. Tuple Space Search (Srinivasan et al.): the rules
+ * are grouped by tuple, the prefixes of all their fields, and each tuple has a
+ * HashTable of the values of its rules on these prefixes. A lookup masks the fields
+ * of the header with each tuple and looks the result up in its table, which gives the
+ * rules to check in full. As in TupleMerge (Daly et al.), the prefixes of a tuple are
+ * rounded down so that close rules, such as the prefixes of a port range, share a
+ * table: a few lists of rules checked one after the other cost less than many more
+ * tables, and the rules of a list grown too long go back to finer tuples. The tuples
+ * are in the order of their first rule, so a lookup stops at the first tuple that
+ * cannot hold a rule before the best one found.
+ *
+ * The memory is linear in the number of rules whatever their wildcards, the time
+ * grows with the number of distinct tuples.
+ */
+template <typename Policy = DefaultTupleSpacePolicy>
+class TupleSpace
+{
+  public:
+    const static std::size_t NotFound = SIZE_MAX;
+
+    // Headers looked up together in each table by findBurst
+    const static std::size_t BurstSize = Policy::BatchSize;
+
+    struct Statistics
+    {
+        std::size_t rules;
+        std::size_t dimensions;
+        std::size_t tuples;
+        std::size_t entries;   // Distinct (tuple, values) pairs
+        std::size_t maxRules;  // Checked for an entry at most
+        std::size_t buildTime; // In microseconds
+    };
+
+    /**
+     * Constructor
+     *
+     * Build the tables of 'nbRules' rules, by priority. Throw std::invalid_argument when
+     * a field is longer than 32 bits or the rules use more than MaxDimensions fields.
+     */
+    TupleSpace(const classifier_rule *const *rules, std::size_t nbRules)
+        : fields(rules, nbRules, "TupleSpace"), stats()
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::size_t nbDimensions = fields.dimensions();
+        std::map<std::vector<uint32_t>, std::size_t> tupleOf;
+        std::vector<std::map<std::vector<uint32_t>, std::vector<uint32_t>>> entries; // Rules of each key of each tuple
+
+        // The rules of an entry longer than MaxListRules go to finer tuples, until they fit or are exact
+        std::vector<uint32_t> steps(nbRules, Policy::PrefixStep);
+        for (bool split = true; split;)
+        {
+            tupleOf.clear();
+            tuples.clear();
+            entries.clear();
+            for (std::size_t i = 0; i < nbRules; ++i)
+            {
+                if (!fields.possible(i))
+                    continue;
+                std::vector<uint32_t> care(nbDimensions), value(nbDimensions);
+                for (std::size_t d = 0; d < nbDimensions; ++d)
+                {
+                    care[d] = prefixOf(fields.care(i)[d], fields.dimension(d).bitLength, steps[i]);
+                    value[d] = fields.value(i)[d] & care[d];
+                }
+                auto found = tupleOf.find(care);
+                if (found == tupleOf.end())
+                {
+                    // The rules come by priority, so the tuples by their first rule
+                    found = tupleOf.emplace(care, tuples.size()).first;
+                    tuples.emplace_back(new Tuple());
+                    std::copy(care.begin(), care.end(), tuples.back()->care);
+                    tuples.back()->first = static_cast<uint32_t>(i);
+                    entries.emplace_back();
+                }
+                entries[found->second][value].push_back(static_cast<uint32_t>(i));
+            }
+
+            split = false;
+            for (const auto &tuple : entries)
+                for (const auto &entry : tuple)
+                    for (uint32_t rule : entry.second)
+                        if (entry.second.size() > Policy::MaxListRules && steps[rule] > 1)
+                        {
+                            steps[rule] /= 2;
+                            split = true;
+                        }
+        }
+
+        // An entry is the offset of its rules in 'lists', after their count
+        for (std::size_t t = 0; t < tuples.size(); ++t)
+        {
+            for (const auto &entry : entries[t])
+            {
+                tuples[t]->table.insert(keyOf(entry.first.data(), nullptr), static_cast<uint32_t>(lists.size()));
+                lists.push_back(static_cast<uint32_t>(entry.second.size()));
+                lists.insert(lists.end(), entry.second.begin(), entry.second.end());
+                stats.maxRules = std::max(stats.maxRules, entry.second.size());
+            }
+            stats.entries += entries[t].size();
+        }
+
+        stats.rules = nbRules;
+        stats.dimensions = nbDimensions;
+        stats.tuples = tuples.size();
+        stats.buildTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start)
+                              .count();
+    }
+
+    /**
+     * find
+     *
+     * Index of the first rule matching the 'length' bytes of 'header', NotFound when
+     * none does. Fields beyond 'length' are read as zeros.
+     */
+    std::size_t find(const uint8_t *header, std::size_t length) const
+    {
+        std::size_t rule;
+        findBurst(&header, &length, 1, &rule);
+        return rule;
+    }
+
+    /**
+     * findBurst
+     *
+     * find for 'n' headers, setting 'rules'. Up to BurstSize headers are looked up in
+     * each table at once (HashTable::visitBatch, their cache misses overlapping), those
+     * that already matched a rule before the first rule of the tuple skipping it. Below
+     * BatchKeys headers left, setting up a batch costs more than it saves.
+     */
+    void findBurst(const uint8_t *const *headers, const std::size_t *lengths, std::size_t n,
+                   std::size_t *rules) const
+    {
+        Epoch::Region region;
+        uint32_t values[BurstSize][Policy::MaxDimensions];
+        Key keys[BurstSize];
+        std::size_t pending[BurstSize];
+        for (std::size_t base = 0; base < n; base += BurstSize)
+        {
+            std::size_t size = std::min(n - base, std::size_t(BurstSize));
+            std::size_t *best = rules + base;
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                fields.extract(headers[base + i], lengths[base + i], values[i]);
+                best[i] = NotFound;
+            }
+
+            for (const std::unique_ptr<Tuple> &tuple : tuples)
+            {
+                std::size_t count = 0;
+                for (std::size_t i = 0; i < size; ++i)
+                {
+                    if (best[i] <= tuple->first)
+                        continue;
+                    keys[count] = keyOf(values[i], tuple->care);
+                    pending[count++] = i;
+                }
+                if (!count) // The next tuples start later still
+                    break;
+                auto check = [this, best, &pending, &values](std::size_t k, const uint32_t *entry) {
+                    if (entry)
+                        best[pending[k]] = firstOf(*entry, values[pending[k]], best[pending[k]]);
+                };
+                if (count >= Policy::BatchKeys)
+                {
+                    tuple->table.visitBatch(keys, count, check);
+                    continue;
+                }
+                for (std::size_t k = 0; k < count; ++k)
+                    tuple->table.visit(keys[k], [&check, k](const uint32_t &entry) { check(k, &entry); });
+            }
+        }
+    }
+
+    /**
+     * search
+     *
+     * Set 'action' to the action of the first rule matching 'header' and return true,
+     * or return false when none does.
+     */
+    bool search(const uint8_t *header, std::size_t length, void *&action) const
+    {
+        std::size_t rule = find(header, length);
+        if (rule == NotFound)
+            return false;
+        action = fields.action(rule);
+        return true;
+    }
+
+    /**
+     * searchBurst
+     *
+     * search for 'n' headers, setting 'matched' to the actions of their first rules,
+     * or to nullptr for the headers no rule matches. Return how many match a rule.
+     */
+    std::size_t searchBurst(const uint8_t *const *headers, const std::size_t *lengths, std::size_t n,
+                            void **matched) const
+    {
+        std::size_t rules[BurstSize], count = 0;
+        for (std::size_t base = 0; base < n; base += BurstSize)
+        {
+            std::size_t size = std::min(n - base, std::size_t(BurstSize));
+            findBurst(headers + base, lengths + base, size, rules);
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                matched[base + i] = rules[i] == NotFound ? nullptr : fields.action(rules[i]);
+                count += rules[i] != NotFound;
+            }
+        }
+        return count;
+    }
+
+    const Statistics &statistics() const
+    {
+        return stats;
+    }
+
+  private:
+    using Key = FixedKey<sizeof(uint32_t) * Policy::MaxDimensions>;
+
+    // The lookups of a HashTable are not const, the tables never change once built
+    struct Tuple
+    {
+        uint32_t care[Policy::MaxDimensions];
+        uint32_t first; // Rule
+        mutable HashTable<Key, uint32_t, Policy> table;
+    };
+
+    FieldSet<Policy::MaxDimensions> fields;
+    std::vector<std::unique_ptr<Tuple>> tuples; // By their first rule
+    std::vector<uint32_t> lists;                // Count then rules, by priority, of each entry
+    Statistics stats;
+
+    // Longest prefix of 'care' over 'bitLength' bits rounded down to 'step' bits, all of it when exact
+    static uint32_t prefixOf(uint32_t care, uint32_t bitLength, uint32_t step)
+    {
+        uint32_t all = FieldSet<Policy::MaxDimensions>::lowMask(bitLength);
+        if (care == all)
+            return care;
+        uint32_t length = __builtin_clz(~(care << (32 - bitLength)));
+        length = length / step * step;
+        return all & ~FieldSet<Policy::MaxDimensions>::lowMask(bitLength - length);
+    }
+
+    // First of the rules of the entry at 'offset' matching the values, if it comes before 'best'
+    std::size_t firstOf(uint32_t offset, const uint32_t *values, std::size_t best) const
+    {
+        const uint32_t *rules = &lists[offset + 1];
+        for (uint32_t k = 0; k < lists[offset] && rules[k] < best; ++k)
+            if (fields.matches(rules[k], values))
+                return rules[k];
+        return best;
+    }
+
+    // The values masked by 'care', or as they are without it, in the bytes of a key
+    Key keyOf(const uint32_t *values, const uint32_t *care) const
+    {
+        uint32_t words[Policy::MaxDimensions] = {};
+        for (std::size_t d = 0; d < fields.dimensions(); ++d)
+            words[d] = care ? values[d] & care[d] : values[d];
+        Key key;
+        std::memcpy(key.bytes, words, sizeof(words));
+        return key;
+    }
+};
+} // namespace DNFC
+
+#endif
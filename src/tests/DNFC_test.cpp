@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include <netinet/in.h>
+
+#include "../../include/DNFC/DNFC.h"
+
+#include <gtest/gtest.h>
+
+#define NB_FLOWS   256
+#define NB_ROUNDS  64
+
+// DefaultFlowTablePolicy::IdleTimeout, and a tick of its timing wheel
+#define IDLE_TIMEOUT 60000
+#define TICK_LENGTH  10
+
+// Bits of the IPv4 protocol in an Ethernet frame
+#define PROTOCOL_OFFSET 184
+
+struct UDPRule
+{
+   classifier_field field;
+   classifier_field* fields[1];
+   classifier_rule rule;
+   classifier_rule* rules[1];
+
+   UDPRule()
+   {
+      field = classifier_field{0, 8, PROTOCOL_OFFSET, 0, IPPROTO_UDP};
+      fields[0] = &field;
+      rule = classifier_rule{0, fields, 1, NULL};
+      rules[0] = &rule;
+   }
+};
+
+uint64_t monotonic_ms(void);
+void make_udp(struct packet_buffer* pckt, uint16_t sport, uint16_t dport);
+void collect_epochs(void);
+void retire_action(struct DNFC_action* action);
+
+struct DNFC_action* retired_action = NULL;
+
+
+
+TEST(DNFC, ExpiredFlowsGiveTheirTagsBack)
+{
+   UDPRule udp;
+   classifier_rule** rules = udp.rules;
+   struct DNFC* classifier = new_DNFC(1, 1, &rules, 1, STATIC_HYPERCUTS, NB_FLOWS, NULL, false);
+   ASSERT_TRUE(classifier != NULL);
+   packet_pool* pool = new_packet_pool(NB_FLOWS, 256);
+   ring_matrix* queue = DNFC_get_rule_queue(&udp.rule);
+
+   // Each round brings new flows, and the flows of the previous round expire
+   uint64_t now = 0;
+   for(int round = 0; round < NB_ROUNDS; ++round)
+   {
+      std::vector<packet_buffer*> pckts(NB_FLOWS);
+      ASSERT_EQ(packet_pool_alloc_n(pool, pckts.data(), NB_FLOWS), NB_FLOWS);
+      for(size_t i = 0; i < NB_FLOWS; ++i)
+         make_udp(pckts[i], 1024 + round, 1024 + i);
+      EXPECT_EQ(DNFC_process_burst(classifier, 0, pckts.data(), NB_FLOWS), NB_FLOWS);
+
+      void* popped[NB_FLOWS];
+      EXPECT_EQ(ring_matrix_pop_n(queue, 0, popped, NB_FLOWS), NB_FLOWS);
+      for(size_t i = 0; i < NB_FLOWS; ++i)
+      {
+         struct packet_buffer* pckt = (struct packet_buffer*)popped[i];
+         ASSERT_TRUE(pckt->tag != NULL);
+         EXPECT_EQ(((struct DNFC_tag*)pckt->tag)->nb_pckts, 1);
+         DNFC_free_pckt(pckt);
+      }
+      EXPECT_EQ(memory_pool_allocated(classifier->tag_pool), NB_FLOWS);
+
+      // After the time the flows were last seen, the real one for the first round
+      now = std::max(now, monotonic_ms()) + IDLE_TIMEOUT + TICK_LENGTH;
+      EXPECT_EQ(DNFC_expire_rule_flows(&udp.rule, now), NB_FLOWS);
+      for(int i = 0; i < 4; ++i)
+         epoch_collect();
+      EXPECT_EQ(memory_pool_allocated(classifier->tag_pool), 0);
+   }
+   EXPECT_EQ(packet_pool_available(pool), NB_FLOWS);
+   free_packet_pool(pool);
+}
+
+TEST(DNFC, QueuedPacketsKeepTheirTag)
+{
+   UDPRule udp;
+   classifier_rule** rules = udp.rules;
+   struct DNFC* classifier = new_DNFC(1, 1, &rules, 1, STATIC_HYPERCUTS, NB_FLOWS, NULL, false);
+   ASSERT_TRUE(classifier != NULL);
+   packet_pool* pool = new_packet_pool(2, 256);
+   ring_matrix* queue = DNFC_get_rule_queue(&udp.rule);
+
+   struct packet_buffer* pckts[2];
+   ASSERT_EQ(packet_pool_alloc_n(pool, pckts, 2), 2);
+   make_udp(pckts[0], 1, 2);
+   make_udp(pckts[1], 1, 2);
+   EXPECT_EQ(DNFC_process_burst(classifier, 0, pckts, 2), 2);
+
+   // The flow expires with its packets still queued, the tag lives until the last is freed
+   uint64_t now = monotonic_ms() + IDLE_TIMEOUT * 2;
+   EXPECT_EQ(DNFC_expire_rule_flows(&udp.rule, now), 1);
+   for(int i = 0; i < 4; ++i)
+      epoch_collect();
+   for(int i = 0; i < 2; ++i)
+   {
+      struct packet_buffer* pckt = (struct packet_buffer*)ring_matrix_pop(queue, 0);
+      ASSERT_TRUE(pckt != NULL);
+      EXPECT_EQ(((struct DNFC_tag*)pckt->tag)->nb_pckts, 2);
+      EXPECT_EQ(memory_pool_allocated(classifier->tag_pool), 1);
+      DNFC_free_pckt(pckt);
+   }
+   for(int i = 0; i < 4; ++i)
+      epoch_collect();
+   EXPECT_EQ(memory_pool_allocated(classifier->tag_pool), 0);
+   free_packet_pool(pool);
+}
+
+TEST(DNFC, RemovedRuleIsDrainedThenFreed)
+{
+   UDPRule udp;
+   classifier_rule** rules = udp.rules;
+   struct DNFC* classifier = new_DNFC(1, 2, &rules, 1, STATIC_HYPERCUTS, NB_FLOWS, NULL, false);
+   ASSERT_TRUE(classifier != NULL);
+   classifier->rule_retired = retire_action;
+   packet_pool* pool = new_packet_pool(NB_FLOWS, 256);
+   struct DNFC_action* action = (struct DNFC_action*)udp.rule.action;
+
+   std::vector<packet_buffer*> pckts(NB_FLOWS);
+   ASSERT_EQ(packet_pool_alloc_n(pool, pckts.data(), NB_FLOWS), NB_FLOWS);
+   for(size_t i = 0; i < NB_FLOWS; ++i)
+      make_udp(pckts[i], 1, 1024 + i);
+   EXPECT_EQ(DNFC_process_burst(classifier, 0, pckts.data(), NB_FLOWS), NB_FLOWS);
+
+   // The queue is handed to the workers once no packet can reach it anymore
+   EXPECT_TRUE(DNFC_remove_rule(classifier, &udp.rule));
+   EXPECT_FALSE(DNFC_remove_rule(classifier, &udp.rule));
+   EXPECT_EQ(udp.rule.action, nullptr);
+   collect_epochs();
+   ASSERT_EQ(retired_action, action);
+
+   // Each worker drains its packets, the last one frees the queue and the flow table
+   for(size_t worker = 0; worker < 2; ++worker)
+   {
+      struct packet_buffer* pckt;
+      while((pckt = (struct packet_buffer*)ring_matrix_pop(action->pckt_queue, worker)))
+         DNFC_free_pckt(pckt);
+      DNFC_rule_drained(action);
+   }
+   collect_epochs();
+   EXPECT_EQ(packet_pool_available(pool), NB_FLOWS);
+   EXPECT_EQ(memory_pool_allocated(classifier->tag_pool), 0);
+   free_packet_pool(pool);
+}
+
+TEST(DNFC, RemovedRuleIsDrainedByDefault)
+{
+   UDPRule udp;
+   classifier_rule** rules = udp.rules;
+   struct DNFC* classifier = new_DNFC(1, 2, &rules, 1, STATIC_HYPERCUTS, NB_FLOWS, NULL, false);
+   ASSERT_TRUE(classifier != NULL);
+   packet_pool* pool = new_packet_pool(NB_FLOWS, 256);
+
+   std::vector<packet_buffer*> pckts(NB_FLOWS);
+   ASSERT_EQ(packet_pool_alloc_n(pool, pckts.data(), NB_FLOWS), NB_FLOWS);
+   for(size_t i = 0; i < NB_FLOWS; ++i)
+      make_udp(pckts[i], 1, 1024 + i);
+   EXPECT_EQ(DNFC_process_burst(classifier, 0, pckts.data(), NB_FLOWS), NB_FLOWS);
+
+   // Without rule_retired the queue is left to the workers, the only ones popping it
+   EXPECT_TRUE(DNFC_remove_rule(classifier, &udp.rule));
+   collect_epochs();
+   EXPECT_EQ(packet_pool_available(pool), 0);
+
+   // Each worker frees its packets, the last one frees the queue and the flow table
+   size_t nb_freed = 0;
+   for(size_t worker = 0; worker < 2; ++worker)
+   {
+      nb_freed += DNFC_drain_retired(classifier, worker);
+      EXPECT_EQ(DNFC_drain_retired(classifier, worker), 0);
+   }
+   EXPECT_EQ(nb_freed, NB_FLOWS);
+   collect_epochs();
+   EXPECT_EQ(packet_pool_available(pool), NB_FLOWS);
+   EXPECT_EQ(memory_pool_allocated(classifier->tag_pool), 0);
+   free_packet_pool(pool);
+}
+
+
+
+void collect_epochs(void)
+{
+   for(int i = 0; i < 4; ++i)
+      epoch_collect();
+}
+
+void retire_action(struct DNFC_action* action)
+{
+   retired_action = action;
+}
+
+uint64_t monotonic_ms(void)
+{
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Ethernet frame of a UDP packet over IPv4 between two fixed addresses
+void make_udp(struct packet_buffer* pckt, uint16_t sport, uint16_t dport)
+{
+   u_char* frame = packet_buffer_append(pckt, 14 + 20 + 8);
+   memset(frame, 0, 14 + 20 + 8);
+   frame[12] = 0x08;
+   u_char* iph = frame + 14;
+   iph[0] = 0x45;
+   iph[9] = IPPROTO_UDP;
+   const u_char addresses[8] = {10, 0, 0, 1, 192, 168, 1, 2};
+   memcpy(iph + 12, addresses, 8);
+   uint16_t ports[2] = {htons(sport), htons(dport)};
+   memcpy(iph + 20, ports, 4);
+}